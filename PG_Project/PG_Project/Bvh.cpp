@@ -0,0 +1,497 @@
+#include "Bvh.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace gps {
+
+	namespace {
+
+		// SAH bins per axis
+		const int BINS = 16;
+		// nodes with this many items are always leaves
+		const uint32_t MAX_LEAF_ITEMS = 4;
+		// a leaf can keep up to this many items when splitting it would cost more
+		const uint32_t MAX_SAH_LEAF_ITEMS = 16;
+		// smaller trees are built on the calling thread only
+		const uint32_t PARALLEL_BUILD_ITEMS = 4096;
+
+		const uint32_t NO_PARENT = 0xFFFFFFFF;
+
+		BoundingBox emptyBox() {
+			BoundingBox box = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+			return box;
+		}
+
+		void grow(BoundingBox& box, const BoundingBox& other) {
+			box.minimum = glm::min(box.minimum, other.minimum);
+			box.maximum = glm::max(box.maximum, other.maximum);
+		}
+
+		void grow(BoundingBox& box, const glm::vec3& point) {
+			box.minimum = glm::min(box.minimum, point);
+			box.maximum = glm::max(box.maximum, point);
+		}
+
+		// half of the surface area, 0 for an empty box
+		float halfArea(const BoundingBox& box) {
+			glm::vec3 size = box.maximum - box.minimum;
+			if (size.x < 0.0f || size.y < 0.0f || size.z < 0.0f)
+				return 0.0f;
+			return size.x * size.y + size.y * size.z + size.z * size.x;
+		}
+
+		bool sameBox(const BoundingBox& a, const BoundingBox& b) {
+			return a.minimum == b.minimum && a.maximum == b.maximum;
+		}
+
+		bool overlaps(const BoundingBox& a, const BoundingBox& b) {
+			return a.minimum.x <= b.maximum.x && a.maximum.x >= b.minimum.x
+				&& a.minimum.y <= b.maximum.y && a.maximum.y >= b.minimum.y
+				&& a.minimum.z <= b.maximum.z && a.maximum.z >= b.minimum.z;
+		}
+
+		float distanceSquared(const BoundingBox& box, const glm::vec3& point) {
+			glm::vec3 closest = glm::clamp(point, box.minimum, box.maximum);
+			glm::vec3 offset = point - closest;
+			return glm::dot(offset, offset);
+		}
+
+		// Slab test - entry distance of the ray into the box, clamped to 0 when the origin is inside
+		bool intersectRay(const BoundingBox& box, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance, float& entry) {
+			float enter = 0.0f;
+			float exit = maxDistance;
+			for (int axis = 0; axis < 3; axis++) {
+				// a ray parallel to the slab is either between its planes or misses the box - the
+				// distances would be inf * 0 = NaN for an origin on one of the planes
+				if (std::isinf(inverseDirection[axis])) {
+					if (origin[axis] < box.minimum[axis] || origin[axis] > box.maximum[axis])
+						return false;
+					continue;
+				}
+				float t0 = (box.minimum[axis] - origin[axis]) * inverseDirection[axis];
+				float t1 = (box.maximum[axis] - origin[axis]) * inverseDirection[axis];
+				enter = std::max(enter, std::min(t0, t1));
+				exit = std::min(exit, std::max(t0, t1));
+			}
+			entry = enter;
+			return enter <= exit;
+		}
+
+		int binOf(const glm::vec3& centroid, int axis, float minimum, float scale) {
+			int bin = (int)((centroid[axis] - minimum) * scale);
+			return std::min(std::max(bin, 0), BINS - 1);
+		}
+
+		// Frustum test against the planes of the mask, the planes the box is entirely inside of are removed
+		bool intersectPlanes(const Frustum& frustum, const BoundingBox& box, uint32_t& mask) {
+			glm::vec3 center = (box.minimum + box.maximum) * 0.5f;
+			glm::vec3 extent = (box.maximum - box.minimum) * 0.5f;
+			for (int i = 0; i < 6; i++) {
+				if (!(mask & (1u << i)))
+					continue;
+				const glm::vec4& plane = frustum.planes[i];
+				float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+				float radius = std::fabs(plane.x) * extent.x + std::fabs(plane.y) * extent.y + std::fabs(plane.z) * extent.z;
+				if (distance + radius < 0.0f)
+					return false;
+				if (distance - radius >= 0.0f)
+					mask &= ~(1u << i);
+			}
+			return true;
+		}
+	}
+
+	Bvh::Bvh()
+	{
+	}
+
+	void Bvh::build(const std::vector<BoundingBox>& boxes)
+	{
+		uint32_t count = (uint32_t)boxes.size();
+		itemBoxes = boxes;
+		centroids.resize(count);
+		itemOrder.resize(count);
+		itemLeaves.resize(count);
+		nodes.clear();
+		parents.clear();
+		if (count == 0)
+			return;
+
+		for (uint32_t i = 0; i < count; i++) {
+			centroids[i] = (boxes[i].minimum + boxes[i].maximum) * 0.5f;
+			itemOrder[i] = i;
+		}
+
+		nodes.resize(1);
+		ThreadPool& pool = ThreadPool::global();
+		if (count >= PARALLEL_BUILD_ITEMS && pool.getThreadCount() > 0) {
+			// the top levels first, then a few subtrees per thread - each one into its own nodes
+			uint32_t parallelItems = std::max(count / ((pool.getThreadCount() + 1) * 4), PARALLEL_BUILD_ITEMS / 4);
+			std::vector<Subtree> subtrees;
+			buildNode(nodes, 0, 0, count, &subtrees, parallelItems);
+
+			std::vector<std::vector<Node> > subtreeNodes(subtrees.size());
+			pool.parallelFor(subtrees.size(), [this, &subtrees, &subtreeNodes](size_t i) {
+				subtreeNodes[i].resize(1);
+				buildNode(subtreeNodes[i], 0, subtrees[i].begin, subtrees[i].end, NULL, 0);
+			});
+
+			// the root of a subtree replaces its placeholder, the other nodes are appended
+			for (size_t i = 0; i < subtrees.size(); i++) {
+				const std::vector<Node>& built = subtreeNodes[i];
+				uint32_t offset = (uint32_t)nodes.size() - 1;
+				for (size_t n = 0; n < built.size(); n++) {
+					Node node = built[n];
+					if (node.count == 0)
+						node.first += offset;
+					if (n == 0)
+						nodes[subtrees[i].node] = node;
+					else
+						nodes.push_back(node);
+				}
+			}
+		}
+		else {
+			buildNode(nodes, 0, 0, count, NULL, 0);
+		}
+
+		parents.assign(nodes.size(), NO_PARENT);
+		for (uint32_t i = 0; i < (uint32_t)nodes.size(); i++) {
+			const Node& node = nodes[i];
+			if (node.count == 0) {
+				parents[node.first] = i;
+				parents[node.first + 1] = i;
+			}
+			else {
+				for (uint32_t k = node.first; k < node.first + node.count; k++)
+					itemLeaves[itemOrder[k]] = i;
+			}
+		}
+	}
+
+	void Bvh::buildNode(std::vector<Node>& nodes, uint32_t node, uint32_t begin, uint32_t end,
+	                    std::vector<Subtree>* subtrees, uint32_t parallelItems)
+	{
+		BoundingBox box = emptyBox();
+		BoundingBox centroidBox = emptyBox();
+		for (uint32_t k = begin; k < end; k++) {
+			grow(box, itemBoxes[itemOrder[k]]);
+			grow(centroidBox, centroids[itemOrder[k]]);
+		}
+		nodes[node].box = box;
+
+		uint32_t count = end - begin;
+		if (subtrees && count <= parallelItems) {
+			Subtree subtree = { node, begin, end };
+			subtrees->push_back(subtree);
+			return;
+		}
+
+		if (count <= MAX_LEAF_ITEMS) {
+			nodes[node].first = begin;
+			nodes[node].count = count;
+			return;
+		}
+
+		// cheapest split between the bins of the centroids along any axis
+		float bestCost = FLT_MAX;
+		int bestAxis = -1;
+		int bestSplit = 0;
+		for (int axis = 0; axis < 3; axis++) {
+			float extent = centroidBox.maximum[axis] - centroidBox.minimum[axis];
+			if (!(extent > 0.0f))
+				continue;
+
+			float scale = BINS / extent;
+			uint32_t binCounts[BINS] = { 0 };
+			BoundingBox binBoxes[BINS];
+			for (int b = 0; b < BINS; b++)
+				binBoxes[b] = emptyBox();
+			for (uint32_t k = begin; k < end; k++) {
+				int bin = binOf(centroids[itemOrder[k]], axis, centroidBox.minimum[axis], scale);
+				binCounts[bin]++;
+				grow(binBoxes[bin], itemBoxes[itemOrder[k]]);
+			}
+
+			// split i puts bins [0, i) on the left
+			float rightAreas[BINS];
+			uint32_t rightCounts[BINS];
+			BoundingBox right = emptyBox();
+			uint32_t rightCount = 0;
+			for (int split = BINS - 1; split > 0; split--) {
+				grow(right, binBoxes[split]);
+				rightCount += binCounts[split];
+				rightAreas[split] = halfArea(right);
+				rightCounts[split] = rightCount;
+			}
+
+			BoundingBox left = emptyBox();
+			uint32_t leftCount = 0;
+			for (int split = 1; split < BINS; split++) {
+				grow(left, binBoxes[split - 1]);
+				leftCount += binCounts[split - 1];
+				if (leftCount == 0 || rightCounts[split] == 0)
+					continue;
+				float cost = leftCount * halfArea(left) + rightCounts[split] * rightAreas[split];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = split;
+				}
+			}
+		}
+
+		uint32_t middle;
+		if (bestAxis < 0) {
+			// all the centroids are at the same point, any split is as good as another
+			if (count <= MAX_SAH_LEAF_ITEMS) {
+				nodes[node].first = begin;
+				nodes[node].count = count;
+				return;
+			}
+			middle = begin + count / 2;
+		}
+		else {
+			if (bestCost >= count * halfArea(box) && count <= MAX_SAH_LEAF_ITEMS) {
+				nodes[node].first = begin;
+				nodes[node].count = count;
+				return;
+			}
+
+			float minimum = centroidBox.minimum[bestAxis];
+			float scale = BINS / (centroidBox.maximum[bestAxis] - minimum);
+			const std::vector<glm::vec3>& centroids = this->centroids;
+			uint32_t* first = itemOrder.data() + begin;
+			uint32_t* split = std::partition(first, itemOrder.data() + end, [&centroids, bestAxis, minimum, scale, bestSplit](uint32_t item) {
+				return binOf(centroids[item], bestAxis, minimum, scale) < bestSplit;
+			});
+			middle = begin + (uint32_t)(split - first);
+		}
+
+		uint32_t children = (uint32_t)nodes.size();
+		nodes.resize(children + 2);
+		nodes[node].first = children;
+		nodes[node].count = 0;
+		buildNode(nodes, children, begin, middle, subtrees, parallelItems);
+		buildNode(nodes, children + 1, middle, end, subtrees, parallelItems);
+	}
+
+	void Bvh::update(uint32_t item, const BoundingBox& box)
+	{
+		itemBoxes[item] = box;
+		centroids[item] = (box.minimum + box.maximum) * 0.5f;
+
+		uint32_t node = itemLeaves[item];
+		BoundingBox leafBox = emptyBox();
+		for (uint32_t k = nodes[node].first; k < nodes[node].first + nodes[node].count; k++)
+			grow(leafBox, itemBoxes[itemOrder[k]]);
+		nodes[node].box = leafBox;
+
+		// up to the root, or to the first node that stays the same
+		while (parents[node] != NO_PARENT) {
+			node = parents[node];
+			BoundingBox nodeBox = nodes[nodes[node].first].box;
+			grow(nodeBox, nodes[nodes[node].first + 1].box);
+			if (sameBox(nodeBox, nodes[node].box))
+				break;
+			nodes[node].box = nodeBox;
+		}
+	}
+
+	size_t Bvh::size() const
+	{
+		return itemBoxes.size();
+	}
+
+	size_t Bvh::nodeCount() const
+	{
+		return nodes.size();
+	}
+
+	const BoundingBox& Bvh::getBox(uint32_t item) const
+	{
+		return itemBoxes[item];
+	}
+
+	void Bvh::appendItems(uint32_t node, std::vector<uint32_t>& items) const
+	{
+		// the items of a subtree are contiguous, from its leftmost to its rightmost leaf
+		uint32_t leftmost = node;
+		while (nodes[leftmost].count == 0)
+			leftmost = nodes[leftmost].first;
+		uint32_t rightmost = node;
+		while (nodes[rightmost].count == 0)
+			rightmost = nodes[rightmost].first + 1;
+
+		items.insert(items.end(), itemOrder.begin() + nodes[leftmost].first,
+			itemOrder.begin() + nodes[rightmost].first + nodes[rightmost].count);
+	}
+
+	void Bvh::queryFrustum(const Frustum& frustum, std::vector<uint32_t>& items) const
+	{
+		if (nodes.empty())
+			return;
+
+		struct Entry
+		{
+			uint32_t node;
+			uint32_t mask;
+		};
+		std::vector<Entry> stack;
+		stack.reserve(64);
+		Entry root = { 0, 0x3F };
+		stack.push_back(root);
+
+		while (!stack.empty()) {
+			Entry entry = stack.back();
+			stack.pop_back();
+			const Node& node = nodes[entry.node];
+			if (!intersectPlanes(frustum, node.box, entry.mask))
+				continue;
+
+			// entirely inside - everything below is visible
+			if (entry.mask == 0) {
+				appendItems(entry.node, items);
+				continue;
+			}
+
+			if (node.count > 0) {
+				for (uint32_t k = node.first; k < node.first + node.count; k++) {
+					uint32_t mask = entry.mask;
+					if (intersectPlanes(frustum, itemBoxes[itemOrder[k]], mask))
+						items.push_back(itemOrder[k]);
+				}
+				continue;
+			}
+
+			Entry left = { node.first, entry.mask };
+			Entry right = { node.first + 1, entry.mask };
+			stack.push_back(right);
+			stack.push_back(left);
+		}
+	}
+
+	void Bvh::querySphere(const glm::vec3& center, float radius, std::vector<uint32_t>& items) const
+	{
+		if (nodes.empty())
+			return;
+
+		float radiusSquared = radius * radius;
+		std::vector<uint32_t> stack;
+		stack.reserve(64);
+		stack.push_back(0);
+
+		while (!stack.empty()) {
+			const Node& node = nodes[stack.back()];
+			stack.pop_back();
+			if (distanceSquared(node.box, center) > radiusSquared)
+				continue;
+
+			if (node.count > 0) {
+				for (uint32_t k = node.first; k < node.first + node.count; k++) {
+					if (distanceSquared(itemBoxes[itemOrder[k]], center) <= radiusSquared)
+						items.push_back(itemOrder[k]);
+				}
+				continue;
+			}
+			stack.push_back(node.first + 1);
+			stack.push_back(node.first);
+		}
+	}
+
+	void Bvh::queryBox(const BoundingBox& box, std::vector<uint32_t>& items) const
+	{
+		if (nodes.empty())
+			return;
+
+		std::vector<uint32_t> stack;
+		stack.reserve(64);
+		stack.push_back(0);
+
+		while (!stack.empty()) {
+			const Node& node = nodes[stack.back()];
+			stack.pop_back();
+			if (!overlaps(node.box, box))
+				continue;
+
+			if (node.count > 0) {
+				for (uint32_t k = node.first; k < node.first + node.count; k++) {
+					if (overlaps(itemBoxes[itemOrder[k]], box))
+						items.push_back(itemOrder[k]);
+				}
+				continue;
+			}
+			stack.push_back(node.first + 1);
+			stack.push_back(node.first);
+		}
+	}
+
+	bool Bvh::raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, uint32_t& item, float& distance) const
+	{
+		if (nodes.empty())
+			return false;
+
+		glm::vec3 inverseDirection = 1.0f / direction;
+		float closest = maxDistance;
+		bool found = false;
+
+		struct Entry
+		{
+			uint32_t node;
+			float entry;
+		};
+		std::vector<Entry> stack;
+		stack.reserve(64);
+		Entry root = { 0, 0.0f };
+		if (!intersectRay(nodes[0].box, origin, inverseDirection, closest, root.entry))
+			return false;
+		stack.push_back(root);
+
+		while (!stack.empty()) {
+			Entry entry = stack.back();
+			stack.pop_back();
+			// a closer hit was found since the node was pushed
+			if (entry.entry > closest)
+				continue;
+
+			const Node& node = nodes[entry.node];
+			if (node.count > 0) {
+				for (uint32_t k = node.first; k < node.first + node.count; k++) {
+					float hit;
+					if (intersectRay(itemBoxes[itemOrder[k]], origin, inverseDirection, closest, hit) && (!found || hit < closest)) {
+						closest = hit;
+						item = itemOrder[k];
+						found = true;
+					}
+				}
+				continue;
+			}
+
+			// the nearer child is visited first
+			Entry left = { node.first, 0.0f };
+			Entry right = { node.first + 1, 0.0f };
+			bool hitLeft = intersectRay(nodes[left.node].box, origin, inverseDirection, closest, left.entry);
+			bool hitRight = intersectRay(nodes[right.node].box, origin, inverseDirection, closest, right.entry);
+			if (hitLeft && hitRight) {
+				if (left.entry < right.entry)
+					std::swap(left, right);
+				stack.push_back(left);
+				stack.push_back(right);
+			}
+			else if (hitLeft) {
+				stack.push_back(left);
+			}
+			else if (hitRight) {
+				stack.push_back(right);
+			}
+		}
+
+		if (found)
+			distance = closest;
+		return found;
+	}
+
+}
@@ -0,0 +1,88 @@
+#ifndef Bvh_hpp
+#define Bvh_hpp
+
+#include "FrustumCuller.hpp"
+
+#include "glm/glm.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    // Bounding volume hierarchy over a set of boxes (items), for culling and spatial queries.
+    // Built top-down with the surface area heuristic evaluated on a fixed number of bins per axis;
+    // the subtrees under the top levels are built in parallel on the thread pool. Items that move
+    // are refitted in place - the tree keeps its shape, so it is meant for a few dynamic items among
+    // many static ones.
+    class Bvh
+    {
+    public:
+        Bvh();
+
+        // Rebuilds the tree, item i being boxes[i]
+        void build(const std::vector<BoundingBox>& boxes);
+
+        // Moves an item to a new box and grows or shrinks the boxes of the nodes above it
+        void update(uint32_t item, const BoundingBox& box);
+
+        size_t size() const;
+        size_t nodeCount() const;
+        const BoundingBox& getBox(uint32_t item) const;
+
+        // The queries append the items found to the vector, in no particular order
+
+        // Items whose boxes intersect the frustum - the planes a node is entirely inside of are not
+        // tested again below it
+        void queryFrustum(const Frustum& frustum, std::vector<uint32_t>& items) const;
+        // Items whose boxes are closer than radius to the center
+        void querySphere(const glm::vec3& center, float radius, std::vector<uint32_t>& items) const;
+        // Items whose boxes overlap the box
+        void queryBox(const BoundingBox& box, std::vector<uint32_t>& items) const;
+
+        // Closest item whose box the ray enters within maxDistance (in units of direction), false if none
+        bool raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, uint32_t& item, float& distance) const;
+
+    private:
+        struct Node
+        {
+            BoundingBox box;
+            // interior node - index of the left child, the right child follows it;
+            // leaf - index of its first item in itemOrder
+            uint32_t first;
+            // items of a leaf, 0 for an interior node
+            uint32_t count;
+        };
+
+        // Node whose subtree is built later, in parallel with the others
+        struct Subtree
+        {
+            uint32_t node;
+            uint32_t begin;
+            uint32_t end;
+        };
+
+        // children always come after their parent
+        std::vector<Node> nodes;
+        std::vector<uint32_t> parents;
+        std::vector<BoundingBox> itemBoxes;
+        std::vector<glm::vec3> centroids;
+        // items sorted by leaf
+        std::vector<uint32_t> itemOrder;
+        std::vector<uint32_t> itemLeaves;
+
+        // Builds the subtree of items [begin, end) of itemOrder under nodes[node] - with subtrees set,
+        // the ranges of at most parallelItems items are left to be built later
+        void buildNode(std::vector<Node>& nodes, uint32_t node, uint32_t begin, uint32_t end,
+                       std::vector<Subtree>* subtrees, uint32_t parallelItems);
+
+        void appendItems(uint32_t node, std::vector<uint32_t>& items) const;
+
+        Bvh(const Bvh&);
+        Bvh& operator=(const Bvh&);
+    };
+
+}
+
+#endif /* Bvh_hpp */
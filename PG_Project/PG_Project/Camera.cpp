@@ -75,6 +75,11 @@ namespace gps {
         return glm::length(distance_vector);
     }
 
+    glm::vec3 Camera::getPosition()
+    {
+        return cameraPosition;
+    }
+
     void Camera::set(glm::vec3 cameraPosition, glm::vec3 cameraTarget, glm::vec3 cameraUp) 
     {
         this->cameraPosition = cameraPosition;
@@ -24,6 +24,8 @@ namespace gps {
         //pitch - camera rotation around the x axis
         void rotate(float pitch, float yaw);
         float getDistance(glm::vec3 point);
+        //return the position of the camera in world space
+        glm::vec3 getPosition();
         void set(glm::vec3 cameraPosition, glm::vec3 cameraTarget, glm::vec3 cameraUp);
         void print();
     private:
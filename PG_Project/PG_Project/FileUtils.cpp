@@ -0,0 +1,210 @@
+#include "FileUtils.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+namespace gps {
+
+	MappedFile::MappedFile() : mappedData(NULL), mappedSize(0)
+#ifdef _WIN32
+		, fileHandle(NULL), mappingHandle(NULL)
+#else
+		, fileDescriptor(-1)
+#endif
+	{
+	}
+
+	MappedFile::~MappedFile() {
+		close();
+	}
+
+	bool MappedFile::open(const std::string& fileName) {
+		close();
+
+#ifdef _WIN32
+		HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+			CloseHandle(file);
+			return false;
+		}
+
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL) {
+			CloseHandle(file);
+			return false;
+		}
+
+		void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (view == NULL) {
+			CloseHandle(mapping);
+			CloseHandle(file);
+			return false;
+		}
+
+		fileHandle = file;
+		mappingHandle = mapping;
+		mappedData = (const unsigned char*)view;
+		mappedSize = (size_t)fileSize.QuadPart;
+#else
+		int fd = ::open(fileName.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat fileStat;
+		if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+			::close(fd);
+			return false;
+		}
+
+		void* view = mmap(NULL, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (view == MAP_FAILED) {
+			::close(fd);
+			return false;
+		}
+
+		fileDescriptor = fd;
+		mappedData = (const unsigned char*)view;
+		mappedSize = (size_t)fileStat.st_size;
+#endif
+		return true;
+	}
+
+	void MappedFile::close() {
+		if (!mappedData)
+			return;
+
+#ifdef _WIN32
+		UnmapViewOfFile(mappedData);
+		CloseHandle((HANDLE)mappingHandle);
+		CloseHandle((HANDLE)fileHandle);
+		mappingHandle = NULL;
+		fileHandle = NULL;
+#else
+		munmap((void*)mappedData, mappedSize);
+		::close(fileDescriptor);
+		fileDescriptor = -1;
+#endif
+		mappedData = NULL;
+		mappedSize = 0;
+	}
+
+	bool MappedFile::isOpen() const {
+		return mappedData != NULL;
+	}
+
+	const unsigned char* MappedFile::data() const {
+		return mappedData;
+	}
+
+	size_t MappedFile::size() const {
+		return mappedSize;
+	}
+
+	bool getFileInfo(const std::string& fileName, FileInfo& info) {
+#ifdef _WIN32
+		WIN32_FILE_ATTRIBUTE_DATA attributes;
+		if (!GetFileAttributesExA(fileName.c_str(), GetFileExInfoStandard, &attributes))
+			return false;
+		info.size = ((uint64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+		// 100ns intervals
+		info.modifiedTime = (int64_t)(((uint64_t)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime);
+#else
+		struct stat fileStat;
+		if (stat(fileName.c_str(), &fileStat) != 0)
+			return false;
+		info.size = (uint64_t)fileStat.st_size;
+		// nanoseconds
+#ifdef __APPLE__
+		info.modifiedTime = (int64_t)fileStat.st_mtimespec.tv_sec * 1000000000 + fileStat.st_mtimespec.tv_nsec;
+#else
+		info.modifiedTime = (int64_t)fileStat.st_mtim.tv_sec * 1000000000 + fileStat.st_mtim.tv_nsec;
+#endif
+#endif
+		return true;
+	}
+
+	uint64_t hashBytes(const void* data, size_t size, uint64_t seed) {
+		const uint64_t prime = 1099511628211ULL;
+		const unsigned char* bytes = (const unsigned char*)data;
+		uint64_t hash = seed;
+
+		size_t words = size / 8;
+		for (size_t i = 0; i < words; i++) {
+			uint64_t word;
+			std::memcpy(&word, bytes + i * 8, sizeof(word));
+			hash ^= word;
+			hash *= prime;
+		}
+
+		for (size_t i = words * 8; i < size; i++) {
+			hash ^= bytes[i];
+			hash *= prime;
+		}
+
+		// mix in the length so that trailing zero bytes change the result
+		hash ^= (uint64_t)size;
+		hash *= prime;
+		return hash;
+	}
+
+	bool hashFile(const std::string& fileName, uint64_t& hash) {
+		MappedFile file;
+		if (!file.open(fileName))
+			return false;
+
+		hash = hashBytes(file.data(), file.size());
+		return true;
+	}
+
+	bool replaceFile(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+		return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+	}
+
+	std::string canonicalPath(const std::string& fileName) {
+#ifdef _WIN32
+		char buffer[MAX_PATH];
+		DWORD length = GetFullPathNameA(fileName.c_str(), MAX_PATH, buffer, NULL);
+		if (length == 0 || length >= MAX_PATH)
+			return fileName;
+		std::string path(buffer, length);
+		// the file system is case insensitive
+		std::transform(path.begin(), path.end(), path.begin(), [](char c) { return (char)std::tolower((unsigned char)c); });
+		std::replace(path.begin(), path.end(), '\\', '/');
+		return path;
+#else
+		char buffer[PATH_MAX];
+		if (realpath(fileName.c_str(), buffer) == NULL)
+			return fileName;
+		return std::string(buffer);
+#endif
+	}
+
+}
@@ -0,0 +1,64 @@
+#ifndef FileUtils_hpp
+#define FileUtils_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace gps {
+
+    // Size and last modification time of a file on disk
+    struct FileInfo
+    {
+        uint64_t size;
+        // platform specific resolution, only compared for equality
+        int64_t modifiedTime;
+    };
+
+    // Read-only memory mapping of a whole file
+    class MappedFile
+    {
+    public:
+        MappedFile();
+        ~MappedFile();
+
+        bool open(const std::string& fileName);
+        void close();
+
+        bool isOpen() const;
+        const unsigned char* data() const;
+        size_t size() const;
+
+    private:
+        const unsigned char* mappedData;
+        size_t mappedSize;
+#ifdef _WIN32
+        void* fileHandle;
+        void* mappingHandle;
+#else
+        int fileDescriptor;
+#endif
+
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+    };
+
+    // Returns false if the file does not exist
+    bool getFileInfo(const std::string& fileName, FileInfo& info);
+
+    // 64 bit FNV-1a style hash, processed a word at a time
+    uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 14695981039346656037ULL);
+
+    // Hashes the contents of a file, returns false if it cannot be read
+    bool hashFile(const std::string& fileName, uint64_t& hash);
+
+    // Replaces a file with another one (the destination may already exist)
+    bool replaceFile(const std::string& from, const std::string& to);
+
+    // Absolute path with "." and ".." resolved and '/' separators (lower case on Windows),
+    // so that different spellings of the same file compare equal. Returns the input if it cannot be resolved.
+    std::string canonicalPath(const std::string& fileName);
+
+}
+
+#endif /* FileUtils_hpp */
@@ -0,0 +1,183 @@
+#include "FrustumCuller.hpp"
+
+#include <cmath>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define FRUSTUM_CULLER_SSE2
+#endif
+
+namespace gps {
+
+	namespace {
+
+		FrustumCuller::Statistics statistics = { 0, 0 };
+
+		glm::vec4 normalizePlane(const glm::vec4& plane) {
+			float length = glm::length(glm::vec3(plane));
+			return length > 0.0f ? plane / length : plane;
+		}
+	}
+
+	BoundingBox BoundingBox::transformed(const glm::mat4& transform) const
+	{
+		// center and half extents, the extents go through the absolute values of the matrix
+		glm::vec3 center = glm::vec3(transform * glm::vec4((minimum + maximum) * 0.5f, 1.0f));
+		glm::vec3 extent = (maximum - minimum) * 0.5f;
+		glm::vec3 transformedExtent(0.0f);
+		for (int column = 0; column < 3; column++) {
+			for (int row = 0; row < 3; row++)
+				transformedExtent[row] += std::fabs(transform[column][row]) * extent[column];
+		}
+
+		BoundingBox box = { center - transformedExtent, center + transformedExtent };
+		return box;
+	}
+
+	Frustum Frustum::fromMatrix(const glm::mat4& viewProjection)
+	{
+		// Gribb & Hartmann - the planes are sums of the rows of the matrix, glm stores columns
+		glm::vec4 rows[4];
+		for (int row = 0; row < 4; row++)
+			rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row], viewProjection[2][row], viewProjection[3][row]);
+
+		Frustum frustum;
+		frustum.planes[0] = normalizePlane(rows[3] + rows[0]); // left
+		frustum.planes[1] = normalizePlane(rows[3] - rows[0]); // right
+		frustum.planes[2] = normalizePlane(rows[3] + rows[1]); // bottom
+		frustum.planes[3] = normalizePlane(rows[3] - rows[1]); // top
+		frustum.planes[4] = normalizePlane(rows[3] + rows[2]); // near
+		frustum.planes[5] = normalizePlane(rows[3] - rows[2]); // far
+		return frustum;
+	}
+
+	Frustum Frustum::toModelSpace(const glm::mat4& model) const
+	{
+		// dot(plane, model * p) = dot(transpose(model) * plane, p)
+		glm::mat4 transposed = glm::transpose(model);
+		Frustum frustum;
+		for (int i = 0; i < 6; i++)
+			frustum.planes[i] = normalizePlane(transposed * planes[i]);
+		return frustum;
+	}
+
+	bool Frustum::intersects(const BoundingBox& box) const
+	{
+		glm::vec3 center = (box.minimum + box.maximum) * 0.5f;
+		glm::vec3 extent = (box.maximum - box.minimum) * 0.5f;
+		for (int i = 0; i < 6; i++) {
+			const glm::vec4& plane = planes[i];
+			float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+			float radius = std::fabs(plane.x) * extent.x + std::fabs(plane.y) * extent.y + std::fabs(plane.z) * extent.z;
+			if (distance + radius < 0.0f)
+				return false;
+		}
+		return true;
+	}
+
+	FrustumCuller::FrustumCuller() : count(0)
+	{
+	}
+
+	void FrustumCuller::clear()
+	{
+		centerX.clear();
+		centerY.clear();
+		centerZ.clear();
+		extentX.clear();
+		extentY.clear();
+		extentZ.clear();
+		count = 0;
+	}
+
+	size_t FrustumCuller::add(const BoundingBox& box)
+	{
+		// the padding is overwritten by the next boxes
+		if (count == centerX.size()) {
+			size_t padded = count + 4;
+			centerX.resize(padded, 0.0f);
+			centerY.resize(padded, 0.0f);
+			centerZ.resize(padded, 0.0f);
+			extentX.resize(padded, 0.0f);
+			extentY.resize(padded, 0.0f);
+			extentZ.resize(padded, 0.0f);
+		}
+
+		glm::vec3 center = (box.minimum + box.maximum) * 0.5f;
+		glm::vec3 extent = (box.maximum - box.minimum) * 0.5f;
+		centerX[count] = center.x;
+		centerY[count] = center.y;
+		centerZ[count] = center.z;
+		extentX[count] = extent.x;
+		extentY[count] = extent.y;
+		extentZ[count] = extent.z;
+		return count++;
+	}
+
+	size_t FrustumCuller::size() const
+	{
+		return count;
+	}
+
+	size_t FrustumCuller::cull(const Frustum& frustum, std::vector<uint8_t>& visible) const
+	{
+		visible.resize(count);
+		size_t visibleCount = 0;
+		size_t i = 0;
+
+#ifdef FRUSTUM_CULLER_SSE2
+		// a box is outside if it is entirely behind one of the planes:
+		// dot(normal, center) + w + dot(|normal|, extent) < 0
+		const __m128 zero = _mm_setzero_ps();
+		for (; i < count; i += 4) {
+			__m128 cx = _mm_loadu_ps(&centerX[i]);
+			__m128 cy = _mm_loadu_ps(&centerY[i]);
+			__m128 cz = _mm_loadu_ps(&centerZ[i]);
+			__m128 ex = _mm_loadu_ps(&extentX[i]);
+			__m128 ey = _mm_loadu_ps(&extentY[i]);
+			__m128 ez = _mm_loadu_ps(&extentZ[i]);
+
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < 6; p++) {
+				const glm::vec4& plane = frustum.planes[p];
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+					_mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+				__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(std::fabs(plane.x))), _mm_mul_ps(ey, _mm_set1_ps(std::fabs(plane.y)))),
+					_mm_mul_ps(ez, _mm_set1_ps(std::fabs(plane.z))));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+			}
+
+			int mask = _mm_movemask_ps(inside);
+			for (size_t k = 0; k < 4 && i + k < count; k++) {
+				visible[i + k] = (uint8_t)((mask >> k) & 1);
+				visibleCount += visible[i + k];
+			}
+		}
+#endif
+
+		for (; i < count; i++) {
+			BoundingBox box = {
+				glm::vec3(centerX[i] - extentX[i], centerY[i] - extentY[i], centerZ[i] - extentZ[i]),
+				glm::vec3(centerX[i] + extentX[i], centerY[i] + extentY[i], centerZ[i] + extentZ[i])
+			};
+			visible[i] = frustum.intersects(box) ? 1 : 0;
+			visibleCount += visible[i];
+		}
+
+		statistics.visible += (unsigned)visibleCount;
+		statistics.culled += (unsigned)(count - visibleCount);
+		return visibleCount;
+	}
+
+	const FrustumCuller::Statistics& FrustumCuller::getStatistics()
+	{
+		return statistics;
+	}
+
+	void FrustumCuller::resetStatistics()
+	{
+		statistics.visible = 0;
+		statistics.culled = 0;
+	}
+
+}
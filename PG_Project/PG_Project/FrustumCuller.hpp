@@ -0,0 +1,78 @@
+#ifndef FrustumCuller_hpp
+#define FrustumCuller_hpp
+
+#include "glm/glm.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    // Axis aligned box
+    struct BoundingBox
+    {
+        glm::vec3 minimum;
+        glm::vec3 maximum;
+
+        // Smallest axis aligned box around the transformed box
+        BoundingBox transformed(const glm::mat4& transform) const;
+    };
+
+    // Planes of a view volume, facing inwards - a point p is inside if dot(plane, vec4(p, 1)) >= 0
+    // for all of them
+    struct Frustum
+    {
+        glm::vec4 planes[6];
+
+        // Planes of the clip volume of a projection * view matrix (or any other matrix to clip space),
+        // in the space the matrix transforms from
+        static Frustum fromMatrix(const glm::mat4& viewProjection);
+
+        // The same planes in the space of a model, model being its model to world matrix
+        Frustum toModelSpace(const glm::mat4& model) const;
+
+        // Conservative - a box that crosses a plane counts as inside even if it misses the corner
+        bool intersects(const BoundingBox& box) const;
+    };
+
+    // Boxes kept as structure of arrays (centers and half extents), tested against a frustum
+    // four at a time with SSE
+    class FrustumCuller
+    {
+    public:
+        // Boxes tested by all the cullers since the last reset
+        struct Statistics
+        {
+            unsigned visible;
+            unsigned culled;
+        };
+
+        FrustumCuller();
+
+        void clear();
+        // Returns the index of the box
+        size_t add(const BoundingBox& box);
+        size_t size() const;
+
+        // Sets visible[i] to 1 for the boxes that intersect the frustum and to 0 for the others,
+        // returns the number of visible boxes
+        size_t cull(const Frustum& frustum, std::vector<uint8_t>& visible) const;
+
+        static const Statistics& getStatistics();
+        static void resetStatistics();
+
+    private:
+        // padded with empty boxes to a multiple of 4
+        std::vector<float> centerX;
+        std::vector<float> centerY;
+        std::vector<float> centerZ;
+        std::vector<float> extentX;
+        std::vector<float> extentY;
+        std::vector<float> extentZ;
+        size_t count;
+    };
+
+}
+
+#endif /* FrustumCuller_hpp */
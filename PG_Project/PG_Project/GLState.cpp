@@ -0,0 +1,187 @@
+#include "GLState.hpp"
+
+namespace gps {
+
+	namespace {
+
+		// no object or enum has this value, the next call always goes through
+		const GLuint UNKNOWN = 0xFFFFFFFF;
+
+		int textureTargetIndex(GLenum target) {
+			switch (target) {
+			case GL_TEXTURE_2D: return 0;
+			case GL_TEXTURE_2D_ARRAY: return 1;
+			case GL_TEXTURE_CUBE_MAP: return 2;
+			case GL_TEXTURE_BUFFER: return 3;
+			default: return -1;
+			}
+		}
+	}
+
+	GLState::GLState()
+	{
+		invalidate();
+		resetStatistics();
+	}
+
+	GLState& GLState::global()
+	{
+		static GLState state;
+		return state;
+	}
+
+	bool GLState::filter(GLuint& current, GLuint value)
+	{
+		if (current == value) {
+			statistics.filtered++;
+			return true;
+		}
+		current = value;
+		statistics.issued++;
+		return false;
+	}
+
+	void GLState::useProgram(GLuint program)
+	{
+		if (!filter(this->program, program))
+			glUseProgram(program);
+	}
+
+	void GLState::activeTexture(GLuint unit)
+	{
+		if (!filter(activeUnit, unit))
+			glActiveTexture(GL_TEXTURE0 + unit);
+	}
+
+	void GLState::bindTexture(GLuint unit, GLenum target, GLuint texture)
+	{
+		int targetIndex = textureTargetIndex(target);
+		if (unit < MAX_TEXTURE_UNITS && targetIndex >= 0) {
+			if (filter(textures[unit][targetIndex], texture))
+				return;
+		}
+		else {
+			statistics.issued++;
+		}
+
+		activeTexture(unit);
+		glBindTexture(target, texture);
+	}
+
+	void GLState::bindVertexArray(GLuint vertexArray)
+	{
+		if (!filter(this->vertexArray, vertexArray))
+			glBindVertexArray(vertexArray);
+	}
+
+	void GLState::bindFramebuffer(GLenum target, GLuint framebuffer)
+	{
+		if (target == GL_FRAMEBUFFER) {
+			if (drawFramebuffer == framebuffer && readFramebuffer == framebuffer) {
+				statistics.filtered++;
+				return;
+			}
+			drawFramebuffer = framebuffer;
+			readFramebuffer = framebuffer;
+			statistics.issued++;
+		}
+		else if (filter(target == GL_READ_FRAMEBUFFER ? readFramebuffer : drawFramebuffer, framebuffer)) {
+			return;
+		}
+		glBindFramebuffer(target, framebuffer);
+	}
+
+	void GLState::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+	{
+		if (viewportRect[0] == x && viewportRect[1] == y && viewportRect[2] == width && viewportRect[3] == height) {
+			statistics.filtered++;
+			return;
+		}
+		viewportRect[0] = x;
+		viewportRect[1] = y;
+		viewportRect[2] = width;
+		viewportRect[3] = height;
+		statistics.issued++;
+		glViewport(x, y, width, height);
+	}
+
+	void GLState::depthFunc(GLenum func)
+	{
+		if (!filter(depthFunction, func))
+			glDepthFunc(func);
+	}
+
+	void GLState::polygonMode(GLenum mode)
+	{
+		if (!filter(polygonFillMode, mode))
+			glPolygonMode(GL_FRONT_AND_BACK, mode);
+	}
+
+	GLuint GLState::getTexture(GLuint unit, GLenum target) const
+	{
+		int targetIndex = textureTargetIndex(target);
+		if (unit >= MAX_TEXTURE_UNITS || targetIndex < 0)
+			return UNKNOWN;
+		return textures[unit][targetIndex];
+	}
+
+	void GLState::textureDeleted(GLuint texture)
+	{
+		for (GLuint unit = 0; unit < MAX_TEXTURE_UNITS; unit++) {
+			for (int target = 0; target < TEXTURE_TARGETS; target++) {
+				if (textures[unit][target] == texture)
+					textures[unit][target] = 0;
+			}
+		}
+	}
+
+	void GLState::vertexArrayDeleted(GLuint vertexArray)
+	{
+		if (this->vertexArray == vertexArray)
+			this->vertexArray = 0;
+	}
+
+	void GLState::programDeleted(GLuint program)
+	{
+		// a program in use stays current until another one is used, the next use always goes through
+		if (this->program == program)
+			this->program = UNKNOWN;
+	}
+
+	void GLState::framebufferDeleted(GLuint framebuffer)
+	{
+		if (drawFramebuffer == framebuffer)
+			drawFramebuffer = 0;
+		if (readFramebuffer == framebuffer)
+			readFramebuffer = 0;
+	}
+
+	void GLState::invalidate()
+	{
+		program = UNKNOWN;
+		activeUnit = UNKNOWN;
+		for (GLuint unit = 0; unit < MAX_TEXTURE_UNITS; unit++) {
+			for (int target = 0; target < TEXTURE_TARGETS; target++)
+				textures[unit][target] = UNKNOWN;
+		}
+		vertexArray = UNKNOWN;
+		drawFramebuffer = UNKNOWN;
+		readFramebuffer = UNKNOWN;
+		viewportRect[0] = viewportRect[1] = -1;
+		viewportRect[2] = viewportRect[3] = -1;
+		depthFunction = UNKNOWN;
+		polygonFillMode = UNKNOWN;
+	}
+
+	const GLState::Statistics& GLState::getStatistics() const
+	{
+		return statistics;
+	}
+
+	void GLState::resetStatistics()
+	{
+		statistics.issued = 0;
+		statistics.filtered = 0;
+	}
+
+}
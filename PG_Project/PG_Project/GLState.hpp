@@ -0,0 +1,81 @@
+#ifndef GLState_hpp
+#define GLState_hpp
+
+#include <GL/glew.h>
+
+namespace gps {
+
+    // Shadow copy of the OpenGL state the renderer changes most often. Each call is only sent to
+    // the driver when it changes something, so callers can keep setting everything they need
+    // before each draw. All the changes to the tracked state must go through here (or be
+    // followed by invalidate()), otherwise the shadow copy no longer matches the context.
+    class GLState
+    {
+    public:
+        // Calls made through GLState since the last reset
+        struct Statistics
+        {
+            unsigned issued;
+            unsigned filtered;
+        };
+
+        GLState();
+
+        // State of the context of the window
+        static GLState& global();
+
+        void useProgram(GLuint program);
+        // unit is 0 for GL_TEXTURE0
+        void activeTexture(GLuint unit);
+        // Makes the unit active only when the binding changes
+        void bindTexture(GLuint unit, GLenum target, GLuint texture);
+        void bindVertexArray(GLuint vertexArray);
+        // GL_FRAMEBUFFER sets both the draw and the read framebuffer
+        void bindFramebuffer(GLenum target, GLuint framebuffer);
+        void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+        void depthFunc(GLenum func);
+        // GL_FRONT_AND_BACK, the only face the core profile accepts
+        void polygonMode(GLenum mode);
+
+        // Texture the shadow copy has for the unit, 0xFFFFFFFF when unknown or not tracked
+        GLuint getTexture(GLuint unit, GLenum target) const;
+
+        // Deleting an object unbinds it - tells the shadow copy about it
+        void textureDeleted(GLuint texture);
+        void vertexArrayDeleted(GLuint vertexArray);
+        void programDeleted(GLuint program);
+        void framebufferDeleted(GLuint framebuffer);
+
+        // Forgets everything, the next call of each kind goes to the driver
+        void invalidate();
+
+        const Statistics& getStatistics() const;
+        void resetStatistics();
+
+    private:
+        static const GLuint MAX_TEXTURE_UNITS = 16;
+        // tracked texture targets: GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BUFFER
+        static const int TEXTURE_TARGETS = 4;
+
+        GLuint program;
+        GLuint activeUnit;
+        GLuint textures[MAX_TEXTURE_UNITS][TEXTURE_TARGETS];
+        GLuint vertexArray;
+        GLuint drawFramebuffer;
+        GLuint readFramebuffer;
+        GLint viewportRect[4];
+        GLenum depthFunction;
+        GLenum polygonFillMode;
+        Statistics statistics;
+
+        // true (and counts the call as filtered) if the value is already set, otherwise stores it
+        // and counts the call as issued
+        bool filter(GLuint& current, GLuint value);
+
+        GLState(const GLState&);
+        GLState& operator=(const GLState&);
+    };
+
+}
+
+#endif /* GLState_hpp */
@@ -0,0 +1,257 @@
+#include "KtxFile.hpp"
+#include "TextureCompressor.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace gps {
+
+	namespace {
+
+		const unsigned char ktxIdentifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+		const uint32_t ktxEndianness = 0x04030201;
+		// bump whenever the way the levels are produced changes
+		const uint32_t cookerVersion = 2;
+
+		const char sourceKey[] = "GPSSource";
+		const char settingsKey[] = "GPSSettings";
+
+		struct KtxHeader
+		{
+			unsigned char identifier[12];
+			uint32_t endianness;
+			uint32_t glType;
+			uint32_t glTypeSize;
+			uint32_t glFormat;
+			uint32_t glInternalFormat;
+			uint32_t glBaseInternalFormat;
+			uint32_t pixelWidth;
+			uint32_t pixelHeight;
+			uint32_t pixelDepth;
+			uint32_t numberOfArrayElements;
+			uint32_t numberOfFaces;
+			uint32_t numberOfMipmapLevels;
+			uint32_t bytesOfKeyValueData;
+		};
+
+		// value stored under settingsKey
+		struct KtxSettings
+		{
+			uint64_t settingsHash;
+			uint32_t cookerVersion;
+			uint32_t flags;
+		};
+
+		uint32_t padTo4(uint32_t size) {
+			return (size + 3) & ~3u;
+		}
+
+		void appendKeyValue(std::vector<unsigned char>& keyValueData, const char* key, const void* value, uint32_t valueSize) {
+			uint32_t keyAndValueSize = (uint32_t)std::strlen(key) + 1 + valueSize;
+			size_t start = keyValueData.size();
+			keyValueData.resize(start + sizeof(uint32_t) + padTo4(keyAndValueSize), 0);
+			std::memcpy(&keyValueData[start], &keyAndValueSize, sizeof(uint32_t));
+			std::memcpy(&keyValueData[start + sizeof(uint32_t)], key, std::strlen(key) + 1);
+			std::memcpy(&keyValueData[start + sizeof(uint32_t) + std::strlen(key) + 1], value, valueSize);
+		}
+
+		// Finds the value of a key in the key/value block, false if it is missing or has another size
+		bool findKeyValue(const unsigned char* data, uint32_t size, const char* key, void* value, uint32_t valueSize) {
+			uint32_t offset = 0;
+			size_t keyLength = std::strlen(key) + 1;
+			while (offset + sizeof(uint32_t) <= size) {
+				uint32_t keyAndValueSize;
+				std::memcpy(&keyAndValueSize, data + offset, sizeof(uint32_t));
+				offset += sizeof(uint32_t);
+				if (keyAndValueSize > size - offset)
+					return false;
+
+				if (keyAndValueSize == keyLength + valueSize && std::memcmp(data + offset, key, keyLength) == 0) {
+					std::memcpy(value, data + offset + keyLength, valueSize);
+					return true;
+				}
+				offset += padTo4(keyAndValueSize);
+			}
+			return false;
+		}
+	}
+
+	bool getTextureSource(const std::string& fileName, TextureSource& source) {
+		FileInfo info;
+		if (!getFileInfo(fileName, info) || !hashFile(fileName, source.hash))
+			return false;
+		source.size = info.size;
+		source.modifiedTime = info.modifiedTime;
+		return true;
+	}
+
+	bool KtxFile::write(const std::string& fileName, const TextureSource& source, uint64_t settingsHash, uint32_t flags,
+	                    GLenum glInternalFormat, GLenum glBaseInternalFormat, int width, int height,
+	                    const std::vector<unsigned char>& data, const std::vector<size_t>& sizes,
+	                    GLenum glType, GLenum glFormat, unsigned glTypeSize) {
+		KtxSettings settings;
+		settings.settingsHash = settingsHash;
+		settings.cookerVersion = cookerVersion;
+		settings.flags = flags;
+
+		std::vector<unsigned char> keyValueData;
+		appendKeyValue(keyValueData, sourceKey, &source, sizeof(source));
+		appendKeyValue(keyValueData, settingsKey, &settings, sizeof(settings));
+
+		KtxHeader header;
+		std::memcpy(header.identifier, ktxIdentifier, sizeof(ktxIdentifier));
+		header.endianness = ktxEndianness;
+		header.glType = glType;
+		header.glTypeSize = glTypeSize;
+		header.glFormat = glFormat;
+		header.glInternalFormat = glInternalFormat;
+		header.glBaseInternalFormat = glBaseInternalFormat;
+		header.pixelWidth = (uint32_t)width;
+		header.pixelHeight = (uint32_t)height;
+		header.pixelDepth = 0;
+		header.numberOfArrayElements = 0;
+		header.numberOfFaces = 1;
+		header.numberOfMipmapLevels = (uint32_t)sizes.size();
+		header.bytesOfKeyValueData = (uint32_t)keyValueData.size();
+
+		// write to a temporary file first so that an interrupted write never leaves a broken file behind
+		std::string temporaryFileName = fileName + ".tmp";
+		std::ofstream out(temporaryFileName.c_str(), std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)keyValueData.data(), (std::streamsize)keyValueData.size());
+
+		static const char zeros[4] = { 0 };
+		size_t offset = 0;
+		for (size_t i = 0; i < sizes.size(); i++) {
+			uint32_t imageSize = (uint32_t)sizes[i];
+			out.write((const char*)&imageSize, sizeof(imageSize));
+			out.write((const char*)data.data() + offset, (std::streamsize)imageSize);
+			out.write(zeros, (std::streamsize)(padTo4(imageSize) - imageSize));
+			offset += sizes[i];
+		}
+
+		out.close();
+		if (!out) {
+			std::remove(temporaryFileName.c_str());
+			return false;
+		}
+
+		return replaceFile(temporaryFileName, fileName);
+	}
+
+	bool KtxFile::open(const std::string& fileName, const std::string& sourceFileName, uint64_t settingsHash) {
+		levels.clear();
+		file.close();
+
+		if (!file.open(fileName))
+			return false;
+
+		TextureSource cachedSource;
+		if (!readLevels(settingsHash, cachedSource)) {
+			levels.clear();
+			file.close();
+			return false;
+		}
+
+		// the size and time stamp are enough most of the time, the contents are only
+		// hashed when the file was touched without necessarily being changed
+		FileInfo sourceInfo;
+		bool upToDate = getFileInfo(sourceFileName, sourceInfo) && sourceInfo.size == cachedSource.size;
+		if (upToDate && sourceInfo.modifiedTime != cachedSource.modifiedTime) {
+			uint64_t sourceHash;
+			upToDate = hashFile(sourceFileName, sourceHash) && sourceHash == cachedSource.hash;
+		}
+
+		if (!upToDate) {
+			levels.clear();
+			file.close();
+		}
+		return upToDate;
+	}
+
+	bool KtxFile::readLevels(uint64_t settingsHash, TextureSource& source) {
+		const unsigned char* data = file.data();
+		size_t size = file.size();
+
+		KtxHeader header;
+		if (size < sizeof(header))
+			return false;
+		std::memcpy(&header, data, sizeof(header));
+
+		if (std::memcmp(header.identifier, ktxIdentifier, sizeof(ktxIdentifier)) != 0 || header.endianness != ktxEndianness
+			|| header.pixelDepth != 0 || header.numberOfArrayElements != 0 || header.numberOfFaces != 1
+			|| header.numberOfMipmapLevels == 0 || header.numberOfMipmapLevels > 32 || header.pixelWidth == 0 || header.pixelHeight == 0
+			|| sizeof(header) + (uint64_t)header.bytesOfKeyValueData > size)
+			return false;
+
+		KtxSettings settings;
+		const unsigned char* keyValueData = data + sizeof(header);
+		if (!findKeyValue(keyValueData, header.bytesOfKeyValueData, sourceKey, &source, sizeof(source))
+			|| !findKeyValue(keyValueData, header.bytesOfKeyValueData, settingsKey, &settings, sizeof(settings))
+			|| settings.settingsHash != settingsHash || settings.cookerVersion != cookerVersion)
+			return false;
+
+		internalFormat = header.glInternalFormat;
+		flags = settings.flags;
+		width = (int)header.pixelWidth;
+		height = (int)header.pixelHeight;
+
+		// only the formats written by TextureCache - the size of each level is checked against them
+		bool compressed = internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+			|| internalFormat == GL_COMPRESSED_RED_RGTC1 || internalFormat == GL_COMPRESSED_RG_RGTC2;
+		if (!compressed && internalFormat != GL_RGBA8)
+			return false;
+
+		uint64_t offset = sizeof(header) + header.bytesOfKeyValueData;
+		for (uint32_t i = 0; i < header.numberOfMipmapLevels; i++) {
+			uint32_t imageSize;
+			if (offset + sizeof(imageSize) > size)
+				return false;
+			std::memcpy(&imageSize, data + offset, sizeof(imageSize));
+			offset += sizeof(imageSize);
+			if (offset + imageSize > size)
+				return false;
+
+			TextureLevel level;
+			level.width = std::max(width >> i, 1);
+			level.height = std::max(height >> i, 1);
+			size_t expectedSize = compressed ? compressedSize(internalFormat, level.width, level.height)
+				: (size_t)level.width * level.height * 4;
+			if (imageSize != expectedSize)
+				return false;
+			level.data = data + offset;
+			level.size = imageSize;
+			levels.push_back(level);
+
+			offset += padTo4(imageSize);
+		}
+
+		return true;
+	}
+
+	GLenum KtxFile::getInternalFormat() const {
+		return internalFormat;
+	}
+
+	int KtxFile::getWidth() const {
+		return width;
+	}
+
+	int KtxFile::getHeight() const {
+		return height;
+	}
+
+	const std::vector<TextureLevel>& KtxFile::getLevels() const {
+		return levels;
+	}
+
+	uint32_t KtxFile::getFlags() const {
+		return flags;
+	}
+
+}
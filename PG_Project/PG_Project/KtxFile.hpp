@@ -0,0 +1,70 @@
+#ifndef KtxFile_hpp
+#define KtxFile_hpp
+
+#include <GL/glew.h>
+
+#include "FileUtils.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Size, time stamp and content hash of the image a cached texture was built from
+    struct TextureSource
+    {
+        uint64_t size;
+        int64_t modifiedTime;
+        uint64_t hash;
+    };
+
+    // Fills in the stamp of a source image, false if it cannot be read
+    bool getTextureSource(const std::string& fileName, TextureSource& source);
+
+    // One mip level of a texture
+    struct TextureLevel
+    {
+        int width;
+        int height;
+        const unsigned char* data;
+        size_t size;
+    };
+
+    // KTX 1.1 texture file (2D, single face) with the stamp of its source image and the settings
+    // it was built with stored as key/value data, so that out of date files are detected
+    class KtxFile
+    {
+    public:
+        // Writes the levels one after another; data holds all of them, sizes has one entry per level.
+        // flags are stored for the reader (what is known about the image, e.g. its alpha).
+        static bool write(const std::string& fileName, const TextureSource& source, uint64_t settingsHash, uint32_t flags,
+                          GLenum glInternalFormat, GLenum glBaseInternalFormat, int width, int height,
+                          const std::vector<unsigned char>& data, const std::vector<size_t>& sizes,
+                          GLenum glType = 0, GLenum glFormat = 0, unsigned glTypeSize = 1);
+
+        // Maps the file, returns false if it is missing, broken or does not match the source image and settings
+        bool open(const std::string& fileName, const std::string& sourceFileName, uint64_t settingsHash);
+
+        GLenum getInternalFormat() const;
+        int getWidth() const;
+        int getHeight() const;
+        const std::vector<TextureLevel>& getLevels() const;
+        uint32_t getFlags() const;
+
+    private:
+        MappedFile file;
+        GLenum internalFormat;
+        int width;
+        int height;
+        uint32_t flags;
+        std::vector<TextureLevel> levels;
+
+        bool readLevels(uint64_t settingsHash, TextureSource& source);
+    };
+
+}
+
+#endif /* KtxFile_hpp */
@@ -1,71 +1,421 @@
 #include "Mesh.hpp"
+#include "GLState.hpp"
+#include "StaticGeometry.hpp"
+#include "TextureArray.hpp"
+#include "TextureStreamer.hpp"
+
+#include "glm/gtc/packing.hpp"
+#include "glm/gtc/type_ptr.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <unordered_map>
+
 namespace gps {
 
+	namespace {
+
+		// names of the per mesh uniforms, built once
+		const std::string positionOffsetName = "positionOffset";
+		const std::string positionScaleName = "positionScale";
+		const std::string octahedralNormalsName = "octahedralNormals";
+		const std::string rangesFromVertexName = "rangesFromVertex";
+		const std::string staticRangesName = "staticRanges";
+		const std::string diffuseTextureName = "diffuseTexture";
+		const std::string specularTextureName = "specularTexture";
+
+		// texture types with a sampler in the shaders (see Texture::type), the others are not drawn with
+		const std::string textureTypeNames[] = { "ambientTexture", diffuseTextureName, specularTextureName };
+		const int TEXTURE_TYPE_COUNT = 3;
+
+		// Uniforms set by Mesh::Draw, looked up once per program
+		struct MeshUniforms
+		{
+			GLuint program;
+			ShaderUniform<int> samplers[TEXTURE_TYPE_COUNT];
+			ShaderUniform<int> layers[TEXTURE_TYPE_COUNT];
+			ShaderUniform<glm::vec3> positionOffset;
+			ShaderUniform<glm::vec3> positionScale;
+			ShaderUniform<int> octahedralNormals;
+			ShaderUniform<int> rangesFromVertex;
+			ShaderUniform<int> staticRanges;
+		};
+
+		// GL thread - the entry of a shader is looked up again when it loads another program
+		const MeshUniforms& meshUniforms(const Shader& shader) {
+			static std::unordered_map<const Shader*, MeshUniforms> cache;
+			MeshUniforms& uniforms = cache[&shader];
+			if (uniforms.program != shader.shaderProgram || uniforms.program == 0) {
+				uniforms.program = shader.shaderProgram;
+				for (int type = 0; type < TEXTURE_TYPE_COUNT; type++) {
+					uniforms.samplers[type] = shader.getUniform<int>(textureTypeNames[type]);
+					uniforms.layers[type] = shader.getUniform<int>(textureTypeNames[type] + "Layer");
+				}
+				uniforms.positionOffset = shader.getUniform<glm::vec3>(positionOffsetName);
+				uniforms.positionScale = shader.getUniform<glm::vec3>(positionScaleName);
+				uniforms.octahedralNormals = shader.getUniform<int>(octahedralNormalsName);
+				uniforms.rangesFromVertex = shader.getUniform<int>(rangesFromVertexName);
+				uniforms.staticRanges = shader.getUniform<int>(staticRangesName);
+			}
+			return uniforms;
+		}
+
+		GLushort quantizeUnorm16(float value) {
+			value = std::min(std::max(value, 0.0f), 1.0f);
+			return (GLushort)(value * 65535.0f + 0.5f);
+		}
+
+		GLshort quantizeSnorm16(float value) {
+			value = std::min(std::max(value, -1.0f), 1.0f);
+			return (GLshort)std::floor(value * 32767.0f + 0.5f);
+		}
+
+		// Octahedral normal encoding - projects the unit sphere on an octahedron and unfolds it on a square
+		glm::vec2 encodeOctahedral(glm::vec3 normal) {
+			float length = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+			if (length == 0.0f)
+				return glm::vec2(0.0f);
+
+			normal /= length;
+			glm::vec2 encoded(normal.x, normal.y);
+			if (normal.z < 0.0f) {
+				encoded.x = (1.0f - std::fabs(normal.y)) * (normal.x >= 0.0f ? 1.0f : -1.0f);
+				encoded.y = (1.0f - std::fabs(normal.x)) * (normal.y >= 0.0f ? 1.0f : -1.0f);
+			}
+			return encoded;
+		}
+	}
+
+	CompactVertex compressVertex(const Vertex& vertex, const glm::vec3& positionOffset, const glm::vec3& inverseScale) {
+		glm::vec3 position = (vertex.Position - positionOffset) * inverseScale;
+		glm::vec2 normal = encodeOctahedral(vertex.Normal);
+
+		CompactVertex compact;
+		compact.Position[0] = quantizeUnorm16(position.x);
+		compact.Position[1] = quantizeUnorm16(position.y);
+		compact.Position[2] = quantizeUnorm16(position.z);
+		compact.Position[3] = 0;
+		compact.Normal[0] = quantizeSnorm16(normal.x);
+		compact.Normal[1] = quantizeSnorm16(normal.y);
+		compact.TexCoords[0] = glm::packHalf1x16(vertex.TexCoords.x);
+		compact.TexCoords[1] = glm::packHalf1x16(vertex.TexCoords.y);
+		return compact;
+	}
+
 	/* Mesh Constructor */
-	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures)
+	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, VertexFormat format, std::vector<MeshLod> lods,
+	           const BoundingBox* positionGrid)
 	{
 		this->vertices = vertices;
 		this->indices = indices;
 		this->textures = textures;
+		this->classifyAlpha();
+		this->classifyTextures();
+
+		this->setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size(), format, lods, positionGrid);
+	}
+
+	/* Mesh Constructor - the data is only read while the buffers are created */
+	Mesh::Mesh(const Vertex* vertexData, size_t vertexCount, const GLuint* indexData, size_t indexCount, std::vector<Texture> textures, VertexFormat format, std::vector<MeshLod> lods,
+	           const BoundingBox* positionGrid)
+	{
+		this->textures = textures;
+		this->classifyAlpha();
+		this->classifyTextures();
+
+		this->setupMesh(vertexData, vertexCount, indexData, indexCount, format, lods, positionGrid);
+	}
+
+	void Mesh::classifyAlpha() {
+		this->cutout = false;
+		for (size_t i = 0; i < this->textures.size(); i++) {
+			if (this->textures[i].type == diffuseTextureName && this->textures[i].handle && this->textures[i].handle->isCutout())
+				this->cutout = true;
+		}
+	}
+
+	void Mesh::classifyTextures() {
+		this->textureTypes.assign(this->textures.size(), -1);
+		for (size_t i = 0; i < this->textures.size(); i++) {
+			for (int type = 0; type < TEXTURE_TYPE_COUNT; type++) {
+				if (this->textures[i].type == textureTypeNames[type])
+					this->textureTypes[i] = type;
+			}
+		}
+	}
+
+	bool Mesh::isCutout() const {
+		return this->cutout;
+	}
+
+	bool Mesh::inBucket(MeshBucket bucket) const {
+		return bucket == MESH_BUCKET_ALL || (bucket == MESH_BUCKET_CUTOUT) == this->cutout;
+	}
+
+	GLuint Mesh::getVertexArray() const {
+		return this->buffers.VAO;
+	}
+
+	uint32_t Mesh::getTextureSet() const {
+		// streamed textures change arrays, so the hash is taken at every submit
+		uint32_t hash = 2166136261u;
+		for (size_t i = 0; i < this->textures.size(); i++) {
+			GLuint id = this->textures[i].handle ? this->textures[i].handle->getId() : 0;
+			hash = (hash ^ id) * 16777619u;
+		}
+		return hash;
+	}
+
+	float Mesh::viewDepth(const glm::mat4& modelView) const {
+		return glm::length(glm::vec3(modelView * glm::vec4(this->boundingCenter, 1.0f)));
+	}
+
+	const BoundingBox& Mesh::getBoundingBox() const {
+		return this->boundingBox;
+	}
 
-		this->setupMesh();
+	glm::vec3 Mesh::getBoundingCenter() const {
+		return this->boundingCenter;
+	}
+
+	float Mesh::getBoundingRadius() const {
+		return this->boundingRadius;
 	}
 
 	Buffers Mesh::getBuffers() {
 	    return this->buffers;
 	}
 
+	void Mesh::selectLod(const glm::mat4& modelView, const glm::mat4& projection, float errorThreshold) {
+		// 1/3 below the threshold before switching to a coarser level
+		const float hysteresis = 0.67f;
+
+		// inside the bounding sphere everything is drawn at full detail
+		float screenScale = this->screenScale(modelView, projection);
+		if (screenScale == FLT_MAX) {
+			this->currentLod = 0;
+			return;
+		}
+
+		size_t finest = 0;
+		size_t coarsest = 0;
+		for (size_t i = 1; i < this->lods.size(); i++) {
+			float screenError = this->lods[i].error * screenScale;
+			if (screenError <= errorThreshold)
+				finest = i;
+			if (screenError <= errorThreshold * hysteresis)
+				coarsest = i;
+		}
+
+		if (finest < this->currentLod)
+			this->currentLod = finest;
+		else if (coarsest > this->currentLod)
+			this->currentLod = coarsest;
+	}
+
+	float Mesh::screenScale(const glm::mat4& modelView, const glm::mat4& projection) const {
+		glm::vec3 center = glm::vec3(modelView * glm::vec4(this->boundingCenter, 1.0f));
+		float scale = std::max(glm::length(glm::vec3(modelView[0])),
+			std::max(glm::length(glm::vec3(modelView[1])), glm::length(glm::vec3(modelView[2]))));
+
+		// closest point of the bounding sphere
+		float distance = glm::length(center) - this->boundingRadius * scale;
+		if (distance <= 0.0f)
+			return FLT_MAX;
+
+		return scale * projection[1][1] / (2.0f * distance);
+	}
+
+	void Mesh::requestTextureLevels(const glm::mat4& modelView, const glm::mat4& projection) {
+		if (this->uvDensity <= 0.0f || this->textures.empty())
+			return;
+
+		TextureStreamer& streamer = TextureStreamer::global();
+		float screenScale = this->screenScale(modelView, projection);
+		float pixelsPerUv = screenScale == FLT_MAX ? FLT_MAX : screenScale * streamer.getViewportHeight() / this->uvDensity;
+		for (size_t i = 0; i < this->textures.size(); i++) {
+			if (this->textures[i].handle)
+				streamer.request(*this->textures[i].handle, pixelsPerUv);
+		}
+	}
+
+	size_t Mesh::getLod() const {
+		return this->currentLod;
+	}
+
+	size_t Mesh::getLodCount() const {
+		return this->lods.size();
+	}
+
+	const std::vector<MeshLod>& Mesh::getLods() const {
+		return this->lods;
+	}
+
+	void Mesh::releaseGeometry() {
+		std::vector<Vertex>().swap(this->vertices);
+		std::vector<GLuint>().swap(this->indices);
+
+		glDeleteBuffers(1, &this->buffers.VBO);
+		glDeleteBuffers(1, &this->buffers.EBO);
+		glDeleteVertexArrays(1, &this->buffers.VAO);
+		GLState::global().vertexArrayDeleted(this->buffers.VAO);
+		this->buffers.VAO = 0;
+		this->buffers.VBO = 0;
+		this->buffers.EBO = 0;
+	}
+
 	/* Mesh drawing function - also applies associated textures */
-	void Mesh::Draw(gps::Shader shader)
+	void Mesh::Draw(gps::Shader& shader)
 	{
 		shader.useShaderProgram();
+		const MeshUniforms& uniforms = meshUniforms(shader);
 
-		//set textures
+		//set textures - layers of texture arrays, the arrays are only bound when they change
 		for (GLuint i = 0; i < textures.size(); i++)
 		{
-			glActiveTexture(GL_TEXTURE0 + i);
-			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
-			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
+			const Texture& texture = this->textures[i];
+			int type = this->textureTypes[i];
+			if (type >= 0) {
+				shader.setUniform(uniforms.samplers[type], (int)i);
+				shader.setUniform(uniforms.layers[type], texture.handle ? texture.handle->getLayer() : 0);
+			}
+			TextureArray::bind(i, texture.handle ? texture.handle->getId() : 0);
 		}
+		// samplers the mesh has no texture for read nothing, as if the previous mesh had unbound its textures
+		TextureArray::unbindFrom((GLuint)textures.size());
 
-		glBindVertexArray(this->buffers.VAO);
-		glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-
-        for(GLuint i = 0; i < this->textures.size(); i++)
-        {
-            glActiveTexture(GL_TEXTURE0 + i);
-            glBindTexture(GL_TEXTURE_2D, 0);
-        }
+		//set vertex dequantization
+		shader.setUniform(uniforms.positionOffset, this->positionOffset);
+		shader.setUniform(uniforms.positionScale, this->positionScale);
+		shader.setUniform(uniforms.octahedralNormals, (int)(this->format == VERTEX_FORMAT_COMPACT));
+		shader.setUniform(uniforms.rangesFromVertex, 0);
+		// unused here, but a sampler left on unit 0 would clash with the diffuse array
+		shader.setUniform(uniforms.staticRanges, (int)STATIC_RANGES_UNIT);
 
+		GLState::global().bindVertexArray(this->buffers.VAO);
+		const MeshLod& lod = this->lods[this->currentLod];
+		size_t indexSize = this->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		glDrawElements(GL_TRIANGLES, lod.indexCount, this->indexType, (GLvoid*)(lod.indexOffset * indexSize));
     }
 
 	// Initializes all the buffer objects/arrays
-	void Mesh::setupMesh(){
+	void Mesh::setupMesh(const Vertex* vertexData, size_t vertexCount, const GLuint* indexData, size_t indexCount,
+	                     VertexFormat format, const std::vector<MeshLod>& lods, const BoundingBox* positionGrid){
+		this->indexCount = (GLsizei)indexCount;
+		this->format = format;
+		this->positionOffset = glm::vec3(0.0f);
+		this->positionScale = glm::vec3(1.0f);
+
+		// without levels of detail the whole index buffer is a single level
+		this->lods = lods;
+		if (this->lods.empty()) {
+			MeshLod lod = { 0, (GLuint)indexCount, 0.0f };
+			this->lods.push_back(lod);
+		}
+		this->currentLod = 0;
+
+		glm::vec3 minimum(0.0f);
+		glm::vec3 maximum(0.0f);
+		if (vertexCount > 0) {
+			minimum = maximum = vertexData[0].Position;
+			for (size_t i = 1; i < vertexCount; i++) {
+				minimum = glm::min(minimum, vertexData[i].Position);
+				maximum = glm::max(maximum, vertexData[i].Position);
+			}
+		}
+		this->boundingBox.minimum = minimum;
+		this->boundingBox.maximum = maximum;
+		this->boundingCenter = (minimum + maximum) * 0.5f;
+		this->boundingRadius = glm::length(maximum - minimum) * 0.5f;
+
+		// average texture density of the full detail triangles, used to pick the mip levels to stream
+		double surfaceArea = 0.0;
+		double uvArea = 0.0;
+		for (GLuint i = this->lods[0].indexOffset; i + 2 < this->lods[0].indexOffset + this->lods[0].indexCount; i += 3) {
+			const Vertex& a = vertexData[indexData[i]];
+			const Vertex& b = vertexData[indexData[i + 1]];
+			const Vertex& c = vertexData[indexData[i + 2]];
+			surfaceArea += glm::length(glm::cross(b.Position - a.Position, c.Position - a.Position));
+			glm::vec2 ab = b.TexCoords - a.TexCoords;
+			glm::vec2 ac = c.TexCoords - a.TexCoords;
+			uvArea += std::fabs(ab.x * ac.y - ab.y * ac.x);
+		}
+		this->uvDensity = surfaceArea > 0.0 ? (float)std::sqrt(uvArea / surfaceArea) : 0.0f;
+
+		if (format == VERTEX_FORMAT_COMPACT) {
+			const BoundingBox& grid = positionGrid ? *positionGrid : this->boundingBox;
+			this->positionOffset = grid.minimum;
+			this->positionScale = grid.maximum - grid.minimum;
+		}
+
 		// Create buffers/arrays
 		glGenVertexArrays(1, &this->buffers.VAO);
 		glGenBuffers(1, &this->buffers.VBO);
 		glGenBuffers(1, &this->buffers.EBO);
 
-		glBindVertexArray(this->buffers.VAO);
+		GLState::global().bindVertexArray(this->buffers.VAO);
 		// Load data into vertex buffers
 		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
-		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
+		if (format == VERTEX_FORMAT_COMPACT) {
+			std::vector<CompactVertex> compactVertices = compressVertices(vertexData, vertexCount);
+			glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(CompactVertex), compactVertices.data(), GL_STATIC_DRAW);
+		}
+		else {
+			glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertexData, GL_STATIC_DRAW);
+		}
 
+		// 16 bit indices halve the index buffer of the smaller meshes
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+		if (vertexCount <= 65536) {
+			std::vector<GLushort> shortIndices(indexData, indexData + indexCount);
+			this->indexType = GL_UNSIGNED_SHORT;
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(GLushort), shortIndices.data(), GL_STATIC_DRAW);
+		}
+		else {
+			this->indexType = GL_UNSIGNED_INT;
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(GLuint), indexData, GL_STATIC_DRAW);
+		}
 
 		// Set the vertex attribute pointers
-		// Vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
-		// Vertex Normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
-		// Vertex Texture Coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
-
-		glBindVertexArray(0);
+		if (format == VERTEX_FORMAT_COMPACT) {
+			// Vertex Positions
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(CompactVertex), (GLvoid*)offsetof(CompactVertex, Position));
+			// Vertex Normals
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(CompactVertex), (GLvoid*)offsetof(CompactVertex, Normal));
+			// Vertex Texture Coords
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactVertex), (GLvoid*)offsetof(CompactVertex, TexCoords));
+		}
+		else {
+			// Vertex Positions
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+			// Vertex Normals
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
+			// Vertex Texture Coords
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+		}
+
+		GLState::global().bindVertexArray(0);
+	}
+
+	// Converts the vertices to the compact layout using the position dequantization
+	std::vector<CompactVertex> Mesh::compressVertices(const Vertex* vertexData, size_t vertexCount) {
+		// flat axes keep a scale of 0, every vertex then decodes to the offset
+		glm::vec3 inverseScale(0.0f);
+		for (int axis = 0; axis < 3; axis++) {
+			if (this->positionScale[axis] > 0.0f)
+				inverseScale[axis] = 1.0f / this->positionScale[axis];
+		}
+
+		std::vector<CompactVertex> compactVertices(vertexCount);
+		for (size_t i = 0; i < vertexCount; i++)
+			compactVertices[i] = compressVertex(vertexData[i], this->positionOffset, inverseScale);
+		return compactVertices;
 	}
 }
@@ -4,8 +4,11 @@
 #include <GL/glew.h>
 #include "glm/glm.hpp"
 
+#include "FrustumCuller.hpp"
 #include "Shader.hpp"
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -19,12 +22,18 @@ struct Vertex
     glm::vec2 TexCoords;
 };
 
+class TextureHandle;
+
 struct Texture
 {
     GLuint id;
     //ambientTexture, diffuseTexture, specularTexture
     std::string type;
+    // type + "Layer" - the uniform with the layer of the texture in its array
+    std::string layerType;
     std::string path;
+    // keeps the GL texture alive while the texture is in use
+    std::shared_ptr<TextureHandle> handle;
 };
 
 struct Material
@@ -40,6 +49,66 @@ struct Buffers {
     GLuint EBO;
 };
 
+// Vertex with quantized attributes - 16 bytes instead of 32
+struct CompactVertex
+{
+    // unsigned normalized, relative to the quantization grid of the mesh (the 4th value is padding)
+    GLushort Position[4];
+    // octahedral encoding, signed normalized
+    GLshort Normal[2];
+    // half floats
+    GLushort TexCoords[2];
+};
+
+// Quantizes a vertex for the compact layout - inverseScale is 1 / positionScale, 0 on flat axes
+CompactVertex compressVertex(const Vertex& vertex, const glm::vec3& positionOffset, const glm::vec3& inverseScale);
+
+// Layout of the vertex buffer of a mesh
+enum VertexFormat
+{
+    // gps::Vertex as it is
+    VERTEX_FORMAT_FLOAT,
+    // gps::CompactVertex, dequantized in the vertex shaders
+    VERTEX_FORMAT_COMPACT
+};
+
+// Meshes covered by a draw - opaque meshes go first with a program without the alpha test, so
+// that they keep early depth testing, the cutout meshes (alpha tested) after them
+enum MeshBucket
+{
+    MESH_BUCKET_ALL,
+    MESH_BUCKET_OPAQUE,
+    MESH_BUCKET_CUTOUT
+};
+
+// Texture referenced by a material - type and path relative to the model directory
+struct TextureReference
+{
+    std::string type;
+    std::string path;
+};
+
+// Range of the index buffer holding one level of detail of a mesh
+struct MeshLod
+{
+    GLuint indexOffset;
+    GLuint indexCount;
+    // largest distance between this level and the full mesh, in model units
+    float error;
+};
+
+// CPU side geometry and material of a mesh, before it is uploaded to the GPU
+struct MeshData
+{
+    std::vector<Vertex> vertices;
+    // all the levels of detail, one after the other
+    std::vector<GLuint> indices;
+    Material material;
+    std::vector<TextureReference> textures;
+    // finest first - empty if the mesh has a single level made of all the indices
+    std::vector<MeshLod> lods;
+};
+
 class Mesh
 {
 public:
@@ -47,18 +116,91 @@ public:
     std::vector<GLuint> indices;
     std::vector<Texture> textures;
 
-	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
+	// positionGrid is the box the compact positions are quantized against - the bounds of the mesh when null.
+	// Meshes that share a grid (see Model3D) snap the vertices they have in common to the same positions.
+	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures,
+	     VertexFormat format = VERTEX_FORMAT_FLOAT, std::vector<MeshLod> lods = std::vector<MeshLod>(),
+	     const BoundingBox* positionGrid = nullptr);
+
+	// Uploads vertex and index data owned by someone else (e.g. a mapped cache file) without keeping a copy
+	Mesh(const Vertex* vertexData, size_t vertexCount, const GLuint* indexData, size_t indexCount, std::vector<Texture> textures,
+	     VertexFormat format = VERTEX_FORMAT_FLOAT, std::vector<MeshLod> lods = std::vector<MeshLod>(),
+	     const BoundingBox* positionGrid = nullptr);
 
 	Buffers getBuffers();
 
-	void Draw(gps::Shader shader);
+	// Picks the coarsest level of detail whose error covers less than errorThreshold of the screen height.
+	// A coarser level is only taken once it is below the threshold by some margin, so that the
+	// level does not flicker back and forth around the switching distance.
+	void selectLod(const glm::mat4& modelView, const glm::mat4& projection, float errorThreshold);
+
+	size_t getLod() const;
+	size_t getLodCount() const;
+	const std::vector<MeshLod>& getLods() const;
+
+	// Tells the TextureStreamer which mip levels of the textures are needed at the current size on screen
+	void requestTextureLevels(const glm::mat4& modelView, const glm::mat4& projection);
+
+	// Draws the selected level of detail
+	void Draw(gps::Shader& shader);
+
+	// True if the diffuse texture has texels the alpha test discards
+	bool isCutout() const;
+	bool inBucket(MeshBucket bucket) const;
+
+	// Sort key fields of the draws of the mesh (see RenderQueue)
+	GLuint getVertexArray() const;
+	// Hash of the texture arrays the mesh binds
+	uint32_t getTextureSet() const;
+	// Distance from the eye to the center of the bounding sphere
+	float viewDepth(const glm::mat4& modelView) const;
+
+	// Bounds of the vertices in model space, computed when the mesh is created
+	const BoundingBox& getBoundingBox() const;
+	glm::vec3 getBoundingCenter() const;
+	float getBoundingRadius() const;
+
+	// Frees the vertices, the indices and the buffer objects - the levels of detail, bounds and
+	// textures stay, for meshes drawn from a StaticGeometry. The mesh cannot be drawn afterwards.
+	void releaseGeometry();
 
 private:
     /*  Render data  */
     Buffers buffers;
+    GLsizei indexCount;
+    // GL_UNSIGNED_SHORT when all the vertices can be addressed with 16 bits
+    GLenum indexType;
+    VertexFormat format;
+    // maps the normalized compact positions back to model space
+    glm::vec3 positionOffset;
+    glm::vec3 positionScale;
+    // bounding box and sphere (around the box) in model space
+    BoundingBox boundingBox;
+    glm::vec3 boundingCenter;
+    float boundingRadius;
+    std::vector<MeshLod> lods;
+    size_t currentLod;
+    // texture coordinate units per model unit, 0 without texture coordinates
+    float uvDensity;
+    bool cutout;
+    // index of the type of each texture in the sampler names of Mesh.cpp, -1 for the unknown ones
+    std::vector<int> textureTypes;
+
+	// Fraction of the screen height covered by one model unit at the closest point of the
+	// bounding sphere, FLT_MAX when the camera is inside it
+	float screenScale(const glm::mat4& modelView, const glm::mat4& projection) const;
 
 	// Initializes all the buffer objects/arrays
-	void setupMesh();
+	void setupMesh(const Vertex* vertexData, size_t vertexCount, const GLuint* indexData, size_t indexCount,
+	               VertexFormat format, const std::vector<MeshLod>& lods, const BoundingBox* positionGrid);
+
+	// Converts the vertices to the compact layout using the position dequantization
+	std::vector<CompactVertex> compressVertices(const Vertex* vertexData, size_t vertexCount);
+
+	// Tags the mesh as opaque or cutout from the alpha of its diffuse texture
+	void classifyAlpha();
+	// Fills textureTypes, so that Draw finds the sampler of each texture without comparing names
+	void classifyTextures();
 
 };
 
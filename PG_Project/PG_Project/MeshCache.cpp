@@ -0,0 +1,366 @@
+#include "MeshCache.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace gps {
+
+	namespace {
+
+		const char cacheMagic[4] = { 'G', 'P', 'S', 'M' };
+		// bump whenever the layout of the file or of the processed geometry changes
+		const uint32_t cacheVersion = 5;
+		const uint64_t dataAlignment = 16;
+
+		struct CacheHeader
+		{
+			char magic[4];
+			uint32_t version;
+			uint64_t sourceSize;
+			int64_t sourceModifiedTime;
+			uint64_t sourceHash;
+			uint64_t settingsHash;
+			uint32_t meshCount;
+			uint32_t vertexSize;
+			// material libraries of the model, each one a DependencyRecord followed by its path
+			uint32_t dependencyCount;
+			uint64_t dependencyOffset;
+		};
+
+		struct DependencyRecord
+		{
+			uint64_t size;
+			int64_t modifiedTime;
+			uint64_t hash;
+			// 0 if the file was missing when the cache was written
+			uint32_t exists;
+			uint32_t padding;
+		};
+
+		// A file the cached geometry depends on besides the .obj
+		struct Dependency
+		{
+			std::string path;
+			DependencyRecord record;
+		};
+
+		struct CacheMeshRecord
+		{
+			uint64_t vertexOffset;
+			uint64_t indexOffset;
+			uint64_t textureOffset;
+			uint64_t lodOffset;
+			uint32_t vertexCount;
+			uint32_t indexCount;
+			uint32_t textureCount;
+			uint32_t lodCount;
+			float ambient[3];
+			float diffuse[3];
+			float specular[3];
+		};
+
+		uint64_t alignOffset(uint64_t offset) {
+			return (offset + dataAlignment - 1) & ~(dataAlignment - 1);
+		}
+
+		uint64_t stringTableSize(const std::vector<TextureReference>& textures) {
+			uint64_t size = 0;
+			for (size_t i = 0; i < textures.size(); i++)
+				size += 2 * sizeof(uint32_t) + textures[i].type.size() + textures[i].path.size();
+			return size;
+		}
+
+		void writePadding(std::ofstream& out, uint64_t& offset) {
+			static const char zeros[dataAlignment] = { 0 };
+			uint64_t aligned = alignOffset(offset);
+			out.write(zeros, (std::streamsize)(aligned - offset));
+			offset = aligned;
+		}
+
+		void writeString(std::ofstream& out, const std::string& value) {
+			uint32_t length = (uint32_t)value.size();
+			out.write((const char*)&length, sizeof(length));
+			out.write(value.data(), length);
+		}
+
+		// Material libraries named by the mtllib lines of the .obj, in the directory the loader reads them from
+		std::vector<std::string> materialLibraries(const std::string& sourceFileName, const std::string& materialDirectory) {
+			std::vector<std::string> libraries;
+			std::ifstream in(sourceFileName.c_str());
+			std::string line;
+			while (std::getline(in, line)) {
+				std::istringstream words(line);
+				std::string keyword;
+				std::string name;
+				if (!(words >> keyword) || keyword != "mtllib")
+					continue;
+				while (words >> name)
+					libraries.push_back(materialDirectory + name);
+			}
+			return libraries;
+		}
+
+		DependencyRecord stampFile(const std::string& fileName) {
+			DependencyRecord record = { 0, 0, 0, 0, 0 };
+			FileInfo info;
+			if (getFileInfo(fileName, info) && hashFile(fileName, record.hash)) {
+				record.size = info.size;
+				record.modifiedTime = info.modifiedTime;
+				record.exists = 1;
+			}
+			return record;
+		}
+
+		// Same policy as the .obj - the contents are only hashed when the time stamp changed
+		bool isUpToDate(const std::string& fileName, const DependencyRecord& record) {
+			FileInfo info;
+			bool exists = getFileInfo(fileName, info);
+			if (exists != (record.exists != 0))
+				return false;
+			if (!exists)
+				return true;
+			if (info.size != record.size)
+				return false;
+			if (info.modifiedTime == record.modifiedTime)
+				return true;
+			uint64_t hash;
+			return hashFile(fileName, hash) && hash == record.hash;
+		}
+
+		bool readString(const unsigned char* data, size_t size, uint64_t& offset, std::string& value) {
+			uint32_t length;
+			if (offset + sizeof(length) > size)
+				return false;
+			std::memcpy(&length, data + offset, sizeof(length));
+			offset += sizeof(length);
+			if (offset + length > size)
+				return false;
+			value.assign((const char*)data + offset, length);
+			offset += length;
+			return true;
+		}
+	}
+
+	std::string MeshCache::cachePath(const std::string& modelFileName) {
+		return modelFileName + ".meshcache";
+	}
+
+	bool MeshCache::write(const std::string& cacheFileName, const std::string& sourceFileName,
+	                      const std::string& materialDirectory, uint64_t settingsHash, const std::vector<MeshData>& meshes) {
+		FileInfo sourceInfo;
+		uint64_t sourceHash;
+		if (!getFileInfo(sourceFileName, sourceInfo) || !hashFile(sourceFileName, sourceHash))
+			return false;
+
+		CacheHeader header;
+		std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+		header.version = cacheVersion;
+		header.sourceSize = sourceInfo.size;
+		header.sourceModifiedTime = sourceInfo.modifiedTime;
+		header.sourceHash = sourceHash;
+		header.settingsHash = settingsHash;
+		header.meshCount = (uint32_t)meshes.size();
+		header.vertexSize = sizeof(Vertex);
+
+		std::vector<std::string> libraries = materialLibraries(sourceFileName, materialDirectory);
+		std::vector<Dependency> dependencies(libraries.size());
+		for (size_t i = 0; i < libraries.size(); i++) {
+			dependencies[i].path = libraries[i];
+			dependencies[i].record = stampFile(libraries[i]);
+		}
+		header.dependencyCount = (uint32_t)dependencies.size();
+
+		// lay out the data blocks after the header and the mesh table
+		std::vector<CacheMeshRecord> records(meshes.size());
+		uint64_t offset = sizeof(CacheHeader) + meshes.size() * sizeof(CacheMeshRecord);
+		for (size_t i = 0; i < meshes.size(); i++) {
+			CacheMeshRecord& record = records[i];
+			record.vertexCount = (uint32_t)meshes[i].vertices.size();
+			record.indexCount = (uint32_t)meshes[i].indices.size();
+			record.textureCount = (uint32_t)meshes[i].textures.size();
+			record.lodCount = (uint32_t)meshes[i].lods.size();
+			for (int c = 0; c < 3; c++) {
+				record.ambient[c] = meshes[i].material.ambient[c];
+				record.diffuse[c] = meshes[i].material.diffuse[c];
+				record.specular[c] = meshes[i].material.specular[c];
+			}
+
+			record.vertexOffset = alignOffset(offset);
+			offset = record.vertexOffset + record.vertexCount * sizeof(Vertex);
+			record.indexOffset = alignOffset(offset);
+			offset = record.indexOffset + record.indexCount * sizeof(GLuint);
+			record.lodOffset = offset;
+			offset += record.lodCount * sizeof(MeshLod);
+			record.textureOffset = offset;
+			offset += stringTableSize(meshes[i].textures);
+		}
+		header.dependencyOffset = offset;
+
+		// write to a temporary file first so that an interrupted write never leaves a broken cache behind
+		std::string temporaryFileName = cacheFileName + ".tmp";
+		std::ofstream out(temporaryFileName.c_str(), std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)records.data(), (std::streamsize)(records.size() * sizeof(CacheMeshRecord)));
+
+		offset = sizeof(CacheHeader) + meshes.size() * sizeof(CacheMeshRecord);
+		for (size_t i = 0; i < meshes.size(); i++) {
+			writePadding(out, offset);
+			out.write((const char*)meshes[i].vertices.data(), (std::streamsize)(records[i].vertexCount * sizeof(Vertex)));
+			offset += records[i].vertexCount * sizeof(Vertex);
+
+			writePadding(out, offset);
+			out.write((const char*)meshes[i].indices.data(), (std::streamsize)(records[i].indexCount * sizeof(GLuint)));
+			offset += records[i].indexCount * sizeof(GLuint);
+
+			out.write((const char*)meshes[i].lods.data(), (std::streamsize)(records[i].lodCount * sizeof(MeshLod)));
+			offset += records[i].lodCount * sizeof(MeshLod);
+
+			for (size_t t = 0; t < meshes[i].textures.size(); t++) {
+				writeString(out, meshes[i].textures[t].type);
+				writeString(out, meshes[i].textures[t].path);
+			}
+			offset += stringTableSize(meshes[i].textures);
+		}
+
+		for (size_t i = 0; i < dependencies.size(); i++) {
+			out.write((const char*)&dependencies[i].record, sizeof(DependencyRecord));
+			writeString(out, dependencies[i].path);
+		}
+
+		out.close();
+		if (!out) {
+			std::remove(temporaryFileName.c_str());
+			return false;
+		}
+
+		return replaceFile(temporaryFileName, cacheFileName);
+	}
+
+	bool MeshCache::open(const std::string& cacheFileName, const std::string& sourceFileName, uint64_t settingsHash) {
+		close();
+
+		if (!file.open(cacheFileName))
+			return false;
+
+		CacheHeader header;
+		if (file.size() < sizeof(header)) {
+			close();
+			return false;
+		}
+		std::memcpy(&header, file.data(), sizeof(header));
+
+		if (std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 || header.version != cacheVersion
+			|| header.vertexSize != sizeof(Vertex) || header.settingsHash != settingsHash) {
+			close();
+			return false;
+		}
+
+		// the size and time stamp are enough most of the time, the contents are only
+		// hashed when the file was touched without necessarily being changed
+		FileInfo sourceInfo;
+		if (!getFileInfo(sourceFileName, sourceInfo) || sourceInfo.size != header.sourceSize) {
+			close();
+			return false;
+		}
+		if (sourceInfo.modifiedTime != header.sourceModifiedTime) {
+			uint64_t sourceHash;
+			if (!hashFile(sourceFileName, sourceHash) || sourceHash != header.sourceHash) {
+				close();
+				return false;
+			}
+		}
+
+		// an edited .mtl changes the textures and materials of the meshes
+		uint64_t offset = header.dependencyOffset;
+		for (uint32_t i = 0; i < header.dependencyCount; i++) {
+			Dependency dependency;
+			if (offset + sizeof(DependencyRecord) > file.size()) {
+				close();
+				return false;
+			}
+			std::memcpy(&dependency.record, file.data() + offset, sizeof(DependencyRecord));
+			offset += sizeof(DependencyRecord);
+			if (!readString(file.data(), file.size(), offset, dependency.path) || !isUpToDate(dependency.path, dependency.record)) {
+				close();
+				return false;
+			}
+		}
+
+		if (!readMeshes()) {
+			std::cerr << "WARNING: mesh cache " << cacheFileName << " is corrupted" << std::endl;
+			close();
+			return false;
+		}
+
+		return true;
+	}
+
+	bool MeshCache::readMeshes() {
+		const unsigned char* data = file.data();
+		size_t size = file.size();
+
+		CacheHeader header;
+		std::memcpy(&header, data, sizeof(header));
+
+		uint64_t tableEnd = sizeof(CacheHeader) + (uint64_t)header.meshCount * sizeof(CacheMeshRecord);
+		if (tableEnd > size)
+			return false;
+
+		cachedMeshes.resize(header.meshCount);
+		for (uint32_t i = 0; i < header.meshCount; i++) {
+			CacheMeshRecord record;
+			std::memcpy(&record, data + sizeof(CacheHeader) + i * sizeof(CacheMeshRecord), sizeof(record));
+
+			if (record.vertexOffset % dataAlignment != 0 || record.indexOffset % dataAlignment != 0
+				|| record.vertexOffset + (uint64_t)record.vertexCount * sizeof(Vertex) > size
+				|| record.indexOffset + (uint64_t)record.indexCount * sizeof(GLuint) > size
+				|| record.lodOffset + (uint64_t)record.lodCount * sizeof(MeshLod) > size)
+				return false;
+
+			CachedMesh& mesh = cachedMeshes[i];
+			mesh.vertices = (const Vertex*)(data + record.vertexOffset);
+			mesh.vertexCount = record.vertexCount;
+			mesh.indices = (const GLuint*)(data + record.indexOffset);
+			mesh.indexCount = record.indexCount;
+			mesh.material.ambient = glm::vec3(record.ambient[0], record.ambient[1], record.ambient[2]);
+			mesh.material.diffuse = glm::vec3(record.diffuse[0], record.diffuse[1], record.diffuse[2]);
+			mesh.material.specular = glm::vec3(record.specular[0], record.specular[1], record.specular[2]);
+
+			mesh.lods.resize(record.lodCount);
+			if (record.lodCount > 0)
+				std::memcpy(mesh.lods.data(), data + record.lodOffset, record.lodCount * sizeof(MeshLod));
+			for (uint32_t l = 0; l < record.lodCount; l++) {
+				if ((uint64_t)mesh.lods[l].indexOffset + mesh.lods[l].indexCount > record.indexCount)
+					return false;
+			}
+
+			uint64_t offset = record.textureOffset;
+			mesh.textures.resize(record.textureCount);
+			for (uint32_t t = 0; t < record.textureCount; t++) {
+				if (!readString(data, size, offset, mesh.textures[t].type) || !readString(data, size, offset, mesh.textures[t].path))
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+	void MeshCache::close() {
+		cachedMeshes.clear();
+		file.close();
+	}
+
+	size_t MeshCache::meshCount() const {
+		return cachedMeshes.size();
+	}
+
+	CachedMesh MeshCache::getMesh(size_t index) const {
+		return cachedMeshes[index];
+	}
+
+}
@@ -0,0 +1,57 @@
+#ifndef MeshCache_hpp
+#define MeshCache_hpp
+
+#include "Mesh.hpp"
+#include "FileUtils.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // View of one mesh stored in a cache file - the arrays point into the mapped file
+    struct CachedMesh
+    {
+        const Vertex* vertices;
+        GLuint vertexCount;
+        const GLuint* indices;
+        GLuint indexCount;
+        Material material;
+        std::vector<TextureReference> textures;
+        std::vector<MeshLod> lods;
+    };
+
+    // Binary cache of the processed geometry of a model, stored next to the .obj file.
+    // The material libraries the .obj refers to are stamped in the file as well.
+    // The cache is memory mapped so that the vertex and index ranges can be given to
+    // glBufferData without being parsed or copied first.
+    class MeshCache
+    {
+    public:
+        // Path of the cache file that belongs to a model
+        static std::string cachePath(const std::string& modelFileName);
+
+        // Writes a new cache file for the given meshes - materialDirectory is where the
+        // material libraries of the source file are read from
+        static bool write(const std::string& cacheFileName, const std::string& sourceFileName,
+                          const std::string& materialDirectory, uint64_t settingsHash, const std::vector<MeshData>& meshes);
+
+        // Maps the cache file, returns false if it is missing, broken or out of date
+        // with respect to the source file, its material libraries or the load settings
+        bool open(const std::string& cacheFileName, const std::string& sourceFileName, uint64_t settingsHash);
+        void close();
+
+        size_t meshCount() const;
+        CachedMesh getMesh(size_t index) const;
+
+    private:
+        MappedFile file;
+        std::vector<CachedMesh> cachedMeshes;
+
+        bool readMeshes();
+    };
+
+}
+
+#endif /* MeshCache_hpp */
@@ -0,0 +1,704 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+#include "glm/geometric.hpp"
+
+namespace gps {
+
+	namespace {
+
+		// Hash key of a vertex - every attribute component either as its exact bit pattern
+		// or as the index of the epsilon sized grid cell it falls into
+		struct VertexKey
+		{
+			int64_t components[8];
+
+			bool operator==(const VertexKey& other) const {
+				return std::memcmp(components, other.components, sizeof(components)) == 0;
+			}
+		};
+
+		struct VertexKeyHash
+		{
+			size_t operator()(const VertexKey& key) const {
+				// FNV-1a over the key components
+				uint64_t hash = 14695981039346656037ULL;
+				for (int i = 0; i < 8; i++) {
+					hash ^= (uint64_t)key.components[i];
+					hash *= 1099511628211ULL;
+				}
+				return (size_t)(hash ^ (hash >> 32));
+			}
+		};
+
+		int64_t quantizeComponent(float value, float epsilon) {
+			if (epsilon > 0.0f)
+				return (int64_t)std::floor(value / epsilon + 0.5f);
+
+			// +0.0 and -0.0 must end up in the same bucket
+			if (value == 0.0f)
+				return 0;
+
+			uint32_t bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+			return bits;
+		}
+
+		VertexKey makeKey(const Vertex& vertex, float epsilon) {
+			VertexKey key;
+			key.components[0] = quantizeComponent(vertex.Position.x, epsilon);
+			key.components[1] = quantizeComponent(vertex.Position.y, epsilon);
+			key.components[2] = quantizeComponent(vertex.Position.z, epsilon);
+			key.components[3] = quantizeComponent(vertex.Normal.x, epsilon);
+			key.components[4] = quantizeComponent(vertex.Normal.y, epsilon);
+			key.components[5] = quantizeComponent(vertex.Normal.z, epsilon);
+			key.components[6] = quantizeComponent(vertex.TexCoords.x, epsilon);
+			key.components[7] = quantizeComponent(vertex.TexCoords.y, epsilon);
+			return key;
+		}
+
+		// FIFO cache simulated with timestamps - a vertex is in the cache if fewer than cacheSize
+		// vertices were added after it. Returns true on a cache miss.
+		bool touchVertex(GLuint vertex, std::vector<unsigned>& cacheTime, unsigned& timestamp, unsigned cacheSize) {
+			if (timestamp - cacheTime[vertex] <= cacheSize)
+				return false;
+			cacheTime[vertex] = timestamp++;
+			return true;
+		}
+
+		// Tipsify: next vertex to fan around - the candidate that stays longest in the cache
+		// after its remaining triangles are emitted, or a dead-end vertex if none qualifies
+		int nextFanningVertex(const std::vector<GLuint>& candidates, const std::vector<unsigned>& cacheTime,
+		                      unsigned timestamp, const std::vector<unsigned>& liveTriangles, unsigned cacheSize) {
+			int best = -1;
+			int bestPriority = -1;
+			for (size_t i = 0; i < candidates.size(); i++) {
+				GLuint vertex = candidates[i];
+				if (liveTriangles[vertex] == 0)
+					continue;
+
+				int priority = 0;
+				if (timestamp - cacheTime[vertex] + 2 * liveTriangles[vertex] <= cacheSize)
+					priority = (int)(timestamp - cacheTime[vertex]);
+				if (priority > bestPriority) {
+					bestPriority = priority;
+					best = (int)vertex;
+				}
+			}
+			return best;
+		}
+
+		int skipDeadEnd(std::vector<GLuint>& deadEnds, const std::vector<unsigned>& liveTriangles, size_t& cursor) {
+			while (!deadEnds.empty()) {
+				GLuint vertex = deadEnds.back();
+				deadEnds.pop_back();
+				if (liveTriangles[vertex] > 0)
+					return (int)vertex;
+			}
+			for (; cursor < liveTriangles.size(); cursor++) {
+				if (liveTriangles[cursor] > 0)
+					return (int)cursor;
+			}
+			return -1;
+		}
+
+		struct OverdrawCluster
+		{
+			size_t start;
+			size_t end;
+			float sortKey;
+		};
+
+		// Symmetric 4x4 matrix giving the weighted sum of the squared distances to a set of planes,
+		// with the sum of the weights to turn it into a mean
+		struct Quadric
+		{
+			double a00, a01, a02, a03;
+			double a11, a12, a13;
+			double a22, a23;
+			double a33;
+			double weight;
+		};
+
+		Quadric planeQuadric(const glm::vec3& normal, float distance, float weight) {
+			double a = normal.x, b = normal.y, c = normal.z, d = distance;
+			Quadric q;
+			q.a00 = weight * a * a; q.a01 = weight * a * b; q.a02 = weight * a * c; q.a03 = weight * a * d;
+			q.a11 = weight * b * b; q.a12 = weight * b * c; q.a13 = weight * b * d;
+			q.a22 = weight * c * c; q.a23 = weight * c * d;
+			q.a33 = weight * d * d;
+			q.weight = weight;
+			return q;
+		}
+
+		void addQuadric(Quadric& q, const Quadric& other) {
+			q.a00 += other.a00; q.a01 += other.a01; q.a02 += other.a02; q.a03 += other.a03;
+			q.a11 += other.a11; q.a12 += other.a12; q.a13 += other.a13;
+			q.a22 += other.a22; q.a23 += other.a23;
+			q.a33 += other.a33;
+			q.weight += other.weight;
+		}
+
+		// Mean squared distance from p to the planes - the area weights cancel out, so its square
+		// root is a distance in model units whatever the size of the triangles. The mean is never
+		// above the largest distance, so it rules out the collapses that are too far cheaply.
+		double evaluateQuadric(const Quadric& q, const glm::vec3& p) {
+			if (q.weight <= 0.0)
+				return 0.0;
+			double x = p.x, y = p.y, z = p.z;
+			double result = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z + q.a33
+				+ 2.0 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z + q.a03 * x + q.a13 * y + q.a23 * z);
+			return result > 0.0 ? result / q.weight : 0.0;
+		}
+
+		// Largest distance from p to the planes of the faces of a and b
+		double maxPlaneDistance(const std::vector<glm::dvec4>& planes, const std::vector<GLuint>& a, const std::vector<GLuint>& b,
+		                        const glm::vec3& p) {
+			glm::dvec4 point(p, 1.0);
+			double distance = 0.0;
+			for (size_t i = 0; i < a.size(); i++)
+				distance = std::max(distance, std::fabs(glm::dot(planes[a[i]], point)));
+			for (size_t i = 0; i < b.size(); i++)
+				distance = std::max(distance, std::fabs(glm::dot(planes[b[i]], point)));
+			return distance;
+		}
+
+		struct EdgeCollapse
+		{
+			GLuint from;
+			GLuint to;
+			double error;
+
+			bool operator<(const EdgeCollapse& other) const {
+				return error < other.error;
+			}
+		};
+
+		bool sameTextures(const std::vector<TextureReference>& a, const std::vector<TextureReference>& b) {
+			if (a.size() != b.size())
+				return false;
+			for (size_t i = 0; i < a.size(); i++) {
+				if (a[i].type != b[i].type || a[i].path != b[i].path)
+					return false;
+			}
+			return true;
+		}
+
+		bool sameMaterial(const MeshData& a, const MeshData& b) {
+			return a.material.ambient == b.material.ambient
+				&& a.material.diffuse == b.material.diffuse
+				&& a.material.specular == b.material.specular
+				&& sameTextures(a.textures, b.textures);
+		}
+	}
+
+	size_t weldVertices(std::vector<Vertex>& vertices, std::vector<GLuint>& indices, float epsilon) {
+		std::unordered_map<VertexKey, GLuint, VertexKeyHash> uniqueVertices;
+		uniqueVertices.reserve(vertices.size());
+
+		// remap[i] - new position of the old vertex i
+		std::vector<GLuint> remap(vertices.size());
+		std::vector<Vertex> welded;
+		welded.reserve(vertices.size());
+
+		for (size_t i = 0; i < vertices.size(); i++) {
+			VertexKey key = makeKey(vertices[i], epsilon);
+			auto it = uniqueVertices.find(key);
+			if (it != uniqueVertices.end()) {
+				remap[i] = it->second;
+			}
+			else {
+				GLuint newIndex = (GLuint)welded.size();
+				uniqueVertices.emplace(key, newIndex);
+				welded.push_back(vertices[i]);
+				remap[i] = newIndex;
+			}
+		}
+
+		for (size_t i = 0; i < indices.size(); i++)
+			indices[i] = remap[indices[i]];
+
+		vertices.swap(welded);
+		return vertices.size();
+	}
+
+	size_t mergeMeshesByMaterial(std::vector<MeshData>& meshes) {
+		std::vector<MeshData> merged;
+
+		for (size_t i = 0; i < meshes.size(); i++) {
+			// a model only has a handful of distinct materials, a linear search is enough
+			size_t target = 0;
+			while (target < merged.size() && !sameMaterial(merged[target], meshes[i]))
+				target++;
+
+			if (target == merged.size()) {
+				merged.push_back(MeshData());
+				merged.back().vertices.swap(meshes[i].vertices);
+				merged.back().indices.swap(meshes[i].indices);
+				merged.back().material = meshes[i].material;
+				merged.back().textures = meshes[i].textures;
+				continue;
+			}
+
+			MeshData& mesh = merged[target];
+			GLuint baseVertex = (GLuint)mesh.vertices.size();
+			mesh.vertices.insert(mesh.vertices.end(), meshes[i].vertices.begin(), meshes[i].vertices.end());
+			mesh.indices.reserve(mesh.indices.size() + meshes[i].indices.size());
+			for (size_t j = 0; j < meshes[i].indices.size(); j++)
+				mesh.indices.push_back(baseVertex + meshes[i].indices[j]);
+		}
+
+		meshes.swap(merged);
+		return meshes.size();
+	}
+
+	VertexCacheStatistics analyzeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount, unsigned cacheSize) {
+		std::vector<unsigned> cacheTime(vertexCount, 0);
+		std::vector<bool> used(vertexCount, false);
+		unsigned timestamp = cacheSize + 1;
+		size_t misses = 0;
+		size_t usedVertices = 0;
+
+		for (size_t i = 0; i < indices.size(); i++) {
+			if (touchVertex(indices[i], cacheTime, timestamp, cacheSize))
+				misses++;
+			if (!used[indices[i]]) {
+				used[indices[i]] = true;
+				usedVertices++;
+			}
+		}
+
+		VertexCacheStatistics statistics;
+		statistics.acmr = indices.size() < 3 ? 0.0f : (float)misses / (indices.size() / 3);
+		statistics.atvr = usedVertices == 0 ? 0.0f : (float)misses / usedVertices;
+		return statistics;
+	}
+
+	void optimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount, unsigned cacheSize, std::vector<size_t>* clusters) {
+		size_t triangleCount = indices.size() / 3;
+		if (clusters)
+			clusters->clear();
+		if (triangleCount == 0)
+			return;
+
+		// triangles using each vertex
+		std::vector<unsigned> liveTriangles(vertexCount, 0);
+		for (size_t i = 0; i < triangleCount * 3; i++)
+			liveTriangles[indices[i]]++;
+
+		std::vector<size_t> adjacencyOffsets(vertexCount + 1, 0);
+		for (size_t v = 0; v < vertexCount; v++)
+			adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+
+		std::vector<GLuint> adjacency(triangleCount * 3);
+		std::vector<size_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < triangleCount * 3; i++)
+			adjacency[fill[indices[i]]++] = (GLuint)(i / 3);
+
+		std::vector<unsigned> cacheTime(vertexCount, 0);
+		std::vector<bool> emitted(triangleCount, false);
+		std::vector<GLuint> deadEnds;
+		std::vector<GLuint> candidates;
+		std::vector<GLuint> result;
+		result.reserve(triangleCount * 3);
+
+		unsigned timestamp = cacheSize + 1;
+		size_t cursor = 0;
+		int fanningVertex = skipDeadEnd(deadEnds, liveTriangles, cursor);
+
+		if (clusters)
+			clusters->push_back(0);
+
+		while (fanningVertex >= 0) {
+			candidates.clear();
+
+			for (size_t a = adjacencyOffsets[fanningVertex]; a < adjacencyOffsets[fanningVertex + 1]; a++) {
+				GLuint triangle = adjacency[a];
+				if (emitted[triangle])
+					continue;
+
+				for (int k = 0; k < 3; k++) {
+					GLuint vertex = indices[triangle * 3 + k];
+					result.push_back(vertex);
+					deadEnds.push_back(vertex);
+					candidates.push_back(vertex);
+					liveTriangles[vertex]--;
+					touchVertex(vertex, cacheTime, timestamp, cacheSize);
+				}
+				emitted[triangle] = true;
+			}
+
+			fanningVertex = nextFanningVertex(candidates, cacheTime, timestamp, liveTriangles, cacheSize);
+			if (fanningVertex < 0) {
+				// no local continuation - the following triangles start a new cluster
+				fanningVertex = skipDeadEnd(deadEnds, liveTriangles, cursor);
+				if (clusters && fanningVertex >= 0 && clusters->back() != result.size())
+					clusters->push_back(result.size());
+			}
+		}
+
+		// a trailing partial triangle, if any, is kept as it was
+		result.insert(result.end(), indices.begin() + triangleCount * 3, indices.end());
+		indices.swap(result);
+	}
+
+	void optimizeOverdraw(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices,
+	                      const std::vector<size_t>& clusters, float threshold, unsigned cacheSize) {
+		size_t indexCount = indices.size() / 3 * 3;
+		if (indexCount == 0)
+			return;
+
+		std::vector<unsigned> cacheTime(vertices.size(), 0);
+		unsigned timestamp = cacheSize + 1;
+		std::vector<OverdrawCluster> sorted;
+
+		// without clusters the whole mesh is a single one
+		std::vector<size_t> hardClusters = clusters.empty() ? std::vector<size_t>(1, 0) : clusters;
+
+		for (size_t c = 0; c < hardClusters.size(); c++) {
+			size_t start = hardClusters[c];
+			size_t end = c + 1 < hardClusters.size() ? hardClusters[c + 1] : indexCount;
+
+			// ACMR of the whole cluster, each cluster starts with an empty cache
+			timestamp += cacheSize + 1;
+			size_t misses = 0;
+			for (size_t i = start; i < end; i++)
+				misses += touchVertex(indices[i], cacheTime, timestamp, cacheSize);
+			float limit = threshold * misses / ((end - start) / 3);
+
+			// split it into smaller clusters as long as each one keeps an ACMR close to the original
+			size_t softStart = start;
+			misses = 0;
+			timestamp += cacheSize + 1;
+			for (size_t i = start; i < end; i += 3) {
+				for (int k = 0; k < 3; k++)
+					misses += touchVertex(indices[i + k], cacheTime, timestamp, cacheSize);
+
+				if (i + 3 < end && (float)misses / ((i + 3 - softStart) / 3) <= limit) {
+					OverdrawCluster cluster = { softStart, i + 3, 0.0f };
+					sorted.push_back(cluster);
+					softStart = i + 3;
+					misses = 0;
+					timestamp += cacheSize + 1;
+				}
+			}
+			OverdrawCluster cluster = { softStart, end, 0.0f };
+			sorted.push_back(cluster);
+		}
+
+		// area weighted centroid of the mesh
+		glm::vec3 meshCentroid(0.0f);
+		float meshArea = 0.0f;
+		for (size_t i = 0; i < indexCount; i += 3) {
+			const glm::vec3& a = vertices[indices[i + 0]].Position;
+			const glm::vec3& b = vertices[indices[i + 1]].Position;
+			const glm::vec3& c = vertices[indices[i + 2]].Position;
+			float area = glm::length(glm::cross(b - a, c - a));
+			meshCentroid += (a + b + c) * (area / 3.0f);
+			meshArea += area;
+		}
+		if (meshArea > 0.0f)
+			meshCentroid /= meshArea;
+
+		// clusters that face away from the centroid are likely to occlude the others
+		for (size_t c = 0; c < sorted.size(); c++) {
+			glm::vec3 centroid(0.0f);
+			glm::vec3 normal(0.0f);
+			float area = 0.0f;
+			for (size_t i = sorted[c].start; i < sorted[c].end; i += 3) {
+				const glm::vec3& a = vertices[indices[i + 0]].Position;
+				const glm::vec3& b = vertices[indices[i + 1]].Position;
+				const glm::vec3& cc = vertices[indices[i + 2]].Position;
+				glm::vec3 weightedNormal = glm::cross(b - a, cc - a);
+				float triangleArea = glm::length(weightedNormal);
+				centroid += (a + b + cc) * (triangleArea / 3.0f);
+				normal += weightedNormal;
+				area += triangleArea;
+			}
+
+			float normalLength = glm::length(normal);
+			if (area > 0.0f && normalLength > 0.0f)
+				sorted[c].sortKey = glm::dot(centroid / area - meshCentroid, normal / normalLength);
+		}
+
+		std::stable_sort(sorted.begin(), sorted.end(), [](const OverdrawCluster& a, const OverdrawCluster& b) {
+			return a.sortKey > b.sortKey;
+		});
+
+		std::vector<GLuint> result;
+		result.reserve(indices.size());
+		for (size_t c = 0; c < sorted.size(); c++)
+			result.insert(result.end(), indices.begin() + sorted[c].start, indices.begin() + sorted[c].end);
+		result.insert(result.end(), indices.begin() + indexCount, indices.end());
+		indices.swap(result);
+	}
+
+	void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices) {
+		const GLuint unused = ~0u;
+		std::vector<GLuint> remap(vertices.size(), unused);
+		std::vector<Vertex> sorted;
+		sorted.reserve(vertices.size());
+
+		for (size_t i = 0; i < indices.size(); i++) {
+			GLuint& newIndex = remap[indices[i]];
+			if (newIndex == unused) {
+				newIndex = (GLuint)sorted.size();
+				sorted.push_back(vertices[indices[i]]);
+			}
+			indices[i] = newIndex;
+		}
+
+		vertices.swap(sorted);
+	}
+
+	std::vector<GLuint> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+	                                 size_t targetIndexCount, float targetError, float* resultError) {
+		std::vector<GLuint> result(indices.begin(), indices.begin() + indices.size() / 3 * 3);
+		size_t vertexCount = vertices.size();
+		if (resultError)
+			*resultError = 0.0f;
+		if (vertexCount == 0 || result.size() <= targetIndexCount)
+			return result;
+
+		// the topology is built on positions - vertices that only differ in their normal or
+		// texture coordinates (seams) move together. positionGroup links them in a circular list.
+		std::vector<GLuint> positionRep(vertexCount);
+		std::vector<GLuint> positionGroup(vertexCount);
+		{
+			std::unordered_map<VertexKey, GLuint, VertexKeyHash> positions;
+			positions.reserve(vertexCount);
+			for (size_t v = 0; v < vertexCount; v++) {
+				Vertex positionOnly = vertices[v];
+				positionOnly.Normal = glm::vec3(0.0f);
+				positionOnly.TexCoords = glm::vec2(0.0f);
+				auto it = positions.emplace(makeKey(positionOnly, 0.0f), (GLuint)v).first;
+				GLuint rep = it->second;
+				positionRep[v] = rep;
+				if (rep == v) {
+					positionGroup[v] = (GLuint)v;
+				}
+				else {
+					positionGroup[v] = positionGroup[rep];
+					positionGroup[rep] = (GLuint)v;
+				}
+			}
+		}
+
+		glm::vec3 minimum = vertices[0].Position;
+		glm::vec3 maximum = vertices[0].Position;
+		for (size_t v = 1; v < vertexCount; v++) {
+			minimum = glm::min(minimum, vertices[v].Position);
+			maximum = glm::max(maximum, vertices[v].Position);
+		}
+		glm::vec3 size = maximum - minimum;
+		double extent = std::max(size.x, std::max(size.y, size.z));
+		double errorLimit = targetError * extent;
+
+		// area weighted plane quadrics of the faces around each position, and the original faces
+		// that each position stands for - a collapsed position takes over those of the other one
+		Quadric zero = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+		std::vector<Quadric> quadrics(vertexCount, zero);
+		std::vector<glm::dvec4> facePlanes;
+		std::vector<std::vector<GLuint> > positionFaces(vertexCount);
+		for (size_t i = 0; i < result.size(); i += 3) {
+			const glm::vec3& a = vertices[result[i + 0]].Position;
+			const glm::vec3& b = vertices[result[i + 1]].Position;
+			const glm::vec3& c = vertices[result[i + 2]].Position;
+			glm::vec3 normal = glm::cross(b - a, c - a);
+			float area = glm::length(normal);
+			if (area == 0.0f)
+				continue;
+			normal /= area;
+			Quadric q = planeQuadric(normal, -glm::dot(normal, a), area);
+			for (int k = 0; k < 3; k++) {
+				addQuadric(quadrics[positionRep[result[i + k]]], q);
+				positionFaces[positionRep[result[i + k]]].push_back((GLuint)facePlanes.size());
+			}
+			// in double, so that the distances scale exactly with the mesh
+			glm::dvec3 planeNormal = glm::normalize(glm::cross(glm::dvec3(b) - glm::dvec3(a), glm::dvec3(c) - glm::dvec3(a)));
+			facePlanes.push_back(glm::dvec4(planeNormal, -glm::dot(planeNormal, glm::dvec3(a))));
+		}
+
+		// positions on an edge used by a single face are on an open border and stay where they are
+		std::vector<bool> locked(vertexCount, false);
+		{
+			std::unordered_map<uint64_t, unsigned> edges;
+			edges.reserve(result.size());
+			for (size_t i = 0; i < result.size(); i += 3) {
+				for (int k = 0; k < 3; k++) {
+					GLuint a = positionRep[result[i + k]];
+					GLuint b = positionRep[result[i + (k + 1) % 3]];
+					if (a > b)
+						std::swap(a, b);
+					edges[((uint64_t)a << 32) | b]++;
+				}
+			}
+			for (auto it = edges.begin(); it != edges.end(); ++it) {
+				if (it->second == 1) {
+					locked[(GLuint)(it->first >> 32)] = true;
+					locked[(GLuint)(it->first & 0xffffffffu)] = true;
+				}
+			}
+		}
+
+		double maxError = 0.0;
+		std::vector<EdgeCollapse> collapses;
+		std::vector<size_t> adjacencyOffsets(vertexCount + 1);
+		std::vector<GLuint> adjacency;
+		std::vector<GLuint> collapseTarget(vertexCount);
+		std::vector<bool> touched(vertexCount);
+
+		while (result.size() > targetIndexCount) {
+			size_t triangleCount = result.size() / 3;
+
+			// faces around each position
+			std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+			for (size_t i = 0; i < result.size(); i++)
+				adjacencyOffsets[positionRep[result[i]] + 1]++;
+			for (size_t v = 0; v < vertexCount; v++)
+				adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+			adjacency.resize(result.size());
+			{
+				std::vector<size_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+				for (size_t i = 0; i < result.size(); i++)
+					adjacency[fill[positionRep[result[i]]]++] = (GLuint)(i / 3);
+			}
+
+			// every directed edge is a candidate, cheapest first
+			collapses.clear();
+			for (size_t i = 0; i < result.size(); i += 3) {
+				for (int k = 0; k < 3; k++) {
+					GLuint a = positionRep[result[i + k]];
+					GLuint b = positionRep[result[i + (k + 1) % 3]];
+					if (a == b)
+						continue;
+					for (int direction = 0; direction < 2; direction++) {
+						// the error is the largest distance to the original faces of both positions
+						if (!locked[a]) {
+							Quadric q = quadrics[a];
+							addQuadric(q, quadrics[b]);
+							const glm::vec3& position = vertices[b].Position;
+							if (evaluateQuadric(q, position) <= errorLimit * errorLimit) {
+								EdgeCollapse collapse = { a, b, maxPlaneDistance(facePlanes, positionFaces[a], positionFaces[b], position) };
+								if (collapse.error <= errorLimit)
+									collapses.push_back(collapse);
+							}
+						}
+						std::swap(a, b);
+					}
+				}
+			}
+			std::sort(collapses.begin(), collapses.end());
+
+			// apply as many independent collapses as possible - the faces around a collapsed
+			// position are frozen for the rest of the pass so that the flip test stays valid
+			for (size_t v = 0; v < vertexCount; v++)
+				collapseTarget[v] = (GLuint)v;
+			std::fill(touched.begin(), touched.end(), false);
+
+			size_t removableTriangles = triangleCount - targetIndexCount / 3;
+			size_t removedTriangles = 0;
+			size_t applied = 0;
+
+			for (size_t c = 0; c < collapses.size() && removedTriangles < removableTriangles; c++) {
+				const EdgeCollapse& collapse = collapses[c];
+				if (touched[collapse.from] || touched[collapse.to])
+					continue;
+
+				// reject collapses that would turn a face over
+				bool flips = false;
+				size_t removes = 0;
+				for (size_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1] && !flips; a++) {
+					GLuint triangle = adjacency[a];
+					glm::vec3 before[3];
+					glm::vec3 after[3];
+					bool degenerate = false;
+					for (int k = 0; k < 3; k++) {
+						GLuint rep = positionRep[result[triangle * 3 + k]];
+						before[k] = vertices[rep].Position;
+						after[k] = rep == collapse.from ? vertices[collapse.to].Position : before[k];
+						degenerate = degenerate || rep == collapse.to;
+					}
+					if (degenerate) {
+						removes++;
+						continue;
+					}
+					glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+					glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+					flips = glm::dot(normalBefore, normalAfter) <= 0.0f;
+				}
+				if (flips)
+					continue;
+
+				for (size_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1]; a++) {
+					GLuint triangle = adjacency[a];
+					for (int k = 0; k < 3; k++)
+						touched[positionRep[result[triangle * 3 + k]]] = true;
+				}
+
+				collapseTarget[collapse.from] = collapse.to;
+				addQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+				std::vector<GLuint>& faces = positionFaces[collapse.to];
+				faces.insert(faces.end(), positionFaces[collapse.from].begin(), positionFaces[collapse.from].end());
+				std::sort(faces.begin(), faces.end());
+				faces.erase(std::unique(faces.begin(), faces.end()), faces.end());
+				std::vector<GLuint>().swap(positionFaces[collapse.from]);
+				maxError = std::max(maxError, collapse.error);
+				removedTriangles += removes;
+				applied++;
+			}
+
+			if (applied == 0)
+				break;
+
+			// every vertex of a collapsed position moves to the vertex of the target position
+			// with the closest normal and texture coordinates, so seams are preserved
+			std::vector<GLuint> vertexRemap(vertexCount);
+			for (size_t v = 0; v < vertexCount; v++) {
+				GLuint target = collapseTarget[positionRep[v]];
+				if (target == positionRep[v]) {
+					vertexRemap[v] = (GLuint)v;
+					continue;
+				}
+
+				GLuint best = target;
+				float bestDistance = -1.0f;
+				GLuint candidate = target;
+				do {
+					glm::vec3 normalDelta = vertices[candidate].Normal - vertices[v].Normal;
+					glm::vec2 texCoordDelta = vertices[candidate].TexCoords - vertices[v].TexCoords;
+					float distance = glm::dot(normalDelta, normalDelta) + glm::dot(texCoordDelta, texCoordDelta);
+					if (bestDistance < 0.0f || distance < bestDistance) {
+						bestDistance = distance;
+						best = candidate;
+					}
+					candidate = positionGroup[candidate];
+				} while (candidate != target);
+				vertexRemap[v] = best;
+			}
+
+			size_t write = 0;
+			for (size_t i = 0; i < result.size(); i += 3) {
+				GLuint a = vertexRemap[result[i + 0]];
+				GLuint b = vertexRemap[result[i + 1]];
+				GLuint c = vertexRemap[result[i + 2]];
+				if (positionRep[a] == positionRep[b] || positionRep[b] == positionRep[c] || positionRep[a] == positionRep[c])
+					continue;
+				result[write++] = a;
+				result[write++] = b;
+				result[write++] = c;
+			}
+			result.resize(write);
+		}
+
+		if (resultError)
+			*resultError = (float)maxError;
+		return result;
+	}
+
+}
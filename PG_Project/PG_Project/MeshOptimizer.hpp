@@ -0,0 +1,64 @@
+#ifndef MeshOptimizer_hpp
+#define MeshOptimizer_hpp
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Post-transform vertex cache size assumed by the optimizer and the statistics
+    const unsigned VERTEX_CACHE_SIZE = 16;
+
+    struct VertexCacheStatistics
+    {
+        // average cache miss ratio - vertex shader runs per triangle (0.5 .. 3, lower is better)
+        float acmr;
+        // average transformed vertex ratio - vertex shader runs per vertex (1 is optimal)
+        float atvr;
+    };
+
+    // Merges vertices with identical position, normal and texture coordinates and
+    // rewrites the index buffer so that it references the unique vertices only.
+    // With epsilon > 0 the attributes are snapped to a grid of that size before comparing.
+    // Returns the number of unique vertices left.
+    size_t weldVertices(std::vector<Vertex>& vertices, std::vector<GLuint>& indices, float epsilon = 0.0f);
+
+    // Concatenates the meshes that use the same material (same colors and the same texture
+    // paths, whatever the material is called) so that each material is drawn with a single call.
+    // The merged meshes keep the order in which their materials first appear.
+    // Returns the number of meshes left.
+    size_t mergeMeshesByMaterial(std::vector<MeshData>& meshes);
+
+    // Simulates a FIFO post-transform cache of the given size over the triangle list
+    VertexCacheStatistics analyzeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount,
+                                             unsigned cacheSize = VERTEX_CACHE_SIZE);
+
+    // Reorders the triangles for vertex cache locality (Tipsify, Sander et al. 2007).
+    // If clusters is given it receives the first index of every run of triangles that starts
+    // after a jump to a non-local vertex - the input expected by optimizeOverdraw.
+    void optimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount,
+                             unsigned cacheSize = VERTEX_CACHE_SIZE, std::vector<size_t>* clusters = NULL);
+
+    // Reorders the clusters produced by optimizeVertexCache so that the ones facing away from the
+    // center of the mesh are drawn first and occlude the rest. Clusters are split further as long as
+    // the ACMR stays below threshold times the original one.
+    void optimizeOverdraw(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices,
+                          const std::vector<size_t>& clusters, float threshold = 1.05f,
+                          unsigned cacheSize = VERTEX_CACHE_SIZE);
+
+    // Sorts the vertices in the order in which they are first referenced and drops unused ones
+    void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices);
+
+    // Quadric error simplification (Garland & Heckbert) by collapsing edges onto existing vertices,
+    // so the result indexes the same vertex buffer. Vertices on open borders are never moved.
+    // Stops at targetIndexCount or when the next collapse would move the surface further than
+    // targetError (relative to the size of the mesh). resultError receives the largest error of the
+    // collapses made - the largest distance from a collapsed position to the planes of the original
+    // faces it stands for, in model units (scaling the mesh by s scales it by s).
+    std::vector<GLuint> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+                                     size_t targetIndexCount, float targetError, float* resultError = NULL);
+
+}
+
+#endif /* MeshOptimizer_hpp */
@@ -1,27 +1,399 @@
 #include "Model3D.hpp"
+#include "GLState.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshCache.hpp"
+#include "ObjParser.hpp"
+#include "ThreadPool.hpp"
+#include "UploadQueue.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_set>
 
 namespace gps {
 
-	void Model3D::LoadModel(std::string fileName)
+	namespace {
+
+		// Fingerprint of the settings that change the processed geometry - a cache built
+		// with different settings must not be reused
+		uint64_t hashLoadOptions(const ModelLoadOptions& options) {
+			uint64_t hash = hashBytes(&options.weldVertices, sizeof(options.weldVertices));
+			hash = hashBytes(&options.weldEpsilon, sizeof(options.weldEpsilon), hash);
+			hash = hashBytes(&options.mergeByMaterial, sizeof(options.mergeByMaterial), hash);
+			hash = hashBytes(&options.optimizeMeshes, sizeof(options.optimizeMeshes), hash);
+			hash = hashBytes(&options.generateLods, sizeof(options.generateLods), hash);
+			return hash;
+		}
+
+		// Texture of a model - already resident, or decoded and waiting to be uploaded
+		struct PendingTexture
+		{
+			std::string path;
+			std::string type;
+			std::shared_ptr<TextureHandle> handle;
+			TextureImage image;
+		};
+
+		// Collects the textures referenced by all the meshes first, so that the ones that are not
+		// loaded yet can be decoded together on the thread pool
+		std::vector<PendingTexture> prepareTextures(const std::string& basePath, const std::vector<TextureReference>& references) {
+			std::vector<PendingTexture> textures;
+			std::unordered_set<std::string> seen;
+			std::vector<std::string> decodePaths;
+			std::vector<size_t> decodeTargets;
+
+			for (size_t i = 0; i < references.size(); i++) {
+				std::string path = basePath + references[i].path;
+				if (!seen.insert(path).second)
+					continue;
+
+				PendingTexture texture;
+				texture.path = path;
+				texture.type = references[i].type;
+				texture.handle = TextureCache::global().find(path);
+				texture.image.width = 0;
+				texture.image.height = 0;
+				if (!texture.handle) {
+					decodePaths.push_back(path);
+					decodeTargets.push_back(textures.size());
+				}
+				textures.push_back(texture);
+			}
+
+			std::vector<TextureImage> images;
+			TextureCache::global().decodeImages(decodePaths, images);
+			for (size_t i = 0; i < images.size(); i++)
+				textures[decodeTargets[i]].image = images[i];
+
+			return textures;
+		}
+
+		// Appends up to MAX_LODS - 1 simplified versions of the mesh to its index buffer, each one with
+		// about half the triangles of the previous one. Stops early once simplifying stops paying off.
+		void generateLods(MeshData& mesh) {
+			const size_t MAX_LODS = 4;
+			// relative to the size of the mesh
+			const float MAX_LOD_ERROR = 0.05f;
+
+			MeshLod full = { 0, (GLuint)mesh.indices.size(), 0.0f };
+			mesh.lods.clear();
+			mesh.lods.push_back(full);
+
+			std::vector<GLuint> previous = mesh.indices;
+			while (mesh.lods.size() < MAX_LODS) {
+				float error;
+				std::vector<GLuint> simplified = simplifyMesh(mesh.vertices, previous, previous.size() / 2, MAX_LOD_ERROR, &error);
+				if (simplified.empty() || simplified.size() > previous.size() * 9 / 10)
+					break;
+
+				optimizeVertexCache(simplified, mesh.vertices.size());
+
+				// errors of successive levels add up, the chain is simplified from the previous level
+				MeshLod lod = { (GLuint)mesh.indices.size(), (GLuint)simplified.size(), mesh.lods.back().error + error };
+				mesh.lods.push_back(lod);
+				mesh.indices.insert(mesh.indices.end(), simplified.begin(), simplified.end());
+				previous.swap(simplified);
+			}
+		}
+
+		// Mesh of the mesh cache, uploaded from the mapped file unless a copy has to be kept
+		gps::Mesh createMesh(const CachedMesh& cachedMesh, const std::vector<gps::Texture>& textures, VertexFormat format,
+		                     const BoundingBox& grid, bool keepGeometry) {
+			if (keepGeometry) {
+				return gps::Mesh(std::vector<Vertex>(cachedMesh.vertices, cachedMesh.vertices + cachedMesh.vertexCount),
+					std::vector<GLuint>(cachedMesh.indices, cachedMesh.indices + cachedMesh.indexCount), textures, format, cachedMesh.lods, &grid);
+			}
+			return gps::Mesh(cachedMesh.vertices, cachedMesh.vertexCount, cachedMesh.indices, cachedMesh.indexCount, textures, format, cachedMesh.lods, &grid);
+		}
+
+		void growBounds(const Vertex* vertices, size_t count, BoundingBox& bounds, bool& empty) {
+			for (size_t i = 0; i < count; i++) {
+				bounds.minimum = empty ? vertices[i].Position : glm::min(bounds.minimum, vertices[i].Position);
+				bounds.maximum = empty ? vertices[i].Position : glm::max(bounds.maximum, vertices[i].Position);
+				empty = false;
+			}
+		}
+
+		// Picks the vertex format of the model and the grid its compact positions are quantized against -
+		// the bounds of the whole model, so that the meshes agree on the positions they share (no cracks
+		// along their seams). Falls back to float positions when half a step of the grid is above the
+		// allowed error.
+		VertexFormat selectVertexFormat(const ModelLoadOptions& options, const MeshCache& cache, const std::vector<MeshData>& meshData,
+		                                bool fromCache, BoundingBox& grid) {
+			grid.minimum = grid.maximum = glm::vec3(0.0f);
+			if (!options.compactVertices)
+				return VERTEX_FORMAT_FLOAT;
+
+			bool empty = true;
+			size_t meshCount = fromCache ? cache.meshCount() : meshData.size();
+			for (size_t i = 0; i < meshCount; i++) {
+				if (fromCache) {
+					CachedMesh cachedMesh = cache.getMesh(i);
+					growBounds(cachedMesh.vertices, cachedMesh.vertexCount, grid, empty);
+				}
+				else {
+					growBounds(meshData[i].vertices.data(), meshData[i].vertices.size(), grid, empty);
+				}
+			}
+
+			glm::vec3 size = grid.maximum - grid.minimum;
+			float error = std::max(size.x, std::max(size.y, size.z)) / 65535.0f * 0.5f;
+			if (error > options.maxQuantizationError) {
+				std::cout << "Model of size " << size.x << " x " << size.y << " x " << size.z
+					<< " is too large for 16 bit positions, keeping floats" << std::endl;
+				return VERTEX_FORMAT_FLOAT;
+			}
+			return VERTEX_FORMAT_COMPACT;
+		}
+	}
+
+	void Model3D::LoadModel(std::string fileName, ModelLoadOptions options)
 	{
         std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
-		ReadOBJ(fileName, basePath);
+		LoadModel(fileName, basePath, options);
+	}
+
+    void Model3D::LoadModel(std::string fileName, std::string basePath, ModelLoadOptions options)
+	{
+		MeshCache cache;
+		std::vector<MeshData> meshData;
+		bool fromCache;
+		failed = false;
+		if (!ReadMeshData(fileName, basePath, options, cache, meshData, fromCache)) {
+			failed = true;
+			return;
+		}
+		BoundingBox grid;
+		VertexFormat format = selectVertexFormat(options, cache, meshData, fromCache, grid);
+		size_t meshCount = fromCache ? cache.meshCount() : meshData.size();
+
+		// decode all the textures at once, then upload them
+		std::vector<TextureReference> references;
+		for (size_t i = 0; i < meshCount; i++) {
+			const std::vector<TextureReference>& meshReferences = fromCache ? cache.getMesh(i).textures : meshData[i].textures;
+			references.insert(references.end(), meshReferences.begin(), meshReferences.end());
+		}
+		std::vector<PendingTexture> textures = prepareTextures(basePath, references);
+		for (size_t i = 0; i < textures.size(); i++) {
+			PendingTexture& texture = textures[i];
+			AddTexture(texture.path, texture.type, texture.handle ? texture.handle : TextureCache::global().insert(texture.path, texture.image));
+		}
+
+		if (fromCache) {
+			// the geometry goes from the mapped file straight into the buffer objects
+			for (size_t i = 0; i < cache.meshCount(); i++) {
+				CachedMesh cachedMesh = cache.getMesh(i);
+				std::vector<gps::Texture> textures = LoadTextures(basePath, cachedMesh.textures);
+				meshes.push_back(createMesh(cachedMesh, textures, format, grid, options.keepGeometry));
+			}
+		}
+		else {
+			for (size_t i = 0; i < meshData.size(); i++) {
+				std::vector<gps::Texture> textures = LoadTextures(basePath, meshData[i].textures);
+				meshes.push_back(gps::Mesh(meshData[i].vertices, meshData[i].indices, textures, format, meshData[i].lods, &grid));
+			}
+		}
+
+		loaded = true;
+	}
+
+	std::future<void> Model3D::LoadModelAsync(std::string fileName, ModelLoadOptions options)
+	{
+		std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
+		return LoadModelAsync(fileName, basePath, options);
+	}
+
+	std::future<void> Model3D::LoadModelAsync(std::string fileName, std::string basePath, ModelLoadOptions options)
+	{
+		loaded = false;
+		failed = false;
+		return ThreadPool::global().submit([this, fileName, basePath, options]() {
+			try {
+				LoadModelWorker(fileName, basePath, options);
+			}
+			catch (...) {
+				UploadQueue::global().push(0, [this]() { failed = true; });
+				throw;
+			}
+		});
+	}
+
+	bool Model3D::isLoaded() const
+	{
+		return loaded;
+	}
+
+	bool Model3D::hasFailed() const
+	{
+		return failed;
+	}
+
+	bool Model3D::ReadMeshData(std::string fileName, std::string basePath, const ModelLoadOptions& options, MeshCache& cache,
+	                           std::vector<MeshData>& meshData, bool& fromCache)
+	{
+		std::string cacheFileName = MeshCache::cachePath(fileName);
+		uint64_t settingsHash = hashLoadOptions(options);
+
+		if (options.useMeshCache && cache.open(cacheFileName, fileName, settingsHash)) {
+			std::cout << "Loading : " << fileName << " (from " << cacheFileName << ")" << std::endl;
+			std::cout << "# of meshes    : " << cache.meshCount() << std::endl;
+			fromCache = true;
+			return true;
+		}
+
+		fromCache = false;
+		if (!ReadOBJ(fileName, basePath, options, meshData))
+			return false;
+
+		if (options.useMeshCache && !MeshCache::write(cacheFileName, fileName, basePath, settingsHash, meshData)) {
+			std::cerr << "WARNING: could not write mesh cache " << cacheFileName << std::endl;
+		}
+		return true;
 	}
 
-    void Model3D::LoadModel(std::string fileName, std::string basePath)
+	void Model3D::LoadModelWorker(std::string fileName, std::string basePath, ModelLoadOptions options)
 	{
-		ReadOBJ(fileName, basePath);
+		// shared with the upload jobs, the mapping / parsed data lives until the last mesh is uploaded
+		std::shared_ptr<MeshCache> cache = std::make_shared<MeshCache>();
+		std::shared_ptr<std::vector<MeshData> > meshData = std::make_shared<std::vector<MeshData> >();
+		bool fromCache;
+		if (!ReadMeshData(fileName, basePath, options, *cache, *meshData, fromCache))
+			throw std::runtime_error("could not load " + fileName);
+		size_t meshCount = fromCache ? cache->meshCount() : meshData->size();
+
+		UploadQueue& uploadQueue = UploadQueue::global();
+		BoundingBox grid;
+		VertexFormat format = selectVertexFormat(options, *cache, *meshData, fromCache, grid);
+
+		// decode every texture once, the textures are queued before the meshes that use them
+		std::vector<TextureReference> references;
+		for (size_t i = 0; i < meshCount; i++) {
+			const std::vector<TextureReference>& meshReferences = fromCache ? cache->getMesh(i).textures : (*meshData)[i].textures;
+			references.insert(references.end(), meshReferences.begin(), meshReferences.end());
+		}
+		std::vector<PendingTexture> textures = prepareTextures(basePath, references);
+		for (size_t i = 0; i < textures.size(); i++) {
+			// a texture that failed to decode is still registered (with id 0), as LoadTexture does
+			PendingTexture texture = textures[i];
+			size_t size = textureMemorySize(texture.image);
+			uploadQueue.push(size, [this, texture]() {
+				AddTexture(texture.path, texture.type, texture.handle ? texture.handle : TextureCache::global().insert(texture.path, texture.image));
+			});
+		}
+
+		for (size_t i = 0; i < meshCount; i++) {
+			size_t size = fromCache
+				? cache->getMesh(i).vertexCount * sizeof(Vertex) + cache->getMesh(i).indexCount * sizeof(GLuint)
+				: (*meshData)[i].vertices.size() * sizeof(Vertex) + (*meshData)[i].indices.size() * sizeof(GLuint);
+
+			bool keepGeometry = options.keepGeometry;
+			uploadQueue.push(size, [this, cache, meshData, fromCache, basePath, format, grid, keepGeometry, i]() {
+				if (fromCache) {
+					CachedMesh cachedMesh = cache->getMesh(i);
+					std::vector<gps::Texture> textures = LoadTextures(basePath, cachedMesh.textures);
+					meshes.push_back(createMesh(cachedMesh, textures, format, grid, keepGeometry));
+				}
+				else {
+					MeshData& data = (*meshData)[i];
+					std::vector<gps::Texture> textures = LoadTextures(basePath, data.textures);
+					meshes.push_back(gps::Mesh(data.vertices, data.indices, textures, format, data.lods, &grid));
+				}
+			});
+		}
+
+		uploadQueue.push(0, [this]() { loaded = true; });
 	}
 
 	// Draw each mesh from the model
-	void Model3D::Draw(gps::Shader shaderProgram)
+	void Model3D::Draw(gps::Shader& shaderProgram, MeshBucket bucket)
+	{
+		// still being streamed in by LoadModelAsync
+		if (!loaded)
+			return;
+
+		for (size_t i = 0; i < meshes.size(); i++) {
+			if (meshes[i].inBucket(bucket))
+				meshes[i].Draw(shaderProgram);
+		}
+	}
+
+	// Draw each mesh from the model at the level of detail that suits its size on screen
+	void Model3D::Draw(gps::Shader& shaderProgram, const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection, MeshBucket bucket)
 	{
-		for (int i = 0; i < meshes.size(); i++)
+		if (!loaded)
+			return;
+
+		glm::mat4 modelView = view * model;
+		cullMeshes(Frustum::fromMatrix(projection * view), model);
+		for (size_t i = 0; i < meshes.size(); i++) {
+			if (!visibility[i] || !meshes[i].inBucket(bucket))
+				continue;
+			meshes[i].selectLod(modelView, projection, lodErrorThreshold);
+			meshes[i].requestTextureLevels(modelView, projection);
 			meshes[i].Draw(shaderProgram);
+		}
+	}
+
+	// Queue the draw of each mesh at the level of detail that suits its size on screen
+	void Model3D::Submit(RenderQueue& queue, RenderPass pass, gps::Shader& opaqueShader, gps::Shader& cutoutShader,
+	                     const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection, const Frustum& frustum)
+	{
+		if (!loaded || meshes.empty())
+			return;
+
+		// nothing is queued for a model that is entirely outside
+		cullMeshes(frustum, model);
+		if (std::find(visibility.begin(), visibility.end(), 1) == visibility.end())
+			return;
+
+		glm::mat4 modelView = view * model;
+		uint32_t transform = queue.addTransform(model);
+		for (size_t i = 0; i < meshes.size(); i++) {
+			if (!visibility[i])
+				continue;
+			gps::Mesh& mesh = meshes[i];
+			mesh.selectLod(modelView, projection, lodErrorThreshold);
+			// only the camera sees the texture levels, the frustum of the other passes is not the camera's
+			if (pass == RENDER_PASS_SCENE)
+				mesh.requestTextureLevels(modelView, projection);
+
+			bool cutout = mesh.isCutout();
+			gps::Shader& shader = cutout ? cutoutShader : opaqueShader;
+			uint64_t key = RenderQueue::makeKey(pass, cutout, shader.shaderProgram, mesh.getTextureSet(),
+				mesh.getVertexArray(), mesh.viewDepth(modelView));
+			queue.submit(key, mesh, shader, transform);
+		}
+	}
+
+	void Model3D::cullMeshes(const Frustum& frustum, const glm::mat4& model)
+	{
+		// the boxes are added once the meshes are all there
+		if (culler.size() != meshes.size()) {
+			culler.clear();
+			for (size_t i = 0; i < meshes.size(); i++)
+				culler.add(meshes[i].getBoundingBox());
+		}
+		culler.cull(frustum.toModelSpace(model), visibility);
+	}
+
+	std::vector<gps::Mesh>& Model3D::getMeshes()
+	{
+		return meshes;
+	}
+
+	void Model3D::releaseGeometry()
+	{
+		for (size_t i = 0; i < meshes.size(); i++)
+			meshes[i].releaseGeometry();
+	}
+
+	void Model3D::setLodErrorThreshold(float threshold)
+	{
+		lodErrorThreshold = threshold;
 	}
 
 	// Does the parsing of the .obj file and fills in the data structure
-	void Model3D::ReadOBJ(std::string fileName, std::string basePath){
+	bool Model3D::ReadOBJ(std::string fileName, std::string basePath, const ModelLoadOptions& options, std::vector<MeshData>& meshData){
 
         std::cout << "Loading : " << fileName << std::endl;
 		tinyobj::attrib_t attrib;
@@ -30,24 +402,39 @@ namespace gps {
 		int materialId;
 
 		std::string err;
-		bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
+		bool ret;
+		if (options.parallelParse)
+			ret = LoadObjParallel(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
+		else
+			ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
 
 		if (!err.empty()) { // `err` may contain warning message.
 			std::cerr << err << std::endl;
 		}
 
 		if (!ret) {
-			exit(1);
+			std::cerr << "ERROR: could not load " << fileName << std::endl;
+			return false;
 		}
 
 		std::cout << "# of shapes    : " << shapes.size() << std::endl;
 		std::cout << "# of materials : " << materials.size() << std::endl;
 
+		size_t totalVerticesBefore = 0;
+		size_t totalVerticesAfter = 0;
+
 		// Loop over shapes
 		for (size_t s = 0; s < shapes.size(); s++) {
-			std::vector<gps::Vertex> vertices;
-			std::vector<GLuint> indices;
-			std::vector<gps::Texture> textures;
+			meshData.push_back(MeshData());
+			std::vector<gps::Vertex>& vertices = meshData.back().vertices;
+			std::vector<GLuint>& indices = meshData.back().indices;
+			std::vector<gps::TextureReference>& textures = meshData.back().textures;
+			meshData.back().material.ambient = glm::vec3(0.0f);
+			meshData.back().material.diffuse = glm::vec3(0.0f);
+			meshData.back().material.specular = glm::vec3(0.0f);
+
+			vertices.reserve(shapes[s].mesh.indices.size());
+			indices.reserve(shapes[s].mesh.indices.size());
 
 			// Loop over faces(polygon)
 			size_t index_offset = 0;
@@ -98,7 +485,7 @@ namespace gps {
 			if (a > 0 && materials.size()>0) {
 				materialId = shapes[s].mesh.material_ids[0];
 				if (materialId != -1) {
-					gps::Material currentMaterial;
+					gps::Material& currentMaterial = meshData.back().material;
 					currentMaterial.ambient = glm::vec3(materials[materialId].ambient[0], materials[materialId].ambient[1], materials[materialId].ambient[2]);
 					currentMaterial.diffuse = glm::vec3(materials[materialId].diffuse[0], materials[materialId].diffuse[1], materials[materialId].diffuse[2]);
 					currentMaterial.specular = glm::vec3(materials[materialId].specular[0], materials[materialId].specular[1], materials[materialId].specular[2]);
@@ -107,8 +494,9 @@ namespace gps {
 					std::string ambientTexturePath = materials[materialId].ambient_texname;
 					if (!ambientTexturePath.empty())
 					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + ambientTexturePath, "ambientTexture");
+						gps::TextureReference currentTexture;
+						currentTexture.type = "ambientTexture";
+						currentTexture.path = ambientTexturePath;
 						textures.push_back(currentTexture);
 					}
 
@@ -116,8 +504,9 @@ namespace gps {
 					std::string diffuseTexturePath = materials[materialId].diffuse_texname;
 					if (!diffuseTexturePath.empty())
 					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + diffuseTexturePath, "diffuseTexture");
+						gps::TextureReference currentTexture;
+						currentTexture.type = "diffuseTexture";
+						currentTexture.path = diffuseTexturePath;
 						textures.push_back(currentTexture);
 					}
 
@@ -125,102 +514,102 @@ namespace gps {
 					std::string specularTexturePath = materials[materialId].specular_texname;
 					if (!specularTexturePath.empty())
 					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + specularTexturePath, "specularTexture");
+						gps::TextureReference currentTexture;
+						currentTexture.type = "specularTexture";
+						currentTexture.path = specularTexturePath;
 						textures.push_back(currentTexture);
 					}
 				}
 			}
+		}
 
-			meshes.push_back(gps::Mesh(vertices, indices, textures));
+		// one mesh (and one draw call) per distinct material instead of one per shape
+		if (options.mergeByMaterial) {
+			size_t meshesBefore = meshData.size();
+			mergeMeshesByMaterial(meshData);
+			std::cout << "# of meshes    : " << meshesBefore << " -> " << meshData.size() << std::endl;
 		}
-	}
 
-	// Retrieves a texture associated with the object - by its name and type
-	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
+		for (size_t m = 0; m < meshData.size(); m++) {
+			// share the corners that are used by more than one face
+			size_t verticesBefore = meshData[m].vertices.size();
+			if (options.weldVertices) {
+				weldVertices(meshData[m].vertices, meshData[m].indices, options.weldEpsilon);
+			}
+			std::cout << "Mesh " << m << " vertices : " << verticesBefore << " -> " << meshData[m].vertices.size() << std::endl;
+			totalVerticesBefore += verticesBefore;
+			totalVerticesAfter += meshData[m].vertices.size();
+
+			// triangle order for the vertex cache, then cluster order for early-z, then vertex order for fetching
+			if (options.optimizeMeshes) {
+				std::vector<gps::Vertex>& vertices = meshData[m].vertices;
+				std::vector<GLuint>& indices = meshData[m].indices;
+				VertexCacheStatistics before = analyzeVertexCache(indices, vertices.size());
+
+				std::vector<size_t> clusters;
+				optimizeVertexCache(indices, vertices.size(), VERTEX_CACHE_SIZE, &clusters);
+				optimizeOverdraw(indices, vertices, clusters);
+				optimizeVertexFetch(vertices, indices);
+
+				VertexCacheStatistics after = analyzeVertexCache(indices, vertices.size());
+				std::cout << "Mesh " << m << " ACMR : " << before.acmr << " -> " << after.acmr
+					<< ", ATVR : " << before.atvr << " -> " << after.atvr << std::endl;
+			}
 
-			for (int i = 0; i < loadedTextures.size(); i++) {
-				if (loadedTextures[i].path == path)
-				{
-					//already loaded texture
-					return loadedTextures[i];
-				}
+			if (options.generateLods) {
+				generateLods(meshData[m]);
+				std::cout << "Mesh " << m << " LOD triangles :";
+				for (size_t l = 0; l < meshData[m].lods.size(); l++)
+					std::cout << " " << meshData[m].lods[l].indexCount / 3;
+				std::cout << std::endl;
 			}
+		}
 
-			gps::Texture currentTexture;
-			currentTexture.id = ReadTextureFromFile(path.c_str());
-			currentTexture.type = std::string(type);
-			currentTexture.path = path;
+		std::cout << "# of vertices  : " << totalVerticesBefore << " -> " << totalVerticesAfter << std::endl;
+		return true;
+	}
 
-			loadedTextures.push_back(currentTexture);
+	// Retrieves the textures of a mesh - paths are relative to the model directory
+	std::vector<gps::Texture> Model3D::LoadTextures(std::string basePath, const std::vector<TextureReference>& references) {
+		std::vector<gps::Texture> textures;
+		for (size_t i = 0; i < references.size(); i++)
+			textures.push_back(LoadTexture(basePath + references[i].path, references[i].type));
+		return textures;
+	}
 
+	// Retrieves a texture associated with the object - by its name and type
+	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
+		auto it = loadedTextures.find(path);
+		if (it != loadedTextures.end()) {
+			//already loaded texture - the same image may be bound to another sampler
+			gps::Texture currentTexture = it->second;
+			currentTexture.type = type;
+			currentTexture.layerType = type + "Layer";
 			return currentTexture;
 		}
 
-	// Reads the pixel data from an image file and loads it into the video memory
-	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
-		int x, y, n;
-		int force_channels = 4;
-		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, force_channels);
-		if (!image_data) {
-			fprintf(stderr, "ERROR: could not load %s\n", file_name);
-			return false;
-		}
-		// NPOT check
-		if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
-			fprintf(
-				stderr, "WARNING: texture %s is not power-of-2 dimensions\n", file_name
-			);
-		}
-
-		int width_in_bytes = x * 4;
-		unsigned char *top = NULL;
-		unsigned char *bottom = NULL;
-		unsigned char temp = 0;
-		int half_height = y / 2;
-
-		for (int row = 0; row < half_height; row++) {
-			top = image_data + row * width_in_bytes;
-			bottom = image_data + (y - row - 1) * width_in_bytes;
-			for (int col = 0; col < width_in_bytes; col++) {
-				temp = *top;
-				*top = *bottom;
-				*bottom = temp;
-				top++;
-				bottom++;
-			}
-		}
+		return AddTexture(path, type, TextureCache::global().load(path));
+	}
 
-		GLuint textureID;
-		glGenTextures(1, &textureID);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(
-			GL_TEXTURE_2D,
-			0,
-			GL_RGBA, //GL_SRGB,//GL_RGBA,
-			x,
-			y,
-			0,
-			GL_RGBA,
-			GL_UNSIGNED_BYTE,
-			image_data
-		);
-		glGenerateMipmap(GL_TEXTURE_2D);
+	// Adds a texture to the ones used by the model
+	gps::Texture Model3D::AddTexture(std::string path, std::string type, std::shared_ptr<TextureHandle> handle) {
+		gps::Texture currentTexture;
+		currentTexture.id = handle ? handle->getId() : 0;
+		currentTexture.type = type;
+		currentTexture.layerType = type + "Layer";
+		currentTexture.path = path;
+		currentTexture.handle = handle;
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glBindTexture(GL_TEXTURE_2D, 0);
+		loadedTextures[path] = currentTexture;
 
-		return textureID;
+		return currentTexture;
 	}
 
-	Model3D::~Model3D() {
-        for (size_t i = 0; i < loadedTextures.size(); i++) {
-            glDeleteTextures(1, &loadedTextures.at(i).id);
-        }
+	Model3D::Model3D() : loaded(false), failed(false), lodErrorThreshold(0.001f) {
+	}
 
+	Model3D::~Model3D() {
+        // the textures are released by TextureCache once no model uses them anymore
         for (size_t i = 0; i < meshes.size(); i++) {
             GLuint VBO = meshes.at(i).getBuffers().VBO;
             GLuint EBO = meshes.at(i).getBuffers().EBO;
@@ -228,6 +617,7 @@ namespace gps {
             glDeleteBuffers(1, &VBO);
             glDeleteBuffers(1, &EBO);
             glDeleteVertexArrays(1, &VAO);
+            GLState::global().vertexArrayDeleted(VAO);
         }
 	}
 }
@@ -1,43 +1,140 @@
 #ifndef Model3D_hpp
 #define Model3D_hpp
 
+#include "FrustumCuller.hpp"
 #include "Mesh.hpp"
+#include "RenderQueue.hpp"
+#include "TextureCache.hpp"
 
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
 
+#include <future>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace gps {
 
+    // Settings applied to the geometry while a model is being loaded
+    struct ModelLoadOptions
+    {
+        // merge the duplicated face corners into shared, indexed vertices
+        bool weldVertices = true;
+        // attributes closer than this are welded together (0 - exact matches only)
+        float weldEpsilon = 0.0f;
+        // put all the shapes that use identical materials into one mesh, drawn with a single call
+        bool mergeByMaterial = true;
+        // reorder triangles and vertices for the post-transform cache, overdraw and vertex fetch
+        // (stored in the mesh cache, so the cost is only paid when the cache is rebuilt)
+        bool optimizeMeshes = true;
+        // upload quantized 16 byte vertices (and 16 bit indices where possible) instead of floats
+        bool compactVertices = true;
+        // largest distance (in model units) a compact position may move from its float value - the
+        // positions are quantized on one grid around the whole model, models too large for it keep floats
+        float maxQuantizationError = 0.005f;
+        // build a chain of simplified versions of every mesh for distant views
+        bool generateLods = true;
+        // reuse the binary cache stored next to the .obj file, rebuilding it when it is out of date
+        bool useMeshCache = true;
+        // parse the .obj on the thread pool instead of with tinyobj (same result, worth it for large files)
+        bool parallelParse = false;
+        // keep a CPU copy of the vertices and indices of every mesh, to build a StaticGeometry from
+        // (meshes read from the mesh cache are otherwise uploaded straight from the mapped file)
+        bool keepGeometry = false;
+    };
+
+    class MeshCache;
+
     class Model3D
     {
 
     public:
+        Model3D();
         ~Model3D();
 
-		void LoadModel(std::string fileName);
+		void LoadModel(std::string fileName, ModelLoadOptions options = ModelLoadOptions());
+
+		void LoadModel(std::string fileName, std::string basePath, ModelLoadOptions options = ModelLoadOptions());
+
+		// Parses the model and decodes its textures on the thread pool and returns right away.
+		// The buffers and textures are created later on the GL thread by UploadQueue::global().process(),
+		// the model is not drawn until all of them are there. The future is ready when the worker is done
+		// and holds its exception if the model could not be read (hasFailed() is then true as well).
+		// The model must not be copied or destroyed before isLoaded() or hasFailed().
+		std::future<void> LoadModelAsync(std::string fileName, ModelLoadOptions options = ModelLoadOptions());
+
+		std::future<void> LoadModelAsync(std::string fileName, std::string basePath, ModelLoadOptions options = ModelLoadOptions());
+
+		// True once every mesh of the model is on the GPU
+		bool isLoaded() const;
+		// True if the .obj file could not be read - the model stays empty. Set on the GL thread
+		// by UploadQueue::global().process(), like isLoaded().
+		bool hasFailed() const;
+
+		// Draws the meshes of the bucket at the level of detail they were last drawn with (the finest one by default)
+		void Draw(gps::Shader& shaderProgram, MeshBucket bucket = MESH_BUCKET_ALL);
 
-		void LoadModel(std::string fileName, std::string basePath);
+		// Picks the level of detail of every mesh of the bucket from its projected size before drawing it,
+		// the meshes outside the view frustum are skipped
+		void Draw(gps::Shader& shaderProgram, const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection,
+		          MeshBucket bucket = MESH_BUCKET_ALL);
 
-		void Draw(gps::Shader shaderProgram);
+		// Picks the level of detail of every mesh inside the world space frustum and queues its draw -
+		// with cutoutShader for the meshes that need the alpha test, opaqueShader for the others.
+		// The scene pass also requests the texture levels of the meshes.
+		void Submit(RenderQueue& queue, RenderPass pass, gps::Shader& opaqueShader, gps::Shader& cutoutShader,
+		            const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection, const Frustum& frustum);
+
+		// Component meshes - the model must be loaded
+		std::vector<gps::Mesh>& getMeshes();
+
+		// Frees the CPU copy and the buffer objects of the meshes once they are in a StaticGeometry,
+		// the model is then only drawn through it
+		void releaseGeometry();
+
+		// Largest error of a simplified mesh, as a fraction of the screen height (0.001 ~ 1 pixel at 1080p)
+		void setLodErrorThreshold(float threshold);
 
     private:
+		bool loaded;
+		bool failed;
+		float lodErrorThreshold;
+
 		// Component meshes - group of objects
         std::vector<gps::Mesh> meshes;
-		// Associated textures
-        std::vector<gps::Texture> loadedTextures;
+		// Associated textures, by path - shared with the other models through TextureCache
+        std::unordered_map<std::string, gps::Texture> loadedTextures;
+
+		// model space boxes of the meshes, tested against the frustum brought into model space
+		FrustumCuller culler;
+		std::vector<uint8_t> visibility;
+
+		// Fills visibility for the frustum, in world space
+		void cullMeshes(const Frustum& frustum, const glm::mat4& model);
+
+		// Fills in the meshes either from the mesh cache or by parsing the .obj file (and then updates the cache).
+		// fromCache is set if the cache was used - the meshes are then read from it instead of meshData.
+		// Returns false if the .obj file could not be read.
+		bool ReadMeshData(std::string fileName, std::string basePath, const ModelLoadOptions& options, MeshCache& cache,
+		                  std::vector<MeshData>& meshData, bool& fromCache);
+
+		// CPU side of LoadModelAsync, runs on the thread pool and queues the GPU uploads
+		void LoadModelWorker(std::string fileName, std::string basePath, ModelLoadOptions options);
+
+		// Does the parsing of the .obj file and fills in the data structure, returns false if it cannot be read
+		bool ReadOBJ(std::string fileName, std::string basePath, const ModelLoadOptions& options, std::vector<MeshData>& meshData);
 
-		// Does the parsing of the .obj file and fills in the data structure
-		void ReadOBJ(std::string fileName, std::string basePath);
+		// Retrieves all the textures referenced by a mesh
+		std::vector<gps::Texture> LoadTextures(std::string basePath, const std::vector<TextureReference>& references);
 
 		// Retrieves a texture associated with the object - by its name and type
 		gps::Texture LoadTexture(std::string path, std::string type);
 
-		// Reads the pixel data from an image file and loads it into the video memory
-		GLuint ReadTextureFromFile(const char* file_name);
+		// Adds a texture to the ones used by the model
+		gps::Texture AddTexture(std::string path, std::string type, std::shared_ptr<TextureHandle> handle);
     };
 }
 
@@ -0,0 +1,699 @@
+#include "ObjParser.hpp"
+#include "FileUtils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <utility>
+
+namespace gps {
+
+	namespace {
+
+		// Chunks smaller than this are not worth a job of their own
+		const size_t minimumChunkSize = 1 << 20;
+		// Faces copied into a shape by one job when a face group is flattened
+		const size_t facesPerFillJob = 1 << 16;
+		const size_t nameBufferSize = 4096;
+
+		inline bool isSpace(char c) { return c == ' ' || c == '\t'; }
+		inline bool isDigit(char c) { return (unsigned int)(c - '0') < 10u; }
+		inline bool isNewLine(char c) { return c == '\r' || c == '\n' || c == '\0'; }
+
+		// The number parsing below follows tinyobj's parser operation by operation so that
+		// both loaders produce exactly the same floats and indices for the same text
+
+		bool tryParseDouble(const char* s, const char* s_end, double* result) {
+			if (s >= s_end)
+				return false;
+
+			double mantissa = 0.0;
+			int exponent = 0;
+			char sign = '+';
+			char exp_sign = '+';
+			const char* curr = s;
+			int read = 0;
+			bool end_not_reached = false;
+
+			if (*curr == '+' || *curr == '-') {
+				sign = *curr;
+				curr++;
+			}
+			else if (!isDigit(*curr)) {
+				return false;
+			}
+
+			// integer part
+			end_not_reached = (curr != s_end);
+			while (end_not_reached && isDigit(*curr)) {
+				mantissa *= 10;
+				mantissa += (int)(*curr - 0x30);
+				curr++;
+				read++;
+				end_not_reached = (curr != s_end);
+			}
+			if (read == 0)
+				return false;
+
+			if (end_not_reached) {
+				bool hasExponent = false;
+
+				// decimal part
+				if (*curr == '.') {
+					static const double pow_lut[] = { 1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001 };
+					const int lut_entries = sizeof(pow_lut) / sizeof(pow_lut[0]);
+
+					curr++;
+					read = 1;
+					end_not_reached = (curr != s_end);
+					while (end_not_reached && isDigit(*curr)) {
+						mantissa += (int)(*curr - 0x30) * (read < lut_entries ? pow_lut[read] : pow(10.0, -read));
+						read++;
+						curr++;
+						end_not_reached = (curr != s_end);
+					}
+					hasExponent = end_not_reached;
+				}
+				else if (*curr == 'e' || *curr == 'E') {
+					hasExponent = true;
+				}
+
+				// exponent part
+				if (hasExponent && (*curr == 'e' || *curr == 'E')) {
+					curr++;
+					end_not_reached = (curr != s_end);
+					if (end_not_reached && (*curr == '+' || *curr == '-')) {
+						exp_sign = *curr;
+						curr++;
+					}
+					else if (!isDigit(*curr)) {
+						return false;
+					}
+
+					read = 0;
+					end_not_reached = (curr != s_end);
+					while (end_not_reached && isDigit(*curr)) {
+						exponent *= 10;
+						exponent += (int)(*curr - 0x30);
+						curr++;
+						read++;
+						end_not_reached = (curr != s_end);
+					}
+					exponent *= (exp_sign == '+' ? 1 : -1);
+					if (read == 0)
+						return false;
+				}
+			}
+
+			*result = (sign == '+' ? 1 : -1) * (exponent ? ldexp(mantissa * pow(5.0, exponent), exponent) : mantissa);
+			return true;
+		}
+
+		inline float parseFloat(const char** token) {
+			(*token) += strspn((*token), " \t");
+			const char* end = (*token) + strcspn((*token), " \t\r");
+			double value = 0.0;
+			tryParseDouble((*token), end, &value);
+			(*token) = end;
+			return (float)value;
+		}
+
+		inline std::string parseString(const char** token) {
+			(*token) += strspn((*token), " \t");
+			size_t e = strcspn((*token), " \t\r");
+			std::string s((*token), &(*token)[e]);
+			(*token) += e;
+			return s;
+		}
+
+		// First word of a line, as read by sscanf("%s")
+		std::string scanName(const char* token) {
+			char nameBuffer[nameBufferSize];
+			nameBuffer[0] = '\0';
+#ifdef _MSC_VER
+			sscanf_s(token, "%s", nameBuffer, (unsigned)_countof(nameBuffer));
+#else
+			sscanf(token, "%4095s", nameBuffer);
+#endif
+			return nameBuffer;
+		}
+
+		enum RelativeIndexFlags { RelativeVertex = 1, RelativeTexcoord = 2, RelativeNormal = 4 };
+
+		// One face corner. Negative (relative) OBJ indices depend on the number of elements
+		// defined in the previous chunks, which is only known after all chunks are parsed -
+		// those are stored relative to the chunk and flagged.
+		struct Corner
+		{
+			int vertex;
+			int texcoord;
+			int normal;
+			unsigned char relative;
+		};
+
+		inline int fixIndex(int index, int count, unsigned char flag, unsigned char& relative) {
+			if (index > 0)
+				return index - 1;
+			if (index == 0)
+				return 0;
+			relative |= flag;
+			return count + index;
+		}
+
+		// Parses i, i/j/k, i//k and i/j
+		Corner parseTriple(const char** token, int vertexCount, int normalCount, int texcoordCount) {
+			Corner corner;
+			corner.vertex = -1;
+			corner.texcoord = -1;
+			corner.normal = -1;
+			corner.relative = 0;
+
+			corner.vertex = fixIndex(atoi((*token)), vertexCount, RelativeVertex, corner.relative);
+			(*token) += strcspn((*token), "/ \t\r");
+			if ((*token)[0] != '/')
+				return corner;
+			(*token)++;
+
+			// i//k
+			if ((*token)[0] == '/') {
+				(*token)++;
+				corner.normal = fixIndex(atoi((*token)), normalCount, RelativeNormal, corner.relative);
+				(*token) += strcspn((*token), "/ \t\r");
+				return corner;
+			}
+
+			// i/j/k or i/j
+			corner.texcoord = fixIndex(atoi((*token)), texcoordCount, RelativeTexcoord, corner.relative);
+			(*token) += strcspn((*token), "/ \t\r");
+			if ((*token)[0] != '/')
+				return corner;
+
+			// i/j/k
+			(*token)++;
+			corner.normal = fixIndex(atoi((*token)), normalCount, RelativeNormal, corner.relative);
+			(*token) += strcspn((*token), "/ \t\r");
+			return corner;
+		}
+
+		// A line that changes the state of the loader (usemtl, mtllib, g, o, t).
+		// These are rare, so they are kept as text and replayed in file order.
+		struct ObjEvent
+		{
+			// number of faces of the chunk that come before this line
+			size_t faceCount;
+			std::string line;
+		};
+
+		struct ObjChunk
+		{
+			const char* begin;
+			const char* end;
+
+			std::vector<float> vertices;
+			std::vector<float> normals;
+			std::vector<float> texcoords;
+
+			std::vector<Corner> corners;
+			// per face (plus one past the end): first corner, first output index and first output face
+			std::vector<size_t> faceCornerStart;
+			std::vector<size_t> faceIndexStart;
+			std::vector<size_t> faceOutputStart;
+
+			std::vector<ObjEvent> events;
+
+			// elements defined by the previous chunks
+			int vertexBase;
+			int normalBase;
+			int texcoordBase;
+
+			size_t faceCount() const { return faceCornerStart.size() - 1; }
+		};
+
+		void parseLine(ObjChunk& chunk, const std::string& lineBuffer, bool triangulate) {
+			const char* token = lineBuffer.c_str();
+			token += strspn(token, " \t");
+
+			if (token[0] == '\0' || token[0] == '#')
+				return;
+
+			// vertex
+			if (token[0] == 'v' && isSpace(token[1])) {
+				token += 2;
+				float x = parseFloat(&token);
+				float y = parseFloat(&token);
+				float z = parseFloat(&token);
+				chunk.vertices.push_back(x);
+				chunk.vertices.push_back(y);
+				chunk.vertices.push_back(z);
+				return;
+			}
+
+			// normal
+			if (token[0] == 'v' && token[1] == 'n' && isSpace(token[2])) {
+				token += 3;
+				float x = parseFloat(&token);
+				float y = parseFloat(&token);
+				float z = parseFloat(&token);
+				chunk.normals.push_back(x);
+				chunk.normals.push_back(y);
+				chunk.normals.push_back(z);
+				return;
+			}
+
+			// texcoord
+			if (token[0] == 'v' && token[1] == 't' && isSpace(token[2])) {
+				token += 3;
+				float x = parseFloat(&token);
+				float y = parseFloat(&token);
+				chunk.texcoords.push_back(x);
+				chunk.texcoords.push_back(y);
+				return;
+			}
+
+			// face
+			if (token[0] == 'f' && isSpace(token[1])) {
+				token += 2;
+				token += strspn(token, " \t");
+
+				int vertexCount = (int)(chunk.vertices.size() / 3);
+				int normalCount = (int)(chunk.normals.size() / 3);
+				int texcoordCount = (int)(chunk.texcoords.size() / 2);
+
+				size_t corners = 0;
+				while (!isNewLine(token[0])) {
+					chunk.corners.push_back(parseTriple(&token, vertexCount, normalCount, texcoordCount));
+					corners++;
+					token += strspn(token, " \t\r");
+				}
+
+				size_t triangles = corners > 2 ? corners - 2 : 0;
+				chunk.faceCornerStart.push_back(chunk.corners.size());
+				chunk.faceIndexStart.push_back(chunk.faceIndexStart.back() + (triangulate ? 3 * triangles : corners));
+				chunk.faceOutputStart.push_back(chunk.faceOutputStart.back() + (triangulate ? triangles : 1));
+				return;
+			}
+
+			if (((0 == strncmp(token, "usemtl", 6)) && isSpace(token[6]))
+				|| ((0 == strncmp(token, "mtllib", 6)) && isSpace(token[6]))
+				|| (token[0] == 'g' && isSpace(token[1]))
+				|| (token[0] == 'o' && isSpace(token[1]))
+				|| (token[0] == 't' && isSpace(token[1]))) {
+				ObjEvent event;
+				event.faceCount = chunk.faceCount();
+				event.line = lineBuffer;
+				chunk.events.push_back(event);
+			}
+
+			// anything else is ignored, like tinyobj does
+		}
+
+		// Splits the chunk into lines the same way tinyobj's safeGetline does ("\n", "\r\n" or "\r")
+		void parseChunk(ObjChunk& chunk, bool triangulate) {
+			size_t estimatedLines = (size_t)(chunk.end - chunk.begin) / 32;
+			chunk.vertices.reserve(estimatedLines);
+			chunk.corners.reserve(estimatedLines);
+
+			chunk.faceCornerStart.assign(1, 0);
+			chunk.faceIndexStart.assign(1, 0);
+			chunk.faceOutputStart.assign(1, 0);
+
+			std::string lineBuffer;
+			const char* current = chunk.begin;
+			while (current < chunk.end) {
+				const char* lineEnd = current;
+				while (lineEnd < chunk.end && *lineEnd != '\n' && *lineEnd != '\r')
+					lineEnd++;
+
+				if (lineEnd != current) {
+					lineBuffer.assign(current, lineEnd);
+					parseLine(chunk, lineBuffer, triangulate);
+				}
+
+				current = lineEnd;
+				if (current < chunk.end) {
+					if (*current == '\r' && current + 1 < chunk.end && current[1] == '\n')
+						current++;
+					current++;
+				}
+			}
+		}
+
+		// Faces of one chunk that belong to the face group being collected
+		struct FaceRange
+		{
+			size_t chunk;
+			size_t firstFace;
+			size_t lastFace;
+		};
+
+		// Replays the state changing lines of the file and builds the shapes out of the parsed faces
+		class ShapeBuilder
+		{
+		public:
+			ShapeBuilder(std::vector<ObjChunk>& chunks, std::vector<tinyobj::shape_t>* shapes,
+			             std::vector<tinyobj::material_t>* materials, tinyobj::MaterialReader& materialReader,
+			             std::string* err, bool triangulate, ThreadPool& pool)
+				: chunks(chunks), shapes(shapes), materials(materials), materialReader(materialReader),
+				  err(err), triangulate(triangulate), pool(pool), material(-1), groupFaces(0)
+			{
+			}
+
+			bool build() {
+				for (size_t c = 0; c < chunks.size(); c++) {
+					size_t firstFace = 0;
+					for (size_t e = 0; e < chunks[c].events.size(); e++) {
+						addFaces(c, firstFace, chunks[c].events[e].faceCount);
+						firstFace = chunks[c].events[e].faceCount;
+						if (!handleEvent(chunks[c].events[e].line))
+							return false;
+					}
+					addFaces(c, firstFace, chunks[c].faceCount());
+				}
+
+				bool exported = exportFaceGroup();
+				// the shape may also hold faces exported by a 'usemtl' on one of the last lines
+				if (exported || shape.mesh.indices.size())
+					shapes->push_back(std::move(shape));
+				return true;
+			}
+
+		private:
+			std::vector<ObjChunk>& chunks;
+			std::vector<tinyobj::shape_t>* shapes;
+			std::vector<tinyobj::material_t>* materials;
+			tinyobj::MaterialReader& materialReader;
+			std::string* err;
+			bool triangulate;
+			ThreadPool& pool;
+
+			std::map<std::string, int> materialMap;
+			int material;
+			std::string name;
+			std::vector<tinyobj::tag_t> tags;
+			tinyobj::shape_t shape;
+			std::vector<FaceRange> faceGroup;
+			size_t groupFaces;
+
+			void addFaces(size_t chunk, size_t firstFace, size_t lastFace) {
+				if (firstFace == lastFace)
+					return;
+				FaceRange range = { chunk, firstFace, lastFace };
+				faceGroup.push_back(range);
+				groupFaces += lastFace - firstFace;
+			}
+
+			void clearFaceGroup() {
+				faceGroup.clear();
+				groupFaces = 0;
+			}
+
+			inline tinyobj::index_t makeIndex(const ObjChunk& chunk, const Corner& corner) const {
+				tinyobj::index_t index;
+				index.vertex_index = corner.vertex + ((corner.relative & RelativeVertex) ? chunk.vertexBase : 0);
+				index.texcoord_index = corner.texcoord + ((corner.relative & RelativeTexcoord) ? chunk.texcoordBase : 0);
+				index.normal_index = corner.normal + ((corner.relative & RelativeNormal) ? chunk.normalBase : 0);
+				return index;
+			}
+
+			// Writes the faces [firstFace, lastFace) of a chunk starting at the given output positions
+			void fillFaces(const ObjChunk& chunk, size_t firstFace, size_t lastFace, size_t indexOffset, size_t faceOffset) {
+				tinyobj::index_t* indices = shape.mesh.indices.data() + indexOffset;
+				unsigned char* faceVertices = shape.mesh.num_face_vertices.data() + faceOffset;
+				int* materialIds = shape.mesh.material_ids.data() + faceOffset;
+
+				for (size_t f = firstFace; f < lastFace; f++) {
+					const Corner* face = chunk.corners.data() + chunk.faceCornerStart[f];
+					size_t corners = chunk.faceCornerStart[f + 1] - chunk.faceCornerStart[f];
+
+					if (triangulate) {
+						// polygon -> triangle fan
+						for (size_t k = 2; k < corners; k++) {
+							*indices++ = makeIndex(chunk, face[0]);
+							*indices++ = makeIndex(chunk, face[k - 1]);
+							*indices++ = makeIndex(chunk, face[k]);
+							*faceVertices++ = 3;
+							*materialIds++ = material;
+						}
+					}
+					else {
+						for (size_t k = 0; k < corners; k++)
+							*indices++ = makeIndex(chunk, face[k]);
+						*faceVertices++ = (unsigned char)corners;
+						*materialIds++ = material;
+					}
+				}
+			}
+
+			// Same as tinyobj's exportFaceGroupToShape - appends the collected faces to the current shape
+			bool exportFaceGroup() {
+				if (groupFaces == 0)
+					return false;
+
+				// where every piece of the group goes in the shape, split so that the copy can run in parallel
+				struct FillJob
+				{
+					size_t chunk;
+					size_t firstFace;
+					size_t lastFace;
+					size_t indexOffset;
+					size_t faceOffset;
+				};
+				std::vector<FillJob> jobs;
+
+				size_t indexOffset = shape.mesh.indices.size();
+				size_t faceOffset = shape.mesh.num_face_vertices.size();
+				for (size_t r = 0; r < faceGroup.size(); r++) {
+					const ObjChunk& chunk = chunks[faceGroup[r].chunk];
+					for (size_t first = faceGroup[r].firstFace; first < faceGroup[r].lastFace; first += facesPerFillJob) {
+						size_t last = std::min(first + facesPerFillJob, faceGroup[r].lastFace);
+						FillJob job = { faceGroup[r].chunk, first, last, indexOffset, faceOffset };
+						jobs.push_back(job);
+						indexOffset += chunk.faceIndexStart[last] - chunk.faceIndexStart[first];
+						faceOffset += chunk.faceOutputStart[last] - chunk.faceOutputStart[first];
+					}
+				}
+
+				shape.mesh.indices.resize(indexOffset);
+				shape.mesh.num_face_vertices.resize(faceOffset);
+				shape.mesh.material_ids.resize(faceOffset);
+
+				pool.parallelFor(jobs.size(), [this, &jobs](size_t j) {
+					fillFaces(chunks[jobs[j].chunk], jobs[j].firstFace, jobs[j].lastFace, jobs[j].indexOffset, jobs[j].faceOffset);
+				});
+
+				shape.name = name;
+				shape.mesh.tags = tags;
+				return true;
+			}
+
+			void flushShape() {
+				if (exportFaceGroup())
+					shapes->push_back(std::move(shape));
+				shape = tinyobj::shape_t();
+				clearFaceGroup();
+			}
+
+			bool handleEvent(const std::string& lineBuffer) {
+				const char* token = lineBuffer.c_str();
+				token += strspn(token, " \t");
+
+				// use mtl
+				if ((0 == strncmp(token, "usemtl", 6)) && isSpace(token[6])) {
+					std::string materialName = scanName(token + 7);
+
+					int newMaterialId = -1;
+					std::map<std::string, int>::iterator it = materialMap.find(materialName);
+					if (it != materialMap.end())
+						newMaterialId = it->second;
+
+					if (newMaterialId != material) {
+						// per-face material - the shape is not finished yet
+						exportFaceGroup();
+						clearFaceGroup();
+						material = newMaterialId;
+					}
+					return true;
+				}
+
+				// load mtl
+				if ((0 == strncmp(token, "mtllib", 6)) && isSpace(token[6])) {
+					std::string materialFile = scanName(token + 7);
+
+					std::string materialError;
+					bool ok = materialReader(materialFile, materials, &materialMap, &materialError);
+					if (err)
+						(*err) += materialError;
+
+					if (!ok) {
+						clearFaceGroup();
+						return false;
+					}
+					return true;
+				}
+
+				// group name
+				if (token[0] == 'g' && isSpace(token[1])) {
+					flushShape();
+
+					std::vector<std::string> names;
+					while (!isNewLine(token[0])) {
+						names.push_back(parseString(&token));
+						token += strspn(token, " \t\r");
+					}
+
+					// names[0] is 'g'
+					name = names.size() > 1 ? names[1] : "";
+					return true;
+				}
+
+				// object name
+				if (token[0] == 'o' && isSpace(token[1])) {
+					flushShape();
+					name = scanName(token + 2);
+					return true;
+				}
+
+				// tag
+				if (token[0] == 't' && isSpace(token[1])) {
+					parseTag(token);
+					return true;
+				}
+
+				return true;
+			}
+
+			void parseTag(const char* token) {
+				tinyobj::tag_t tag;
+
+				token += 2;
+				tag.name = scanName(token);
+				token += tag.name.size() + 1;
+
+				int intCount = atoi(token);
+				int floatCount = 0;
+				int stringCount = 0;
+				token += strcspn(token, "/ \t\r");
+				if (token[0] == '/') {
+					token++;
+					floatCount = atoi(token);
+					token += strcspn(token, "/ \t\r");
+					if (token[0] == '/') {
+						token++;
+						stringCount = atoi(token);
+						token += strcspn(token, "/ \t\r") + 1;
+					}
+				}
+
+				tag.intValues.resize((size_t)intCount);
+				for (size_t i = 0; i < (size_t)intCount; ++i) {
+					tag.intValues[i] = atoi(token);
+					token += strcspn(token, "/ \t\r") + 1;
+				}
+
+				tag.floatValues.resize((size_t)floatCount);
+				for (size_t i = 0; i < (size_t)floatCount; ++i) {
+					tag.floatValues[i] = parseFloat(&token);
+					token += strcspn(token, "/ \t\r") + 1;
+				}
+
+				tag.stringValues.resize((size_t)stringCount);
+				for (size_t i = 0; i < (size_t)stringCount; ++i) {
+					tag.stringValues[i] = scanName(token);
+					token += tag.stringValues[i].size() + 1;
+				}
+
+				tags.push_back(tag);
+			}
+		};
+
+		// Splits the file into chunks that start at the beginning of a line
+		std::vector<ObjChunk> splitIntoChunks(const char* data, size_t size, size_t chunkCount) {
+			std::vector<ObjChunk> chunks;
+			const char* end = data + size;
+			const char* begin = data;
+
+			for (size_t i = 1; i <= chunkCount && begin < end; i++) {
+				const char* chunkEnd = end;
+				if (i < chunkCount) {
+					chunkEnd = data + size / chunkCount * i;
+					if (chunkEnd <= begin)
+						continue;
+					const char* newLine = (const char*)memchr(chunkEnd, '\n', (size_t)(end - chunkEnd));
+					chunkEnd = newLine ? newLine + 1 : end;
+				}
+
+				ObjChunk chunk;
+				chunk.begin = begin;
+				chunk.end = chunkEnd;
+				chunk.vertexBase = 0;
+				chunk.normalBase = 0;
+				chunk.texcoordBase = 0;
+				chunks.push_back(std::move(chunk));
+				begin = chunkEnd;
+			}
+
+			return chunks;
+		}
+
+		template <typename T>
+		void concatenate(std::vector<ObjChunk>& chunks, std::vector<T> ObjChunk::*member, std::vector<T>& output, ThreadPool& pool) {
+			std::vector<size_t> offsets(chunks.size() + 1, 0);
+			for (size_t c = 0; c < chunks.size(); c++)
+				offsets[c + 1] = offsets[c] + (chunks[c].*member).size();
+
+			output.resize(offsets.back());
+			pool.parallelFor(chunks.size(), [&](size_t c) {
+				const std::vector<T>& source = chunks[c].*member;
+				if (!source.empty())
+					std::memcpy(output.data() + offsets[c], source.data(), source.size() * sizeof(T));
+			});
+		}
+	}
+
+	bool LoadObjParallel(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+	                     std::vector<tinyobj::material_t>* materials, std::string* err,
+	                     const char* filename, const char* mtl_basepath,
+	                     bool triangulate, ThreadPool& pool) {
+		MappedFile file;
+		if (!file.open(filename)) {
+			// missing or empty file - let tinyobj produce the usual result and message
+			return tinyobj::LoadObj(attrib, shapes, materials, err, filename, mtl_basepath, triangulate);
+		}
+
+		attrib->vertices.clear();
+		attrib->normals.clear();
+		attrib->texcoords.clear();
+		shapes->clear();
+
+		// a few chunks per thread keep the workers busy when the line mix is uneven
+		size_t chunkCount = std::max<size_t>(1, std::min<size_t>((pool.getThreadCount() + 1) * 4, file.size() / minimumChunkSize));
+		std::vector<ObjChunk> chunks = splitIntoChunks((const char*)file.data(), file.size(), chunkCount);
+
+		pool.parallelFor(chunks.size(), [&chunks, triangulate](size_t c) {
+			parseChunk(chunks[c], triangulate);
+		});
+
+		// prefix sums of the element counts give the base of every chunk
+		for (size_t c = 1; c < chunks.size(); c++) {
+			chunks[c].vertexBase = chunks[c - 1].vertexBase + (int)(chunks[c - 1].vertices.size() / 3);
+			chunks[c].normalBase = chunks[c - 1].normalBase + (int)(chunks[c - 1].normals.size() / 3);
+			chunks[c].texcoordBase = chunks[c - 1].texcoordBase + (int)(chunks[c - 1].texcoords.size() / 2);
+		}
+
+		tinyobj::MaterialFileReader materialReader(mtl_basepath ? mtl_basepath : "");
+		ShapeBuilder builder(chunks, shapes, materials, materialReader, err, triangulate, pool);
+		if (!builder.build())
+			return false;
+
+		concatenate(chunks, &ObjChunk::vertices, attrib->vertices, pool);
+		concatenate(chunks, &ObjChunk::normals, attrib->normals, pool);
+		concatenate(chunks, &ObjChunk::texcoords, attrib->texcoords, pool);
+
+		return true;
+	}
+
+}
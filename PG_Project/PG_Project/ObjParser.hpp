@@ -0,0 +1,24 @@
+#ifndef ObjParser_hpp
+#define ObjParser_hpp
+
+#include "tiny_obj_loader.h"
+#include "ThreadPool.hpp"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Multi-threaded drop-in replacement for tinyobj::LoadObj.
+    // The file is memory mapped and split into line aligned chunks that are parsed on the
+    // thread pool; the per-chunk results are then stitched together using prefix sums of
+    // the per-chunk vertex/normal/texcoord/face counts. The output is identical to the
+    // one produced by tinyobj::LoadObj for the same file.
+    bool LoadObjParallel(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+                         std::vector<tinyobj::material_t>* materials, std::string* err,
+                         const char* filename, const char* mtl_basepath = NULL,
+                         bool triangulate = true, ThreadPool& pool = ThreadPool::global());
+
+}
+
+#endif /* ObjParser_hpp */
@@ -0,0 +1,495 @@
+#include "OcclusionCuller.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define OCCLUSION_CULLER_SSE2
+#endif
+
+namespace gps {
+
+	namespace {
+
+		// side of the tiles of the hierarchical depth, and height of the bands rasterized by one job
+		const int TILE_SIZE = 8;
+		// vertices or triangles set up by one job
+		const size_t SETUP_CHUNK = 4096;
+
+		const uint32_t NO_VERTEX = 0xFFFFFFFF;
+		const uint32_t NO_TRIANGLE = 0xFFFFFFFF;
+
+		int roundUp(int value, int multiple) {
+			return (std::max(value, 1) + multiple - 1) / multiple * multiple;
+		}
+
+		// Positive for a point on the left of a to b, the triangles are counter-clockwise
+		float edge(const glm::vec3& a, const glm::vec3& b, float x, float y) {
+			return (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+		}
+
+		// Bits of the clip planes a vertex is outside of
+		unsigned outcode(const glm::vec4& clip) {
+			unsigned code = 0;
+			if (clip.x < -clip.w) code |= 1;
+			if (clip.x > clip.w) code |= 2;
+			if (clip.y < -clip.w) code |= 4;
+			if (clip.y > clip.w) code |= 8;
+			if (clip.z < -clip.w) code |= 16;
+			if (clip.z > clip.w) code |= 32;
+			return code;
+		}
+
+		// Winding of a triangle on the buffer, 0 when it crosses the near plane, is outside one of the
+		// planes or has no area
+		int8_t screenFacing(const glm::vec4 clip[3]) {
+			if (outcode(clip[0]) & outcode(clip[1]) & outcode(clip[2]))
+				return 0;
+			for (int i = 0; i < 3; i++) {
+				if (clip[i].w <= 0.0f || clip[i].z < -clip[i].w)
+					return 0;
+			}
+			glm::vec3 a = glm::vec3(clip[0]) / clip[0].w;
+			glm::vec3 b = glm::vec3(clip[1]) / clip[1].w;
+			glm::vec3 c = glm::vec3(clip[2]) / clip[2].w;
+			float area = edge(a, b, c.x, c.y);
+			return area > 0.0f ? 1 : (area < 0.0f ? -1 : 0);
+		}
+
+		uint64_t edgeKey(uint32_t from, uint32_t to) {
+			return (uint64_t)from << 32 | to;
+		}
+
+		// True for two triangles made of the same vertices - the back of a two sided face
+		bool sameVertices(const uint32_t* a, const uint32_t* b) {
+			uint32_t sortedA[3] = { a[0], a[1], a[2] };
+			uint32_t sortedB[3] = { b[0], b[1], b[2] };
+			std::sort(sortedA, sortedA + 3);
+			std::sort(sortedB, sortedB + 3);
+			return std::equal(sortedA, sortedA + 3, sortedB);
+		}
+	}
+
+	OcclusionCuller::OcclusionCuller(int width, int height) :
+		width(roundUp(width, TILE_SIZE)), height(roundUp(height, TILE_SIZE)), viewProjection(1.0f), rendered(false)
+	{
+		tilesX = this->width / TILE_SIZE;
+		tilesY = this->height / TILE_SIZE;
+		depth.assign(this->width * this->height, 1.0f);
+		tileDepth.assign(tilesX * tilesY, 1.0f);
+		resetStatistics();
+		statistics.renderMilliseconds = 0.0;
+	}
+
+	OcclusionCuller::~OcclusionCuller()
+	{
+		// the job uses the buffers
+		if (pending.valid())
+			pending.wait();
+	}
+
+	bool OcclusionCuller::addOccluder(const Mesh& mesh, const glm::mat4& transform)
+	{
+		const std::vector<MeshLod>& lods = mesh.getLods();
+		if (mesh.isCutout() || mesh.vertices.empty() || lods.empty())
+			return false;
+
+		// the full detail level - a simplified one can stick out of the mesh and hide what is visible
+		std::vector<glm::vec3> meshPositions(mesh.vertices.size());
+		for (size_t v = 0; v < mesh.vertices.size(); v++)
+			meshPositions[v] = mesh.vertices[v].Position;
+		const MeshLod& lod = lods[0];
+		std::vector<uint32_t> lodIndices(mesh.indices.begin() + lod.indexOffset, mesh.indices.begin() + lod.indexOffset + lod.indexCount);
+		addOccluder(meshPositions, lodIndices, transform);
+		return true;
+	}
+
+	void OcclusionCuller::addOccluder(const std::vector<glm::vec3>& meshPositions, const std::vector<uint32_t>& meshIndices, const glm::mat4& transform)
+	{
+		finishRender();
+
+		// the vertices split along texture seams are welded, the triangles on both sides are neighbors
+		std::vector<uint32_t> remap(meshPositions.size(), NO_VERTEX);
+		std::map<std::tuple<float, float, float>, uint32_t> welded;
+		size_t firstTriangle = indices.size() / 3;
+		for (size_t k = 0; k < meshIndices.size(); k++) {
+			uint32_t vertex = meshIndices[k];
+			if (remap[vertex] == NO_VERTEX) {
+				glm::vec3 position = glm::vec3(transform * glm::vec4(meshPositions[vertex], 1.0f));
+				std::pair<std::map<std::tuple<float, float, float>, uint32_t>::iterator, bool> inserted =
+					welded.insert(std::make_pair(std::make_tuple(position.x, position.y, position.z), (uint32_t)positions.size()));
+				if (inserted.second)
+					positions.push_back(position);
+				remap[vertex] = inserted.first->second;
+			}
+			indices.push_back(remap[vertex]);
+		}
+		linkNeighbors(firstTriangle);
+	}
+
+	void OcclusionCuller::linkNeighbors(size_t firstTriangle)
+	{
+		size_t triangleCount = indices.size() / 3;
+		neighbors.resize(triangleCount * 3, NO_TRIANGLE);
+
+		// edges (triangle * 3 + k) of the mesh by the vertices they go from and to
+		std::unordered_multimap<uint64_t, uint32_t> edges;
+		for (size_t i = firstTriangle * 3; i < triangleCount * 3; i++)
+			edges.insert(std::make_pair(edgeKey(indices[i], indices[i - i % 3 + (i + 1) % 3]), (uint32_t)i));
+
+		// a neighbor goes the other way along the edge, the back of a two sided face is not one
+		for (size_t i = firstTriangle * 3; i < triangleCount * 3; i++) {
+			if (neighbors[i] != NO_TRIANGLE)
+				continue;
+			size_t triangle = i / 3;
+			std::pair<std::unordered_multimap<uint64_t, uint32_t>::iterator, std::unordered_multimap<uint64_t, uint32_t>::iterator> range =
+				edges.equal_range(edgeKey(indices[triangle * 3 + (i + 1) % 3], indices[i]));
+			for (std::unordered_multimap<uint64_t, uint32_t>::iterator it = range.first; it != range.second; ++it) {
+				uint32_t other = it->second;
+				if (neighbors[other] != NO_TRIANGLE || sameVertices(&indices[triangle * 3], &indices[other - other % 3]))
+					continue;
+				neighbors[i] = other / 3;
+				neighbors[other] = (uint32_t)triangle;
+				break;
+			}
+		}
+	}
+
+	void OcclusionCuller::clearOccluders()
+	{
+		finishRender();
+		positions.clear();
+		indices.clear();
+		neighbors.clear();
+	}
+
+	size_t OcclusionCuller::getTriangleCount() const
+	{
+		return indices.size() / 3;
+	}
+
+	void OcclusionCuller::beginRender(const glm::mat4& viewProjection)
+	{
+		finishRender();
+		this->viewProjection = viewProjection;
+		rendered = false;
+		if (indices.empty())
+			return;
+		pending = ThreadPool::global().submit([this]() { render(); });
+	}
+
+	void OcclusionCuller::finishRender()
+	{
+		if (pending.valid())
+			pending.get();
+	}
+
+	bool OcclusionCuller::isOccluded(const BoundingBox& box)
+	{
+		finishRender();
+		statistics.tested++;
+		if (!rendered)
+			return false;
+
+		// rectangle and nearest depth of the box on the buffer
+		float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+		float nearest = FLT_MAX;
+		for (int corner = 0; corner < 8; corner++) {
+			glm::vec3 point((corner & 1) ? box.maximum.x : box.minimum.x,
+				(corner & 2) ? box.maximum.y : box.minimum.y,
+				(corner & 4) ? box.maximum.z : box.minimum.z);
+			glm::vec4 clip = viewProjection * glm::vec4(point, 1.0f);
+			if (clip.w <= 0.0f || clip.z < -clip.w)
+				return false;
+
+			float inverseW = 1.0f / clip.w;
+			float x = (clip.x * inverseW * 0.5f + 0.5f) * width;
+			float y = (clip.y * inverseW * 0.5f + 0.5f) * height;
+			minX = std::min(minX, x);
+			maxX = std::max(maxX, x);
+			minY = std::min(minY, y);
+			maxY = std::max(maxY, y);
+			nearest = std::min(nearest, clip.z * inverseW * 0.5f + 0.5f);
+		}
+
+		// outside the buffer - left to the frustum culling
+		if (maxX < 0.0f || maxY < 0.0f || minX >= (float)width || minY >= (float)height)
+			return false;
+		int x0 = (int)std::max(minX, 0.0f);
+		int y0 = (int)std::max(minY, 0.0f);
+		int x1 = (int)std::min(maxX, (float)(width - 1));
+		int y1 = (int)std::min(maxY, (float)(height - 1));
+
+		for (int tileY = y0 / TILE_SIZE; tileY <= y1 / TILE_SIZE; tileY++) {
+			for (int tileX = x0 / TILE_SIZE; tileX <= x1 / TILE_SIZE; tileX++) {
+				// every pixel of the tile is in front of the box
+				if (nearest > tileDepth[tileY * tilesX + tileX])
+					continue;
+
+				int rowEnd = std::min(y1, tileY * TILE_SIZE + TILE_SIZE - 1);
+				int columnEnd = std::min(x1, tileX * TILE_SIZE + TILE_SIZE - 1);
+				for (int y = std::max(y0, tileY * TILE_SIZE); y <= rowEnd; y++) {
+					for (int x = std::max(x0, tileX * TILE_SIZE); x <= columnEnd; x++) {
+						if (nearest <= depth[y * width + x])
+							return false;
+					}
+				}
+			}
+		}
+
+		statistics.occluded++;
+		return true;
+	}
+
+	int OcclusionCuller::getWidth() const
+	{
+		return width;
+	}
+
+	int OcclusionCuller::getHeight() const
+	{
+		return height;
+	}
+
+	float OcclusionCuller::getDepth(int x, int y)
+	{
+		finishRender();
+		return depth[y * width + x];
+	}
+
+	const OcclusionCuller::Statistics& OcclusionCuller::getStatistics() const
+	{
+		return statistics;
+	}
+
+	void OcclusionCuller::resetStatistics()
+	{
+		statistics.tested = 0;
+		statistics.occluded = 0;
+	}
+
+	void OcclusionCuller::render()
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		ThreadPool& pool = ThreadPool::global();
+
+		clipPositions.resize(positions.size());
+		pool.parallelFor((positions.size() + SETUP_CHUNK - 1) / SETUP_CHUNK, [this](size_t chunk) {
+			size_t end = std::min(positions.size(), (chunk + 1) * SETUP_CHUNK);
+			for (size_t i = chunk * SETUP_CHUNK; i < end; i++)
+				clipPositions[i] = viewProjection * glm::vec4(positions[i], 1.0f);
+		});
+
+		// the triangles need the winding of their neighbors
+		size_t triangleCount = indices.size() / 3;
+		size_t chunkCount = (triangleCount + SETUP_CHUNK - 1) / SETUP_CHUNK;
+		facing.resize(triangleCount);
+		pool.parallelFor(chunkCount, [this, triangleCount](size_t chunk) {
+			size_t end = std::min(triangleCount, (chunk + 1) * SETUP_CHUNK);
+			for (size_t i = chunk * SETUP_CHUNK; i < end; i++) {
+				glm::vec4 clip[3] = { clipPositions[indices[i * 3]], clipPositions[indices[i * 3 + 1]], clipPositions[indices[i * 3 + 2]] };
+				facing[i] = screenFacing(clip);
+			}
+		});
+
+		std::vector<std::vector<ScreenTriangle> > chunkTriangles(chunkCount);
+		pool.parallelFor(chunkCount, [this, triangleCount, &chunkTriangles](size_t chunk) {
+			size_t end = std::min(triangleCount, (chunk + 1) * SETUP_CHUNK);
+			for (size_t i = chunk * SETUP_CHUNK; i < end; i++)
+				setupTriangle(i, chunkTriangles[chunk]);
+		});
+
+		triangles.clear();
+		for (size_t i = 0; i < chunkTriangles.size(); i++)
+			triangles.insert(triangles.end(), chunkTriangles[i].begin(), chunkTriangles[i].end());
+
+		// each band only goes through the triangles that reach it
+		bandTriangles.resize(tilesY);
+		for (int band = 0; band < tilesY; band++)
+			bandTriangles[band].clear();
+		for (uint32_t i = 0; i < (uint32_t)triangles.size(); i++) {
+			for (int band = triangles[i].firstRow / TILE_SIZE; band <= triangles[i].lastRow / TILE_SIZE; band++)
+				bandTriangles[band].push_back(i);
+		}
+
+		// the bands have no pixel in common
+		pool.parallelFor(tilesY, [this](size_t tileRow) { rasterizeBand((int)tileRow); });
+
+		rendered = true;
+		statistics.renderMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void OcclusionCuller::setupTriangle(size_t index, std::vector<ScreenTriangle>& output) const
+	{
+		glm::vec4 clip[3] = { clipPositions[indices[index * 3]], clipPositions[indices[index * 3 + 1]], clipPositions[indices[index * 3 + 2]] };
+
+		// entirely outside one of the planes
+		if (outcode(clip[0]) & outcode(clip[1]) & outcode(clip[2]))
+			return;
+
+		// the part in front of the near plane (z >= -w), at most a quad
+		glm::vec4 polygon[4];
+		int count = 0;
+		for (int i = 0; i < 3; i++) {
+			const glm::vec4& a = clip[i];
+			const glm::vec4& b = clip[(i + 1) % 3];
+			float distanceA = a.z + a.w;
+			float distanceB = b.z + b.w;
+			if (distanceA >= 0.0f)
+				polygon[count++] = a;
+			if ((distanceA >= 0.0f) != (distanceB >= 0.0f))
+				polygon[count++] = a + (b - a) * (distanceA / (distanceA - distanceB));
+		}
+
+		glm::vec3 screen[4];
+		for (int i = 0; i < count; i++) {
+			if (polygon[i].w <= 0.0f)
+				return;
+			float inverseW = 1.0f / polygon[i].w;
+			screen[i] = glm::vec3((polygon[i].x * inverseW * 0.5f + 0.5f) * width,
+				(polygon[i].y * inverseW * 0.5f + 0.5f) * height,
+				polygon[i].z * inverseW * 0.5f + 0.5f);
+		}
+
+		// edges of the polygon (from vertex j to j + 1) on the outline of the occluder - the edges
+		// shared with a neighbor wound the same way on the buffer are covered on the other side.
+		// The edges of a clipped triangle are all taken as outline edges.
+		bool outline[4] = { true, true, true, true };
+		if (count == 3 && facing[index] != 0) {
+			for (int j = 0; j < 3; j++) {
+				uint32_t neighbor = neighbors[index * 3 + j];
+				outline[j] = neighbor == NO_TRIANGLE || facing[neighbor] != facing[index];
+			}
+		}
+
+		for (int i = 2; i < count; i++) {
+			ScreenTriangle triangle;
+			triangle.vertices[0] = screen[0];
+			triangle.vertices[1] = screen[i - 1];
+			triangle.vertices[2] = screen[i];
+			// the diagonals of the fan are inside the polygon
+			bool opposite[3] = { outline[i - 1], i == count - 1 && outline[count - 1], i == 2 && outline[0] };
+			float area = edge(triangle.vertices[0], triangle.vertices[1], triangle.vertices[2].x, triangle.vertices[2].y);
+			if (area == 0.0f)
+				continue;
+			if (area < 0.0f) {
+				std::swap(triangle.vertices[1], triangle.vertices[2]);
+				std::swap(opposite[1], opposite[2]);
+			}
+			triangle.outlineEdges = (opposite[0] ? 1u : 0u) | (opposite[1] ? 2u : 0u) | (opposite[2] ? 4u : 0u);
+
+			// rows whose pixel centers are inside the vertical extent
+			float minY = std::min(std::min(screen[0].y, screen[i - 1].y), screen[i].y);
+			float maxY = std::max(std::max(screen[0].y, screen[i - 1].y), screen[i].y);
+			triangle.firstRow = (int)std::ceil(std::max(minY - 0.5f, 0.0f));
+			triangle.lastRow = (int)std::floor(std::min(maxY - 0.5f, (float)(height - 1)));
+			if (triangle.firstRow <= triangle.lastRow)
+				output.push_back(triangle);
+		}
+	}
+
+	void OcclusionCuller::rasterizeBand(int tileRow)
+	{
+		int firstRow = tileRow * TILE_SIZE;
+		int lastRow = firstRow + TILE_SIZE - 1;
+		std::fill(depth.begin() + firstRow * width, depth.begin() + (lastRow + 1) * width, 1.0f);
+
+		const std::vector<uint32_t>& band = bandTriangles[tileRow];
+		for (size_t i = 0; i < band.size(); i++) {
+			const ScreenTriangle& triangle = triangles[band[i]];
+			rasterizeTriangle(triangle, std::max(firstRow, triangle.firstRow), std::min(lastRow, triangle.lastRow));
+		}
+
+		for (int tileX = 0; tileX < tilesX; tileX++) {
+			float farthest = 0.0f;
+			for (int y = firstRow; y <= lastRow; y++) {
+				const float* row = &depth[y * width + tileX * TILE_SIZE];
+				for (int x = 0; x < TILE_SIZE; x++)
+					farthest = std::max(farthest, row[x]);
+			}
+			tileDepth[tileRow * tilesX + tileX] = farthest;
+		}
+	}
+
+	void OcclusionCuller::rasterizeTriangle(const ScreenTriangle& triangle, int firstRow, int lastRow)
+	{
+		const glm::vec3& v0 = triangle.vertices[0];
+		const glm::vec3& v1 = triangle.vertices[1];
+		const glm::vec3& v2 = triangle.vertices[2];
+
+		float minX = std::min(std::min(v0.x, v1.x), v2.x);
+		float maxX = std::max(std::max(v0.x, v1.x), v2.x);
+		int firstColumn = (int)std::ceil(std::max(minX - 0.5f, 0.0f));
+		int lastColumn = (int)std::floor(std::min(maxX - 0.5f, (float)(width - 1)));
+		if (firstColumn > lastColumn)
+			return;
+
+		// edge functions w = a * x + b * y + c, each one opposite a vertex and positive inside;
+		// the depth is interpolated with them
+		float a0 = v1.y - v2.y, b0 = v2.x - v1.x, c0 = -(a0 * v1.x + b0 * v1.y);
+		float a1 = v2.y - v0.y, b1 = v0.x - v2.x, c1 = -(a1 * v2.x + b1 * v2.y);
+		float a2 = v0.y - v1.y, b2 = v1.x - v0.x, c2 = -(a2 * v0.x + b2 * v0.y);
+		float inverseArea = 1.0f / edge(v0, v1, v2.x, v2.y);
+		float az = (a0 * v0.z + a1 * v1.z + a2 * v2.z) * inverseArea;
+		float bz = (b0 * v0.z + b1 * v1.z + b2 * v2.z) * inverseArea;
+		float cz = (c0 * v0.z + c1 * v1.z + c2 * v2.z) * inverseArea;
+
+		// inner conservative - a pixel is only covered when all of it is inside the occluder, so the
+		// centers are tested against the outline edges moved in by half a pixel (up to the least
+		// covered corner). The edges inside the occluder stay, a neighbor covers the other side.
+		// The depth of a pixel is the farthest one over it.
+		if (triangle.outlineEdges & 1)
+			c0 -= 0.5f * (std::abs(a0) + std::abs(b0));
+		if (triangle.outlineEdges & 2)
+			c1 -= 0.5f * (std::abs(a1) + std::abs(b1));
+		if (triangle.outlineEdges & 4)
+			c2 -= 0.5f * (std::abs(a2) + std::abs(b2));
+		cz += 0.5f * (std::abs(az) + std::abs(bz));
+
+		for (int y = firstRow; y <= lastRow; y++) {
+			float py = y + 0.5f;
+			float* row = &depth[y * width];
+			int x = firstColumn;
+
+#ifdef OCCLUSION_CULLER_SSE2
+			// from the group of four the first column is in, the rows are a multiple of 8 wide
+			x = firstColumn & ~3;
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+			__m128 rowW0 = _mm_set1_ps(b0 * py + c0);
+			__m128 rowW1 = _mm_set1_ps(b1 * py + c1);
+			__m128 rowW2 = _mm_set1_ps(b2 * py + c2);
+			__m128 rowZ = _mm_set1_ps(bz * py + cz);
+			for (; x <= lastColumn; x += 4) {
+				__m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+				__m128 w0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a0), px), rowW0);
+				__m128 w1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a1), px), rowW1);
+				__m128 w2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a2), px), rowW2);
+				__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(w0, zero), _mm_cmpge_ps(w1, zero)), _mm_cmpge_ps(w2, zero));
+				if (_mm_movemask_ps(inside) == 0)
+					continue;
+
+				__m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(az), px), rowZ);
+				__m128 current = _mm_loadu_ps(row + x);
+				__m128 nearer = _mm_min_ps(current, z);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+			}
+#endif
+
+			for (; x <= lastColumn; x++) {
+				float px = x + 0.5f;
+				if (a0 * px + b0 * py + c0 < 0.0f || a1 * px + b1 * py + c1 < 0.0f || a2 * px + b2 * py + c2 < 0.0f)
+					continue;
+				row[x] = std::min(row[x], az * px + bz * py + cz);
+			}
+		}
+	}
+
+}
@@ -0,0 +1,119 @@
+#ifndef OcclusionCuller_hpp
+#define OcclusionCuller_hpp
+
+#include "FrustumCuller.hpp"
+#include "Mesh.hpp"
+
+#include "glm/glm.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <vector>
+
+namespace gps {
+
+    // Software occlusion culling - a few large meshes (occluders) are rasterized on the CPU into a
+    // small depth buffer, and the boxes of the other meshes are tested against it before they are
+    // submitted. The buffer keeps the farthest depth of every 8x8 tile as well (a one level
+    // hierarchical Z), so that most boxes are decided without looking at their pixels.
+    // The occluders are rasterized in horizontal bands on the thread pool, four pixels at a time
+    // with SSE, while the caller goes on with the rest of the frame.
+    class OcclusionCuller
+    {
+    public:
+        // Tests since the last reset, and time taken by the last rasterization
+        struct Statistics
+        {
+            unsigned tested;
+            unsigned occluded;
+            double renderMilliseconds;
+        };
+
+        // width is rounded up to a multiple of 8, height as well
+        explicit OcclusionCuller(int width = 256, int height = 128);
+        ~OcclusionCuller();
+
+        // Adds the full detail level of the mesh as an occluder. The simplified levels are not used:
+        // they are not conservative proxies (a collapse can move the surface outwards), so they could
+        // hide meshes that are visible. The mesh needs its geometry; cutout meshes are skipped (the
+        // alpha test leaves holes in them), returns false for those.
+        bool addOccluder(const Mesh& mesh, const glm::mat4& transform);
+        // Adds a triangle list as an occluder, positions in model space
+        void addOccluder(const std::vector<glm::vec3>& meshPositions, const std::vector<uint32_t>& meshIndices, const glm::mat4& transform);
+        void clearOccluders();
+        size_t getTriangleCount() const;
+
+        // Starts rasterizing the occluders as seen through viewProjection on the thread pool
+        void beginRender(const glm::mat4& viewProjection);
+        // Waits for the rasterization started by beginRender
+        void finishRender();
+
+        // True if the box is entirely behind the occluders of the last rasterization (waits for it),
+        // false for a box that crosses the near plane or when nothing was rasterized
+        bool isOccluded(const BoundingBox& box);
+
+        int getWidth() const;
+        int getHeight() const;
+        // Depth in [0, 1] of a pixel of the buffer, 1 where no occluder was drawn
+        float getDepth(int x, int y);
+
+        const Statistics& getStatistics() const;
+        void resetStatistics();
+
+    private:
+        // Triangle in buffer coordinates - x and y in pixels, z the depth in [0, 1]
+        struct ScreenTriangle
+        {
+            glm::vec3 vertices[3];
+            int firstRow;
+            int lastRow;
+            // bit k set when the edge opposite vertex k is on the outline of the occluder (see
+            // rasterizeTriangle)
+            unsigned outlineEdges;
+        };
+
+        int width;
+        int height;
+        int tilesX;
+        int tilesY;
+
+        // occluders in world space, triangles as index triples
+        std::vector<glm::vec3> positions;
+        std::vector<uint32_t> indices;
+        // for each edge of a triangle (from its vertex k to k + 1) the triangle on the other side
+        // of it, NO_TRIANGLE on the border of a mesh
+        std::vector<uint32_t> neighbors;
+
+        glm::mat4 viewProjection;
+        std::vector<glm::vec4> clipPositions;
+        // winding of each triangle on the buffer, 0 when it is clipped or outside
+        std::vector<int8_t> facing;
+        std::vector<ScreenTriangle> triangles;
+        // triangles overlapping each band of tiles
+        std::vector<std::vector<uint32_t> > bandTriangles;
+        std::vector<float> depth;
+        // farthest depth of each tile
+        std::vector<float> tileDepth;
+        bool rendered;
+        std::future<void> pending;
+        Statistics statistics;
+
+        // Finds the neighbors of the triangles added from firstTriangle on
+        void linkNeighbors(size_t firstTriangle);
+
+        // Job of beginRender
+        void render();
+        // Clips a triangle to the near plane and adds what is left to triangles
+        void setupTriangle(size_t triangle, std::vector<ScreenTriangle>& output) const;
+        // Rasterizes the triangles into the rows of a band of tiles and updates their tile depths
+        void rasterizeBand(int tileRow);
+        void rasterizeTriangle(const ScreenTriangle& triangle, int firstRow, int lastRow);
+
+        OcclusionCuller(const OcclusionCuller&);
+        OcclusionCuller& operator=(const OcclusionCuller&);
+    };
+
+}
+
+#endif /* OcclusionCuller_hpp */
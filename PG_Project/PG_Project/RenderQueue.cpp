@@ -0,0 +1,163 @@
+#include "RenderQueue.hpp"
+#include "Mesh.hpp"
+#include "TextureCache.hpp"
+
+#include <cstring>
+
+namespace gps {
+
+	namespace {
+
+		const std::string modelName = "model";
+
+		// Orders the positive floats by their bits, which grow with the value - the 16 bits kept
+		// are the exponent and 7 bits of mantissa, finer up close than far away
+		uint64_t depthBits(float depth) {
+			if (!(depth > 0.0f))
+				return 0;
+			uint32_t bits;
+			std::memcpy(&bits, &depth, sizeof(bits));
+			return bits >> 16;
+		}
+
+		GLuint textureId(const Mesh& mesh, size_t unit) {
+			if (unit >= mesh.textures.size() || !mesh.textures[unit].handle)
+				return 0;
+			return mesh.textures[unit].handle->getId();
+		}
+	}
+
+	RenderQueue::RenderQueue()
+	{
+		resetStatistics();
+	}
+
+	uint64_t RenderQueue::makeKey(RenderPass pass, bool cutout, GLuint program, uint32_t textureSet, GLuint vertexArray, float depth)
+	{
+		uint64_t key = (uint64_t)(pass & 0xF) << 60;
+		key |= (uint64_t)(cutout ? 1 : 0) << 59;
+		key |= (uint64_t)(program & 0x7FF) << 48;
+		key |= (uint64_t)(textureSet & 0xFFFF) << 32;
+		key |= (uint64_t)(vertexArray & 0xFFFF) << 16;
+		key |= depthBits(depth);
+		return key;
+	}
+
+	uint32_t RenderQueue::addTransform(const glm::mat4& model)
+	{
+		transforms.push_back(model);
+		return (uint32_t)(transforms.size() - 1);
+	}
+
+	void RenderQueue::submit(uint64_t key, Mesh& mesh, Shader& shader, uint32_t transform)
+	{
+		DrawPacket packet = { &mesh, &shader, transform };
+		SortEntry entry = { key, (uint32_t)packets.size() };
+		packets.push_back(packet);
+		entries.push_back(entry);
+	}
+
+	void RenderQueue::execute()
+	{
+		countChanges(entries, submittedStatistics);
+		radixSort(entries, scratch);
+		countChanges(entries, statistics);
+
+		Shader* shader = NULL;
+		ShaderUniform<glm::mat4> modelUniform;
+		for (size_t i = 0; i < entries.size(); i++) {
+			const DrawPacket& packet = packets[entries[i].packet];
+			if (packet.shader != shader) {
+				shader = packet.shader;
+				shader->useShaderProgram();
+				modelUniform = shader->getUniform<glm::mat4>(modelName);
+			}
+			shader->setUniform(modelUniform, transforms[packet.transform]);
+			packet.mesh->Draw(*shader);
+		}
+
+		packets.clear();
+		entries.clear();
+		transforms.clear();
+	}
+
+	size_t RenderQueue::size() const
+	{
+		return packets.size();
+	}
+
+	const RenderQueue::Statistics& RenderQueue::getStatistics() const
+	{
+		return statistics;
+	}
+
+	const RenderQueue::Statistics& RenderQueue::getSubmittedStatistics() const
+	{
+		return submittedStatistics;
+	}
+
+	void RenderQueue::resetStatistics()
+	{
+		std::memset(&statistics, 0, sizeof(statistics));
+		std::memset(&submittedStatistics, 0, sizeof(submittedStatistics));
+	}
+
+	void RenderQueue::radixSort(std::vector<SortEntry>& entries, std::vector<SortEntry>& scratch)
+	{
+		const int DIGITS = 8;
+		size_t count = entries.size();
+		if (count < 2)
+			return;
+
+		// the histograms of all the digits in a single sweep
+		size_t histograms[DIGITS][256];
+		std::memset(histograms, 0, sizeof(histograms));
+		for (size_t i = 0; i < count; i++) {
+			uint64_t key = entries[i].key;
+			for (int digit = 0; digit < DIGITS; digit++)
+				histograms[digit][(key >> (digit * 8)) & 0xFF]++;
+		}
+
+		scratch.resize(count);
+		for (int digit = 0; digit < DIGITS; digit++) {
+			size_t* histogram = histograms[digit];
+			if (histogram[(entries[0].key >> (digit * 8)) & 0xFF] == count)
+				continue;
+
+			// bucket offsets, then a stable scatter
+			size_t offset = 0;
+			for (int bucket = 0; bucket < 256; bucket++) {
+				size_t bucketSize = histogram[bucket];
+				histogram[bucket] = offset;
+				offset += bucketSize;
+			}
+			for (size_t i = 0; i < count; i++)
+				scratch[histogram[(entries[i].key >> (digit * 8)) & 0xFF]++] = entries[i];
+			entries.swap(scratch);
+		}
+	}
+
+	void RenderQueue::countChanges(const std::vector<SortEntry>& order, Statistics& counts) const
+	{
+		const DrawPacket* previous = NULL;
+		for (size_t i = 0; i < order.size(); i++) {
+			const DrawPacket& packet = packets[order[i].packet];
+			counts.draws++;
+			if (!previous || previous->shader->shaderProgram != packet.shader->shaderProgram)
+				counts.programChanges++;
+			if (!previous || previous->mesh->getVertexArray() != packet.mesh->getVertexArray())
+				counts.vertexArrayChanges++;
+
+			size_t units = packet.mesh->textures.size();
+			if (previous && previous->mesh->textures.size() > units)
+				units = previous->mesh->textures.size();
+			for (size_t unit = 0; unit < units; unit++) {
+				GLuint before = previous ? textureId(*previous->mesh, unit) : 0;
+				if (before != textureId(*packet.mesh, unit))
+					counts.textureChanges++;
+			}
+			previous = &packet;
+		}
+	}
+
+}
@@ -0,0 +1,96 @@
+#ifndef RenderQueue_hpp
+#define RenderQueue_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    class Mesh;
+    class Shader;
+
+    // Passes of a frame, the most significant field of the sort key
+    enum RenderPass
+    {
+        RENDER_PASS_SHADOW,
+        RENDER_PASS_SCENE
+    };
+
+    // Draws collected during a frame and executed in the order of their 64 bit sort keys, so that
+    // draws sharing a program, textures and vertex array end up next to each other. Key fields,
+    // most significant first:
+    //   pass (4) | cutout (1) | program (11) | texture set (16) | vertex array (16) | depth (16)
+    // Opaque meshes come before cutout ones, and within the same state the closest are drawn first.
+    class RenderQueue
+    {
+    public:
+        // State changes between consecutive draws
+        struct Statistics
+        {
+            unsigned draws;
+            unsigned programChanges;
+            // texture units whose texture array differs from the previous draw
+            unsigned textureChanges;
+            unsigned vertexArrayChanges;
+        };
+
+        RenderQueue();
+
+        static uint64_t makeKey(RenderPass pass, bool cutout, GLuint program, uint32_t textureSet, GLuint vertexArray, float depth);
+
+        // Model matrix shared by the draws of an object, returns the index to submit them with
+        uint32_t addTransform(const glm::mat4& model);
+
+        // The mesh is drawn at the level of detail it has when the queue is executed
+        void submit(uint64_t key, Mesh& mesh, Shader& shader, uint32_t transform);
+
+        // GL thread - sorts the draws by key, executes them and empties the queue
+        void execute();
+
+        size_t size() const;
+
+        // Counted over the executions since the last reset - sorted is the order the draws were
+        // executed in, submitted the order they were submitted in
+        const Statistics& getStatistics() const;
+        const Statistics& getSubmittedStatistics() const;
+        void resetStatistics();
+
+        // Key of a draw and the draw it stands for - public, with the sort, for the checks
+        struct SortEntry
+        {
+            uint64_t key;
+            uint32_t packet;
+        };
+
+        // Sorts by key, keeping the submission order of equal keys. Least significant digit first,
+        // 8 bits per pass - the passes where all the keys share the digit are skipped.
+        static void radixSort(std::vector<SortEntry>& entries, std::vector<SortEntry>& scratch);
+
+    private:
+        struct DrawPacket
+        {
+            Mesh* mesh;
+            Shader* shader;
+            uint32_t transform;
+        };
+
+        std::vector<DrawPacket> packets;
+        std::vector<SortEntry> entries;
+        std::vector<SortEntry> scratch;
+        std::vector<glm::mat4> transforms;
+        Statistics statistics;
+        Statistics submittedStatistics;
+
+        // Adds the state changes of drawing the packets in the given order
+        void countChanges(const std::vector<SortEntry>& order, Statistics& counts) const;
+
+        RenderQueue(const RenderQueue&);
+        RenderQueue& operator=(const RenderQueue&);
+    };
+
+}
+
+#endif /* RenderQueue_hpp */
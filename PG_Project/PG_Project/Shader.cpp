@@ -1,6 +1,55 @@
 #include "Shader.hpp"
+#include "FileUtils.hpp"
+#include "GLState.hpp"
+
+#include "glm/gtc/type_ptr.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
 
 namespace gps {
+
+    namespace {
+
+        const uint32_t programCacheMagic = 0x50535047; // "GPSP"
+        const uint32_t programCacheVersion = 1;
+
+        struct ProgramCacheHeader
+        {
+            uint32_t magic;
+            uint32_t version;
+            // sources of both stages plus the driver strings
+            uint64_t sourceHash;
+            uint32_t binaryFormat;
+            uint32_t binaryLength;
+        };
+
+        std::string glString(GLenum name) {
+            const GLubyte* value = glGetString(name);
+            return value ? std::string((const char*)value) : std::string();
+        }
+
+        uint64_t hashString(const std::string& value, uint64_t seed) {
+            return hashBytes(value.data(), value.size(), seed);
+        }
+
+        // Program binaries are a core GL 4.1 feature, but drivers may still offer no binary format
+        bool programBinariesSupported() {
+            if (!GLEW_ARB_get_program_binary)
+                return false;
+            GLint formatCount = 0;
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+            return formatCount > 0;
+        }
+    }
+
+    Shader::Shader() : shaderProgram(0)
+    {
+    }
+
     std::string Shader::readShaderFile(std::string fileName)
     {
         std::ifstream shaderFile;
@@ -22,6 +71,29 @@ namespace gps {
         return shaderString;
     }
 
+    std::string Shader::insertDefines(const std::string& source, const std::string& defines)
+    {
+        if (defines.empty())
+            return source;
+
+        // #version has to stay the first statement
+        size_t position = 0;
+        size_t version = source.find("#version");
+        if (version != std::string::npos) {
+            size_t lineEnd = source.find('\n', version);
+            position = lineEnd != std::string::npos ? lineEnd + 1 : source.size();
+        }
+
+        std::string result = source.substr(0, position);
+        if (!result.empty() && result[result.size() - 1] != '\n')
+            result += '\n';
+        result += defines;
+        if (defines[defines.size() - 1] != '\n')
+            result += '\n';
+        result += source.substr(position);
+        return result;
+    }
+
     void Shader::shaderCompileLog(GLuint shaderId)
     {
         GLint success;
@@ -49,10 +121,98 @@ namespace gps {
         }
     }
 
-    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName)
+    bool Shader::loadProgramBinary(const std::string& cacheFileName, uint64_t sourceHash)
     {
-        //read, parse and compile the vertex shader
-        std::string v = readShaderFile(vertexShaderFileName);
+        std::ifstream in(cacheFileName.c_str(), std::ios::binary);
+        if (!in)
+            return false;
+
+        ProgramCacheHeader header;
+        if (!in.read((char*)&header, sizeof(header)) || header.magic != programCacheMagic
+            || header.version != programCacheVersion || header.sourceHash != sourceHash || header.binaryLength == 0)
+            return false;
+
+        std::vector<char> binary(header.binaryLength);
+        if (!in.read(binary.data(), (std::streamsize)binary.size()))
+            return false;
+
+        GLuint program = glCreateProgram();
+        glProgramBinary(program, header.binaryFormat, binary.data(), (GLsizei)binary.size());
+
+        // a driver update can reject binaries it produced itself
+        GLint success;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success) {
+            glDeleteProgram(program);
+            return false;
+        }
+
+        this->shaderProgram = program;
+        return true;
+    }
+
+    void Shader::saveProgramBinary(const std::string& cacheFileName, uint64_t sourceHash)
+    {
+        GLint length = 0;
+        glGetProgramiv(this->shaderProgram, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+
+        std::vector<char> binary(length);
+        GLsizei written = 0;
+        GLenum format = 0;
+        glGetProgramBinary(this->shaderProgram, length, &written, &format, binary.data());
+        if (written <= 0)
+            return;
+
+        ProgramCacheHeader header;
+        header.magic = programCacheMagic;
+        header.version = programCacheVersion;
+        header.sourceHash = sourceHash;
+        header.binaryFormat = format;
+        header.binaryLength = (uint32_t)written;
+
+        // write to a temporary file first so that an interrupted write never leaves a broken cache behind
+        std::string temporaryFileName = cacheFileName + ".tmp";
+        {
+            std::ofstream out(temporaryFileName.c_str(), std::ios::binary | std::ios::trunc);
+            out.write((const char*)&header, sizeof(header));
+            out.write(binary.data(), written);
+            if (!out) {
+                fprintf(stderr, "WARNING: could not write program cache %s\n", cacheFileName.c_str());
+                return;
+            }
+        }
+        replaceFile(temporaryFileName, cacheFileName);
+    }
+
+    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, const std::string& defines)
+    {
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point start = Clock::now();
+
+        std::string v = insertDefines(readShaderFile(vertexShaderFileName), defines);
+        std::string f = insertDefines(readShaderFile(fragmentShaderFileName), defines);
+
+        // a binary is only valid for the same sources on the same driver and GPU
+        bool useProgramCache = programBinariesSupported();
+        std::string cacheFileName = fragmentShaderFileName + ".program";
+        if (!defines.empty()) {
+            char permutation[32];
+            snprintf(permutation, sizeof(permutation), ".%016llx", (unsigned long long)hashBytes(defines.data(), defines.size()));
+            cacheFileName = fragmentShaderFileName + permutation + ".program";
+        }
+        std::string driver = glString(GL_VENDOR) + "\n" + glString(GL_RENDERER) + "\n" + glString(GL_VERSION);
+        uint64_t sourceHash = hashString(f, hashString(v, hashBytes(driver.data(), driver.size())));
+
+        if (useProgramCache && loadProgramBinary(cacheFileName, sourceHash)) {
+            reflect();
+            std::cout << "Shader : " << vertexShaderFileName << " + " << fragmentShaderFileName << " from the program cache in "
+                << std::chrono::duration<double, std::milli>(Clock::now() - start).count() << " ms" << std::endl;
+            return;
+        }
+
+        //parse and compile the vertex shader
         const GLchar* vertexShaderString = v.c_str();
         GLuint vertexShader;
         vertexShader = glCreateShader(GL_VERTEX_SHADER);
@@ -61,8 +221,7 @@ namespace gps {
         //check compilation status
         shaderCompileLog(vertexShader);
 
-        //read, parse and compile the vertex shader
-        std::string f = readShaderFile(fragmentShaderFileName);
+        //parse and compile the fragment shader
         const GLchar* fragmentShaderString = f.c_str();
         GLuint fragmentShader;
         fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
@@ -75,16 +234,140 @@ namespace gps {
         this->shaderProgram = glCreateProgram();
         glAttachShader(this->shaderProgram, vertexShader);
         glAttachShader(this->shaderProgram, fragmentShader);
+        if (useProgramCache)
+            glProgramParameteri(this->shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         glLinkProgram(this->shaderProgram);
         glDeleteShader(vertexShader);
         glDeleteShader(fragmentShader);
         //check linking info
         shaderLinkLog(this->shaderProgram);
+
+        GLint linked;
+        glGetProgramiv(this->shaderProgram, GL_LINK_STATUS, &linked);
+        if (useProgramCache && linked)
+            saveProgramBinary(cacheFileName, sourceHash);
+        reflect();
+
+        std::cout << "Shader : " << vertexShaderFileName << " + " << fragmentShaderFileName << " compiled in "
+            << std::chrono::duration<double, std::milli>(Clock::now() - start).count() << " ms" << std::endl;
     }
 
     void Shader::useShaderProgram()
     {
-        glUseProgram(this->shaderProgram);
+        GLState::global().useProgram(this->shaderProgram);
+    }
+
+    void Shader::reflect()
+    {
+        this->uniforms.clear();
+        this->uniformIndices.clear();
+        this->attributeLocations.clear();
+
+        GLint uniformCount = 0;
+        GLint attributeCount = 0;
+        GLint uniformNameLength = 0;
+        GLint attributeNameLength = 0;
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORMS, &uniformCount);
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_ATTRIBUTES, &attributeCount);
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &uniformNameLength);
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &attributeNameLength);
+        std::vector<GLchar> name(std::max(std::max(uniformNameLength, attributeNameLength), 1));
+
+        for (GLint i = 0; i < uniformCount; i++) {
+            GLsizei length = 0;
+            UniformInfo uniform;
+            glGetActiveUniform(this->shaderProgram, (GLuint)i, (GLsizei)name.size(), &length, &uniform.size, &uniform.type, name.data());
+            std::string uniformName(name.data(), length);
+
+            // members of uniform blocks have no location
+            uniform.location = glGetUniformLocation(this->shaderProgram, uniformName.c_str());
+            if (uniform.location < 0)
+                continue;
+            uniform.valueKnown = false;
+
+            // arrays are reported as name[0] and looked up by their name
+            size_t bracket = uniformName.find('[');
+            if (bracket != std::string::npos)
+                uniformName.erase(bracket);
+
+            this->uniformIndices[uniformName] = (int)this->uniforms.size();
+            this->uniforms.push_back(uniform);
+        }
+
+        for (GLint i = 0; i < attributeCount; i++) {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveAttrib(this->shaderProgram, (GLuint)i, (GLsizei)name.size(), &length, &size, &type, name.data());
+            std::string attributeName(name.data(), length);
+            this->attributeLocations[attributeName] = glGetAttribLocation(this->shaderProgram, attributeName.c_str());
+        }
+    }
+
+    int Shader::findUniform(const std::string& name) const
+    {
+        std::unordered_map<std::string, int>::const_iterator it = this->uniformIndices.find(name);
+        return it != this->uniformIndices.end() ? it->second : -1;
+    }
+
+    GLint Shader::getAttributeLocation(const std::string& name) const
+    {
+        std::unordered_map<std::string, GLint>::const_iterator it = this->attributeLocations.find(name);
+        return it != this->attributeLocations.end() ? it->second : -1;
+    }
+
+    bool Shader::updateValue(int index, const void* value, size_t size)
+    {
+        UniformInfo& uniform = this->uniforms[index];
+        if (uniform.valueKnown && uniform.value.size() == size && std::memcmp(uniform.value.data(), value, size) == 0)
+            return false;
+
+        const unsigned char* bytes = (const unsigned char*)value;
+        uniform.value.assign(bytes, bytes + size);
+        uniform.valueKnown = true;
+        return true;
+    }
+
+    void Shader::setUniform(ShaderUniform<int> uniform, int value)
+    {
+        if (uniform.index >= 0 && updateValue(uniform.index, &value, sizeof(value)))
+            glUniform1i(this->uniforms[uniform.index].location, value);
+    }
+
+    void Shader::setUniform(ShaderUniform<float> uniform, float value)
+    {
+        if (uniform.index >= 0 && updateValue(uniform.index, &value, sizeof(value)))
+            glUniform1f(this->uniforms[uniform.index].location, value);
+    }
+
+    void Shader::setUniform(ShaderUniform<glm::vec3> uniform, const glm::vec3& value)
+    {
+        if (uniform.index >= 0 && updateValue(uniform.index, glm::value_ptr(value), sizeof(value)))
+            glUniform3fv(this->uniforms[uniform.index].location, 1, glm::value_ptr(value));
+    }
+
+    void Shader::setUniform(ShaderUniform<glm::mat3> uniform, const glm::mat3& value)
+    {
+        if (uniform.index >= 0 && updateValue(uniform.index, glm::value_ptr(value), sizeof(value)))
+            glUniformMatrix3fv(this->uniforms[uniform.index].location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+
+    void Shader::setUniform(ShaderUniform<glm::mat4> uniform, const glm::mat4& value)
+    {
+        if (uniform.index >= 0 && updateValue(uniform.index, glm::value_ptr(value), sizeof(value)))
+            glUniformMatrix4fv(this->uniforms[uniform.index].location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+
+    void Shader::setUniform(ShaderUniform<int> uniform, const int* values, int count)
+    {
+        if (uniform.index >= 0 && updateValue(uniform.index, values, count * sizeof(int)))
+            glUniform1iv(this->uniforms[uniform.index].location, count, values);
+    }
+
+    void Shader::setUniform(ShaderUniform<glm::vec3> uniform, const glm::vec3* values, int count)
+    {
+        if (uniform.index >= 0 && updateValue(uniform.index, values, count * sizeof(glm::vec3)))
+            glUniform3fv(this->uniforms[uniform.index].location, count, glm::value_ptr(values[0]));
     }
 
 }
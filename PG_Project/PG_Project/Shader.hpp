@@ -3,25 +3,99 @@
 
 #include <GL/glew.h>
 
+#include "glm/glm.hpp"
+
+#include <cstdint>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace gps {
 
+// Handle to a uniform of one Shader, T being the type of its value (int for samplers). Looked up
+// once instead of calling glGetUniformLocation for every upload; a handle to a uniform the
+// program does not use is valid and does nothing.
+template <typename T>
+struct ShaderUniform
+{
+    int index;
+};
+
 class Shader
 {
 public:
     GLuint shaderProgram;
-    void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
+
+    Shader();
+
+    // The linked program is kept in a <fragment shader>.program file, later runs load it from
+    // there unless the sources, the driver or the GPU changed. defines ("#define NAME value" lines)
+    // are inserted after the #version line of both stages; each set of defines is a separate
+    // program with its own cache file.
+    void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, const std::string& defines = std::string());
     void useShaderProgram();
 
+    template <typename T>
+    ShaderUniform<T> getUniform(const std::string& name) const
+    {
+        ShaderUniform<T> uniform;
+        uniform.index = findUniform(name);
+        return uniform;
+    }
+
+    // -1 if the attribute is not used by the program
+    GLint getAttributeLocation(const std::string& name) const;
+
+    // The program must be in use. A value equal to the one last set through the same handle is
+    // not sent again, so all the uploads to a uniform have to go through here.
+    void setUniform(ShaderUniform<int> uniform, int value);
+    void setUniform(ShaderUniform<float> uniform, float value);
+    void setUniform(ShaderUniform<glm::vec3> uniform, const glm::vec3& value);
+    void setUniform(ShaderUniform<glm::mat3> uniform, const glm::mat3& value);
+    void setUniform(ShaderUniform<glm::mat4> uniform, const glm::mat4& value);
+    void setUniform(ShaderUniform<int> uniform, const int* values, int count);
+    void setUniform(ShaderUniform<glm::vec3> uniform, const glm::vec3* values, int count);
+
+    // One lookup by name, for uniforms set once
+    template <typename T>
+    void setUniform(const std::string& name, const T& value)
+    {
+        setUniform(getUniform<T>(name), value);
+    }
+
 private:
+    // active uniform found by reflection, with the last value uploaded
+    struct UniformInfo
+    {
+        GLint location;
+        GLenum type;
+        GLint size;
+        bool valueKnown;
+        std::vector<unsigned char> value;
+    };
+
+    std::vector<UniformInfo> uniforms;
+    std::unordered_map<std::string, int> uniformIndices;
+    std::unordered_map<std::string, GLint> attributeLocations;
+
+    // Enumerates the active uniforms and attributes of the linked program
+    void reflect();
+    int findUniform(const std::string& name) const;
+    // Remembers the value, false if it is the one already uploaded
+    bool updateValue(int index, const void* value, size_t size);
+
     std::string readShaderFile(std::string fileName);
+    static std::string insertDefines(const std::string& source, const std::string& defines);
     void shaderCompileLog(GLuint shaderId);
     void shaderLinkLog(GLuint shaderProgramId);
+
+    // Program binary cache - false if the file is missing, out of date or rejected by the driver
+    bool loadProgramBinary(const std::string& cacheFileName, uint64_t sourceHash);
+    void saveProgramBinary(const std::string& cacheFileName, uint64_t sourceHash);
 };
 
 }
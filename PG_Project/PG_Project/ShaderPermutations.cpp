@@ -0,0 +1,36 @@
+#include "ShaderPermutations.hpp"
+
+#include <iostream>
+
+namespace gps {
+
+	ShaderPermutations::ShaderPermutations()
+	{
+	}
+
+	void ShaderPermutations::init(const std::string& vertexShaderFileName, const std::string& fragmentShaderFileName, DefinesFunction defines)
+	{
+		this->vertexShaderFileName = vertexShaderFileName;
+		this->fragmentShaderFileName = fragmentShaderFileName;
+		this->defines = defines;
+		variants.clear();
+	}
+
+	Shader& ShaderPermutations::get(uint32_t key)
+	{
+		std::unordered_map<uint32_t, Shader>::iterator it = variants.find(key);
+		if (it != variants.end())
+			return it->second;
+
+		std::cout << "Shader permutation 0x" << std::hex << key << std::dec << " of " << fragmentShaderFileName << std::endl;
+		Shader& shader = variants[key];
+		shader.loadShader(vertexShaderFileName, fragmentShaderFileName, defines ? defines(key) : std::string());
+		return shader;
+	}
+
+	size_t ShaderPermutations::getVariantCount() const
+	{
+		return variants.size();
+	}
+
+}
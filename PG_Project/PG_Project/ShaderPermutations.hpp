@@ -0,0 +1,45 @@
+#ifndef ShaderPermutations_hpp
+#define ShaderPermutations_hpp
+
+#include "Shader.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+namespace gps {
+
+    // Specialized variants of one uber-shader. A key selects the features a variant is built
+    // with; the defines function turns the key into the #define lines inserted in the sources,
+    // so that the features left out are compiled away instead of branched over per fragment.
+    // A variant is built the first time its key is used and kept for the following frames.
+    class ShaderPermutations
+    {
+    public:
+        typedef std::function<std::string(uint32_t key)> DefinesFunction;
+
+        ShaderPermutations();
+
+        void init(const std::string& vertexShaderFileName, const std::string& fragmentShaderFileName, DefinesFunction defines);
+
+        // GL thread - the variant for the key, built on first use. The reference stays valid
+        // while the permutations exist.
+        Shader& get(uint32_t key);
+
+        size_t getVariantCount() const;
+
+    private:
+        std::string vertexShaderFileName;
+        std::string fragmentShaderFileName;
+        DefinesFunction defines;
+        // node based, variants do not move when others are added
+        std::unordered_map<uint32_t, Shader> variants;
+
+        ShaderPermutations(const ShaderPermutations&);
+        ShaderPermutations& operator=(const ShaderPermutations&);
+    };
+
+}
+
+#endif /* ShaderPermutations_hpp */
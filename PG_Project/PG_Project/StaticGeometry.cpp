@@ -0,0 +1,441 @@
+#include "StaticGeometry.hpp"
+#include "GLState.hpp"
+#include "TextureArray.hpp"
+#include "TextureStreamer.hpp"
+
+#include "glm/gtc/matrix_inverse.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <unordered_map>
+
+namespace gps {
+
+	namespace {
+
+		const std::string modelName = "model";
+		const std::string octahedralNormalsName = "octahedralNormals";
+		const std::string rangesFromVertexName = "rangesFromVertex";
+		const std::string staticRangesName = "staticRanges";
+		const std::string diffuseTextureName = "diffuseTexture";
+		const std::string specularTextureName = "specularTexture";
+
+		// the range index of a vertex is 16 bits, and buffer textures hold at least 65536 texels
+		const size_t MAX_RANGES = 32768;
+
+		// Vertex of the float layout - CompactVertex with the position left as floats
+		struct FloatPositionVertex
+		{
+			GLfloat Position[3];
+			// index of the mesh in the range table, the 4th value of CompactVertex::Position otherwise
+			GLushort Range;
+			GLushort Padding;
+			GLshort Normal[2];
+			GLushort TexCoords[2];
+		};
+
+		// Uniforms set by StaticGeometry::Draw, looked up once per program
+		struct GeometryUniforms
+		{
+			GLuint program;
+			ShaderUniform<glm::mat4> model;
+			ShaderUniform<int> octahedralNormals;
+			ShaderUniform<int> rangesFromVertex;
+			ShaderUniform<int> staticRanges;
+			ShaderUniform<int> diffuseTexture;
+			ShaderUniform<int> specularTexture;
+		};
+
+		// GL thread - the entry of a shader is looked up again when it loads another program
+		const GeometryUniforms& geometryUniforms(const Shader& shader) {
+			static std::unordered_map<const Shader*, GeometryUniforms> cache;
+			GeometryUniforms& uniforms = cache[&shader];
+			if (uniforms.program != shader.shaderProgram || uniforms.program == 0) {
+				uniforms.program = shader.shaderProgram;
+				uniforms.model = shader.getUniform<glm::mat4>(modelName);
+				uniforms.octahedralNormals = shader.getUniform<int>(octahedralNormalsName);
+				uniforms.rangesFromVertex = shader.getUniform<int>(rangesFromVertexName);
+				uniforms.staticRanges = shader.getUniform<int>(staticRangesName);
+				uniforms.diffuseTexture = shader.getUniform<int>(diffuseTextureName);
+				uniforms.specularTexture = shader.getUniform<int>(specularTextureName);
+			}
+			return uniforms;
+		}
+
+		std::shared_ptr<TextureHandle> findTexture(const Mesh& mesh, const std::string& type) {
+			for (size_t i = 0; i < mesh.textures.size(); i++) {
+				if (mesh.textures[i].type == type)
+					return mesh.textures[i].handle;
+			}
+			return std::shared_ptr<TextureHandle>();
+		}
+
+		const TextureArray* arrayOf(const std::shared_ptr<TextureHandle>& handle) {
+			return handle ? &handle->getArray() : NULL;
+		}
+
+		float layerOf(const std::shared_ptr<TextureHandle>& handle) {
+			return handle ? (float)handle->getLayer() : 0.0f;
+		}
+	}
+
+	StaticGeometry::StaticGeometry() :
+		VAO(0), VBO(0), EBO(0), indexType(GL_UNSIGNED_INT), format(VERTEX_FORMAT_COMPACT), rangeBuffer(0), rangeTexture(0),
+		textureGeneration(0), built(false), lodErrorThreshold(0.001f), maxQuantizationError(0.005f)
+	{
+		resetStatistics();
+	}
+
+	StaticGeometry::~StaticGeometry()
+	{
+		if (!built)
+			return;
+		glDeleteBuffers(1, &VBO);
+		glDeleteBuffers(1, &EBO);
+		glDeleteVertexArrays(1, &VAO);
+		GLState::global().vertexArrayDeleted(VAO);
+		glDeleteTextures(1, &rangeTexture);
+		GLState::global().textureDeleted(rangeTexture);
+		glDeleteBuffers(1, &rangeBuffer);
+	}
+
+	void StaticGeometry::add(Model3D& model, const glm::mat4& transform)
+	{
+		std::vector<Mesh>& meshes = model.getMeshes();
+		transforms.push_back(transform);
+		for (size_t i = 0; i < meshes.size(); i++) {
+			if (meshes[i].vertices.empty()) {
+				std::cerr << "WARNING: static geometry needs a model loaded with keepGeometry" << std::endl;
+				continue;
+			}
+			if (ranges.size() == MAX_RANGES) {
+				std::cerr << "WARNING: static geometry is full, " << meshes.size() - i << " meshes left out" << std::endl;
+				break;
+			}
+			Range range = { &meshes[i], transforms.size() - 1, 0, 0,
+				findTexture(meshes[i], diffuseTextureName), findTexture(meshes[i], specularTextureName) };
+			ranges.push_back(range);
+		}
+	}
+
+	void StaticGeometry::build()
+	{
+		// world space bounds of each model - the meshes of a model share a grid, so that they agree
+		// on the positions they have in common (see Model3D)
+		std::vector<BoundingBox> grids(transforms.size());
+		std::vector<bool> emptyGrids(transforms.size(), true);
+		bool shortIndices = true;
+		size_t vertexCount = 0;
+		size_t indexCount = 0;
+		for (size_t i = 0; i < ranges.size(); i++) {
+			const Mesh& mesh = *ranges[i].mesh;
+			const glm::mat4& transform = transforms[ranges[i].transform];
+			BoundingBox& grid = grids[ranges[i].transform];
+			for (size_t v = 0; v < mesh.vertices.size(); v++) {
+				glm::vec3 position = glm::vec3(transform * glm::vec4(mesh.vertices[v].Position, 1.0f));
+				grid.minimum = emptyGrids[ranges[i].transform] ? position : glm::min(grid.minimum, position);
+				grid.maximum = emptyGrids[ranges[i].transform] ? position : glm::max(grid.maximum, position);
+				emptyGrids[ranges[i].transform] = false;
+			}
+			// indices are relative to the base vertex of their mesh
+			if (mesh.vertices.size() > 65536)
+				shortIndices = false;
+			vertexCount += mesh.vertices.size();
+			indexCount += mesh.indices.size();
+		}
+
+		// half a step of the grid is the largest error of a compact position
+		format = VERTEX_FORMAT_COMPACT;
+		for (size_t i = 0; i < grids.size(); i++) {
+			glm::vec3 size = grids[i].maximum - grids[i].minimum;
+			float error = std::max(size.x, std::max(size.y, size.z)) / 65535.0f * 0.5f;
+			if (!emptyGrids[i] && error > maxQuantizationError) {
+				std::cout << "Static geometry: model of size " << size.x << " x " << size.y << " x " << size.z
+					<< " is too large for 16 bit positions, keeping floats" << std::endl;
+				format = VERTEX_FORMAT_FLOAT;
+				break;
+			}
+		}
+
+		std::vector<CompactVertex> compactVertices;
+		std::vector<FloatPositionVertex> floatVertices;
+		std::vector<GLuint> indices;
+		if (format == VERTEX_FORMAT_COMPACT)
+			compactVertices.reserve(vertexCount);
+		else
+			floatVertices.reserve(vertexCount);
+		indices.reserve(indexCount);
+		rangeTable.reserve(ranges.size() * 8);
+		for (size_t i = 0; i < ranges.size(); i++) {
+			Range& range = ranges[i];
+			const Mesh& mesh = *range.mesh;
+			const glm::mat4& transform = transforms[range.transform];
+			glm::mat3 normalTransform = glm::inverseTranspose(glm::mat3(transform));
+
+			// float positions are used as they are
+			glm::vec3 positionOffset(0.0f);
+			glm::vec3 positionScale(1.0f);
+			glm::vec3 inverseScale(0.0f);
+			if (format == VERTEX_FORMAT_COMPACT) {
+				positionOffset = grids[range.transform].minimum;
+				positionScale = grids[range.transform].maximum - positionOffset;
+				for (int axis = 0; axis < 3; axis++) {
+					if (positionScale[axis] > 0.0f)
+						inverseScale[axis] = 1.0f / positionScale[axis];
+				}
+			}
+
+			// the layers are written by groupRanges
+			GLfloat entry[8] = { positionOffset.x, positionOffset.y, positionOffset.z, 0.0f,
+				positionScale.x, positionScale.y, positionScale.z, 0.0f };
+			rangeTable.insert(rangeTable.end(), entry, entry + 8);
+
+			range.firstIndex = (GLuint)indices.size();
+			range.baseVertex = (GLint)(compactVertices.size() + floatVertices.size());
+			for (size_t v = 0; v < mesh.vertices.size(); v++) {
+				Vertex vertex = mesh.vertices[v];
+				vertex.Position = glm::vec3(transform * glm::vec4(vertex.Position, 1.0f));
+				vertex.Normal = glm::normalize(normalTransform * vertex.Normal);
+				CompactVertex compact = compressVertex(vertex, positionOffset, inverseScale);
+				compact.Position[3] = (GLushort)i;
+				if (format == VERTEX_FORMAT_COMPACT) {
+					compactVertices.push_back(compact);
+					continue;
+				}
+				FloatPositionVertex floatVertex;
+				floatVertex.Position[0] = vertex.Position.x;
+				floatVertex.Position[1] = vertex.Position.y;
+				floatVertex.Position[2] = vertex.Position.z;
+				floatVertex.Range = (GLushort)i;
+				floatVertex.Padding = 0;
+				floatVertex.Normal[0] = compact.Normal[0];
+				floatVertex.Normal[1] = compact.Normal[1];
+				floatVertex.TexCoords[0] = compact.TexCoords[0];
+				floatVertex.TexCoords[1] = compact.TexCoords[1];
+				floatVertices.push_back(floatVertex);
+			}
+			indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+		}
+		groupRanges();
+
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glGenBuffers(1, &EBO);
+
+		GLState::global().bindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		if (format == VERTEX_FORMAT_COMPACT)
+			glBufferData(GL_ARRAY_BUFFER, compactVertices.size() * sizeof(CompactVertex), compactVertices.data(), GL_STATIC_DRAW);
+		else
+			glBufferData(GL_ARRAY_BUFFER, floatVertices.size() * sizeof(FloatPositionVertex), floatVertices.data(), GL_STATIC_DRAW);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		if (shortIndices) {
+			std::vector<GLushort> packedIndices(indices.begin(), indices.end());
+			indexType = GL_UNSIGNED_SHORT;
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, packedIndices.size() * sizeof(GLushort), packedIndices.data(), GL_STATIC_DRAW);
+		}
+		else {
+			indexType = GL_UNSIGNED_INT;
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+		}
+
+		// the compact layout of Mesh (or its float position variant), with the padding of the position read as the range
+		if (format == VERTEX_FORMAT_COMPACT) {
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(CompactVertex), (GLvoid*)offsetof(CompactVertex, Position));
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(CompactVertex), (GLvoid*)offsetof(CompactVertex, Normal));
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactVertex), (GLvoid*)offsetof(CompactVertex, TexCoords));
+			glEnableVertexAttribArray(3);
+			glVertexAttribIPointer(3, 1, GL_UNSIGNED_SHORT, sizeof(CompactVertex), (GLvoid*)(offsetof(CompactVertex, Position) + 3 * sizeof(GLushort)));
+		}
+		else {
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(FloatPositionVertex), (GLvoid*)offsetof(FloatPositionVertex, Position));
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(FloatPositionVertex), (GLvoid*)offsetof(FloatPositionVertex, Normal));
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(FloatPositionVertex), (GLvoid*)offsetof(FloatPositionVertex, TexCoords));
+			glEnableVertexAttribArray(3);
+			glVertexAttribIPointer(3, 1, GL_UNSIGNED_SHORT, sizeof(FloatPositionVertex), (GLvoid*)offsetof(FloatPositionVertex, Range));
+		}
+
+		GLState::global().bindVertexArray(0);
+
+		glGenBuffers(1, &rangeBuffer);
+		glBindBuffer(GL_TEXTURE_BUFFER, rangeBuffer);
+		glBufferData(GL_TEXTURE_BUFFER, rangeTable.size() * sizeof(GLfloat), rangeTable.data(), GL_DYNAMIC_DRAW);
+		glGenTextures(1, &rangeTexture);
+		GLState::global().bindTexture(STATIC_RANGES_UNIT, GL_TEXTURE_BUFFER, rangeTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, rangeBuffer);
+
+		visibility.assign(ranges.size(), 1);
+		built = true;
+
+		std::cout << "Static geometry: " << ranges.size() << " meshes, " << vertexCount << " "
+			<< (format == VERTEX_FORMAT_COMPACT ? "compact" : "float") << " vertices, " << groups.size() << " texture groups" << std::endl;
+	}
+
+	bool StaticGeometry::isBuilt() const
+	{
+		return built;
+	}
+
+	void StaticGeometry::selectLods(const glm::mat4& view, const glm::mat4& projection)
+	{
+		for (size_t i = 0; i < ranges.size(); i++) {
+			// culled meshes are not drawn, they keep their level
+			if (!visibility.empty() && !visibility[i])
+				continue;
+			glm::mat4 modelView = view * transforms[ranges[i].transform];
+			ranges[i].mesh->selectLod(modelView, projection, lodErrorThreshold);
+		}
+	}
+
+	void StaticGeometry::requestTextureLevels(const glm::mat4& view, const glm::mat4& projection)
+	{
+		for (size_t i = 0; i < ranges.size(); i++) {
+			// culled meshes do not stream their textures in
+			if (!visibility.empty() && !visibility[i])
+				continue;
+			ranges[i].mesh->requestTextureLevels(view * transforms[ranges[i].transform], projection);
+		}
+	}
+
+	size_t StaticGeometry::getMeshCount() const
+	{
+		return ranges.size();
+	}
+
+	BoundingBox StaticGeometry::getMeshBounds(size_t mesh) const
+	{
+		return ranges[mesh].mesh->getBoundingBox().transformed(transforms[ranges[mesh].transform]);
+	}
+
+	void StaticGeometry::setVisibility(const std::vector<uint8_t>& visible)
+	{
+		if (built && visible.size() == ranges.size())
+			visibility = visible;
+	}
+
+	void StaticGeometry::Draw(gps::Shader& shader, MeshBucket bucket)
+	{
+		if (!built)
+			return;
+
+		// a streamed texture moved to an array of its own or back
+		if (textureGeneration != TextureStreamer::global().getGeneration()) {
+			groupRanges();
+			glBindBuffer(GL_TEXTURE_BUFFER, rangeBuffer);
+			glBufferSubData(GL_TEXTURE_BUFFER, 0, rangeTable.size() * sizeof(GLfloat), rangeTable.data());
+		}
+
+		shader.useShaderProgram();
+		const GeometryUniforms& uniforms = geometryUniforms(shader);
+		// the transforms are already applied to the vertices, the positions are dequantized with the range table
+		shader.setUniform(uniforms.model, glm::mat4(1.0f));
+		shader.setUniform(uniforms.octahedralNormals, 1);
+		shader.setUniform(uniforms.rangesFromVertex, 1);
+		shader.setUniform(uniforms.staticRanges, (int)STATIC_RANGES_UNIT);
+		GLState::global().bindTexture(STATIC_RANGES_UNIT, GL_TEXTURE_BUFFER, rangeTexture);
+		GLState::global().bindVertexArray(VAO);
+
+		bool textured = uniforms.diffuseTexture.index >= 0 || uniforms.specularTexture.index >= 0;
+
+		for (size_t i = 0; i < groups.size(); i++) {
+			const Group& group = groups[i];
+			if (!ranges[group.ranges[0]].mesh->inBucket(bucket))
+				continue;
+
+			// the textures of a group with no visible mesh are not bound
+			addDraws(group);
+			if (textured && !counts.empty()) {
+				shader.setUniform(uniforms.diffuseTexture, 0);
+				shader.setUniform(uniforms.specularTexture, 1);
+				TextureArray::bind(0, group.diffuse ? group.diffuse->getId() : 0);
+				TextureArray::bind(1, group.specular ? group.specular->getId() : 0);
+				TextureArray::unbindFrom(2);
+				flushDraws();
+			}
+		}
+		flushDraws();
+	}
+
+	void StaticGeometry::setLodErrorThreshold(float threshold)
+	{
+		lodErrorThreshold = threshold;
+	}
+
+	void StaticGeometry::setMaxQuantizationError(float error)
+	{
+		maxQuantizationError = error;
+	}
+
+	const StaticGeometry::Statistics& StaticGeometry::getStatistics() const
+	{
+		return statistics;
+	}
+
+	void StaticGeometry::resetStatistics()
+	{
+		statistics.drawCalls = 0;
+		statistics.meshes = 0;
+	}
+
+	void StaticGeometry::groupRanges()
+	{
+		groups.clear();
+		for (size_t i = 0; i < ranges.size(); i++) {
+			const Range& range = ranges[i];
+			rangeTable[i * 8 + 3] = layerOf(range.diffuse);
+			rangeTable[i * 8 + 7] = layerOf(range.specular);
+
+			// one call for all the meshes of the bucket that sample the same texture arrays
+			bool cutout = range.mesh->isCutout();
+			size_t group = 0;
+			while (group < groups.size() && (groups[group].cutout != cutout
+				|| arrayOf(groups[group].diffuse) != arrayOf(range.diffuse) || arrayOf(groups[group].specular) != arrayOf(range.specular)))
+				group++;
+			if (group == groups.size()) {
+				Group newGroup;
+				newGroup.cutout = cutout;
+				newGroup.diffuse = range.diffuse;
+				newGroup.specular = range.specular;
+				groups.push_back(newGroup);
+			}
+			groups[group].ranges.push_back(i);
+		}
+		textureGeneration = TextureStreamer::global().getGeneration();
+	}
+
+	void StaticGeometry::addDraws(const Group& group)
+	{
+		size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		for (size_t i = 0; i < group.ranges.size(); i++) {
+			if (!visibility[group.ranges[i]])
+				continue;
+			const Range& range = ranges[group.ranges[i]];
+			const MeshLod& lod = range.mesh->getLods()[range.mesh->getLod()];
+			counts.push_back((GLsizei)lod.indexCount);
+			offsets.push_back((const GLvoid*)((range.firstIndex + lod.indexOffset) * indexSize));
+			baseVertices.push_back(range.baseVertex);
+		}
+	}
+
+	void StaticGeometry::flushDraws()
+	{
+		if (counts.empty())
+			return;
+
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), indexType, offsets.data(), (GLsizei)counts.size(), baseVertices.data());
+		statistics.drawCalls++;
+		statistics.meshes += (unsigned)counts.size();
+		counts.clear();
+		offsets.clear();
+		baseVertices.clear();
+	}
+
+}
@@ -0,0 +1,140 @@
+#ifndef StaticGeometry_hpp
+#define StaticGeometry_hpp
+
+#include "FrustumCuller.hpp"
+#include "Mesh.hpp"
+#include "Model3D.hpp"
+#include "Shader.hpp"
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace gps {
+
+    // Texture unit of the range table of the static geometry (staticRanges in the scene shaders)
+    const GLuint STATIC_RANGES_UNIT = 4;
+
+    // Meshes that never move, packed into one vertex and one index buffer with their transform
+    // applied, so that they are all drawn from a single vertex array. Each mesh keeps its own
+    // index range and base vertex; the meshes that sample the same texture arrays are drawn
+    // together with glMultiDrawElementsBaseVertex. Since a single draw covers several meshes, each
+    // vertex has the index of its mesh in a range table (a buffer texture) holding the position
+    // dequantization and the texture layers of the mesh. The compact positions of a model are
+    // quantized on a grid around the model in world space - the vertices stay floats when one of
+    // the models is too large for it.
+    class StaticGeometry
+    {
+    public:
+        // Calls made by Draw since the last reset
+        struct Statistics
+        {
+            unsigned drawCalls;
+            unsigned meshes;
+        };
+
+        StaticGeometry();
+        ~StaticGeometry();
+
+        // Adds the meshes of a model loaded with ModelLoadOptions::keepGeometry - the model keeps
+        // its meshes (their levels of detail and textures are used from there) and must outlive this
+        void add(Model3D& model, const glm::mat4& transform);
+
+        // GL thread - uploads the meshes added so far, the models can then release their geometry
+        void build();
+        bool isBuilt() const;
+
+        // Picks the level of detail of every visible mesh (see setVisibility) from its projected size
+        void selectLods(const glm::mat4& view, const glm::mat4& projection);
+
+        // Requests the texture levels of every visible mesh - from the camera only, once the
+        // visibility is the camera's
+        void requestTextureLevels(const glm::mat4& view, const glm::mat4& projection);
+
+        size_t getMeshCount() const;
+        // World space box of a mesh, in the order the meshes were added
+        BoundingBox getMeshBounds(size_t mesh) const;
+
+        // Meshes drawn until the next call, one flag per mesh (all the meshes are drawn before the first one)
+        void setVisibility(const std::vector<uint8_t>& visible);
+
+        // Draws the meshes of the bucket at their selected level of detail - the shader variant
+        // reads the texture layers from the vertices. A shader that samples no texture draws the
+        // whole bucket with one call.
+        void Draw(gps::Shader& shader, MeshBucket bucket);
+
+        // Largest error of a simplified mesh, as a fraction of the screen height
+        void setLodErrorThreshold(float threshold);
+
+        // Largest distance (in world units) a compact position may move from its float value,
+        // see ModelLoadOptions::maxQuantizationError - set it before build()
+        void setMaxQuantizationError(float error);
+
+        const Statistics& getStatistics() const;
+        void resetStatistics();
+
+    private:
+        // Index range and base vertex of a mesh in the shared buffers
+        struct Range
+        {
+            Mesh* mesh;
+            size_t transform;
+            GLuint firstIndex;
+            GLint baseVertex;
+            std::shared_ptr<TextureHandle> diffuse;
+            std::shared_ptr<TextureHandle> specular;
+        };
+
+        // Meshes drawn by one call - same bucket and texture arrays
+        struct Group
+        {
+            bool cutout;
+            std::shared_ptr<TextureHandle> diffuse;
+            std::shared_ptr<TextureHandle> specular;
+            std::vector<size_t> ranges;
+        };
+
+        std::vector<Range> ranges;
+        std::vector<glm::mat4> transforms;
+        std::vector<Group> groups;
+        std::vector<uint8_t> visibility;
+
+        GLuint VAO;
+        GLuint VBO;
+        GLuint EBO;
+        GLenum indexType;
+        VertexFormat format;
+        // two RGBA32F texels per range: position offset and diffuse layer, position scale and specular layer
+        std::vector<GLfloat> rangeTable;
+        GLuint rangeBuffer;
+        GLuint rangeTexture;
+        // TextureStreamer generation the groups and the layers of the range table were made for
+        unsigned textureGeneration;
+        bool built;
+        float lodErrorThreshold;
+        float maxQuantizationError;
+        Statistics statistics;
+
+        // glMultiDrawElementsBaseVertex arguments, reused by every call
+        std::vector<GLsizei> counts;
+        std::vector<const GLvoid*> offsets;
+        std::vector<GLint> baseVertices;
+
+        // Groups the ranges by bucket and texture arrays, and writes their layers to the range table -
+        // again whenever a streamed texture moves to another array
+        void groupRanges();
+
+        // Adds the selected levels of the ranges of the group to the call arguments
+        void addDraws(const Group& group);
+        void flushDraws();
+
+        StaticGeometry(const StaticGeometry&);
+        StaticGeometry& operator=(const StaticGeometry&);
+    };
+
+}
+
+#endif /* StaticGeometry_hpp */
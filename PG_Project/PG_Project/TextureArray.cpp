@@ -0,0 +1,160 @@
+#include "TextureArray.hpp"
+#include "TextureCompressor.hpp"
+#include "GLState.hpp"
+
+#include <algorithm>
+
+namespace gps {
+
+	namespace {
+
+		// units Mesh::Draw may leave a texture array on
+		const GLuint MAX_TEXTURE_UNITS = 16;
+
+		size_t levelSize(GLenum format, int width, int height) {
+			if (format == GL_RGBA)
+				return (size_t)width * height * 4;
+			return compressedSize(format, width, height);
+		}
+	}
+
+	TextureArray::TextureArray(int width, int height, GLenum format, size_t levelCount, size_t residentLevel, int capacity) :
+		id(0), width(width), height(height), format(format), levelCount(levelCount), residentLevel(residentLevel),
+		capacity(capacity), usedLayers(capacity, false), layerCount(0)
+	{
+		glGenTextures(1, &id);
+		bind(0, id);
+
+		// storage for all the layers, level by level
+		for (size_t level = residentLevel; level < levelCount; level++) {
+			int levelWidth = std::max(width >> level, 1);
+			int levelHeight = std::max(height >> level, 1);
+			GLint target = (GLint)(level - residentLevel);
+			if (format == GL_RGBA) {
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, target, GL_RGBA, levelWidth, levelHeight, capacity, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			}
+			else {
+				GLsizei size = (GLsizei)(levelSize(format, levelWidth, levelHeight) * capacity);
+				glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, target, format, levelWidth, levelHeight, capacity, 0, size, NULL);
+			}
+		}
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, (GLint)(levelCount - residentLevel - 1));
+
+		if (format != GL_RGBA) {
+			// the grey formats only store red (and green for the alpha)
+			GLint swizzle[4];
+			compressedFormatSwizzle(format, swizzle);
+			glTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+		}
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+
+	TextureArray::~TextureArray()
+	{
+		glDeleteTextures(1, &id);
+		GLState::global().textureDeleted(id);
+	}
+
+	bool TextureArray::matches(const TextureImage& image, size_t residentLevel) const
+	{
+		return image.width == width && image.height == height && image.format == format
+			&& image.levels.size() == levelCount && residentLevel == this->residentLevel;
+	}
+
+	bool TextureArray::isFull() const
+	{
+		return layerCount == capacity;
+	}
+
+	int TextureArray::add(const TextureImage& image)
+	{
+		int layer = (int)(std::find(usedLayers.begin(), usedLayers.end(), false) - usedLayers.begin());
+		usedLayers[layer] = true;
+		layerCount++;
+
+		bind(0, id);
+		for (size_t level = residentLevel; level < levelCount; level++) {
+			const TextureLevel& data = image.levels[level];
+			GLint target = (GLint)(level - residentLevel);
+			if (format == GL_RGBA) {
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, target, 0, 0, layer, data.width, data.height, 1, GL_RGBA, GL_UNSIGNED_BYTE, data.data);
+			}
+			else {
+				glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, target, 0, 0, layer, data.width, data.height, 1, format, (GLsizei)data.size, data.data);
+			}
+		}
+		return layer;
+	}
+
+	void TextureArray::remove(int layer)
+	{
+		usedLayers[layer] = false;
+		layerCount--;
+	}
+
+	GLuint TextureArray::getId() const
+	{
+		return id;
+	}
+
+	int TextureArray::getWidth() const
+	{
+		return width;
+	}
+
+	int TextureArray::getHeight() const
+	{
+		return height;
+	}
+
+	size_t TextureArray::getLevelCount() const
+	{
+		return levelCount;
+	}
+
+	size_t TextureArray::getResidentLevel() const
+	{
+		return residentLevel;
+	}
+
+	int TextureArray::getCapacity() const
+	{
+		return capacity;
+	}
+
+	int TextureArray::getLayerCount() const
+	{
+		return layerCount;
+	}
+
+	size_t TextureArray::memorySize() const
+	{
+		return layerSize(format, width, height, residentLevel, levelCount) * capacity;
+	}
+
+	size_t TextureArray::layerSize(GLenum format, int width, int height, size_t first, size_t last)
+	{
+		size_t size = 0;
+		for (size_t level = first; level < last; level++)
+			size += levelSize(format, std::max(width >> level, 1), std::max(height >> level, 1));
+		return size;
+	}
+
+	void TextureArray::bind(GLuint unit, GLuint id)
+	{
+		GLState::global().bindTexture(unit, GL_TEXTURE_2D_ARRAY, id);
+	}
+
+	void TextureArray::unbindFrom(GLuint firstUnit)
+	{
+		for (GLuint unit = firstUnit; unit < MAX_TEXTURE_UNITS; unit++) {
+			if (GLState::global().getTexture(unit, GL_TEXTURE_2D_ARRAY) != 0)
+				bind(unit, 0);
+		}
+	}
+
+}
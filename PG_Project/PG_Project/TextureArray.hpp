@@ -0,0 +1,76 @@
+#ifndef TextureArray_hpp
+#define TextureArray_hpp
+
+#include <GL/glew.h>
+
+#include "TextureCache.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+    // GL_TEXTURE_2D_ARRAY holding textures of the same size, format and number of mip levels,
+    // one per layer, so that meshes using different textures do not need different binds.
+    // The storage of all the layers is made with the array and never grows - once it is full the
+    // next texture of the same layout goes to another array (see TextureCache). All the layers
+    // start from the same resident level, the finer levels are not in the array at all.
+    class TextureArray
+    {
+    public:
+        // minimum GL_MAX_ARRAY_TEXTURE_LAYERS
+        static const int MAX_LAYERS = 256;
+
+        // GL thread - creates the storage for capacity layers. residentLevel is the level the
+        // layers start from, it becomes level 0 of the GL texture.
+        TextureArray(int width, int height, GLenum format, size_t levelCount, size_t residentLevel, int capacity);
+        ~TextureArray();
+
+        // True if the image has the layout of the array, whether a layer is free or not
+        bool matches(const TextureImage& image, size_t residentLevel) const;
+        bool isFull() const;
+
+        // GL thread - uploads the resident levels of the image to a free layer, returns the layer
+        int add(const TextureImage& image);
+
+        // GL thread - gives the layer back, its memory is reused by the next image added
+        void remove(int layer);
+
+        GLuint getId() const;
+        int getWidth() const;
+        int getHeight() const;
+        size_t getLevelCount() const;
+        size_t getResidentLevel() const;
+        int getCapacity() const;
+        int getLayerCount() const;
+
+        // Video memory taken by the array - every layer of its capacity, in use or not
+        size_t memorySize() const;
+
+        // Video memory taken by levels [first, last) of one texture
+        static size_t layerSize(GLenum format, int width, int height, size_t first, size_t last);
+
+        // Binds an array to a texture unit through GLState, unless it is bound there already
+        static void bind(GLuint unit, GLuint id);
+
+        // Unbinds the texture arrays from the units starting with firstUnit
+        static void unbindFrom(GLuint firstUnit);
+
+    private:
+        GLuint id;
+        int width;
+        int height;
+        GLenum format;
+        size_t levelCount;
+        size_t residentLevel;
+        int capacity;
+        std::vector<bool> usedLayers;
+        int layerCount;
+
+        TextureArray(const TextureArray&);
+        TextureArray& operator=(const TextureArray&);
+    };
+
+}
+
+#endif /* TextureArray_hpp */
@@ -0,0 +1,494 @@
+#include "TextureCache.hpp"
+#include "TextureArray.hpp"
+#include "TextureCompressor.hpp"
+#include "TextureStreamer.hpp"
+#include "UploadQueue.hpp"
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+namespace gps {
+
+	namespace {
+
+		// stored in the .ktx files, change them when the cooked output changes
+		const uint64_t compressedTextureSettings = 1;
+		const uint64_t rawTextureSettings = 2;
+
+		// flags of the .ktx files
+		const uint32_t ktxCutoutFlag = 1;
+
+		GLenum baseInternalFormat(GLenum format) {
+			switch (format) {
+			case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return GL_RGB;
+			case GL_COMPRESSED_RED_RGTC1: return GL_RED;
+			case GL_COMPRESSED_RG_RGTC2: return GL_RG;
+			default: return GL_RGBA;
+			}
+		}
+
+		// Drops the finest levels - the mip chain simply starts further down
+		void reduceImage(TextureImage& image, size_t levels) {
+			levels = std::min(levels, image.levels.size() - 1);
+			if (levels == 0)
+				return;
+
+			image.levels.erase(image.levels.begin(), image.levels.begin() + levels);
+			image.width = image.levels[0].width;
+			image.height = image.levels[0].height;
+		}
+	}
+
+	const char* textureQualityName(TextureQuality quality) {
+		switch (quality) {
+		case TEXTURE_QUALITY_HALF: return "half";
+		case TEXTURE_QUALITY_QUARTER: return "quarter";
+		default: return "full";
+		}
+	}
+
+	size_t textureMemorySize(const TextureImage& image) {
+		size_t size = 0;
+		for (size_t i = 0; i < image.levels.size(); i++)
+			size += image.levels[i].size;
+		return size;
+	}
+
+	TextureHandle::TextureHandle(const std::shared_ptr<TextureArray>& array, int layer, bool cutout) : array(array), layer(layer), cutout(cutout)
+	{
+	}
+
+	TextureHandle::~TextureHandle()
+	{
+		// the arrays are only changed (and deleted with their last texture) on the GL thread,
+		// the streamed array is captured to be released there as well
+		std::shared_ptr<TextureArray> array = this->array;
+		std::shared_ptr<TextureArray> streamedArray = this->streamedArray;
+		int layer = this->layer;
+		UploadQueue::global().push(0, [array, streamedArray, layer]() {
+			array->remove(layer);
+		});
+	}
+
+	GLuint TextureHandle::getId() const
+	{
+		return getArray().getId();
+	}
+
+	int TextureHandle::getLayer() const
+	{
+		return streamedArray ? 0 : layer;
+	}
+
+	TextureArray& TextureHandle::getArray() const
+	{
+		return streamedArray ? *streamedArray : *array;
+	}
+
+	void TextureHandle::setStreamedArray(const std::shared_ptr<TextureArray>& array)
+	{
+		streamedArray = array;
+	}
+
+	bool TextureHandle::isCutout() const
+	{
+		return cutout;
+	}
+
+	TextureCache::TextureCache() : hits(0), misses(0), compression(false), diskCache(true), streaming(false), quality(TEXTURE_QUALITY_FULL), maxSize(0),
+		decodedMemory(0), fullQualityMemory(0)
+	{
+	}
+
+	TextureCache& TextureCache::global()
+	{
+		static TextureCache cache;
+		return cache;
+	}
+
+	bool TextureCache::contentHash(const std::string& fileName, uint64_t& hash)
+	{
+		std::string path = canonicalPath(fileName);
+		FileInfo info;
+		if (!getFileInfo(path, info))
+			return false;
+
+		{
+			std::lock_guard<std::mutex> lock(cacheMutex);
+			auto it = paths.find(path);
+			if (it != paths.end() && it->second.info.size == info.size && it->second.info.modifiedTime == info.modifiedTime) {
+				hash = it->second.contentHash;
+				return true;
+			}
+		}
+
+		// new or modified file - hashed without holding the lock
+		if (!hashFile(path, hash))
+			return false;
+
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		PathEntry& entry = paths[path];
+		entry.info = info;
+		entry.contentHash = hash;
+		return true;
+	}
+
+	std::shared_ptr<TextureHandle> TextureCache::findByHash(uint64_t hash)
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		auto it = textures.find(hash);
+		if (it == textures.end())
+			return std::shared_ptr<TextureHandle>();
+
+		std::shared_ptr<TextureHandle> handle = it->second.lock();
+		if (!handle)
+			textures.erase(it);
+		return handle;
+	}
+
+	std::shared_ptr<TextureHandle> TextureCache::find(const std::string& fileName)
+	{
+		uint64_t hash;
+		if (!contentHash(fileName, hash))
+			return std::shared_ptr<TextureHandle>();
+
+		std::shared_ptr<TextureHandle> handle = findByHash(hash);
+		if (handle)
+			hits++;
+		return handle;
+	}
+
+	std::shared_ptr<TextureHandle> TextureCache::load(const std::string& fileName)
+	{
+		std::shared_ptr<TextureHandle> handle = find(fileName);
+		if (handle)
+			return handle;
+
+		TextureImage image;
+		if (!decodeImage(fileName, image))
+			return std::shared_ptr<TextureHandle>();
+		return insert(fileName, image);
+	}
+
+	std::shared_ptr<TextureHandle> TextureCache::insert(const std::string& fileName, const TextureImage& image)
+	{
+		if (image.levels.empty())
+			return std::shared_ptr<TextureHandle>();
+
+		uint64_t hash;
+		bool hashed = contentHash(fileName, hash);
+		if (hashed) {
+			std::shared_ptr<TextureHandle> handle = findByHash(hash);
+			if (handle) {
+				hits++;
+				return handle;
+			}
+		}
+
+		misses++;
+		std::shared_ptr<TextureHandle> handle = addToArray(image);
+
+		if (hashed) {
+			std::lock_guard<std::mutex> lock(cacheMutex);
+			textures[hash] = handle;
+		}
+		return handle;
+	}
+
+	std::shared_ptr<TextureHandle> TextureCache::addToArray(const TextureImage& image)
+	{
+		// streamed textures start with only the mip tail
+		size_t residentLevel = streaming ? TextureStreamer::tailLevel(image.width, image.height, image.levels.size()) : 0;
+		std::shared_ptr<TextureArray> array = findArray(image, residentLevel);
+		std::shared_ptr<TextureHandle> handle = std::make_shared<TextureHandle>(array, array->add(image), image.cutout);
+		if (residentLevel > 0)
+			TextureStreamer::global().add(handle, image);
+		return handle;
+	}
+
+	std::shared_ptr<TextureArray> TextureCache::findArray(const TextureImage& image, size_t residentLevel)
+	{
+		int capacity = 1;
+		for (size_t i = 0; i < arrays.size();) {
+			std::shared_ptr<TextureArray> array = arrays[i].lock();
+			if (!array) {
+				arrays.erase(arrays.begin() + i);
+				continue;
+			}
+			if (array->matches(image, residentLevel)) {
+				if (!array->isFull())
+					return array;
+				capacity = std::max(capacity, array->getCapacity() * 2);
+			}
+			i++;
+		}
+
+		// at most as many free layers as there are textures of the layout, like an array that doubles
+		capacity = std::min(capacity, (int)TextureArray::MAX_LAYERS);
+		std::shared_ptr<TextureArray> array = std::make_shared<TextureArray>(image.width, image.height, image.format,
+			image.levels.size(), residentLevel, capacity);
+		arrays.push_back(array);
+		return array;
+	}
+
+	unsigned TextureCache::getHitCount() const
+	{
+		return hits;
+	}
+
+	unsigned TextureCache::getMissCount() const
+	{
+		return misses;
+	}
+
+	void TextureCache::setCompression(bool enabled)
+	{
+		compression = enabled;
+	}
+
+	bool TextureCache::getCompression() const
+	{
+		return compression;
+	}
+
+	void TextureCache::setDiskCache(bool enabled)
+	{
+		diskCache = enabled;
+	}
+
+	bool TextureCache::getDiskCache() const
+	{
+		return diskCache;
+	}
+
+	void TextureCache::setStreaming(bool enabled)
+	{
+		streaming = enabled;
+	}
+
+	bool TextureCache::getStreaming() const
+	{
+		return streaming;
+	}
+
+	void TextureCache::setQuality(TextureQuality quality, int maxSize)
+	{
+		this->quality = quality;
+		this->maxSize = maxSize;
+	}
+
+	TextureQuality TextureCache::getQuality() const
+	{
+		return (TextureQuality)quality.load();
+	}
+
+	int TextureCache::getMaxSize() const
+	{
+		return maxSize;
+	}
+
+	size_t TextureCache::getDecodedMemory() const
+	{
+		return decodedMemory;
+	}
+
+	size_t TextureCache::getFullQualityMemory() const
+	{
+		return fullQualityMemory;
+	}
+
+	size_t TextureCache::skippedLevels(int width, int height) const
+	{
+		int size = std::max(width, height);
+		size_t levels = (size_t)quality.load();
+		int limit = maxSize;
+		while (limit > 0 && (size >> levels) > limit)
+			levels++;
+		// never below a single pixel
+		while (levels > 0 && (size >> levels) == 0)
+			levels--;
+		return levels;
+	}
+
+	bool TextureCache::decodeImage(const std::string& fileName, TextureImage& image, bool* fromDiskCache)
+	{
+		if (!readImage(fileName, image, fromDiskCache))
+			return false;
+
+		// a cached mip chain is only mapped, the levels that are skipped are never read
+		size_t fullSize = textureMemorySize(image);
+		reduceImage(image, skippedLevels(image.width, image.height));
+
+		fullQualityMemory += fullSize;
+		decodedMemory += textureMemorySize(image);
+		return true;
+	}
+
+	bool TextureCache::readImage(const std::string& fileName, TextureImage& image, bool* fromDiskCache)
+	{
+		bool compressed = compression;
+		bool cached = diskCache;
+		uint64_t settings = compressed ? compressedTextureSettings : rawTextureSettings;
+		std::string ktxFileName = fileName + ".ktx";
+		if (fromDiskCache)
+			*fromDiskCache = false;
+
+		if (cached) {
+			std::shared_ptr<KtxFile> ktx = std::make_shared<KtxFile>();
+			if (ktx->open(ktxFileName, fileName, settings)) {
+				image.width = ktx->getWidth();
+				image.height = ktx->getHeight();
+				image.format = compressed ? ktx->getInternalFormat() : GL_RGBA;
+				image.levels = ktx->getLevels();
+				image.cutout = (ktx->getFlags() & ktxCutoutFlag) != 0;
+				image.storage = ktx;
+				if (fromDiskCache)
+					*fromDiskCache = true;
+				return true;
+			}
+		}
+
+		TextureImage raw;
+		if (!decodeRawImage(fileName, raw))
+			return false;
+
+		// build the whole mip chain, each level is box filtered from the previous one - here rather
+		// than by the driver, on the GL thread, once per texture array
+		const TextureLevel& base = raw.levels[0];
+		GLenum format = compressed ? chooseCompressedFormat(base.data, base.width, base.height) : GL_RGBA;
+		std::shared_ptr<std::vector<unsigned char> > data = std::make_shared<std::vector<unsigned char> >();
+		std::vector<size_t> sizes;
+
+		std::vector<unsigned char> level(base.data, base.data + base.size);
+		std::vector<unsigned char> nextLevel;
+		int width = base.width;
+		int height = base.height;
+		for (;;) {
+			size_t start = data->size();
+			if (compressed)
+				compressImage(level.data(), width, height, format, *data);
+			else
+				data->insert(data->end(), level.begin(), level.end());
+			sizes.push_back(data->size() - start);
+
+			if (width == 1 && height == 1)
+				break;
+			downsampleImage(level.data(), width, height, nextLevel);
+			level.swap(nextLevel);
+			width = std::max(width / 2, 1);
+			height = std::max(height / 2, 1);
+		}
+
+		if (cached) {
+			TextureSource source;
+			bool written = getTextureSource(fileName, source);
+			if (written && compressed) {
+				written = KtxFile::write(ktxFileName, source, settings, raw.cutout ? ktxCutoutFlag : 0, format, baseInternalFormat(format),
+					base.width, base.height, *data, sizes);
+			}
+			else if (written) {
+				written = KtxFile::write(ktxFileName, source, settings, raw.cutout ? ktxCutoutFlag : 0, GL_RGBA8, GL_RGBA,
+					base.width, base.height, *data, sizes, GL_UNSIGNED_BYTE, GL_RGBA, 1);
+			}
+			if (!written)
+				fprintf(stderr, "WARNING: could not write texture cache file %s\n", ktxFileName.c_str());
+		}
+
+		image.width = base.width;
+		image.height = base.height;
+		image.format = format;
+		image.cutout = raw.cutout;
+		image.levels.clear();
+		size_t offset = 0;
+		for (size_t i = 0; i < sizes.size(); i++) {
+			TextureLevel mip;
+			mip.width = std::max(base.width >> i, 1);
+			mip.height = std::max(base.height >> i, 1);
+			mip.data = data->data() + offset;
+			mip.size = sizes[i];
+			image.levels.push_back(mip);
+			offset += sizes[i];
+		}
+		image.storage = data;
+		return true;
+	}
+
+	// Reads the pixel data from an image file - safe to call from any thread
+	bool TextureCache::decodeRawImage(const std::string& fileName, TextureImage& image) {
+		const char* file_name = fileName.c_str();
+		int x, y, n;
+		int force_channels = 4;
+		// stb_image flips the rows while it writes them out (the setting is per thread)
+		stbi_set_flip_vertically_on_load_thread(1);
+		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, force_channels);
+		// back to the default for the other users of stb_image on this thread (e.g. the skybox)
+		stbi_set_flip_vertically_on_load_thread(0);
+		if (!image_data) {
+			fprintf(stderr, "ERROR: could not load %s\n", file_name);
+			return false;
+		}
+		// NPOT check
+		if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
+			fprintf(
+				stderr, "WARNING: texture %s is not power-of-2 dimensions\n", file_name
+			);
+		}
+
+		TextureLevel level;
+		level.width = x;
+		level.height = y;
+		level.data = image_data;
+		level.size = (size_t)x * y * 4;
+
+		image.width = x;
+		image.height = y;
+		image.format = GL_RGBA;
+		image.levels.assign(1, level);
+		// classified once here, the .ktx files keep the result
+		image.cutout = isCutoutImage(image_data, x, y);
+		image.storage = std::shared_ptr<const void>(image_data, stbi_image_free);
+		return true;
+	}
+
+	void TextureCache::decodeImages(const std::vector<std::string>& fileNames, std::vector<TextureImage>& images, ThreadPool& pool) {
+		typedef std::chrono::steady_clock Clock;
+		std::vector<double> milliseconds(fileNames.size());
+		std::vector<char> fromDiskCache(fileNames.size(), 0);
+		images.resize(fileNames.size());
+
+		Clock::time_point start = Clock::now();
+		pool.parallelFor(fileNames.size(), [&](size_t i) {
+			Clock::time_point fileStart = Clock::now();
+			images[i].width = 0;
+			images[i].height = 0;
+			bool cached = false;
+			decodeImage(fileNames[i], images[i], &cached);
+			fromDiskCache[i] = cached;
+			milliseconds[i] = std::chrono::duration<double, std::milli>(Clock::now() - fileStart).count();
+		});
+		double totalMilliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+		// reported once everything is done so that the lines do not interleave
+		double sequentialMilliseconds = 0.0;
+		size_t diskCacheHits = 0;
+		size_t memory = 0;
+		for (size_t i = 0; i < fileNames.size(); i++) {
+			std::cout << "Decoded : " << fileNames[i] << " (" << images[i].width << "x" << images[i].height
+				<< ") in " << milliseconds[i] << " ms" << (fromDiskCache[i] ? " from cache" : "") << std::endl;
+			sequentialMilliseconds += milliseconds[i];
+			diskCacheHits += fromDiskCache[i];
+			memory += textureMemorySize(images[i]);
+		}
+		if (!fileNames.empty()) {
+			std::cout << "# of textures decoded : " << fileNames.size() << " in " << totalMilliseconds
+				<< " ms (" << sequentialMilliseconds << " ms of decoding), " << diskCacheHits << "/"
+				<< fileNames.size() << " from the disk cache, " << memory / 1024 << " KB at "
+				<< textureQualityName(getQuality()) << " quality" << std::endl;
+		}
+	}
+
+}
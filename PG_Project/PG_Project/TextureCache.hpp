@@ -0,0 +1,186 @@
+#ifndef TextureCache_hpp
+#define TextureCache_hpp
+
+#include <GL/glew.h>
+
+#include "FileUtils.hpp"
+#include "KtxFile.hpp"
+#include "ThreadPool.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    // Pixels of a texture ready to be uploaded, rows already flipped for OpenGL - a complete mip
+    // chain, RGBA8 or block compressed.
+    struct TextureImage
+    {
+        int width;
+        int height;
+        // GL_RGBA for plain pixels, one of the GL_COMPRESSED_* formats otherwise
+        GLenum format;
+        std::vector<TextureLevel> levels;
+        // some texels are transparent enough to be discarded by the alpha test (see isCutoutImage)
+        bool cutout;
+        // owns the memory the levels point to - decoded pixels, encoded blocks or a mapped cache file
+        std::shared_ptr<const void> storage;
+    };
+
+    // Video memory taken by a texture once uploaded
+    size_t textureMemorySize(const TextureImage& image);
+
+    // Resolution the textures are loaded at, for machines with less memory
+    enum TextureQuality
+    {
+        TEXTURE_QUALITY_FULL,
+        TEXTURE_QUALITY_HALF,
+        TEXTURE_QUALITY_QUARTER
+    };
+
+    const char* textureQualityName(TextureQuality quality);
+
+    class TextureArray;
+
+    // Layer of a texture array holding an image, shared by everyone that uses the same image and
+    // given back with the last reference. The last reference may go on any thread, the layer is
+    // given back on the GL thread through the UploadQueue.
+    class TextureHandle
+    {
+    public:
+        TextureHandle(const std::shared_ptr<TextureArray>& array, int layer, bool cutout);
+        ~TextureHandle();
+
+        // GL_TEXTURE_2D_ARRAY texture - it changes when the texture streams its levels
+        GLuint getId() const;
+        int getLayer() const;
+        TextureArray& getArray() const;
+        // True if the image needs the alpha test, the meshes using it are drawn after the opaque ones
+        bool isCutout() const;
+
+        // GL thread - draws the texture from a single layer array of its own (the TextureStreamer
+        // puts the finer levels there), NULL goes back to the layer it was created with
+        void setStreamedArray(const std::shared_ptr<TextureArray>& array);
+
+    private:
+        std::shared_ptr<TextureArray> array;
+        int layer;
+        std::shared_ptr<TextureArray> streamedArray;
+        bool cutout;
+
+        TextureHandle(const TextureHandle&);
+        TextureHandle& operator=(const TextureHandle&);
+    };
+
+    // Process-wide cache of the textures loaded from image files. Textures are found by the
+    // canonical path of the file and then by a hash of its contents, so copies of the same image
+    // in different folders are uploaded only once. Images of the same size and format are packed
+    // into the layers of shared texture arrays - when they are full a new array twice as large as
+    // the last one is made next to them, so the arrays never have to be rebuilt. The cache only
+    // keeps weak references - a texture is released as soon as the last model that uses it is gone.
+    class TextureCache
+    {
+    public:
+        TextureCache();
+
+        static TextureCache& global();
+
+        // Any thread - returns the texture of the file if it is already loaded, NULL otherwise
+        std::shared_ptr<TextureHandle> find(const std::string& fileName);
+
+        // GL thread - returns the texture of the file, decoding and uploading it on a miss.
+        // NULL if the image cannot be read.
+        std::shared_ptr<TextureHandle> load(const std::string& fileName);
+
+        // GL thread - uploads an image decoded beforehand (on any thread) unless the same
+        // texture was loaded in the meantime
+        std::shared_ptr<TextureHandle> insert(const std::string& fileName, const TextureImage& image);
+
+        unsigned getHitCount() const;
+        unsigned getMissCount() const;
+
+        // Block compress the textures - only enable when the driver supports S3TC
+        void setCompression(bool enabled);
+        bool getCompression() const;
+
+        // Keep the decoded (or compressed) mip chain of each image in a .ktx file next to it, so
+        // later runs map it instead of decoding the image. On by default.
+        void setDiskCache(bool enabled);
+        bool getDiskCache() const;
+
+        // Only keep the small mip levels resident and let the TextureStreamer bring in the others
+        // as they are needed. TextureStreamer::update() must then be called every frame.
+        void setStreaming(bool enabled);
+        bool getStreaming() const;
+
+        // Textures are loaded at the given tier, then halved until no edge is longer than maxSize
+        // (0 - no limit). Set it before loading anything, textures already loaded keep their size.
+        void setQuality(TextureQuality quality, int maxSize = 0);
+        TextureQuality getQuality() const;
+        int getMaxSize() const;
+
+        // Video memory of the textures decoded so far, and what they would take at full quality
+        size_t getDecodedMemory() const;
+        size_t getFullQualityMemory() const;
+
+        // Reads the pixel data from an image file at the current quality - safe to call from any thread
+        bool decodeImage(const std::string& fileName, TextureImage& image, bool* fromDiskCache = NULL);
+
+        // Decodes the files concurrently on the thread pool and reports the time spent on each one.
+        // Images that cannot be read are left empty.
+        void decodeImages(const std::vector<std::string>& fileNames, std::vector<TextureImage>& images,
+                          ThreadPool& pool = ThreadPool::global());
+
+    private:
+        // what is known about a path, the hash is only recomputed when the file changes
+        struct PathEntry
+        {
+            FileInfo info;
+            uint64_t contentHash;
+        };
+
+        std::unordered_map<std::string, PathEntry> paths;
+        std::unordered_map<uint64_t, std::weak_ptr<TextureHandle> > textures;
+        // GL thread only
+        std::vector<std::weak_ptr<TextureArray> > arrays;
+        std::mutex cacheMutex;
+        std::atomic<unsigned> hits;
+        std::atomic<unsigned> misses;
+        std::atomic<bool> compression;
+        std::atomic<bool> diskCache;
+        std::atomic<bool> streaming;
+        std::atomic<int> quality;
+        std::atomic<int> maxSize;
+        std::atomic<size_t> decodedMemory;
+        std::atomic<size_t> fullQualityMemory;
+
+        // Full resolution image, from the disk cache when possible
+        bool readImage(const std::string& fileName, TextureImage& image, bool* fromDiskCache);
+
+        // Uploads the image to a layer of an array with the same layout, creating one if needed
+        std::shared_ptr<TextureHandle> addToArray(const TextureImage& image);
+        // Array with the layout and a free layer
+        std::shared_ptr<TextureArray> findArray(const TextureImage& image, size_t residentLevel);
+
+        // Number of mip levels dropped at the current quality
+        size_t skippedLevels(int width, int height) const;
+
+        // stb_image decode to a single RGBA8 level, readImage builds the mip chain
+        static bool decodeRawImage(const std::string& fileName, TextureImage& image);
+
+        // Content hash of a file, false if it cannot be read
+        bool contentHash(const std::string& fileName, uint64_t& hash);
+        std::shared_ptr<TextureHandle> findByHash(uint64_t hash);
+
+        TextureCache(const TextureCache&);
+        TextureCache& operator=(const TextureCache&);
+    };
+
+}
+
+#endif /* TextureCache_hpp */
@@ -0,0 +1,396 @@
+#include "TextureCompressor.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TEXTURE_COMPRESSOR_SSE2
+#endif
+
+namespace gps {
+
+	namespace {
+
+		// largest difference between the color channels that still counts as grey (JPEG noise)
+		const int greyTolerance = 2;
+
+		// Copies a 4x4 block out of the image, repeating the last row/column at the edges
+		void extractBlock(const unsigned char* pixels, int width, int height, int blockX, int blockY, unsigned char block[64]) {
+			for (int y = 0; y < 4; y++) {
+				int sourceY = std::min(blockY * 4 + y, height - 1);
+				for (int x = 0; x < 4; x++) {
+					int sourceX = std::min(blockX * 4 + x, width - 1);
+					std::memcpy(block + (y * 4 + x) * 4, pixels + ((size_t)sourceY * width + sourceX) * 4, 4);
+				}
+			}
+		}
+
+		uint16_t packColor565(const float color[3]) {
+			int r = (int)std::floor(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+			int g = (int)std::floor(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+			int b = (int)std::floor(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+			return (uint16_t)((r << 11) | (g << 5) | b);
+		}
+
+		void unpackColor565(uint16_t packed, float color[3]) {
+			int r = (packed >> 11) & 31;
+			int g = (packed >> 5) & 63;
+			int b = packed & 31;
+			color[0] = (float)((r << 3) | (r >> 2));
+			color[1] = (float)((g << 2) | (g >> 4));
+			color[2] = (float)((b << 3) | (b >> 2));
+		}
+
+		// Picks the closest of the 4 palette entries for every pixel, returns the packed indices and the error
+		uint32_t matchColors(const unsigned char block[64], uint16_t color0, uint16_t color1, float& error) {
+			float palette[4][3];
+			unpackColor565(color0, palette[0]);
+			unpackColor565(color1, palette[1]);
+			for (int c = 0; c < 3; c++) {
+				palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+				palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+			}
+
+			uint32_t indices = 0;
+			error = 0.0f;
+			for (int i = 0; i < 16; i++) {
+				int best = 0;
+				float bestDistance = 0.0f;
+				for (int p = 0; p < 4; p++) {
+					float distance = 0.0f;
+					for (int c = 0; c < 3; c++) {
+						float delta = block[i * 4 + c] - palette[p][c];
+						distance += delta * delta;
+					}
+					if (p == 0 || distance < bestDistance) {
+						best = p;
+						bestDistance = distance;
+					}
+				}
+				indices |= (uint32_t)best << (i * 2);
+				error += bestDistance;
+			}
+			return indices;
+		}
+
+		void writeColorBlock(unsigned char* output, uint16_t color0, uint16_t color1, uint32_t indices) {
+			output[0] = (unsigned char)(color0 & 0xff);
+			output[1] = (unsigned char)(color0 >> 8);
+			output[2] = (unsigned char)(color1 & 0xff);
+			output[3] = (unsigned char)(color1 >> 8);
+			for (int i = 0; i < 4; i++)
+				output[4 + i] = (unsigned char)(indices >> (i * 8));
+		}
+
+		// Keeps the 4 color mode (color0 > color1); swapping the endpoints swaps the indices 0/1 and 2/3
+		void orderEndpoints(uint16_t& color0, uint16_t& color1, uint32_t& indices) {
+			if (color0 < color1) {
+				std::swap(color0, color1);
+				indices ^= 0x55555555;
+			}
+		}
+
+		// BC1 color block: endpoints on the principal axis of the colors, refined once by least squares
+		void compressColorBlock(const unsigned char block[64], unsigned char output[8]) {
+			float mean[3] = { 0.0f, 0.0f, 0.0f };
+			for (int i = 0; i < 16; i++)
+				for (int c = 0; c < 3; c++)
+					mean[c] += block[i * 4 + c] / 16.0f;
+
+			float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+			for (int i = 0; i < 16; i++) {
+				float r = block[i * 4 + 0] - mean[0];
+				float g = block[i * 4 + 1] - mean[1];
+				float b = block[i * 4 + 2] - mean[2];
+				covariance[0] += r * r; covariance[1] += r * g; covariance[2] += r * b;
+				covariance[3] += g * g; covariance[4] += g * b; covariance[5] += b * b;
+			}
+
+			// power iteration for the principal axis
+			float axis[3] = { 1.0f, 1.0f, 1.0f };
+			for (int iteration = 0; iteration < 8; iteration++) {
+				float next[3] = {
+					covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+					covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+					covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2]
+				};
+				float length = std::max(std::fabs(next[0]), std::max(std::fabs(next[1]), std::fabs(next[2])));
+				if (length == 0.0f)
+					break;
+				for (int c = 0; c < 3; c++)
+					axis[c] = next[c] / length;
+			}
+
+			float minimum = 0.0f, maximum = 0.0f;
+			int minimumPixel = 0, maximumPixel = 0;
+			for (int i = 0; i < 16; i++) {
+				float projection = 0.0f;
+				for (int c = 0; c < 3; c++)
+					projection += (block[i * 4 + c] - mean[c]) * axis[c];
+				if (i == 0 || projection < minimum) {
+					minimum = projection;
+					minimumPixel = i;
+				}
+				if (i == 0 || projection > maximum) {
+					maximum = projection;
+					maximumPixel = i;
+				}
+			}
+
+			float endpoint0[3], endpoint1[3];
+			for (int c = 0; c < 3; c++) {
+				endpoint0[c] = block[maximumPixel * 4 + c];
+				endpoint1[c] = block[minimumPixel * 4 + c];
+			}
+			uint16_t color0 = packColor565(endpoint0);
+			uint16_t color1 = packColor565(endpoint1);
+
+			float error;
+			uint32_t indices = matchColors(block, color0, color1, error);
+
+			// least squares endpoints for the chosen indices
+			const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+			float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+			float ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+			for (int i = 0; i < 16; i++) {
+				float a = weights[(indices >> (i * 2)) & 3];
+				float b = 1.0f - a;
+				aa += a * a; ab += a * b; bb += b * b;
+				for (int c = 0; c < 3; c++) {
+					ax[c] += a * block[i * 4 + c];
+					bx[c] += b * block[i * 4 + c];
+				}
+			}
+			float determinant = aa * bb - ab * ab;
+			if (std::fabs(determinant) > 1e-6f) {
+				float refined0[3], refined1[3];
+				for (int c = 0; c < 3; c++) {
+					refined0[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+					refined1[c] = (bx[c] * aa - ax[c] * ab) / determinant;
+				}
+				uint16_t refinedColor0 = packColor565(refined0);
+				uint16_t refinedColor1 = packColor565(refined1);
+				float refinedError;
+				uint32_t refinedIndices = matchColors(block, refinedColor0, refinedColor1, refinedError);
+				if (refinedError < error) {
+					color0 = refinedColor0;
+					color1 = refinedColor1;
+					indices = refinedIndices;
+				}
+			}
+
+			if (color0 == color1)
+				indices = 0;
+			orderEndpoints(color0, color1, indices);
+			writeColorBlock(output, color0, color1, indices);
+		}
+
+		// Builds the 8 entry palette of a BC4 block
+		void alphaPalette(int value0, int value1, int palette[8]) {
+			palette[0] = value0;
+			palette[1] = value1;
+			if (value0 > value1) {
+				for (int i = 1; i < 7; i++)
+					palette[i + 1] = ((7 - i) * value0 + i * value1 + 3) / 7;
+			}
+			else {
+				for (int i = 1; i < 5; i++)
+					palette[i + 1] = ((5 - i) * value0 + i * value1 + 2) / 5;
+				palette[6] = 0;
+				palette[7] = 255;
+			}
+		}
+
+		uint64_t matchAlpha(const unsigned char values[16], int value0, int value1, int& error) {
+			int palette[8];
+			alphaPalette(value0, value1, palette);
+
+			uint64_t indices = 0;
+			error = 0;
+			for (int i = 0; i < 16; i++) {
+				int best = 0;
+				int bestDistance = 256 * 256;
+				for (int p = 0; p < 8; p++) {
+					int distance = (values[i] - palette[p]) * (values[i] - palette[p]);
+					if (distance < bestDistance) {
+						best = p;
+						bestDistance = distance;
+					}
+				}
+				indices |= (uint64_t)best << (i * 3);
+				error += bestDistance;
+			}
+			return indices;
+		}
+
+		// BC4 block: tries the 8 value mode over the whole range and the 6 value mode, which has
+		// exact 0 and 255 entries (better for cut-out alpha), and keeps the more accurate one
+		void compressAlphaBlock(const unsigned char values[16], unsigned char output[8]) {
+			int minimum = 255, maximum = 0;
+			int innerMinimum = 255, innerMaximum = 0;
+			for (int i = 0; i < 16; i++) {
+				minimum = std::min(minimum, (int)values[i]);
+				maximum = std::max(maximum, (int)values[i]);
+				if (values[i] != 0 && values[i] != 255) {
+					innerMinimum = std::min(innerMinimum, (int)values[i]);
+					innerMaximum = std::max(innerMaximum, (int)values[i]);
+				}
+			}
+
+			int value0 = maximum, value1 = minimum;
+			int error;
+			uint64_t indices = matchAlpha(values, value0, value1, error);
+
+			if (innerMinimum <= innerMaximum) {
+				int sixError;
+				uint64_t sixIndices = matchAlpha(values, innerMinimum, innerMaximum, sixError);
+				if (sixError < error) {
+					value0 = innerMinimum;
+					value1 = innerMaximum;
+					indices = sixIndices;
+				}
+			}
+
+			output[0] = (unsigned char)value0;
+			output[1] = (unsigned char)value1;
+			for (int i = 0; i < 6; i++)
+				output[2 + i] = (unsigned char)(indices >> (i * 8));
+		}
+	}
+
+	GLenum chooseCompressedFormat(const unsigned char* pixels, int width, int height) {
+		bool opaque = true;
+		bool grey = true;
+		size_t pixelCount = (size_t)width * height;
+		for (size_t i = 0; i < pixelCount && (opaque || grey); i++) {
+			const unsigned char* pixel = pixels + i * 4;
+			opaque = opaque && pixel[3] == 255;
+			grey = grey && std::abs(pixel[0] - pixel[1]) <= greyTolerance && std::abs(pixel[1] - pixel[2]) <= greyTolerance;
+		}
+
+		if (grey)
+			return opaque ? GL_COMPRESSED_RED_RGTC1 : GL_COMPRESSED_RG_RGTC2;
+		return opaque ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	}
+
+	bool isCutoutImage(const unsigned char* pixels, int width, int height) {
+		size_t pixelCount = (size_t)width * height;
+		for (size_t i = 0; i < pixelCount; i++) {
+			if (pixels[i * 4 + 3] < ALPHA_TEST_CUTOFF)
+				return true;
+		}
+		return false;
+	}
+
+	void compressedFormatSwizzle(GLenum format, GLint swizzle[4]) {
+		swizzle[0] = GL_RED;
+		swizzle[1] = GL_GREEN;
+		swizzle[2] = GL_BLUE;
+		swizzle[3] = GL_ALPHA;
+		if (format == GL_COMPRESSED_RED_RGTC1) {
+			swizzle[1] = GL_RED;
+			swizzle[2] = GL_RED;
+			swizzle[3] = GL_ONE;
+		}
+		else if (format == GL_COMPRESSED_RG_RGTC2) {
+			swizzle[1] = GL_RED;
+			swizzle[2] = GL_RED;
+			swizzle[3] = GL_GREEN;
+		}
+	}
+
+	size_t compressedSize(GLenum format, int width, int height) {
+		size_t blocks = (size_t)((width + 3) / 4) * ((height + 3) / 4);
+		bool eightBytes = format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_RED_RGTC1;
+		return blocks * (eightBytes ? 8 : 16);
+	}
+
+	void downsampleImage(const unsigned char* pixels, int width, int height, std::vector<unsigned char>& result) {
+		int resultWidth = std::max(width / 2, 1);
+		int resultHeight = std::max(height / 2, 1);
+		result.resize((size_t)resultWidth * resultHeight * 4);
+
+		for (int y = 0; y < resultHeight; y++) {
+			const unsigned char* top = pixels + (size_t)std::min(y * 2, height - 1) * width * 4;
+			const unsigned char* bottom = pixels + (size_t)std::min(y * 2 + 1, height - 1) * width * 4;
+			unsigned char* destination = result.data() + (size_t)y * resultWidth * 4;
+			int x = 0;
+
+#ifdef TEXTURE_COMPRESSOR_SSE2
+			// two result pixels from 4x2 source pixels at a time, summed in 16 bits
+			if (width >= 2) {
+				const __m128i zero = _mm_setzero_si128();
+				const __m128i rounding = _mm_set1_epi16(2);
+				for (; x + 2 <= resultWidth; x += 2) {
+					__m128i topPixels = _mm_loadu_si128((const __m128i*)(top + x * 8));
+					__m128i bottomPixels = _mm_loadu_si128((const __m128i*)(bottom + x * 8));
+					__m128i left = _mm_add_epi16(_mm_unpacklo_epi8(topPixels, zero), _mm_unpacklo_epi8(bottomPixels, zero));
+					__m128i right = _mm_add_epi16(_mm_unpackhi_epi8(topPixels, zero), _mm_unpackhi_epi8(bottomPixels, zero));
+					__m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(left, right), _mm_unpackhi_epi64(left, right));
+					sum = _mm_srli_epi16(_mm_add_epi16(sum, rounding), 2);
+					_mm_storel_epi64((__m128i*)(destination + x * 4), _mm_packus_epi16(sum, sum));
+				}
+			}
+#endif
+
+			for (; x < resultWidth; x++) {
+				int x0 = std::min(x * 2, width - 1) * 4;
+				int x1 = std::min(x * 2 + 1, width - 1) * 4;
+				for (int c = 0; c < 4; c++) {
+					int sum = top[x0 + c] + top[x1 + c] + bottom[x0 + c] + bottom[x1 + c];
+					destination[x * 4 + c] = (unsigned char)((sum + 2) / 4);
+				}
+			}
+		}
+	}
+
+	void compressImage(const unsigned char* pixels, int width, int height, GLenum format, std::vector<unsigned char>& output) {
+		int blocksX = (width + 3) / 4;
+		int blocksY = (height + 3) / 4;
+		size_t start = output.size();
+		output.resize(start + compressedSize(format, width, height));
+		unsigned char* destination = output.data() + start;
+
+		unsigned char block[64];
+		unsigned char channel[16];
+		for (int blockY = 0; blockY < blocksY; blockY++) {
+			for (int blockX = 0; blockX < blocksX; blockX++) {
+				extractBlock(pixels, width, height, blockX, blockY, block);
+
+				switch (format) {
+				case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+					compressColorBlock(block, destination);
+					destination += 8;
+					break;
+				case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+					for (int i = 0; i < 16; i++)
+						channel[i] = block[i * 4 + 3];
+					compressAlphaBlock(channel, destination);
+					compressColorBlock(block, destination + 8);
+					destination += 16;
+					break;
+				case GL_COMPRESSED_RED_RGTC1:
+					for (int i = 0; i < 16; i++)
+						channel[i] = block[i * 4];
+					compressAlphaBlock(channel, destination);
+					destination += 8;
+					break;
+				case GL_COMPRESSED_RG_RGTC2:
+					for (int i = 0; i < 16; i++)
+						channel[i] = block[i * 4];
+					compressAlphaBlock(channel, destination);
+					for (int i = 0; i < 16; i++)
+						channel[i] = block[i * 4 + 3];
+					compressAlphaBlock(channel, destination + 8);
+					destination += 16;
+					break;
+				}
+			}
+		}
+	}
+
+}
@@ -0,0 +1,38 @@
+#ifndef TextureCompressor_hpp
+#define TextureCompressor_hpp
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+    // Picks the block compressed format that suits the channels used by an RGBA8 image:
+    // BC4 (GL_COMPRESSED_RED_RGTC1) for grey, BC5 (GL_COMPRESSED_RG_RGTC2) for grey and alpha,
+    // BC1 for opaque colors and BC3 for colors with alpha
+    GLenum chooseCompressedFormat(const unsigned char* pixels, int width, int height);
+
+    // Alpha (0-255) under which texels may be discarded by the alpha test of the shaders - they discard
+    // below 0.1 (25.5), the margin covers the error of block compressed alpha
+    const int ALPHA_TEST_CUTOFF = 32;
+
+    // True if some texel of an RGBA8 image can be discarded by the alpha test, false if the image
+    // can be drawn without it (filtered texels never go below the smallest alpha of the image)
+    bool isCutoutImage(const unsigned char* pixels, int width, int height);
+
+    // Swizzle that maps the channels of a compressed format back to RGBA (grey formats store luminance in red)
+    void compressedFormatSwizzle(GLenum format, GLint swizzle[4]);
+
+    // Bytes taken by one mip level in a block compressed format
+    size_t compressedSize(GLenum format, int width, int height);
+
+    // Halves an RGBA8 image with a box filter - odd sizes round down, never below 1 pixel
+    void downsampleImage(const unsigned char* pixels, int width, int height, std::vector<unsigned char>& result);
+
+    // Encodes an RGBA8 image in 4x4 blocks and appends them to output
+    void compressImage(const unsigned char* pixels, int width, int height, GLenum format, std::vector<unsigned char>& output);
+
+}
+
+#endif /* TextureCompressor_hpp */
@@ -0,0 +1,252 @@
+#include "TextureStreamer.hpp"
+#include "ThreadPool.hpp"
+#include "UploadQueue.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace gps {
+
+	namespace {
+
+		// levels up to this size stay resident all the time
+		const int MIP_TAIL_SIZE = 128;
+
+		const size_t DEFAULT_BUDGET = 256 * 1024 * 1024;
+
+		// reads one byte per page so that the mapped file is in memory before the upload
+		void touchPages(const unsigned char* data, size_t size) {
+			const size_t pageSize = 4096;
+			volatile unsigned char sink = 0;
+			for (size_t offset = 0; offset < size; offset += pageSize)
+				sink ^= data[offset];
+			if (size > 0)
+				sink ^= data[size - 1];
+		}
+	}
+
+	TextureStreamer::TextureStreamer() : budget(DEFAULT_BUDGET), residentBytes(0), committedBytes(0), viewportHeight(1080), frame(0),
+		generation(0)
+	{
+	}
+
+	TextureStreamer& TextureStreamer::global()
+	{
+		static TextureStreamer streamer;
+		return streamer;
+	}
+
+	size_t TextureStreamer::tailLevel(int width, int height, size_t levelCount)
+	{
+		size_t level = 0;
+		while (level + 1 < levelCount && std::max(width >> level, height >> level) > MIP_TAIL_SIZE)
+			level++;
+		return level;
+	}
+
+	void TextureStreamer::add(const std::shared_ptr<TextureHandle>& texture, const TextureImage& image)
+	{
+		// a new handle may take the address of a deleted one, its entry is simply replaced
+		StreamedTexture& streamed = textures[texture.get()];
+		streamed.handle = texture;
+		streamed.image = image;
+		streamed.tailLevel = tailLevel(image.width, image.height, image.levels.size());
+		streamed.residentLevel = streamed.tailLevel;
+		streamed.pendingLevel = streamed.tailLevel;
+		streamed.requestedLevel = streamed.tailLevel;
+		streamed.lastUsedFrame = frame;
+	}
+
+	size_t TextureStreamer::streamedSize(const StreamedTexture& texture, size_t level)
+	{
+		if (level >= texture.tailLevel)
+			return 0;
+		const TextureImage& image = texture.image;
+		return TextureArray::layerSize(image.format, image.width, image.height, level, image.levels.size());
+	}
+
+	void TextureStreamer::request(const TextureHandle& texture, float pixelsPerUv)
+	{
+		std::unordered_map<const TextureHandle*, StreamedTexture>::iterator it = textures.find(&texture);
+		if (it == textures.end())
+			return;
+
+		// level at which one texel covers about one pixel
+		StreamedTexture& streamed = it->second;
+		float texelsPerUv = (float)std::max(streamed.image.width, streamed.image.height);
+		size_t level = 0;
+		if (pixelsPerUv < texelsPerUv)
+			level = (size_t)std::floor(std::log2(texelsPerUv / std::max(pixelsPerUv, 1e-6f)));
+
+		streamed.requestedLevel = std::min(streamed.requestedLevel, std::min(level, streamed.tailLevel));
+		streamed.lastUsedFrame = frame;
+	}
+
+	void TextureStreamer::update()
+	{
+		// forget the textures that were deleted, their arrays went with the handles
+		residentBytes = 0;
+		committedBytes = 0;
+		for (std::unordered_map<const TextureHandle*, StreamedTexture>::iterator it = textures.begin(); it != textures.end();) {
+			if (it->second.handle.expired()) {
+				it = textures.erase(it);
+				continue;
+			}
+			residentBytes += streamedSize(it->second, it->second.residentLevel);
+			committedBytes += streamedSize(it->second, it->second.pendingLevel);
+			++it;
+		}
+
+		// the textures missing the most levels go first
+		std::vector<StreamedTexture*> missing;
+		for (std::unordered_map<const TextureHandle*, StreamedTexture>::iterator it = textures.begin(); it != textures.end(); ++it) {
+			StreamedTexture& streamed = it->second;
+			if (streamed.pendingLevel == streamed.residentLevel && streamed.requestedLevel < streamed.residentLevel)
+				missing.push_back(&streamed);
+		}
+		std::sort(missing.begin(), missing.end(), [](const StreamedTexture* a, const StreamedTexture* b) {
+			return a->residentLevel - a->requestedLevel > b->residentLevel - b->requestedLevel;
+		});
+
+		for (size_t i = 0; i < missing.size(); i++) {
+			StreamedTexture& streamed = *missing[i];
+			size_t current = streamedSize(streamed, streamed.pendingLevel);
+			size_t growth = streamedSize(streamed, streamed.requestedLevel) - current;
+			if (committedBytes + growth > budget)
+				evict(growth, streamed);
+
+			// settle for a coarser level if the requested one still does not fit
+			size_t level = streamed.requestedLevel;
+			while (level < streamed.residentLevel && committedBytes + streamedSize(streamed, level) - current > budget)
+				level++;
+			if (level < streamed.residentLevel)
+				moveTo(streamed, level);
+		}
+
+		frame++;
+		for (std::unordered_map<const TextureHandle*, StreamedTexture>::iterator it = textures.begin(); it != textures.end(); ++it)
+			it->second.requestedLevel = it->second.tailLevel;
+	}
+
+	void TextureStreamer::evict(size_t size, const StreamedTexture& keep)
+	{
+		// textures drawn last frame keep the levels they asked for, the others go back to the tail
+		struct Victim
+		{
+			StreamedTexture* streamed;
+			size_t level;
+		};
+		std::vector<Victim> victims;
+		for (std::unordered_map<const TextureHandle*, StreamedTexture>::iterator it = textures.begin(); it != textures.end(); ++it) {
+			StreamedTexture& streamed = it->second;
+			if (&streamed == &keep || streamed.pendingLevel != streamed.residentLevel)
+				continue;
+			size_t level = streamed.lastUsedFrame == frame ? streamed.requestedLevel : streamed.tailLevel;
+			if (level > streamed.residentLevel) {
+				Victim victim = { &streamed, level };
+				victims.push_back(victim);
+			}
+		}
+		std::sort(victims.begin(), victims.end(), [](const Victim& a, const Victim& b) {
+			return a.streamed->lastUsedFrame < b.streamed->lastUsedFrame;
+		});
+
+		for (size_t i = 0; i < victims.size() && committedBytes + size > budget; i++)
+			moveTo(*victims[i].streamed, victims[i].level);
+	}
+
+	void TextureStreamer::moveTo(StreamedTexture& streamed, size_t level)
+	{
+		committedBytes = committedBytes - streamedSize(streamed, streamed.pendingLevel) + streamedSize(streamed, level);
+		streamed.pendingLevel = level;
+
+		// back to the tail - the array of its own is deleted right away
+		if (level >= streamed.tailLevel) {
+			std::shared_ptr<TextureHandle> handle = streamed.handle.lock();
+			if (handle)
+				handle->setStreamedArray(std::shared_ptr<TextureArray>());
+			residentBytes -= streamedSize(streamed, streamed.residentLevel);
+			streamed.residentLevel = level;
+			generation++;
+			return;
+		}
+
+		std::weak_ptr<TextureHandle> handle = streamed.handle;
+		size_t uploadSize = streamedSize(streamed, level);
+		if (level > streamed.residentLevel) {
+			// coarser levels were read already
+			UploadQueue::global().push(uploadSize, [handle, level]() {
+				TextureStreamer::global().finishMove(handle, level);
+			});
+			return;
+		}
+
+		TextureImage image = streamed.image;
+		size_t last = streamed.residentLevel;
+		ThreadPool::global().submit([handle, image, level, last, uploadSize]() {
+			// page faults on the mapped cache files happen here instead of on the GL thread
+			for (size_t i = level; i < last && i < image.levels.size(); i++)
+				touchPages(image.levels[i].data, image.levels[i].size);
+
+			UploadQueue::global().push(uploadSize, [handle, level]() {
+				TextureStreamer::global().finishMove(handle, level);
+			});
+		});
+	}
+
+	void TextureStreamer::finishMove(const std::weak_ptr<TextureHandle>& target, size_t level)
+	{
+		std::shared_ptr<TextureHandle> handle = target.lock();
+		if (!handle)
+			return;
+		std::unordered_map<const TextureHandle*, StreamedTexture>::iterator it = textures.find(handle.get());
+		if (it == textures.end())
+			return;
+		// moved somewhere else since
+		StreamedTexture& streamed = it->second;
+		if (streamed.pendingLevel != level)
+			return;
+
+		// the previous array of its own goes with the last reference
+		const TextureImage& image = streamed.image;
+		std::shared_ptr<TextureArray> array = std::make_shared<TextureArray>(image.width, image.height, image.format,
+			image.levels.size(), level, 1);
+		array->add(image);
+		handle->setStreamedArray(array);
+		residentBytes = residentBytes - streamedSize(streamed, streamed.residentLevel) + streamedSize(streamed, level);
+		streamed.residentLevel = level;
+		generation++;
+	}
+
+	void TextureStreamer::setBudget(size_t bytes)
+	{
+		budget = bytes;
+	}
+
+	size_t TextureStreamer::getBudget() const
+	{
+		return budget;
+	}
+
+	void TextureStreamer::setViewportHeight(int height)
+	{
+		viewportHeight = height;
+	}
+
+	int TextureStreamer::getViewportHeight() const
+	{
+		return viewportHeight;
+	}
+
+	size_t TextureStreamer::getResidentBytes() const
+	{
+		return residentBytes;
+	}
+
+	unsigned TextureStreamer::getGeneration() const
+	{
+		return generation;
+	}
+
+}
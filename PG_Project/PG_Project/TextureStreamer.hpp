@@ -0,0 +1,101 @@
+#ifndef TextureStreamer_hpp
+#define TextureStreamer_hpp
+
+#include <GL/glew.h>
+
+#include "TextureArray.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    // Streams the finest mip levels of textures in and out of video memory. A texture starts with
+    // only its small levels (the mip tail) resident, in a layer of a shared texture array. Every
+    // frame the meshes report how large their textures appear on screen; when finer levels are
+    // needed they are paged in on the thread pool and uploaded through the UploadQueue into a
+    // single layer array of the texture's own, which replaces the shared layer until the texture
+    // goes back to its tail. The least recently used textures give their fine levels back whenever
+    // the memory budget would be exceeded - their own arrays are deleted, so the memory really is
+    // freed.
+    class TextureStreamer
+    {
+    public:
+        TextureStreamer();
+
+        static TextureStreamer& global();
+
+        // Finest level that is always resident for a texture of the given size
+        static size_t tailLevel(int width, int height, size_t levelCount);
+
+        // GL thread - starts managing a texture created with its mip tail resident, image holds
+        // the whole mip chain
+        void add(const std::shared_ptr<TextureHandle>& texture, const TextureImage& image);
+
+        // GL thread - asks for the level that gives one texel per pixel, pixelsPerUv being the
+        // number of screen pixels covered by one unit of texture coordinates
+        void request(const TextureHandle& texture, float pixelsPerUv);
+
+        // GL thread, once per frame - streams in the levels requested during the last frame and
+        // evicts levels to stay within the budget
+        void update();
+
+        // Video memory the streamed levels may use, on top of the mip tails
+        void setBudget(size_t bytes);
+        size_t getBudget() const;
+
+        // Height in pixels of the view the requests are made for
+        void setViewportHeight(int height);
+        int getViewportHeight() const;
+
+        // Video memory taken by the streamed levels, as of the last update
+        size_t getResidentBytes() const;
+
+        // Changes every time a texture moves to another array, to know when the ids and layers
+        // returned by the handles have to be read again
+        unsigned getGeneration() const;
+
+    private:
+        struct StreamedTexture
+        {
+            std::weak_ptr<TextureHandle> handle;
+            TextureImage image;
+            size_t tailLevel;
+            // finest level the texture is drawn with
+            size_t residentLevel;
+            // level the texture is moving to, residentLevel when it is not moving
+            size_t pendingLevel;
+            // finest level asked for since the last update
+            size_t requestedLevel;
+            unsigned lastUsedFrame;
+        };
+
+        std::unordered_map<const TextureHandle*, StreamedTexture> textures;
+        size_t budget;
+        size_t residentBytes;
+        // memory of the levels the textures will hold once their moves are done
+        size_t committedBytes;
+        int viewportHeight;
+        unsigned frame;
+        unsigned generation;
+
+        // Memory of the array of its own a texture needs to be drawn from level
+        static size_t streamedSize(const StreamedTexture& texture, size_t level);
+
+        // Starts moving the texture to level - finer levels are read on the thread pool first
+        void moveTo(StreamedTexture& texture, size_t level);
+        void finishMove(const std::weak_ptr<TextureHandle>& handle, size_t level);
+
+        // Moves the least recently used textures to coarser levels until size more bytes fit in
+        // the budget
+        void evict(size_t size, const StreamedTexture& keep);
+
+        TextureStreamer(const TextureStreamer&);
+        TextureStreamer& operator=(const TextureStreamer&);
+    };
+
+}
+
+#endif /* TextureStreamer_hpp */
@@ -0,0 +1,136 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+namespace gps {
+
+	ThreadPool::ThreadPool(unsigned threadCount) : stopping(false)
+	{
+		if (threadCount == 0) {
+			unsigned hardwareThreads = std::thread::hardware_concurrency();
+			threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+		}
+
+		for (unsigned i = 0; i < threadCount; i++)
+			workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(jobsMutex);
+			stopping = true;
+		}
+		jobsAvailable.notify_all();
+
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	ThreadPool& ThreadPool::global()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+
+	unsigned ThreadPool::getThreadCount() const
+	{
+		return (unsigned)workers.size();
+	}
+
+	void ThreadPool::enqueue(std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(jobsMutex);
+			jobs.push_back(job);
+		}
+		jobsAvailable.notify_one();
+	}
+
+	void ThreadPool::workerLoop()
+	{
+		for (;;) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(jobsMutex);
+				jobsAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (stopping && jobs.empty())
+					return;
+				job = jobs.front();
+				jobs.pop_front();
+			}
+			job();
+		}
+	}
+
+	namespace {
+
+		// Work shared between the caller of parallelFor and the helper jobs - it outlives
+		// the call, helpers that start late simply find nothing left to do
+		struct ParallelForState
+		{
+			std::function<void(size_t)> body;
+			size_t count;
+			std::atomic<size_t> nextItem;
+			std::atomic<size_t> finishedItems;
+			std::mutex doneMutex;
+			std::condition_variable done;
+			std::exception_ptr error;
+			std::mutex errorMutex;
+
+			void run() {
+				size_t item;
+				while ((item = nextItem.fetch_add(1)) < count) {
+					try {
+						body(item);
+					}
+					catch (...) {
+						std::lock_guard<std::mutex> lock(errorMutex);
+						if (!error)
+							error = std::current_exception();
+					}
+
+					if (finishedItems.fetch_add(1) + 1 == count) {
+						std::lock_guard<std::mutex> lock(doneMutex);
+						done.notify_all();
+					}
+				}
+			}
+		};
+	}
+
+	void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& body)
+	{
+		if (count == 0)
+			return;
+
+		if (count == 1 || workers.empty()) {
+			for (size_t i = 0; i < count; i++)
+				body(i);
+			return;
+		}
+
+		std::shared_ptr<ParallelForState> state = std::make_shared<ParallelForState>();
+		state->body = body;
+		state->count = count;
+		state->nextItem = 0;
+		state->finishedItems = 0;
+
+		size_t helpers = std::min(count - 1, workers.size());
+		for (size_t i = 0; i < helpers; i++)
+			enqueue([state]() { state->run(); });
+
+		state->run();
+
+		{
+			std::unique_lock<std::mutex> lock(state->doneMutex);
+			state->done.wait(lock, [&state]() { return state->finishedItems.load() == state->count; });
+		}
+
+		if (state->error)
+			std::rethrow_exception(state->error);
+	}
+
+}
@@ -0,0 +1,61 @@
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    // Fixed set of worker threads that run queued jobs
+    class ThreadPool
+    {
+    public:
+        // threadCount = 0 - one worker per hardware thread, minus the calling one
+        explicit ThreadPool(unsigned threadCount = 0);
+        ~ThreadPool();
+
+        // Pool shared by the loaders and the per-frame jobs
+        static ThreadPool& global();
+
+        unsigned getThreadCount() const;
+
+        // Queues a job, the future holds its result (or the exception it threw)
+        template <typename Function>
+        auto submit(Function function) -> std::future<decltype(function())>
+        {
+            typedef decltype(function()) Result;
+            std::shared_ptr<std::packaged_task<Result()> > task =
+                std::make_shared<std::packaged_task<Result()> >(function);
+            std::future<Result> result = task->get_future();
+            enqueue([task]() { (*task)(); });
+            return result;
+        }
+
+        // Runs body(0) .. body(count - 1) on the workers and on the calling thread, returns when all are done.
+        // Safe to call from inside a job - the caller keeps working instead of waiting for a free worker.
+        void parallelFor(size_t count, const std::function<void(size_t)>& body);
+
+    private:
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()> > jobs;
+        std::mutex jobsMutex;
+        std::condition_variable jobsAvailable;
+        bool stopping;
+
+        void enqueue(std::function<void()> job);
+        void workerLoop();
+
+        ThreadPool(const ThreadPool&);
+        ThreadPool& operator=(const ThreadPool&);
+    };
+
+}
+
+#endif /* ThreadPool_hpp */
@@ -0,0 +1,68 @@
+#include "UploadQueue.hpp"
+
+namespace gps {
+
+	UploadQueue::UploadQueue() : frameBudget(8 * 1024 * 1024)
+	{
+	}
+
+	UploadQueue& UploadQueue::global()
+	{
+		// never deleted - the textures released by the global models at exit still push to it
+		static UploadQueue* queue = new UploadQueue();
+		return *queue;
+	}
+
+	void UploadQueue::push(size_t size, std::function<void()> upload)
+	{
+		Upload item;
+		item.size = size;
+		item.upload = upload;
+
+		std::lock_guard<std::mutex> lock(uploadsMutex);
+		uploads.push_back(item);
+	}
+
+	void UploadQueue::process()
+	{
+		size_t budget = getFrameBudget();
+		size_t uploaded = 0;
+
+		for (;;) {
+			Upload item;
+			{
+				std::lock_guard<std::mutex> lock(uploadsMutex);
+				if (uploads.empty())
+					return;
+				// keep the next upload for the following frame if it does not fit anymore
+				if (uploaded > 0 && uploaded + uploads.front().size > budget)
+					return;
+				item = uploads.front();
+				uploads.pop_front();
+			}
+
+			// the lock is not held here, so the loaders are never blocked by the driver
+			item.upload();
+			uploaded += item.size;
+		}
+	}
+
+	void UploadQueue::setFrameBudget(size_t bytes)
+	{
+		std::lock_guard<std::mutex> lock(uploadsMutex);
+		frameBudget = bytes;
+	}
+
+	size_t UploadQueue::getFrameBudget() const
+	{
+		std::lock_guard<std::mutex> lock(uploadsMutex);
+		return frameBudget;
+	}
+
+	size_t UploadQueue::pending() const
+	{
+		std::lock_guard<std::mutex> lock(uploadsMutex);
+		return uploads.size();
+	}
+
+}
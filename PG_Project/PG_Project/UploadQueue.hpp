@@ -0,0 +1,53 @@
+#ifndef UploadQueue_hpp
+#define UploadQueue_hpp
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+namespace gps {
+
+    // Queue of OpenGL uploads prepared by the loader threads and executed on the GL thread.
+    // Each frame only a bounded amount of data is sent to the driver, so that large models
+    // are streamed in over several frames instead of stalling a single one.
+    class UploadQueue
+    {
+    public:
+        UploadQueue();
+
+        // Queue used by Model3D::LoadModelAsync
+        static UploadQueue& global();
+
+        // Can be called from any thread - size is the number of bytes the upload sends to the GPU
+        void push(size_t size, std::function<void()> upload);
+
+        // GL thread only - runs queued uploads until the frame budget is used up.
+        // At least one upload runs per call, so an item larger than the budget still goes through.
+        void process();
+
+        // Bytes uploaded per call to process()
+        void setFrameBudget(size_t bytes);
+        size_t getFrameBudget() const;
+
+        // Number of uploads still waiting
+        size_t pending() const;
+
+    private:
+        struct Upload
+        {
+            size_t size;
+            std::function<void()> upload;
+        };
+
+        std::deque<Upload> uploads;
+        mutable std::mutex uploadsMutex;
+        size_t frameBudget;
+
+        UploadQueue(const UploadQueue&);
+        UploadQueue& operator=(const UploadQueue&);
+    };
+
+}
+
+#endif /* UploadQueue_hpp */
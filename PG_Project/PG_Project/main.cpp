@@ -9,17 +9,38 @@
 
 #include "Window.h"
 #include "Shader.hpp"
+#include "ShaderPermutations.hpp"
+#include "Bvh.hpp"
 #include "Camera.hpp"
+#include "FrustumCuller.hpp"
+#include "GLState.hpp"
 #include "Model3D.hpp"
+#include "OcclusionCuller.hpp"
+#include "RenderQueue.hpp"
 #include "Skybox.hpp"
+#include "StaticGeometry.hpp"
+#include "TextureStreamer.hpp"
+#include "UploadQueue.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <future>
 #include <iostream>
+#include <string>
 
 #define NUMBER_OF_LIGHTS 13
 
 const unsigned int SHADOW_WIDTH = 15048;
 const unsigned int SHADOW_HEIGHT = 15048;
 
+// bytes of geometry/textures sent to the GPU per frame while models are streamed in
+const size_t UPLOAD_BUDGET_PER_FRAME = 8 * 1024 * 1024;
+// video memory for the mip levels streamed in on top of the always resident mip tails
+const size_t TEXTURE_STREAMING_BUDGET = 256 * 1024 * 1024;
+// lower it on machines with little memory - MAX_TEXTURE_SIZE clamps the longest edge (0 - no limit)
+const gps::TextureQuality TEXTURE_QUALITY = gps::TEXTURE_QUALITY_FULL;
+const int MAX_TEXTURE_SIZE = 0;
+
 // window
 gps::Window myWindow;
 
@@ -39,18 +60,18 @@ GLint color[10];
 GLuint shadowMapFBO;
 GLuint depthMapTexture;
 bool showDepthMap;
+bool shadowsEnabled = true;
+// occlusion culling of the scene pass - toggled with the 6 key
+bool occlusionEnabled = true;
+
+// bits of the key of a shaderStart.frag permutation, the enabled lights follow
+const uint32_t SCENE_SHADER_ALPHA_TEST = 1 << 0;
+const uint32_t SCENE_SHADER_SHADOWS = 1 << 1;
+const int SCENE_SHADER_LIGHT_SHIFT = 2;
 
 
 // shader uniform locations
-GLuint modelLoc;
-GLuint viewLoc;
-GLuint projectionLoc;
-GLuint normalMatrixLoc;
-GLuint lightDirLoc;
-GLuint lightColorLoc;
-GLuint lightEnableLoc;
-GLuint enableDiscardLoc;
-GLuint colorLoc;
+gps::ShaderUniform<int> colorLoc;
 
 // camera
 gps::Camera myCamera(
@@ -77,14 +98,44 @@ gps::Model3D scene2;
 gps::Model3D scene3;
 gps::Model3D windmill;
 gps::Model3D water[2000];
+// background loads, checked every frame for errors
+std::vector<std::future<void> > modelLoads;
 
 GLfloat angleY, lightAngle, windAngle;
 
-// shaders
-gps::Shader myCustomShader;
+// shaders - the scene shader has a variant for every combination of lights, alpha test and shadows
+gps::ShaderPermutations sceneShaders;
+gps::ShaderPermutations depthShaders;
+
+// draws of the scene objects, sorted by state before they are executed
+gps::RenderQueue renderQueue;
+// scene1..3 in shared buffers once they are loaded, drawn with a few multi-draw calls
+gps::StaticGeometry staticScene;
+
+// every mesh instance drawn from staticScene, the windmill and the light cubes, built once they are
+// loaded - the windmill items are refitted as it turns, the rain drops move too much to be in it
+enum SceneItemKind { SCENE_ITEM_STATIC_MESH, SCENE_ITEM_WINDMILL_MESH, SCENE_ITEM_LIGHT_CUBE };
+struct SceneItem
+{
+    SceneItemKind kind;
+    // mesh of staticScene or of the windmill, or light cube
+    size_t index;
+};
+gps::Bvh sceneBvh;
+std::vector<SceneItem> sceneItems;
+std::vector<uint32_t> windmillItems;
+std::vector<uint32_t> lightCubeItems;
+// flag per item and per static mesh, set by the last frustum query
+std::vector<uint8_t> sceneItemVisible;
+std::vector<uint8_t> staticMeshVisible;
+std::vector<uint32_t> sceneQuery;
+
+// the large opaque meshes of the scene hide the items of sceneBvh behind them in the scene pass
+gps::OcclusionCuller occlusionCuller;
+// smallest world space size, along two axes, of a mesh that is used as an occluder
+const float OCCLUDER_MINIMUM_SIZE = 3.0f;
 gps::Shader lightShader;
 gps::Shader screenQuadShader;
-gps::Shader depthMapShader;
 
 //skybox
 std::vector<const GLchar*> faces;
@@ -180,6 +231,7 @@ void progress()
 void windowResizeCallback(GLFWwindow* window, int width, int height) 
 {
     fprintf(stdout, "Window resized! New width: %d , and height: %d\n", width, height);
+    gps::TextureStreamer::global().setViewportHeight(height);
 }
 
 void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int mode) 
@@ -189,6 +241,10 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
 
     if (key == GLFW_KEY_M && action == GLFW_PRESS)
         showDepthMap = !showDepthMap;
+    if (key == GLFW_KEY_5 && action == GLFW_PRESS)
+        shadowsEnabled = !shadowsEnabled;
+    if (key == GLFW_KEY_6 && action == GLFW_PRESS)
+        occlusionEnabled = !occlusionEnabled;
     if (key == GLFW_KEY_1 && action == GLFW_PRESS)
         lightEnable[0] = !lightEnable[0];
     if (key == GLFW_KEY_2 && action == GLFW_PRESS)
@@ -290,17 +346,17 @@ void processMovement()
 
     if (pressedKeys[GLFW_KEY_Z]) 
     {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        gps::GLState::global().polygonMode(GL_FILL);
     }
 
     if (pressedKeys[GLFW_KEY_X]) 
     {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+        gps::GLState::global().polygonMode(GL_LINE);
     }
 
     if (pressedKeys[GLFW_KEY_C]) 
     {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_POINT);
+        gps::GLState::global().polygonMode(GL_POINT);
     }
 }
 
@@ -319,22 +375,60 @@ void setWindowCallbacks()
 void initOpenGLState() 
 {
     glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
-    glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+    gps::GLState::global().viewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
 
     glEnable(GL_DEPTH_TEST); // enable depth-testing
-    glDepthFunc(GL_LESS); // depth-testing interprets a smaller value as "closer"
+    gps::GLState::global().depthFunc(GL_LESS); // depth-testing interprets a smaller value as "closer"
     glEnable(GL_CULL_FACE); // cull face
     glCullFace(GL_BACK); // cull back face
     glFrontFace(GL_CCW); // GL_CCW for counter clock-wise
 
     glEnable(GL_FRAMEBUFFER_SRGB);
+
+    // cook the textures into block compressed .ktx files when the driver can sample them
+    gps::TextureCache::global().setCompression(GLEW_EXT_texture_compression_s3tc != 0);
+    gps::TextureCache::global().setStreaming(true);
+    gps::TextureCache::global().setQuality(TEXTURE_QUALITY, MAX_TEXTURE_SIZE);
+    gps::TextureStreamer::global().setBudget(TEXTURE_STREAMING_BUDGET);
+    gps::TextureStreamer::global().setViewportHeight(myWindow.getWindowDimensions().height);
+}
+
+// Reports the background loads that failed - the models stay empty and are not drawn
+void checkModelLoads()
+{
+    for (size_t i = 0; i < modelLoads.size(); i++)
+    {
+        if (!modelLoads[i].valid() || modelLoads[i].wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            continue;
+        try
+        {
+            modelLoads[i].get();
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "ERROR: " << e.what() << std::endl;
+        }
+    }
 }
 
 void initModels()
 {
-    scene1.LoadModel("models/scene/scene1.obj");
-    scene2.LoadModel("models/scene/scene2.obj");
-    scene3.LoadModel("models/scene/scene3.obj");
+    // the scene files are large enough to benefit from the multi-threaded parser
+    gps::ModelLoadOptions sceneOptions;
+    sceneOptions.parallelParse = true;
+    // the scene is moved into staticScene once it is loaded
+    sceneOptions.keepGeometry = true;
+    // one mesh per object of the files - staticScene batches them by texture array anyway, and the
+    // occlusion and frustum tests need boxes around single objects, not around a material used all
+    // over the village
+    sceneOptions.mergeByMaterial = false;
+
+    // the big models are loaded in the background and show up once they are uploaded
+    gps::UploadQueue::global().setFrameBudget(UPLOAD_BUDGET_PER_FRAME);
+    modelLoads.push_back(scene1.LoadModelAsync("models/scene/scene1.obj", sceneOptions));
+    modelLoads.push_back(scene2.LoadModelAsync("models/scene/scene2.obj", sceneOptions));
+    modelLoads.push_back(scene3.LoadModelAsync("models/scene/scene3.obj", sceneOptions));
+    modelLoads.push_back(windmill.LoadModelAsync("models/windmill/windmill.obj"));
     lightCube.LoadModel("models/cube/cube.obj");
     lightCubes[0].LoadModel("models/cubes/cube1.obj");
     lightCubes[1].LoadModel("models/cubes/cube2.obj");
@@ -347,7 +441,6 @@ void initModels()
     lightCubes[8].LoadModel("models/cubes/cube9.obj");
     lightCubes[9].LoadModel("models/cubes/cube10.obj");
     screenQuad.LoadModel("models/quad/quad.obj");
-    windmill.LoadModel("models/windmill/windmill.obj");
     water[0].LoadModel("models/water/water.obj");
     srand(time(0));
 
@@ -377,48 +470,59 @@ void initModels()
     skyboxShader.useShaderProgram();
 
     view = myCamera.getViewMatrix();
-    glUniformMatrix4fv(glGetUniformLocation(skyboxShader.shaderProgram, "view"), 1, GL_FALSE,
-        glm::value_ptr(view));
+    skyboxShader.setUniform("view", view);
 
     projection = glm::perspective(glm::radians(45.0f), (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height, 0.1f, 2000.0f);
-    glUniformMatrix4fv(glGetUniformLocation(skyboxShader.shaderProgram, "projection"), 1, GL_FALSE,
-        glm::value_ptr(projection));
+    skyboxShader.setUniform("projection", projection);
+}
+
+// Defines of the scene shader permutation with the given key
+std::string sceneShaderDefines(uint32_t key)
+{
+    char defines[128];
+    snprintf(defines, sizeof(defines), "#define ALPHA_TEST %d\n#define SHADOWS %d\n#define LIGHT_MASK 0x%x\n",
+        (key & SCENE_SHADER_ALPHA_TEST) ? 1 : 0, (key & SCENE_SHADER_SHADOWS) ? 1 : 0, key >> SCENE_SHADER_LIGHT_SHIFT);
+    return defines;
+}
+
+// Key of the scene shader permutation for the lights that are on and the shadow setting
+uint32_t sceneShaderKey(bool alphaTest)
+{
+    uint32_t key = 0;
+    if (alphaTest)
+        key |= SCENE_SHADER_ALPHA_TEST;
+    if (shadowsEnabled)
+        key |= SCENE_SHADER_SHADOWS;
+    for (int i = 0; i < NUMBER_OF_LIGHTS; i++) {
+        if (lightEnable[i])
+            key |= 1u << (SCENE_SHADER_LIGHT_SHIFT + i);
+    }
+    return key;
+}
+
+// Defines of the depth map shader permutation, only the alpha test bit of the key is used
+std::string depthShaderDefines(uint32_t key)
+{
+    return (key & SCENE_SHADER_ALPHA_TEST) ? "#define ALPHA_TEST 1\n" : "#define ALPHA_TEST 0\n";
 }
 
 void initShaders() 
 {
-    myCustomShader.loadShader("shaders/shaderStart.vert", "shaders/shaderStart.frag");
-    myCustomShader.useShaderProgram();
+    sceneShaders.init("shaders/shaderStart.vert", "shaders/shaderStart.frag", sceneShaderDefines);
     lightShader.loadShader("shaders/lightCube.vert", "shaders/lightCube.frag");
     lightShader.useShaderProgram();
     screenQuadShader.loadShader("shaders/screenQuad.vert", "shaders/screenQuad.frag");
     screenQuadShader.useShaderProgram();
-    depthMapShader.loadShader("shaders/depthMap.vert", "shaders/depthMap.frag");
-    depthMapShader.useShaderProgram();
+    depthShaders.init("shaders/depthMap.vert", "shaders/depthMap.frag", depthShaderDefines);
 }
 
 void initUniforms() 
 {
-    myCustomShader.useShaderProgram();
-
+    // the scene shader variants get their uniforms in useSceneShader
     model = glm::mat4(1.0f);
-    modelLoc = glGetUniformLocation(myCustomShader.shaderProgram, "model");
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
     view = myCamera.getViewMatrix();
-    viewLoc = glGetUniformLocation(myCustomShader.shaderProgram, "view");
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-
     normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    normalMatrixLoc = glGetUniformLocation(myCustomShader.shaderProgram, "normalMatrix");
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-
     projection = glm::perspective(glm::radians(45.0f), (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height, 0.1f, 2000.0f);
-    projectionLoc = glGetUniformLocation(myCustomShader.shaderProgram, "projection");
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    enableDiscardLoc = glGetUniformLocation(myCustomShader.shaderProgram, "enableDiscard");
-    glUniform1i(enableDiscardLoc, 0);
 
     //set the light direction (direction towards the light)
     lightRotation = glm::vec3(0.0f, 12.0f, -17.0f);
@@ -438,9 +542,6 @@ void initUniforms()
     lightDir[12] = glm::vec3(8.42223f, 0.227888f, 2.00436f);
 
 
-    lightDirLoc = glGetUniformLocation(myCustomShader.shaderProgram, "lightDir");
-    glUniform3fv(lightDirLoc, NUMBER_OF_LIGHTS, glm::value_ptr(lightDir[0]));
-
     //set light color
     lightColor[0] = glm::vec3(1.0f, 0.0f, 0.0f); //red light
     lightColor[1] = glm::vec3(0.0f, 1.0f, 0.0f); //green light
@@ -449,8 +550,6 @@ void initUniforms()
     {
         lightColor[i] = glm::vec3(1.0f, 0.0f, 0.0f); //red light
     }
-    lightColorLoc = glGetUniformLocation(myCustomShader.shaderProgram, "lightColor");
-    glUniform3fv(lightColorLoc, NUMBER_OF_LIGHTS, glm::value_ptr(lightColor[0]));
 
     //set which lights are on
     lightEnable[0] = 1;
@@ -460,18 +559,22 @@ void initUniforms()
     {
         lightEnable[i] = 0;
     }
-    lightEnableLoc = glGetUniformLocation(myCustomShader.shaderProgram, "lightEnable");
-    glUniform1iv(lightEnableLoc, NUMBER_OF_LIGHTS, lightEnable);
+
+    // the variant for the lights that start on is built now instead of in the first frame
+    sceneShaders.get(sceneShaderKey(false));
+    sceneShaders.get(sceneShaderKey(true));
+    depthShaders.get(0);
+    depthShaders.get(SCENE_SHADER_ALPHA_TEST);
 
     //cubes
     lightShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-    colorLoc = glGetUniformLocation(lightShader.shaderProgram, "color");
+    lightShader.setUniform("projection", projection);
+    colorLoc = lightShader.getUniform<int>("color");
     for (int i = 0; i < 10; i++)
     {
         color[i] = 0;
     }
-    glUniform1i(colorLoc, 0);
+    lightShader.setUniform(colorLoc, 0);
 }
 
 void initFBO() 
@@ -481,7 +584,7 @@ void initFBO()
 
     //create depth texture for FBO
     glGenTextures(1, &depthMapTexture);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
+    gps::GLState::global().bindTexture(0, GL_TEXTURE_2D, depthMapTexture);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
         SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -492,13 +595,13 @@ void initFBO()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 
     //attach texture to FBO
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+    gps::GLState::global().bindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMapTexture, 0);
 
     glDrawBuffer(GL_NONE);
     glReadBuffer(GL_NONE);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    gps::GLState::global().bindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 glm::mat4 computeLightSpaceTrMatrix()
@@ -518,63 +621,252 @@ void updateDelta(double elapsedSeconds)
 }
 double lastTimeStamp = glfwGetTime();
 
-void drawObjects(gps::Shader shader, bool depthPass)
+// Placement of the scene models
+glm::mat4 sceneModelMatrix()
 {
-    shader.useShaderProgram();
-    if (!depthPass) glUniform1i(enableDiscardLoc, 0);
+    glm::mat4 sceneModel = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+    return glm::scale(sceneModel, glm::vec3(9.0f));
+}
 
-    // scene
-    if (!depthPass) glUniform1i(enableDiscardLoc, 1);
-    model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
-    model = glm::scale(model, glm::vec3(9.0f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    scene1.Draw(shader);
-    scene2.Draw(shader);
-    scene3.Draw(shader);
+// Placement of the windmill, turning around its axis
+glm::mat4 windmillModelMatrix()
+{
+    glm::mat4 windmillModel = glm::translate(sceneModelMatrix(), glm::vec3(-0.374719f, 1.66209f, -0.749788f));
+    windmillModel = glm::rotate(windmillModel, glm::radians(delta), glm::vec3(0.0f, 0.0f, 1.0f));
+    return glm::translate(windmillModel, glm::vec3(0.374719f, -1.66209f, 0.749788f));
+}
 
+// Turns the windmill and moves the rain drops - once per frame, the passes only draw them
+void animateObjects()
+{
     // get current time
     double currentTimeStamp = glfwGetTime();
     updateDelta(currentTimeStamp - lastTimeStamp);
     lastTimeStamp = currentTimeStamp;
 
-    model = glm::translate(model, glm::vec3(-0.374719f, 1.66209f, -0.749788f));
-    model = glm::rotate(model, glm::radians(delta), glm::vec3(0.0f, 0.0f, 1.0f));
-    model = glm::translate(model, glm::vec3(0.374719f, -1.66209f, 0.749788f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    windmill.Draw(shader);
-
+    // the step the drops used to take in both the shadow and the final pass
     for (int i = 0; i < 2000; i++)
     {
-        water_drops[i].y -= 0.10f;
+        water_drops[i].y -= 0.20f;
         if (water_drops[i].y < -2)
         {
             water_drops[i] = glm::vec3((rand() / (float)RAND_MAX) * 30 * 9 - 15 * 9, (rand() / (float)RAND_MAX) * 7, (rand() / (float)RAND_MAX) * 25 * 9 - 3 * 9);
         }
-        
+    }
+
+    // the boxes of the windmill meshes follow the rotation
+    glm::mat4 windmillModel = windmillModelMatrix();
+    for (size_t i = 0; i < windmillItems.size(); i++)
+    {
+        const gps::Mesh& mesh = windmill.getMeshes()[sceneItems[windmillItems[i]].index];
+        sceneBvh.update(windmillItems[i], mesh.getBoundingBox().transformed(windmillModel));
+    }
+}
+
+// Adds the meshes of the model big enough to hide others (walls, roofs, fences) to occlusionCuller
+void addOccluders(gps::Model3D& model, const glm::mat4& transform)
+{
+    std::vector<gps::Mesh>& meshes = model.getMeshes();
+    for (size_t i = 0; i < meshes.size(); i++)
+    {
+        gps::BoundingBox box = meshes[i].getBoundingBox().transformed(transform);
+        glm::vec3 size = box.maximum - box.minimum;
+        int largeSides = (size.x >= OCCLUDER_MINIMUM_SIZE) + (size.y >= OCCLUDER_MINIMUM_SIZE) + (size.z >= OCCLUDER_MINIMUM_SIZE);
+        if (largeSides >= 2)
+            occlusionCuller.addOccluder(meshes[i], transform);
+    }
+}
+
+// Packs the scene models into staticScene once all of them are loaded, their own buffers are freed
+void buildStaticScene()
+{
+    // the models that failed to load are left out
+    gps::Model3D* scenes[] = { &scene1, &scene2, &scene3 };
+    bool anyLoaded = false;
+    for (int i = 0; i < 3; i++)
+    {
+        if (!scenes[i]->isLoaded() && !scenes[i]->hasFailed())
+            return;
+        anyLoaded = anyLoaded || scenes[i]->isLoaded();
+    }
+    if (staticScene.isBuilt() || !anyLoaded)
+        return;
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (scenes[i]->isLoaded())
+            staticScene.add(*scenes[i], sceneModelMatrix());
+    }
+    staticScene.build();
+    for (int i = 0; i < 3; i++)
+    {
+        if (scenes[i]->isLoaded())
+            addOccluders(*scenes[i], sceneModelMatrix());
+    }
+    std::cout << "Occluders: " << occlusionCuller.getTriangleCount() << " triangles" << std::endl;
+    for (int i = 0; i < 3; i++)
+    {
+        if (scenes[i]->isLoaded())
+            scenes[i]->releaseGeometry();
+    }
+}
+
+void addSceneItem(std::vector<gps::BoundingBox>& boxes, SceneItemKind kind, size_t index, const gps::BoundingBox& box)
+{
+    SceneItem item = { kind, index };
+    sceneItems.push_back(item);
+    boxes.push_back(box);
+}
+
+// Builds sceneBvh over the static scene, the windmill and the light cubes once all of them are loaded
+void buildSceneBvh()
+{
+    if (!sceneItems.empty() || !staticScene.isBuilt() || (!windmill.isLoaded() && !windmill.hasFailed()))
+        return;
+
+    std::vector<gps::BoundingBox> boxes;
+    for (size_t i = 0; i < staticScene.getMeshCount(); i++)
+        addSceneItem(boxes, SCENE_ITEM_STATIC_MESH, i, staticScene.getMeshBounds(i));
+
+    // empty if the windmill failed to load
+    std::vector<gps::Mesh>& windmillMeshes = windmill.getMeshes();
+    glm::mat4 windmillModel = windmillModelMatrix();
+    for (size_t i = 0; i < windmillMeshes.size(); i++)
+    {
+        windmillItems.push_back((uint32_t)sceneItems.size());
+        addSceneItem(boxes, SCENE_ITEM_WINDMILL_MESH, i, windmillMeshes[i].getBoundingBox().transformed(windmillModel));
+    }
+
+    for (int i = 0; i < 10; i++)
+    {
+        std::vector<gps::Mesh>& cubeMeshes = lightCubes[i].getMeshes();
+        for (size_t m = 0; m < cubeMeshes.size(); m++)
+        {
+            lightCubeItems.push_back((uint32_t)sceneItems.size());
+            addSceneItem(boxes, SCENE_ITEM_LIGHT_CUBE, i, cubeMeshes[m].getBoundingBox().transformed(sceneModelMatrix()));
+        }
+    }
+
+    sceneBvh.build(boxes);
+    sceneItemVisible.assign(sceneItems.size(), 1);
+    staticMeshVisible.assign(staticScene.getMeshCount(), 1);
+    std::cout << "Scene BVH: " << sceneBvh.size() << " items, " << sceneBvh.nodeCount() << " nodes" << std::endl;
+}
+
+// Marks the items of sceneBvh inside the frustum, and with occlusion not hidden by the occluders,
+// the static meshes left out are not drawn
+void cullScene(const gps::Frustum& frustum, bool occlusion)
+{
+    sceneQuery.clear();
+    sceneBvh.queryFrustum(frustum, sceneQuery);
+    std::fill(sceneItemVisible.begin(), sceneItemVisible.end(), 0);
+    std::fill(staticMeshVisible.begin(), staticMeshVisible.end(), 0);
+    for (size_t i = 0; i < sceneQuery.size(); i++)
+    {
+        if (occlusion && occlusionCuller.isOccluded(sceneBvh.getBox(sceneQuery[i])))
+            continue;
+        const SceneItem& item = sceneItems[sceneQuery[i]];
+        sceneItemVisible[sceneQuery[i]] = 1;
+        if (item.kind == SCENE_ITEM_STATIC_MESH)
+            staticMeshVisible[item.index] = 1;
+    }
+    staticScene.setVisibility(staticMeshVisible);
+}
+
+// Queues the draws of the scene objects inside the frustum - the meshes that need the alpha test
+// get cutoutShader
+void submitObjects(gps::RenderPass pass, gps::Shader& opaqueShader, gps::Shader& cutoutShader, const gps::Frustum& frustum)
+{
+    // the occlusion buffer is rendered from the camera, it does not apply to the shadow pass
+    if (!sceneItems.empty())
+        cullScene(frustum, occlusionEnabled && pass == gps::RENDER_PASS_SCENE);
+
+    // scene - levels of detail follow the camera, in the shadow pass as well. The texture levels
+    // are only requested for what the camera sees, in the scene pass.
+    model = sceneModelMatrix();
+    if (staticScene.isBuilt())
+    {
+        staticScene.selectLods(view, projection);
+        if (pass == gps::RENDER_PASS_SCENE)
+            staticScene.requestTextureLevels(view, projection);
+    }
+    else
+    {
+        // the models loaded so far, until all of them are in staticScene
+        scene1.Submit(renderQueue, pass, opaqueShader, cutoutShader, model, view, projection, frustum);
+        scene2.Submit(renderQueue, pass, opaqueShader, cutoutShader, model, view, projection, frustum);
+        scene3.Submit(renderQueue, pass, opaqueShader, cutoutShader, model, view, projection, frustum);
+    }
+
+    // the windmill culls its own meshes, it is skipped when none of them is in the frustum
+    bool windmillVisible = sceneItems.empty();
+    for (size_t i = 0; i < windmillItems.size(); i++)
+        windmillVisible = windmillVisible || sceneItemVisible[windmillItems[i]];
+    model = windmillModelMatrix();
+    if (windmillVisible)
+        windmill.Submit(renderQueue, pass, opaqueShader, cutoutShader, model, view, projection, frustum);
+
+    for (int i = 0; i < 2000; i++)
+    {
         model = glm::translate(glm::mat4(1.0f), water_drops[i]);
         model = glm::scale(model, glm::vec3(1/90.0f));
 
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-        water[i].Draw(shader);
+        water[i].Submit(renderQueue, pass, opaqueShader, cutoutShader, model, view, projection, frustum);
     }
 }
 
+// Draws the scene objects inside the frustum - the static scene opaque meshes first, the queued
+// draws, then the static scene cutout meshes
+void drawObjects(gps::RenderPass pass, gps::Shader& opaqueShader, gps::Shader& cutoutShader, const gps::Frustum& frustum)
+{
+    submitObjects(pass, opaqueShader, cutoutShader, frustum);
+    staticScene.Draw(opaqueShader, gps::MESH_BUCKET_OPAQUE);
+    renderQueue.execute();
+    staticScene.Draw(cutoutShader, gps::MESH_BUCKET_CUTOUT);
+}
+
+// Makes the depth map shader variant with or without the alpha test the program in use
+gps::Shader& useDepthShader(bool alphaTest)
+{
+    gps::Shader& shader = depthShaders.get(alphaTest ? SCENE_SHADER_ALPHA_TEST : 0);
+    shader.useShaderProgram();
+    shader.setUniform("lightSpaceTrMatrix", computeLightSpaceTrMatrix());
+    return shader;
+}
+
 void renderSceneToDepthBuffer()
 {
-    depthMapShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix"),
-        1,
-        GL_FALSE,
-        glm::value_ptr(computeLightSpaceTrMatrix()));
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+    gps::GLState::global().viewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+    gps::GLState::global().bindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
     glClear(GL_DEPTH_BUFFER_BIT);
-    drawObjects(depthMapShader, true);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // only the cutout meshes pay for the alpha test
+    // the casters outside the view still throw shadows into it, the light volume is culled against
+    gps::Frustum lightFrustum = gps::Frustum::fromMatrix(computeLightSpaceTrMatrix());
+    drawObjects(gps::RENDER_PASS_SHADOW, useDepthShader(false), useDepthShader(true), lightFrustum);
+    gps::GLState::global().bindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Makes the scene shader variant for the current settings the program in use, with the uniforms
+// of this frame - the values a variant already has are not uploaded again
+gps::Shader& useSceneShader(bool alphaTest)
+{
+    gps::Shader& shader = sceneShaders.get(sceneShaderKey(alphaTest));
+    shader.useShaderProgram();
+
+    shader.setUniform("view", view);
+    shader.setUniform("projection", projection);
+    shader.setUniform("normalMatrix", normalMatrix);
+    shader.setUniform(shader.getUniform<glm::vec3>("lightDir"), lightDir, NUMBER_OF_LIGHTS);
+    shader.setUniform(shader.getUniform<glm::vec3>("lightColor"), lightColor, NUMBER_OF_LIGHTS);
+    shader.setUniform("shadowMap", 3);
+    shader.setUniform("lightSpaceTrMatrix", computeLightSpaceTrMatrix());
+    return shader;
 }
 
 void renderScene()
 {
+    animateObjects();
+
     // render depth map on screen - toggled with the M key
     if (showDepthMap)
     {
@@ -582,15 +874,14 @@ void renderScene()
 
         renderSceneToDepthBuffer();
 
-        glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+        gps::GLState::global().viewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
         glClear(GL_COLOR_BUFFER_BIT);
 
         screenQuadShader.useShaderProgram();
 
         //bind the depth map
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-        glUniform1i(glGetUniformLocation(screenQuadShader.shaderProgram, "depthMap"), 0);
+        gps::GLState::global().bindTexture(0, GL_TEXTURE_2D, depthMapTexture);
+        screenQuadShader.setUniform("depthMap", 0);
 
         glDisable(GL_DEPTH_TEST);
         screenQuad.Draw(screenQuadShader);
@@ -599,72 +890,79 @@ void renderScene()
     else
     {
 
-        renderSceneToDepthBuffer();
-
-        // final scene rendering pass (with shadows)
-
-        glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        myCustomShader.useShaderProgram();
-
         if (!presentation)view = myCamera.getViewMatrix();
         else
         {
             progress();
             view = myCameraPresentation.getViewMatrix();
         }
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+
+        // the occluders are rasterized on the thread pool while the shadow pass is submitted and
+        // the GPU finishes the previous frame
+        if (occlusionEnabled)
+            occlusionCuller.beginRender(projection * view);
+
+        // the shadow map is only needed by the variants built with shadows - toggled with the 5 key
+        if (shadowsEnabled)
+            renderSceneToDepthBuffer();
+
+        // final scene rendering pass (with shadows)
+
+        gps::GLState::global().viewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         lightDir[0] = glm::vec3(glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(lightRotation, 1.0f));
         lightDir[1] = glm::vec3(glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(lightRotation, 1.0f));
         lightDir[2] = glm::vec3(glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(lightRotation, 1.0f));
-        glUniform3fv(lightDirLoc, NUMBER_OF_LIGHTS, glm::value_ptr(lightDir[0]));
-
-        glUniform1iv(lightEnableLoc, NUMBER_OF_LIGHTS, lightEnable);
 
         //bind the shadow map
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-        glUniform1i(glGetUniformLocation(myCustomShader.shaderProgram, "shadowMap"), 3);
+        gps::GLState::global().bindTexture(3, GL_TEXTURE_2D, depthMapTexture);
 
-        glUniformMatrix4fv(glGetUniformLocation(myCustomShader.shaderProgram, "lightSpaceTrMatrix"),
-            1,
-            GL_FALSE,
-            glm::value_ptr(computeLightSpaceTrMatrix()));
-
-        drawObjects(myCustomShader, false);
+        // opaque meshes first, with early depth testing, then the alpha tested ones behind them
+        drawObjects(gps::RENDER_PASS_SCENE, useSceneShader(false), useSceneShader(true), gps::Frustum::fromMatrix(projection * view));
 
         //draw a white cube around the light
 
         lightShader.useShaderProgram();
 
-        glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        lightShader.setUniform("view", view);
 
         model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
         model = glm::scale(model, glm::vec3(9.0f));
-        glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-
-        for (int i = 0; i < 10; i++)
+        lightShader.setUniform("model", model);
+
+        // the cubes in the frustum of the scene pass are drawn, the ones close to the camera lit
+        bool cubeVisible[10];
+        bool cubeLit[10];
+        std::fill(cubeVisible, cubeVisible + 10, sceneItems.empty());
+        std::fill(cubeLit, cubeLit + 10, false);
+        if (!sceneItems.empty())
         {
-            float auxx = myCamera.getDistance(lightDir[i + 3]);
-            if (auxx < 5.0f)
+            sceneQuery.clear();
+            sceneBvh.querySphere(myCamera.getPosition(), 5.0f, sceneQuery);
+            for (size_t i = 0; i < sceneQuery.size(); i++)
             {
-                //glUniform1i(colorLoc, color[i]);
-                glUniform1i(colorLoc, 1);
-                //lightEnable[i] = 1;
+                if (sceneItems[sceneQuery[i]].kind == SCENE_ITEM_LIGHT_CUBE)
+                    cubeLit[sceneItems[sceneQuery[i]].index] = true;
             }
-            else
+            for (size_t i = 0; i < lightCubeItems.size(); i++)
             {
-                glUniform1i(colorLoc, 0);
-                //lightEnable[i] = 0;
+                if (sceneItemVisible[lightCubeItems[i]])
+                    cubeVisible[sceneItems[lightCubeItems[i]].index] = true;
             }
+        }
+
+        for (int i = 0; i < 10; i++)
+        {
+            if (!cubeVisible[i])
+                continue;
+            lightShader.setUniform(colorLoc, cubeLit[i] ? 1 : 0);
             lightCubes[i].Draw(lightShader);
         }
 
         model = glm::translate(model, 1.0f * lightDir[0]);
         model = glm::scale(model, glm::vec3(0.05f, 0.05f, 0.05f));
-        glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+        lightShader.setUniform("model", model);
         lightCube.Draw(lightShader);
 
         // skybox
@@ -675,10 +973,36 @@ void renderScene()
 
 void cleanup()
 {
+    std::cout << "Texture cache  : " << gps::TextureCache::global().getHitCount() << " hits, "
+        << gps::TextureCache::global().getMissCount() << " misses" << std::endl;
+    std::cout << "Texture memory : " << gps::TextureCache::global().getDecodedMemory() / (1024 * 1024) << " MB at "
+        << gps::textureQualityName(gps::TextureCache::global().getQuality()) << " quality ("
+        << gps::TextureCache::global().getFullQualityMemory() / (1024 * 1024) << " MB at full quality)" << std::endl;
+    const gps::RenderQueue::Statistics& sorted = renderQueue.getStatistics();
+    const gps::RenderQueue::Statistics& submitted = renderQueue.getSubmittedStatistics();
+    std::cout << "Render queue   : " << sorted.draws << " draws in the last frame, program/texture/vertex array changes "
+        << sorted.programChanges << "/" << sorted.textureChanges << "/" << sorted.vertexArrayChanges << " sorted, "
+        << submitted.programChanges << "/" << submitted.textureChanges << "/" << submitted.vertexArrayChanges << " in submission order" << std::endl;
+    std::cout << "Static geometry: " << staticScene.getStatistics().drawCalls << " draw calls for "
+        << staticScene.getStatistics().meshes << " meshes in the last frame" << std::endl;
+    std::cout << "Frustum culling: " << gps::FrustumCuller::getStatistics().visible << " meshes visible, "
+        << gps::FrustumCuller::getStatistics().culled << " culled in the last frame" << std::endl;
+    // the last rasterization writes the statistics - and has to end before the thread pool is destroyed
+    occlusionCuller.finishRender();
+    const gps::OcclusionCuller::Statistics& occlusion = occlusionCuller.getStatistics();
+    std::cout << "Occlusion      : " << occlusion.occluded << " of " << occlusion.tested << " meshes hidden in the last frame, "
+        << occlusionCuller.getTriangleCount() << " occluder triangles rasterized in " << occlusion.renderMilliseconds << " ms" << std::endl;
+    const gps::GLState::Statistics& state = gps::GLState::global().getStatistics();
+    std::cout << "GL state calls : " << state.issued << " issued, " << state.filtered << " filtered in the last frame" << std::endl;
+    std::cout << "Shader variants: " << sceneShaders.getVariantCount() << " of shaderStart" << std::endl;
+    std::cout << "Streamed mips  : " << gps::TextureStreamer::global().getResidentBytes() / (1024 * 1024) << " MB resident" << std::endl;
+
     myWindow.Delete();
     glDeleteTextures(1, &depthMapTexture);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    gps::GLState::global().textureDeleted(depthMapTexture);
+    gps::GLState::global().bindFramebuffer(GL_FRAMEBUFFER, 0);
     glDeleteFramebuffers(1, &shadowMapFBO);
+    gps::GLState::global().framebufferDeleted(shadowMapFBO);
 
 }
 
@@ -710,6 +1034,16 @@ int main(int argc, const char* argv[])
     while (!glfwWindowShouldClose(myWindow.getWindow()))
     {
         processMovement();
+        renderQueue.resetStatistics();
+        gps::GLState::global().resetStatistics();
+        staticScene.resetStatistics();
+        gps::FrustumCuller::resetStatistics();
+        occlusionCuller.resetStatistics();
+        gps::TextureStreamer::global().update();
+        gps::UploadQueue::global().process();
+        checkModelLoads();
+        buildStaticScene();
+        buildSceneBvh();
         renderScene();
 
         glfwPollEvents();
@@ -1,8 +1,25 @@
 #version 410 core
 
+//permutations are built with ALPHA_TEST (0 or 1) defined
+#ifndef ALPHA_TEST
+#define ALPHA_TEST 0
+#endif
+
+#if ALPHA_TEST
+in vec2 fTexCoords;
+flat in int fLayer;
+
+//same cutoff as shaderStart.frag
+uniform sampler2DArray diffuseTexture;
+#endif
+
 out vec4 fColor;
 
 void main()
 {
+#if ALPHA_TEST
+	if(texture(diffuseTexture, vec3(fTexCoords, fLayer)).a < 0.1)
+		discard;
+#endif
 	fColor = vec4(1.0f);
 }
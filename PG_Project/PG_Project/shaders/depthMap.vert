@@ -1,11 +1,53 @@
 #version 410 core
 
+//permutations are built with ALPHA_TEST (0 or 1) defined
+#ifndef ALPHA_TEST
+#define ALPHA_TEST 0
+#endif
+
 layout(location=0) in vec3 vPosition;
+layout(location=3) in uint vRange;
+#if ALPHA_TEST
+layout(location=2) in vec2 vTexCoords;
+
+out vec2 fTexCoords;
+flat out int fLayer;
+
+uniform int diffuseTextureLayer;
+#endif
 
 uniform mat4 lightSpaceTrMatrix;
 uniform mat4 model;
 
+// dequantization of the compact vertex format (identity for float vertices)
+uniform vec3 positionOffset = vec3(0.0f);
+uniform vec3 positionScale = vec3(1.0f);
+
+// per mesh offset, scale and layers of the static geometry (see shaderStart.vert)
+uniform samplerBuffer staticRanges;
+uniform bool rangesFromVertex = false;
+
 void main()
 {
-	gl_Position = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+	vec3 offset = positionOffset;
+	vec3 scale = positionScale;
+	int layer = 0;
+#if ALPHA_TEST
+	layer = diffuseTextureLayer;
+#endif
+	if (rangesFromVertex)
+	{
+		vec4 first = texelFetch(staticRanges, int(vRange) * 2);
+		offset = first.xyz;
+		scale = texelFetch(staticRanges, int(vRange) * 2 + 1).xyz;
+		layer = int(first.w);
+	}
+
+	vec3 position = vPosition * scale + offset;
+
+	gl_Position = lightSpaceTrMatrix * model * vec4(position, 1.0f);
+#if ALPHA_TEST
+	fTexCoords = vTexCoords;
+	fLayer = layer;
+#endif
 }
@@ -8,7 +8,13 @@ uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// dequantization of the compact vertex format (identity for float vertices)
+uniform vec3 positionOffset = vec3(0.0f);
+uniform vec3 positionScale = vec3(1.0f);
+
 void main() 
 {
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
+	vec3 position = vPosition * positionScale + positionOffset;
+
+	gl_Position = projection * view * model * vec4(position, 1.0f);
 }
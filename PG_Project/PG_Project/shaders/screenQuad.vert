@@ -6,8 +6,14 @@ layout(location=2) in vec2 vTexCoords;
 
 out vec2 fTexCoords;
 
+// dequantization of the compact vertex format (identity for float vertices)
+uniform vec3 positionOffset = vec3(0.0f);
+uniform vec3 positionScale = vec3(1.0f);
+
 void main() 
 {
+	vec3 position = vPosition * positionScale + positionOffset;
+
 	fTexCoords = vTexCoords;
-	gl_Position = vec4(vPosition, 1.0f);
+	gl_Position = vec4(position, 1.0f);
 }
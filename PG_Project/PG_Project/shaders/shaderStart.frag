@@ -2,17 +2,26 @@
 
 #define NUMBER_OF_LIGHTS 13
 
+//permutations are built with ALPHA_TEST, SHADOWS (0 or 1) and LIGHT_MASK (bit i set if light i is on)
+//defined, without them the shader reads enableDiscard and lightEnable at run time
+#ifndef SHADOWS
+#define SHADOWS 1
+#endif
+
 in vec3 fNormal;
 in vec4 fPosEye;
 in vec2 fTexCoords;
 in vec4 fragPosLightSpace;
+flat in ivec2 fLayers;
 
 out vec4 fColor;
 
 //lighting
 uniform	vec3 lightDir[NUMBER_OF_LIGHTS];
 uniform	vec3 lightColor[NUMBER_OF_LIGHTS];
+#ifndef LIGHT_MASK
 uniform int lightEnable[NUMBER_OF_LIGHTS];
+#endif
 
 vec3 ambient;
 float ambientStrength = 0.2f;
@@ -21,12 +30,14 @@ vec3 specular;
 float specularStrength = 0.5f;
 float shininess = 32.0f;
 
-//texture
-uniform sampler2D diffuseTexture;
-uniform sampler2D specularTexture;
+//texture - the material textures are layers of texture arrays, fLayers has the diffuse and specular layer
+uniform sampler2DArray diffuseTexture;
+uniform sampler2DArray specularTexture;
 uniform sampler2D shadowMap;
 
+#ifndef ALPHA_TEST
 uniform int enableDiscard;
+#endif
 
 float shadow = 1.0f;
 
@@ -48,7 +59,11 @@ void computeLightComponents()
 
 	for(int i = 0; i < NUMBER_OF_LIGHTS; i++)
 	{
+#ifdef LIGHT_MASK
+		if(((LIGHT_MASK >> i) & 1) == 0) continue;
+#else
 		if(lightEnable[i] == 0) continue;
+#endif
 
 		//compute light direction
 		lightDirN = normalize(lightDir[i]);
@@ -113,18 +128,27 @@ void main()
 	
 	vec3 baseColor = vec3(0.9f, 0.35f, 0.0f);//orange
 	
-	ambient *= texture(diffuseTexture, fTexCoords).rgb;
-	diffuse *= texture(diffuseTexture, fTexCoords).rgb;
-	specular *= texture(specularTexture, fTexCoords).rgb;
+	vec4 colorFromTexture = texture(diffuseTexture, vec3(fTexCoords, fLayers.x));
+	ambient *= colorFromTexture.rgb;
+	diffuse *= colorFromTexture.rgb;
+	specular *= texture(specularTexture, vec3(fTexCoords, fLayers.y)).rgb;
 
+#ifndef ALPHA_TEST
 	if(enableDiscard == 1)
 	{
-		vec4 colorFromTexture = texture(diffuseTexture, fTexCoords);
 		if(colorFromTexture.a < 0.1)
 			discard;
 	}
+#elif ALPHA_TEST
+	if(colorFromTexture.a < 0.1)
+		discard;
+#endif
 
+#if SHADOWS
 	shadow = computeShadow();
+#else
+	shadow = 0.0f;
+#endif
 	vec3 color = min((ambient + (1.0f - shadow)*diffuse) + (1.0f - shadow)*specular, 1.0f);
     float fogFactor = computeFog();
 	vec4 fogColor = vec4(0.5f, 0.5f, 0.5f, 1.0f);
@@ -3,11 +3,13 @@
 layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
+layout(location=3) in uint vRange;
 
 out vec3 fNormal;
 out vec4 fPosEye;
 out vec2 fTexCoords;
 out vec4 fragPosLightSpace;
+flat out ivec2 fLayers;
 
 uniform mat4 model;
 uniform mat4 view;
@@ -15,12 +17,52 @@ uniform mat4 projection;
 uniform	mat3 normalMatrix;
 uniform mat4 lightSpaceTrMatrix;
 
+// dequantization of the compact vertex format (identity for float vertices)
+uniform vec3 positionOffset = vec3(0.0f);
+uniform vec3 positionScale = vec3(1.0f);
+uniform bool octahedralNormals = false;
+
+// texture array layers of the material
+uniform int diffuseTextureLayer;
+uniform int specularTextureLayer;
+
+// the static geometry draws several meshes at once - each vertex has the index of its mesh in
+// staticRanges, two texels per mesh: position offset and diffuse layer, position scale and specular layer
+uniform samplerBuffer staticRanges;
+uniform bool rangesFromVertex = false;
+
+vec3 decodeNormal(vec3 normal)
+{
+	if (!octahedralNormals)
+		return normal;
+
+	vec3 decoded = vec3(normal.xy, 1.0f - abs(normal.x) - abs(normal.y));
+	if (decoded.z < 0.0f)
+		decoded.xy = (1.0f - abs(decoded.yx)) * vec2(decoded.x >= 0.0f ? 1.0f : -1.0f, decoded.y >= 0.0f ? 1.0f : -1.0f);
+	return normalize(decoded);
+}
+
 void main() 
 {
+	vec3 offset = positionOffset;
+	vec3 scale = positionScale;
+	fLayers = ivec2(diffuseTextureLayer, specularTextureLayer);
+	if (rangesFromVertex)
+	{
+		vec4 first = texelFetch(staticRanges, int(vRange) * 2);
+		vec4 second = texelFetch(staticRanges, int(vRange) * 2 + 1);
+		offset = first.xyz;
+		scale = second.xyz;
+		fLayers = ivec2(first.w, second.w);
+	}
+
+	vec3 position = vPosition * scale + offset;
+	vec3 normal = decodeNormal(vNormal);
+
 	//compute eye space coordinates
-	fPosEye = view * model * vec4(vPosition, 1.0f);
-	fNormal = normalize(normalMatrix * vNormal);
+	fPosEye = view * model * vec4(position, 1.0f);
+	fNormal = normalize(normalMatrix * normal);
 	fTexCoords = vTexCoords;
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
-	fragPosLightSpace = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+	gl_Position = projection * view * model * vec4(position, 1.0f);
+	fragPosLightSpace = lightSpaceTrMatrix * model * vec4(position, 1.0f);
 }
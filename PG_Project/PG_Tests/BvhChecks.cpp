@@ -0,0 +1,202 @@
+#include "Checks.hpp"
+#include "Bvh.hpp"
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+namespace gps {
+
+	namespace {
+
+		// Brute force references, written apart from the ones of the BVH
+
+		bool referenceOverlaps(const BoundingBox& a, const BoundingBox& b) {
+			for (int axis = 0; axis < 3; axis++) {
+				if (a.maximum[axis] < b.minimum[axis] || b.maximum[axis] < a.minimum[axis])
+					return false;
+			}
+			return true;
+		}
+
+		float referenceDistanceSquared(const BoundingBox& box, const glm::vec3& point) {
+			float distance = 0.0f;
+			for (int axis = 0; axis < 3; axis++) {
+				float outside = std::max(box.minimum[axis] - point[axis], std::max(point[axis] - box.maximum[axis], 0.0f));
+				distance += outside * outside;
+			}
+			return distance;
+		}
+
+		// Entry distance of the ray into the box within maxDistance, 0 from inside
+		bool referenceIntersectRay(const BoundingBox& box, const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& entry) {
+			float enter = 0.0f;
+			float exit = maxDistance;
+			for (int axis = 0; axis < 3; axis++) {
+				if (direction[axis] == 0.0f) {
+					if (origin[axis] < box.minimum[axis] || origin[axis] > box.maximum[axis])
+						return false;
+					continue;
+				}
+				float t0 = (box.minimum[axis] - origin[axis]) / direction[axis];
+				float t1 = (box.maximum[axis] - origin[axis]) / direction[axis];
+				enter = std::max(enter, std::min(t0, t1));
+				exit = std::min(exit, std::max(t0, t1));
+			}
+			entry = enter;
+			return enter <= exit;
+		}
+	}
+
+	bool benchmarkBvh()
+	{
+		bool passed = true;
+		typedef std::chrono::steady_clock Clock;
+		const size_t sizes[] = { 1000, 10000, 100000 };
+		const int QUERIES = 1000;
+		std::mt19937 random(12345);
+
+		for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			size_t count = sizes[s];
+			// the world grows with the number of items, so that the density stays the same
+			float worldSize = 100.0f * std::sqrt((float)count / 1000.0f);
+			std::uniform_real_distribution<float> position(-worldSize, worldSize);
+			std::uniform_real_distribution<float> height(0.0f, 20.0f);
+			std::uniform_real_distribution<float> size(0.5f, 5.0f);
+			std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+
+			std::vector<BoundingBox> boxes(count);
+			for (size_t i = 0; i < count; i++) {
+				glm::vec3 minimum(position(random), height(random), position(random));
+				BoundingBox box = { minimum, minimum + glm::vec3(size(random), size(random), size(random)) };
+				boxes[i] = box;
+			}
+
+			Bvh bvh;
+			Clock::time_point start = Clock::now();
+			bvh.build(boxes);
+			double buildTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+			// queries from points of view at the height of a person, looking around
+			std::vector<Frustum> frustums(QUERIES);
+			std::vector<glm::vec3> centers(QUERIES);
+			std::vector<glm::vec3> directions(QUERIES);
+			glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 200.0f);
+			for (int q = 0; q < QUERIES; q++) {
+				centers[q] = glm::vec3(position(random), 2.0f, position(random));
+				float yaw = angle(random);
+				directions[q] = glm::vec3(std::cos(yaw), -0.05f, std::sin(yaw));
+				frustums[q] = Frustum::fromMatrix(projection * glm::lookAt(centers[q], centers[q] + directions[q], glm::vec3(0.0f, 1.0f, 0.0f)));
+			}
+
+			std::vector<uint32_t> items;
+			size_t results[4][2] = { { 0 } };
+			double times[4][2] = { { 0.0 } };
+			const char* names[4] = { "frustum", "sphere", "box", "ray" };
+
+			for (int method = 0; method < 2; method++) {
+				bool useBvh = method == 0;
+
+				start = Clock::now();
+				for (int q = 0; q < QUERIES; q++) {
+					items.clear();
+					if (useBvh) {
+						bvh.queryFrustum(frustums[q], items);
+					}
+					else {
+						for (size_t i = 0; i < count; i++) {
+							if (frustums[q].intersects(boxes[i]))
+								items.push_back((uint32_t)i);
+						}
+					}
+					results[0][method] += items.size();
+				}
+				times[0][method] = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / QUERIES;
+
+				start = Clock::now();
+				for (int q = 0; q < QUERIES; q++) {
+					items.clear();
+					if (useBvh) {
+						bvh.querySphere(centers[q], 10.0f, items);
+					}
+					else {
+						for (size_t i = 0; i < count; i++) {
+							if (referenceDistanceSquared(boxes[i], centers[q]) <= 100.0f)
+								items.push_back((uint32_t)i);
+						}
+					}
+					results[1][method] += items.size();
+				}
+				times[1][method] = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / QUERIES;
+
+				start = Clock::now();
+				for (int q = 0; q < QUERIES; q++) {
+					items.clear();
+					BoundingBox range = { centers[q] - glm::vec3(10.0f), centers[q] + glm::vec3(10.0f) };
+					if (useBvh) {
+						bvh.queryBox(range, items);
+					}
+					else {
+						for (size_t i = 0; i < count; i++) {
+							if (referenceOverlaps(boxes[i], range))
+								items.push_back((uint32_t)i);
+						}
+					}
+					results[2][method] += items.size();
+				}
+				times[2][method] = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / QUERIES;
+
+				start = Clock::now();
+				for (int q = 0; q < QUERIES; q++) {
+					uint32_t item = 0;
+					float distance = 0.0f;
+					bool hit;
+					if (useBvh) {
+						hit = bvh.raycast(centers[q], directions[q], 1000.0f, item, distance);
+					}
+					else {
+						hit = false;
+						float closest = 1000.0f;
+						for (size_t i = 0; i < count; i++) {
+							float entry;
+							if (referenceIntersectRay(boxes[i], centers[q], directions[q], closest, entry) && (!hit || entry < closest)) {
+								closest = entry;
+								hit = true;
+							}
+						}
+					}
+					results[3][method] += hit ? 1 : 0;
+				}
+				times[3][method] = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / QUERIES;
+			}
+
+			// refitting the tree after moving 1% of the items
+			std::uniform_int_distribution<size_t> anyItem(0, count - 1);
+			std::uniform_real_distribution<float> step(-1.0f, 1.0f);
+			size_t moved = count / 100;
+			start = Clock::now();
+			for (size_t i = 0; i < moved; i++) {
+				uint32_t item = (uint32_t)anyItem(random);
+				glm::vec3 offset(step(random), 0.0f, step(random));
+				BoundingBox box = { bvh.getBox(item).minimum + offset, bvh.getBox(item).maximum + offset };
+				bvh.update(item, box);
+			}
+			double refitTime = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+			printf("BVH %zu items : %zu nodes, built in %.2f ms, %zu items refitted in %.3f ms\n",
+				count, bvh.nodeCount(), buildTime, moved, refitTime);
+			for (int query = 0; query < 4; query++) {
+				printf("  %-8s: %9.2f us per query, brute force %9.2f us (%.1fx)%s\n", names[query], times[query][0], times[query][1],
+					times[query][0] > 0.0 ? times[query][1] / times[query][0] : 0.0,
+					results[query][0] == results[query][1] ? "" : " - RESULTS DIFFER");
+				passed = passed && results[query][0] == results[query][1];
+			}
+		}
+		return passed;
+	}
+
+}
@@ -0,0 +1,43 @@
+#ifndef Checks_hpp
+#define Checks_hpp
+
+namespace gps {
+
+    // Checks of the engine modules that run without a window. Each one prints what it measured and
+    // returns false if the module does not behave.
+
+    // Compares the BVH queries with loops over the same boxes for 1k, 10k and 100k random items,
+    // and prints how long both take
+    bool benchmarkBvh();
+
+    // Simplifies a bumpy sphere at a few scales and checks that the reported error scales with the
+    // mesh and bounds the distance measured from the simplified faces to the original ones
+    bool checkSimplifyError();
+
+    // Compares the radix sort of the render queue with std::stable_sort on random keys, keys of a
+    // frame that share most of their digits and equal keys, and checks the order of the key fields
+    bool checkRenderQueueSort();
+
+    // Compares the SSE culling with Frustum::intersects for random boxes and frustums - they may only
+    // differ within rounding of a plane - and checks that no box with a corner in view is culled
+    bool checkFrustumCuller();
+
+    // Tests boxes around a wall against the occlusion buffer, checks that no random box the wall
+    // does not hide is culled, and reports how much of a synthetic village its houses hide
+    bool checkOcclusionCuller();
+
+    // Writes a mesh cache for a small model and reads it back, and checks that it is out of date once
+    // the model, its material library or the load settings change, and that a truncated cache is refused
+    bool checkMeshCache();
+
+    // Encodes test images in BC1, BC3, BC4 and BC5, decodes them and checks the error, and checks
+    // the choice of the format and the downsampling
+    bool checkTextureCompressor();
+
+    // Writes texture files in the block compressed formats and RGBA8 and reads them back, and checks
+    // that they are out of date once the source image or the settings change, and that broken files are refused
+    bool checkKtxFile();
+
+}
+
+#endif /* Checks_hpp */
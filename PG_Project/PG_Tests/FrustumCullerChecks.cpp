@@ -0,0 +1,145 @@
+#include "Checks.hpp"
+#include "FrustumCuller.hpp"
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+namespace gps {
+
+	namespace {
+
+		// Largest |distance + radius| of the box to the planes that decide it - the SSE and the
+		// scalar test may only disagree on boxes this close to a plane
+		float closestPlaneMargin(const Frustum& frustum, const BoundingBox& box) {
+			glm::vec3 center = (box.minimum + box.maximum) * 0.5f;
+			glm::vec3 extent = (box.maximum - box.minimum) * 0.5f;
+			float margin = INFINITY;
+			for (int i = 0; i < 6; i++) {
+				const glm::vec4& plane = frustum.planes[i];
+				float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+				float radius = glm::dot(glm::abs(glm::vec3(plane)), extent);
+				margin = std::min(margin, std::fabs(distance + radius));
+			}
+			return margin;
+		}
+
+		// True if one of the corners is inside the clip volume of the matrix
+		bool cornerInside(const glm::mat4& viewProjection, const BoundingBox& box) {
+			for (int corner = 0; corner < 8; corner++) {
+				glm::vec3 p((corner & 1) ? box.maximum.x : box.minimum.x, (corner & 2) ? box.maximum.y : box.minimum.y,
+					(corner & 4) ? box.maximum.z : box.minimum.z);
+				glm::vec4 clip = viewProjection * glm::vec4(p, 1.0f);
+				// a little inside, away from the rounding of the planes
+				float w = clip.w * 0.999f;
+				if (clip.w > 0.0f && std::fabs(clip.x) <= w && std::fabs(clip.y) <= w && std::fabs(clip.z) <= w)
+					return true;
+			}
+			return false;
+		}
+	}
+
+	bool checkFrustumCuller()
+	{
+		std::mt19937 random(23);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		std::uniform_real_distribution<float> coordinate(-100.0f, 100.0f);
+		bool passed = true;
+
+		size_t boxesTested = 0;
+		size_t nearPlane = 0;
+		size_t mismatches = 0;
+		size_t notConservative = 0;
+
+		const int FRUSTUMS = 200;
+		for (int f = 0; f < FRUSTUMS; f++) {
+			glm::vec3 eye(coordinate(random), coordinate(random) * 0.2f, coordinate(random));
+			glm::vec3 target(coordinate(random), coordinate(random) * 0.2f, coordinate(random));
+			if (glm::length(target - eye) < 1.0f)
+				target = eye + glm::vec3(0.0f, 0.0f, -1.0f);
+			glm::mat4 view = glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+			glm::mat4 projection = f % 4 == 3
+				? glm::ortho(-20.0f - 40.0f * unit(random), 20.0f, -20.0f, 20.0f + 40.0f * unit(random), 0.1f, 150.0f)
+				: glm::perspective(glm::radians(30.0f + 60.0f * unit(random)), 0.5f + 1.5f * unit(random),
+					0.05f + unit(random), 50.0f + 200.0f * unit(random));
+			glm::mat4 viewProjection = projection * view;
+			Frustum frustum = Frustum::fromMatrix(viewProjection);
+
+			// counts that leave every number of boxes in the last group of four, so the padding is read
+			size_t count = f < 8 ? (size_t)f + 1 : 257 + (size_t)f % 4;
+			std::vector<BoundingBox> boxes(count);
+			FrustumCuller culler;
+			for (size_t i = 0; i < count; i++) {
+				glm::vec3 center(coordinate(random), coordinate(random) * 0.2f, coordinate(random));
+				// from flat and tiny to larger than the near plane
+				glm::vec3 extent(unit(random), unit(random), unit(random));
+				extent *= i % 16 == 0 ? 20.0f : (i % 16 == 1 ? 0.0f : 3.0f);
+				boxes[i].minimum = center - extent;
+				boxes[i].maximum = center + extent;
+				culler.add(boxes[i]);
+			}
+
+			std::vector<uint8_t> visible;
+			size_t visibleCount = culler.cull(frustum, visible);
+			size_t counted = 0;
+			for (size_t i = 0; i < count; i++) {
+				bool expected = frustum.intersects(boxes[i]);
+				counted += visible[i];
+				bool close = closestPlaneMargin(frustum, boxes[i]) <= 1e-4f * (1.0f + glm::length(boxes[i].maximum));
+				nearPlane += close;
+				if ((visible[i] != 0) != expected && !close)
+					mismatches++;
+				if (visible[i] == 0 && cornerInside(viewProjection, boxes[i]))
+					notConservative++;
+			}
+			if (visible.size() != count || counted != visibleCount)
+				mismatches++;
+			boxesTested += count;
+		}
+		passed = mismatches == 0 && notConservative == 0;
+		std::printf("  %zu boxes against %d frustums: %zu differ from Frustum::intersects, %zu culled with a corner inside,"
+			" %zu within rounding of a plane\n", boxesTested, FRUSTUMS, mismatches, notConservative, nearPlane);
+
+		// a cleared culler starts over without the old boxes
+		FrustumCuller culler;
+		BoundingBox outside = { glm::vec3(1000.0f), glm::vec3(1001.0f) };
+		BoundingBox inside = { glm::vec3(-1.0f, -1.0f, -6.0f), glm::vec3(1.0f, 1.0f, -4.0f) };
+		Frustum frustum = Frustum::fromMatrix(glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, 100.0f));
+		for (int i = 0; i < 5; i++)
+			culler.add(outside);
+		culler.clear();
+		culler.add(inside);
+		std::vector<uint8_t> visible;
+		bool cleared = culler.size() == 1 && culler.cull(frustum, visible) == 1 && visible.size() == 1 && visible[0] == 1;
+		std::printf("  cleared culler: %s\n", cleared ? "ok" : "FAILED");
+		passed = passed && cleared;
+
+		// four at a time against one at a time
+		const size_t TIMED = 100000;
+		std::vector<BoundingBox> boxes(TIMED);
+		culler.clear();
+		for (size_t i = 0; i < TIMED; i++) {
+			glm::vec3 center(coordinate(random), coordinate(random), coordinate(random));
+			boxes[i].minimum = center - glm::vec3(1.0f);
+			boxes[i].maximum = center + glm::vec3(1.0f);
+			culler.add(boxes[i]);
+		}
+		auto start = std::chrono::high_resolution_clock::now();
+		size_t culled = culler.cull(frustum, visible);
+		auto middle = std::chrono::high_resolution_clock::now();
+		size_t scalar = 0;
+		for (size_t i = 0; i < TIMED; i++)
+			scalar += frustum.intersects(boxes[i]) ? 1 : 0;
+		auto end = std::chrono::high_resolution_clock::now();
+		std::printf("  %zu boxes: cull %.3f ms (%zu visible), Frustum::intersects %.3f ms (%zu visible)\n", TIMED,
+			std::chrono::duration<double, std::milli>(middle - start).count(), culled,
+			std::chrono::duration<double, std::milli>(end - middle).count(), scalar);
+
+		return passed;
+	}
+
+}
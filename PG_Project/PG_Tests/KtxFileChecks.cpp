@@ -0,0 +1,161 @@
+#include "Checks.hpp"
+#include "KtxFile.hpp"
+#include "TextureCompressor.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+	namespace {
+
+		// source image and texture file written by the check, in the working directory
+		const std::string sourceFileName = "pg_tests_texture.png";
+		const std::string ktxFileName = "pg_tests_texture.ktx";
+		const uint64_t settingsHash = 0x7E87u;
+
+		void writeBytes(const std::string& fileName, const std::string& bytes, bool append = false) {
+			std::ofstream out(fileName.c_str(), std::ios::binary | (append ? std::ios::app : std::ios::trunc));
+			out << bytes;
+		}
+
+		// RGBA8 mip chain of a checker pattern, every level after the other in data
+		void makeLevels(int width, int height, GLenum format, std::vector<unsigned char>& data, std::vector<size_t>& sizes) {
+			std::vector<unsigned char> pixels((size_t)width * height * 4);
+			for (int y = 0; y < height; y++) {
+				for (int x = 0; x < width; x++) {
+					unsigned char* pixel = &pixels[((size_t)y * width + x) * 4];
+					bool light = ((x / 2) + (y / 2)) % 2 == 0;
+					pixel[0] = (unsigned char)(light ? 220 : 30);
+					pixel[1] = (unsigned char)(x * 255 / width);
+					pixel[2] = (unsigned char)(y * 255 / height);
+					pixel[3] = 255;
+				}
+			}
+			while (true) {
+				size_t start = data.size();
+				if (format == GL_RGBA8)
+					data.insert(data.end(), pixels.begin(), pixels.end());
+				else
+					compressImage(pixels.data(), width, height, format, data);
+				sizes.push_back(data.size() - start);
+				if (width == 1 && height == 1)
+					break;
+				std::vector<unsigned char> next;
+				downsampleImage(pixels.data(), width, height, next);
+				pixels.swap(next);
+				width = width > 1 ? width / 2 : 1;
+				height = height > 1 ? height / 2 : 1;
+			}
+		}
+
+		bool sameLevels(const KtxFile& file, int width, int height, const std::vector<unsigned char>& data, const std::vector<size_t>& sizes) {
+			const std::vector<TextureLevel>& levels = file.getLevels();
+			if (levels.size() != sizes.size())
+				return false;
+			size_t offset = 0;
+			for (size_t i = 0; i < levels.size(); i++) {
+				int levelWidth = width >> i, levelHeight = height >> i;
+				if (levels[i].width != (levelWidth > 0 ? levelWidth : 1) || levels[i].height != (levelHeight > 0 ? levelHeight : 1)
+					|| levels[i].size != sizes[i] || std::memcmp(levels[i].data, data.data() + offset, sizes[i]) != 0)
+					return false;
+				// the levels are 4 byte aligned in the file
+				if (((uintptr_t)levels[i].data & 3) != 0)
+					return false;
+				offset += sizes[i];
+			}
+			return true;
+		}
+
+		// a file of its own each time - an open file stays mapped, and a mapped file cannot be
+		// replaced on Windows
+		bool opens(uint64_t hash) {
+			KtxFile file;
+			return file.open(ktxFileName, sourceFileName, hash);
+		}
+
+		bool report(const char* name, bool passed) {
+			std::printf("  %-40s: %s\n", name, passed ? "ok" : "FAILED");
+			return passed;
+		}
+	}
+
+	bool checkKtxFile()
+	{
+		writeBytes(sourceFileName, "\x89PNG not really an image");
+		bool passed = true;
+
+		TextureSource source;
+		passed = report("source image stamped", getTextureSource(sourceFileName, source)) && passed;
+
+		passed = report("missing file is not opened", !opens(settingsHash)) && passed;
+
+		// block compressed, with levels smaller than a block, and plain pixels whose level sizes are
+		// not multiples of 4 (the levels are padded)
+		struct Layout
+		{
+			const char* name;
+			GLenum format;
+			GLenum baseFormat;
+			int width;
+			int height;
+		};
+		const Layout layouts[] = {
+			{ "BC1 levels read back", GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_RGB, 32, 16 },
+			{ "BC3 levels read back", GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GL_RGBA, 16, 16 },
+			{ "BC4 levels read back", GL_COMPRESSED_RED_RGTC1, GL_RED, 8, 32 },
+			{ "BC5 levels read back", GL_COMPRESSED_RG_RGTC2, GL_RG, 64, 64 },
+			{ "RGBA8 levels read back", GL_RGBA8, GL_RGBA, 12, 6 },
+		};
+		for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+			const Layout& layout = layouts[l];
+			std::vector<unsigned char> data;
+			std::vector<size_t> sizes;
+			makeLevels(layout.width, layout.height, layout.format, data, sizes);
+			uint32_t flags = (uint32_t)l + 1;
+			bool written = layout.format == GL_RGBA8
+				? KtxFile::write(ktxFileName, source, settingsHash, flags, layout.format, layout.baseFormat, layout.width, layout.height,
+					data, sizes, GL_UNSIGNED_BYTE, GL_RGBA, 1)
+				: KtxFile::write(ktxFileName, source, settingsHash, flags, layout.format, layout.baseFormat, layout.width, layout.height,
+					data, sizes);
+			KtxFile file;
+			bool opened = written && file.open(ktxFileName, sourceFileName, settingsHash);
+			bool same = opened && file.getInternalFormat() == layout.format && file.getWidth() == layout.width
+				&& file.getHeight() == layout.height && file.getFlags() == flags && sameLevels(file, layout.width, layout.height, data, sizes);
+			passed = report(layout.name, same) && passed;
+		}
+
+		passed = report("other settings are out of date", !opens(settingsHash + 1)) && passed;
+
+		// a level cut short
+		std::vector<char> contents;
+		{
+			std::ifstream in(ktxFileName.c_str(), std::ios::binary);
+			contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		}
+		{
+			std::ofstream out(ktxFileName.c_str(), std::ios::binary | std::ios::trunc);
+			out.write(contents.data(), (std::streamsize)(contents.size() - 8));
+		}
+		passed = report("truncated file is not opened", !opens(settingsHash)) && passed;
+
+		// a file that is not a KTX file
+		writeBytes(ktxFileName, std::string(contents.begin(), contents.end()).replace(1, 3, "PNG"));
+		passed = report("other file type is not opened", !opens(settingsHash)) && passed;
+
+		writeBytes(ktxFileName, std::string(contents.begin(), contents.end()));
+		passed = report("restored file opens again", opens(settingsHash)) && passed;
+		writeBytes(sourceFileName, " edited", true);
+		passed = report("edited source image is out of date", !opens(settingsHash)) && passed;
+
+		std::remove(ktxFileName.c_str());
+		std::remove(sourceFileName.c_str());
+		return passed;
+	}
+
+}
@@ -0,0 +1,158 @@
+#include "Checks.hpp"
+#include "MeshCache.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+	namespace {
+
+		// model and material library written by the check, in the working directory
+		const std::string sourceFileName = "pg_tests_meshcache.obj";
+		const std::string libraryName = "pg_tests_meshcache.mtl";
+		const uint64_t settingsHash = 0x5E771265ull;
+
+		void writeText(const std::string& fileName, const std::string& text, bool append = false) {
+			std::ofstream out(fileName.c_str(), std::ios::binary | (append ? std::ios::app : std::ios::trunc));
+			out << text;
+		}
+
+		std::vector<MeshData> makeMeshes() {
+			std::vector<MeshData> meshes(2);
+
+			// a textured grid with two levels of detail
+			MeshData& grid = meshes[0];
+			for (int y = 0; y < 5; y++) {
+				for (int x = 0; x < 5; x++) {
+					Vertex vertex;
+					vertex.Position = glm::vec3((float)x, 0.1f * x * y, (float)y);
+					vertex.Normal = glm::normalize(glm::vec3(0.1f * x, 1.0f, -0.1f * y));
+					vertex.TexCoords = glm::vec2(x / 4.0f, y / 4.0f);
+					grid.vertices.push_back(vertex);
+				}
+			}
+			for (GLuint y = 0; y < 4; y++) {
+				for (GLuint x = 0; x < 4; x++) {
+					GLuint a = y * 5 + x;
+					GLuint quad[6] = { a, a + 5, a + 1, a + 1, a + 5, a + 6 };
+					grid.indices.insert(grid.indices.end(), quad, quad + 6);
+				}
+			}
+			GLuint coarse[6] = { 0, 20, 4, 4, 20, 24 };
+			grid.indices.insert(grid.indices.end(), coarse, coarse + 6);
+			MeshLod fine = { 0, 96, 0.0f };
+			MeshLod simplified = { 96, 6, 0.35f };
+			grid.lods.push_back(fine);
+			grid.lods.push_back(simplified);
+			grid.material.ambient = glm::vec3(0.1f, 0.2f, 0.3f);
+			grid.material.diffuse = glm::vec3(0.4f, 0.5f, 0.6f);
+			grid.material.specular = glm::vec3(0.7f, 0.8f, 0.9f);
+			TextureReference diffuse = { "diffuseTexture", "textures/grid_diffuse.png" };
+			TextureReference specular = { "specularTexture", "" };
+			grid.textures.push_back(diffuse);
+			grid.textures.push_back(specular);
+
+			// an untextured triangle with a single level
+			MeshData& triangle = meshes[1];
+			for (int k = 0; k < 3; k++) {
+				Vertex vertex;
+				vertex.Position = glm::vec3(k == 1 ? 1.0f : 0.0f, k == 2 ? 1.0f : 0.0f, -2.0f);
+				vertex.Normal = glm::vec3(0.0f, 0.0f, 1.0f);
+				vertex.TexCoords = glm::vec2(0.0f);
+				triangle.vertices.push_back(vertex);
+				triangle.indices.push_back((GLuint)k);
+			}
+			triangle.material.ambient = glm::vec3(1.0f);
+			triangle.material.diffuse = glm::vec3(0.5f);
+			triangle.material.specular = glm::vec3(0.0f);
+			return meshes;
+		}
+
+		bool sameMesh(const MeshData& expected, const CachedMesh& mesh) {
+			if (mesh.vertexCount != expected.vertices.size() || mesh.indexCount != expected.indices.size()
+				|| mesh.lods.size() != expected.lods.size() || mesh.textures.size() != expected.textures.size())
+				return false;
+			if (mesh.vertexCount > 0 && std::memcmp(mesh.vertices, expected.vertices.data(), mesh.vertexCount * sizeof(Vertex)) != 0)
+				return false;
+			if (mesh.indexCount > 0 && std::memcmp(mesh.indices, expected.indices.data(), mesh.indexCount * sizeof(GLuint)) != 0)
+				return false;
+			for (size_t l = 0; l < mesh.lods.size(); l++) {
+				if (mesh.lods[l].indexOffset != expected.lods[l].indexOffset || mesh.lods[l].indexCount != expected.lods[l].indexCount
+					|| mesh.lods[l].error != expected.lods[l].error)
+					return false;
+			}
+			for (size_t t = 0; t < mesh.textures.size(); t++) {
+				if (mesh.textures[t].type != expected.textures[t].type || mesh.textures[t].path != expected.textures[t].path)
+					return false;
+			}
+			return mesh.material.ambient == expected.material.ambient && mesh.material.diffuse == expected.material.diffuse
+				&& mesh.material.specular == expected.material.specular;
+		}
+
+		bool report(const char* name, bool passed) {
+			std::printf("  %-40s: %s\n", name, passed ? "ok" : "FAILED");
+			return passed;
+		}
+	}
+
+	bool checkMeshCache()
+	{
+		writeText(sourceFileName, "mtllib " + libraryName + "\no grid\nv 0 0 0\n");
+		writeText(libraryName, "newmtl grid\nKd 0.4 0.5 0.6\n");
+		std::string cacheFileName = MeshCache::cachePath(sourceFileName);
+		std::vector<MeshData> meshes = makeMeshes();
+		bool passed = true;
+
+		MeshCache cache;
+		passed = report("missing cache is not opened", !cache.open(cacheFileName, sourceFileName, settingsHash)) && passed;
+
+		bool written = MeshCache::write(cacheFileName, sourceFileName, "", settingsHash, meshes);
+		passed = report("cache written", written) && passed;
+
+		bool opened = cache.open(cacheFileName, sourceFileName, settingsHash);
+		bool same = opened && cache.meshCount() == meshes.size();
+		for (size_t i = 0; same && i < meshes.size(); i++)
+			same = sameMesh(meshes[i], cache.getMesh(i));
+		passed = report("meshes read back as written", same) && passed;
+		bool aligned = opened && ((uintptr_t)cache.getMesh(0).vertices % 16) == 0 && ((uintptr_t)cache.getMesh(0).indices % 16) == 0;
+		passed = report("vertex and index ranges aligned", aligned) && passed;
+		cache.close();
+
+		passed = report("other load settings are out of date", !cache.open(cacheFileName, sourceFileName, settingsHash + 1)) && passed;
+
+		writeText(libraryName, "Ks 0 0 0\n", true);
+		passed = report("edited material library is out of date", !cache.open(cacheFileName, sourceFileName, settingsHash)) && passed;
+		MeshCache::write(cacheFileName, sourceFileName, "", settingsHash, meshes);
+		passed = report("rewritten cache opens again", cache.open(cacheFileName, sourceFileName, settingsHash)) && passed;
+		cache.close();
+
+		writeText(sourceFileName, "v 1 1 1\n", true);
+		passed = report("edited model is out of date", !cache.open(cacheFileName, sourceFileName, settingsHash)) && passed;
+
+		// a cache cut short, as if the program stopped while writing it in place
+		MeshCache::write(cacheFileName, sourceFileName, "", settingsHash, meshes);
+		std::vector<char> contents;
+		{
+			std::ifstream in(cacheFileName.c_str(), std::ios::binary);
+			contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		}
+		{
+			std::ofstream out(cacheFileName.c_str(), std::ios::binary | std::ios::trunc);
+			out.write(contents.data(), (std::streamsize)(contents.size() / 2));
+		}
+		passed = report("truncated cache is not opened", !cache.open(cacheFileName, sourceFileName, settingsHash)) && passed;
+
+		cache.close();
+		std::remove(cacheFileName.c_str());
+		std::remove(sourceFileName.c_str());
+		std::remove(libraryName.c_str());
+		return passed;
+	}
+
+}
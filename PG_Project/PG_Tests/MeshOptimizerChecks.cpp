@@ -0,0 +1,140 @@
+#include "Checks.hpp"
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "glm/geometric.hpp"
+
+namespace gps {
+
+	namespace {
+
+		// Closest point of the triangle abc to p (Ericson, Real-Time Collision Detection 5.1.5)
+		glm::vec3 closestOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+			glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+			float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+			if (d1 <= 0.0f && d2 <= 0.0f)
+				return a;
+			glm::vec3 bp = p - b;
+			float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+			if (d3 >= 0.0f && d4 <= d3)
+				return b;
+			float vc = d1 * d4 - d3 * d2;
+			if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+				return a + ab * (d1 / (d1 - d3));
+			glm::vec3 cp = p - c;
+			float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+			if (d6 >= 0.0f && d5 <= d6)
+				return c;
+			float vb = d5 * d2 - d1 * d6;
+			if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+				return a + ac * (d2 / (d2 - d6));
+			float va = d3 * d6 - d5 * d4;
+			if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+				return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+			float denominator = 1.0f / (va + vb + vc);
+			return a + ab * (vb * denominator) + ac * (vc * denominator);
+		}
+
+		// Largest distance from a point of the simplified faces to the original ones, measured on a
+		// grid of points over each simplified face
+		float surfaceDistance(const std::vector<Vertex>& vertices, const std::vector<GLuint>& original, const std::vector<GLuint>& simplified) {
+			const int STEPS = 4;
+
+			// bounding spheres of the original faces, to skip the ones too far to be the closest
+			std::vector<glm::vec4> bounds;
+			for (size_t o = 0; o < original.size(); o += 3) {
+				const glm::vec3& a = vertices[original[o]].Position;
+				const glm::vec3& b = vertices[original[o + 1]].Position;
+				const glm::vec3& c = vertices[original[o + 2]].Position;
+				glm::vec3 center = (a + b + c) / 3.0f;
+				float radius = std::max(glm::length(a - center), std::max(glm::length(b - center), glm::length(c - center)));
+				bounds.push_back(glm::vec4(center, radius));
+			}
+
+			float largest = 0.0f;
+			for (size_t t = 0; t < simplified.size(); t += 3) {
+				const glm::vec3& a = vertices[simplified[t]].Position;
+				const glm::vec3& b = vertices[simplified[t + 1]].Position;
+				const glm::vec3& c = vertices[simplified[t + 2]].Position;
+				for (int i = 0; i <= STEPS; i++) {
+					for (int j = 0; i + j <= STEPS; j++) {
+						glm::vec3 p = a + (b - a) * ((float)i / STEPS) + (c - a) * ((float)j / STEPS);
+						float nearest = FLT_MAX;
+						for (size_t o = 0; o < original.size() && nearest > 0.0f; o += 3) {
+							const glm::vec4& bound = bounds[o / 3];
+							if (glm::length(p - glm::vec3(bound)) - bound.w >= nearest)
+								continue;
+							glm::vec3 closest = closestOnTriangle(p, vertices[original[o]].Position,
+								vertices[original[o + 1]].Position, vertices[original[o + 2]].Position);
+							nearest = std::min(nearest, glm::length(p - closest));
+						}
+						largest = std::max(largest, nearest);
+					}
+				}
+			}
+			return largest;
+		}
+	}
+
+	bool checkSimplifyError()
+	{
+		// sphere with a ripple, so that every collapse moves the surface a little
+		const int RINGS = 48;
+		const int SEGMENTS = 96;
+		std::vector<Vertex> sphere;
+		std::vector<GLuint> indices;
+		for (int r = 0; r <= RINGS; r++) {
+			float theta = 3.14159265f * r / RINGS;
+			for (int s = 0; s <= SEGMENTS; s++) {
+				float phi = 6.2831853f * s / SEGMENTS;
+				glm::vec3 normal(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+				Vertex vertex;
+				vertex.Position = normal * (1.0f + 0.05f * std::sin(7.0f * theta) * std::cos(5.0f * phi));
+				vertex.Normal = normal;
+				vertex.TexCoords = glm::vec2((float)s / SEGMENTS, (float)r / RINGS);
+				sphere.push_back(vertex);
+			}
+		}
+		for (int r = 0; r < RINGS; r++) {
+			for (int s = 0; s < SEGMENTS; s++) {
+				GLuint a = r * (SEGMENTS + 1) + s;
+				GLuint b = a + SEGMENTS + 1;
+				GLuint quad[6] = { a, b, a + 1, a + 1, b, b + 1 };
+				indices.insert(indices.end(), quad, quad + 6);
+			}
+		}
+
+		// powers of two scale the float positions exactly, the same collapses are made at every scale
+		const float scales[] = { 1.0f / 64.0f, 1.0f, 64.0f };
+		float referenceError = 0.0f;
+		bool passed = true;
+		for (size_t i = 0; i < sizeof(scales) / sizeof(scales[0]); i++) {
+			std::vector<Vertex> scaled = sphere;
+			for (size_t v = 0; v < scaled.size(); v++)
+				scaled[v].Position *= scales[i];
+
+			float error = 0.0f;
+			std::vector<GLuint> simplified = simplifyMesh(scaled, indices, indices.size() / 8, 1.0f, &error);
+			if (i == 0)
+				referenceError = error / scales[i];
+			float ratio = referenceError > 0.0f ? error / scales[i] / referenceError : 0.0f;
+			bool consistent = std::fabs(ratio - 1.0f) < 0.01f;
+
+			// the error is used as a bound by the level of detail selection
+			float distance = surfaceDistance(scaled, indices, simplified);
+			bool bounded = distance <= error * 1.001f;
+			passed = passed && consistent && bounded;
+
+			std::cout << "Simplify scale " << scales[i] << ": " << indices.size() / 3 << " -> " << simplified.size() / 3
+				<< " triangles, error " << error << " (" << ratio << "x the scaled error), measured distance " << distance
+				<< (consistent && bounded ? "" : " - FAILED") << std::endl;
+		}
+		return passed;
+	}
+
+}
@@ -0,0 +1,210 @@
+#include "Checks.hpp"
+#include "OcclusionCuller.hpp"
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace gps {
+
+	namespace {
+
+		// Two triangles, abcd counter-clockwise seen from the front
+		void addQuad(OcclusionCuller& culler, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& d) {
+			std::vector<glm::vec3> positions = { a, b, c, d };
+			std::vector<uint32_t> indices = { 0, 1, 2, 0, 2, 3 };
+			culler.addOccluder(positions, indices, glm::mat4(1.0f));
+		}
+
+		// The six walls of a box with both windings, the way two sided walls are modelled
+		void addHouse(OcclusionCuller& culler, const BoundingBox& box) {
+			std::vector<glm::vec3> positions(8);
+			for (int corner = 0; corner < 8; corner++)
+				positions[corner] = glm::vec3((corner & 1) ? box.maximum.x : box.minimum.x,
+					(corner & 2) ? box.maximum.y : box.minimum.y, (corner & 4) ? box.maximum.z : box.minimum.z);
+			const uint32_t faces[6][4] = { { 0, 1, 3, 2 }, { 4, 6, 7, 5 }, { 0, 4, 5, 1 }, { 2, 3, 7, 6 }, { 0, 2, 6, 4 }, { 1, 5, 7, 3 } };
+			std::vector<uint32_t> indices;
+			for (int f = 0; f < 6; f++) {
+				const uint32_t* q = faces[f];
+				uint32_t front[6] = { q[0], q[1], q[2], q[0], q[2], q[3] };
+				uint32_t back[6] = { q[0], q[3], q[2], q[0], q[2], q[1] };
+				indices.insert(indices.end(), front, front + 6);
+				indices.insert(indices.end(), back, back + 6);
+			}
+			culler.addOccluder(positions, indices, glm::mat4(1.0f));
+		}
+
+		BoundingBox join(const BoundingBox& a, const BoundingBox& b) {
+			BoundingBox box = { glm::min(a.minimum, b.minimum), glm::max(a.maximum, b.maximum) };
+			return box;
+		}
+
+		bool expect(OcclusionCuller& culler, const char* name, const BoundingBox& box, bool occluded) {
+			bool result = culler.isOccluded(box);
+			std::printf("  %-28s: %s%s\n", name, result ? "occluded" : "visible", result == occluded ? "" : " - FAILED");
+			return result == occluded;
+		}
+
+		// A 10x10 wall 10 units in front of a camera at the origin and the ground below, crossing the
+		// near plane
+		bool checkWall() {
+			OcclusionCuller culler(250, 125);
+			addQuad(culler, glm::vec3(-5.0f, -5.0f, -10.0f), glm::vec3(5.0f, -5.0f, -10.0f), glm::vec3(5.0f, 5.0f, -10.0f), glm::vec3(-5.0f, 5.0f, -10.0f));
+			addQuad(culler, glm::vec3(-50.0f, -2.0f, 5.0f), glm::vec3(50.0f, -2.0f, 5.0f), glm::vec3(50.0f, -2.0f, -100.0f), glm::vec3(-50.0f, -2.0f, -100.0f));
+			glm::mat4 projection = glm::perspective(glm::radians(45.0f), 2.0f, 0.1f, 200.0f);
+			culler.beginRender(projection);
+			culler.finishRender();
+
+			bool passed = culler.getWidth() == 256 && culler.getHeight() == 128;
+			BoundingBox behind = { glm::vec3(-1.0f, -1.0f, -21.0f), glm::vec3(1.0f, 1.0f, -20.0f) };
+			BoundingBox front = { glm::vec3(-1.0f, -1.0f, -6.0f), glm::vec3(1.0f, 1.0f, -5.0f) };
+			BoundingBox aside = { glm::vec3(20.0f, 0.0f, -30.0f), glm::vec3(22.0f, 1.0f, -29.0f) };
+			BoundingBox underground = { glm::vec3(-1.0f, -5.0f, -30.0f), glm::vec3(1.0f, -3.0f, -29.0f) };
+			BoundingBox through = { glm::vec3(-1.0f, -1.0f, -12.0f), glm::vec3(1.0f, 1.0f, -8.0f) };
+			BoundingBox edgeHidden = { glm::vec3(4.0f, -1.0f, -21.0f), glm::vec3(7.0f, 1.0f, -20.0f) };
+			BoundingBox peeking = { glm::vec3(8.0f, -1.0f, -21.0f), glm::vec3(12.0f, 1.0f, -20.0f) };
+			BoundingBox nearPlane = { glm::vec3(-1.0f, -1.0f, -1.0f), glm::vec3(1.0f, 1.0f, 1.0f) };
+			passed = expect(culler, "behind the wall", behind, true) && passed;
+			passed = expect(culler, "in front of the wall", front, false) && passed;
+			passed = expect(culler, "beside the wall", aside, false) && passed;
+			passed = expect(culler, "under the ground", underground, true) && passed;
+			passed = expect(culler, "through the wall", through, false) && passed;
+			passed = expect(culler, "behind the edge of the wall", edgeHidden, true) && passed;
+			passed = expect(culler, "peeking past the wall", peeking, false) && passed;
+			passed = expect(culler, "across the near plane", nearPlane, false) && passed;
+
+			// a smaller wall alone, inside the view and with its outline across pixels - a box is hidden
+			// only if all its corners are behind it and their rays from the camera go through it, no
+			// box may be culled otherwise
+			culler.clearOccluders();
+			const float HALF = 3.1f;
+			addQuad(culler, glm::vec3(-HALF, -HALF, -10.0f), glm::vec3(HALF, -HALF, -10.0f), glm::vec3(HALF, HALF, -10.0f), glm::vec3(-HALF, HALF, -10.0f));
+			culler.beginRender(projection);
+			culler.finishRender();
+
+			std::mt19937 random(25);
+			std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+			// boxes anywhere around the wall, then small boxes seen across its outline, where a
+			// pixel is only partly covered
+			const char* kinds[2] = { "random boxes", "boxes on the outline" };
+			bool conservative = true;
+			for (int kind = 0; kind < 2; kind++) {
+				int hidden = 0;
+				int occluded = 0;
+				int wrong = 0;
+				for (int i = 0; i < 10000; i++) {
+					glm::vec3 center(-10.0f + 20.0f * unit(random), -6.0f + 12.0f * unit(random), -4.0f - 40.0f * unit(random));
+					glm::vec3 extent = glm::vec3(unit(random), unit(random), unit(random)) * 2.0f;
+					if (kind == 1) {
+						glm::vec2 onOutline(HALF, HALF * (2.0f * unit(random) - 1.0f));
+						if (i % 2)
+							onOutline = glm::vec2(onOutline.y, onOutline.x);
+						if (unit(random) < 0.5f)
+							onOutline = -onOutline;
+						onOutline += glm::vec2(unit(random) - 0.5f, unit(random) - 0.5f) * 0.1f;
+						float distance = 11.0f + 30.0f * unit(random);
+						center = glm::vec3(onOutline * (distance / 10.0f), -distance);
+						extent = glm::vec3(unit(random), unit(random), unit(random)) * 0.02f;
+					}
+					BoundingBox box = { center - extent, center + extent };
+					bool reallyHidden = true;
+					for (int corner = 0; corner < 8 && reallyHidden; corner++) {
+						glm::vec3 p((corner & 1) ? box.maximum.x : box.minimum.x, (corner & 2) ? box.maximum.y : box.minimum.y,
+							(corner & 4) ? box.maximum.z : box.minimum.z);
+						glm::vec2 onWall = glm::vec2(p) * (-10.0f / p.z);
+						reallyHidden = p.z < -10.0f && std::fabs(onWall.x) <= HALF && std::fabs(onWall.y) <= HALF;
+					}
+					bool result = culler.isOccluded(box);
+					hidden += reallyHidden;
+					occluded += result;
+					wrong += result && !reallyHidden;
+				}
+				std::printf("  %-28s: %d hidden by the wall, %d found occluded, %d of those visible\n", kinds[kind], hidden, occluded, wrong);
+				conservative = conservative && wrong == 0;
+				// the half pixel the outline moves in leaves the boxes along it visible, not many more
+				if (kind == 0)
+					passed = passed && occluded > hidden * 9 / 10;
+			}
+			return passed && conservative;
+		}
+
+		// Houses in a grid, their walls the occluders, with a roof and three props each - tested as
+		// one box per object and as the boxes of the same objects merged by material
+		bool checkVillage() {
+			const int HOUSES = 12;
+			const float SPACING = 14.0f;
+			const int MATERIALS = 16;
+			std::mt19937 random(7);
+
+			OcclusionCuller culler(256, 128);
+			std::vector<BoundingBox> objects;
+			std::vector<int> materials;
+			for (int i = 0; i < HOUSES; i++) {
+				for (int j = 0; j < HOUSES; j++) {
+					glm::vec3 corner(i * SPACING - HOUSES * SPACING / 2.0f, 0.0f, -j * SPACING - 6.0f);
+					BoundingBox house = { corner, corner + glm::vec3(8.0f, 6.0f, 8.0f) };
+					addHouse(culler, house);
+					objects.push_back(house);
+					materials.push_back((int)(random() % 6));
+					BoundingBox roof = { corner + glm::vec3(0.0f, 6.0f, 0.0f), corner + glm::vec3(8.0f, 8.0f, 8.0f) };
+					objects.push_back(roof);
+					materials.push_back(6 + (int)(random() % 4));
+					for (int k = 0; k < 3; k++) {
+						glm::vec3 position = corner + glm::vec3((float)(random() % 10) - 1.0f, 0.0f, (float)(random() % 10) - 1.0f);
+						BoundingBox prop = { position, position + glm::vec3(0.8f, 1.0f, 0.8f) };
+						objects.push_back(prop);
+						materials.push_back(10 + (int)(random() % 6));
+					}
+				}
+			}
+			std::vector<BoundingBox> merged(MATERIALS);
+			std::vector<bool> used(MATERIALS, false);
+			for (size_t i = 0; i < objects.size(); i++) {
+				int m = materials[i];
+				merged[m] = used[m] ? join(merged[m], objects[i]) : objects[i];
+				used[m] = true;
+			}
+
+			glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 500.0f);
+			const glm::vec3 eyes[3] = { glm::vec3(-3.0f, 1.7f, 5.0f), glm::vec3(-3.0f + SPACING * 2.0f, 1.7f, -SPACING * 4.0f),
+				glm::vec3(-3.0f - SPACING * 3.0f, 1.7f, -SPACING * 8.0f) };
+			const glm::vec3 directions[3] = { glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.3f, 0.0f, -1.0f), glm::vec3(1.0f, 0.0f, -0.2f) };
+			bool passed = true;
+			for (int v = 0; v < 3; v++) {
+				glm::mat4 viewProjection = projection * glm::lookAt(eyes[v], eyes[v] + directions[v], glm::vec3(0.0f, 1.0f, 0.0f));
+				culler.beginRender(viewProjection);
+				Frustum frustum = Frustum::fromMatrix(viewProjection);
+				int inFrustum = 0, occluded = 0, mergedInFrustum = 0, mergedOccluded = 0;
+				for (size_t i = 0; i < objects.size(); i++) {
+					if (frustum.intersects(objects[i])) {
+						inFrustum++;
+						occluded += culler.isOccluded(objects[i]);
+					}
+				}
+				for (int m = 0; m < MATERIALS; m++) {
+					if (used[m] && frustum.intersects(merged[m])) {
+						mergedInFrustum++;
+						mergedOccluded += culler.isOccluded(merged[m]);
+					}
+				}
+				float hidden = inFrustum > 0 ? 100.0f * occluded / inFrustum : 0.0f;
+				std::printf("  view %d: per object %d/%d hidden (%.0f%%), per material %d/%d hidden\n", v, occluded, inFrustum,
+					hidden, mergedOccluded, mergedInFrustum);
+				// most of a street is behind its first houses
+				passed = passed && hidden >= 75.0f;
+			}
+			return passed;
+		}
+	}
+
+	bool checkOcclusionCuller()
+	{
+		bool wall = checkWall();
+		bool village = checkVillage();
+		return wall && village;
+	}
+
+}
@@ -0,0 +1,111 @@
+#include "Checks.hpp"
+#include "RenderQueue.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace gps {
+
+	namespace {
+
+		typedef RenderQueue::SortEntry SortEntry;
+
+		bool keyLess(const SortEntry& a, const SortEntry& b) {
+			return a.key < b.key;
+		}
+
+		// Sorts a copy of the entries both ways and compares keys and packets, so that equal keys
+		// have to keep their submission order
+		bool sortsLikeStableSort(const char* name, const std::vector<SortEntry>& entries) {
+			std::vector<SortEntry> sorted = entries;
+			std::vector<SortEntry> scratch;
+			auto start = std::chrono::high_resolution_clock::now();
+			RenderQueue::radixSort(sorted, scratch);
+			auto middle = std::chrono::high_resolution_clock::now();
+			std::vector<SortEntry> expected = entries;
+			std::stable_sort(expected.begin(), expected.end(), keyLess);
+			auto end = std::chrono::high_resolution_clock::now();
+
+			bool same = sorted.size() == expected.size();
+			for (size_t i = 0; i < sorted.size() && same; i++)
+				same = sorted[i].key == expected[i].key && sorted[i].packet == expected[i].packet;
+
+			double radixTime = std::chrono::duration<double, std::milli>(middle - start).count();
+			double stableTime = std::chrono::duration<double, std::milli>(end - middle).count();
+			std::printf("  %-24s: %7zu keys, radix %8.3f ms, std::stable_sort %8.3f ms%s\n", name, entries.size(),
+				radixTime, stableTime, same ? "" : " - ORDER DIFFERS");
+			return same;
+		}
+
+		std::vector<SortEntry> makeEntries(size_t count) {
+			std::vector<SortEntry> entries(count);
+			for (size_t i = 0; i < count; i++)
+				entries[i].packet = (uint32_t)i;
+			return entries;
+		}
+	}
+
+	bool checkRenderQueueSort()
+	{
+		std::mt19937_64 random(20);
+		bool passed = true;
+
+		// fewer keys than a sort needs
+		passed = sortsLikeStableSort("empty", makeEntries(0)) && passed;
+		std::vector<SortEntry> single = makeEntries(1);
+		single[0].key = 42;
+		passed = sortsLikeStableSort("single", single) && passed;
+
+		// every digit differs between the keys
+		const size_t counts[] = { 2, 255, 1000, 100000 };
+		for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+			std::vector<SortEntry> entries = makeEntries(counts[c]);
+			for (size_t i = 0; i < entries.size(); i++)
+				entries[i].key = random();
+			passed = sortsLikeStableSort("random keys", entries) && passed;
+		}
+
+		// every key the same - all the passes are skipped and the order is the submitted one
+		std::vector<SortEntry> equal = makeEntries(1000);
+		for (size_t i = 0; i < equal.size(); i++)
+			equal[i].key = 0x1234567890ABCDEFull;
+		passed = sortsLikeStableSort("equal keys", equal) && passed;
+
+		// keys of a frame - few programs, texture sets and vertex arrays, so most digits are
+		// shared by all the keys or by many of them, and the same state drawn at the same depth
+		std::vector<SortEntry> frame = makeEntries(100000);
+		for (size_t i = 0; i < frame.size(); i++) {
+			RenderPass pass = random() % 2 ? RENDER_PASS_SCENE : RENDER_PASS_SHADOW;
+			float depth = (float)(random() % 64) * 0.25f;
+			frame[i].key = RenderQueue::makeKey(pass, random() % 8 == 0, (GLuint)(3 + random() % 4),
+				(uint32_t)(random() % 16), (GLuint)(1 + random() % 3), depth);
+		}
+		passed = sortsLikeStableSort("frame keys", frame) && passed;
+
+		// a digit that differs in a single key, in the highest byte and in the lowest one
+		for (int digit = 0; digit < 8; digit += 7) {
+			std::vector<SortEntry> outlier = makeEntries(1000);
+			for (size_t i = 0; i < outlier.size(); i++)
+				outlier[i].key = 0x0101010101010101ull;
+			outlier[500].key ^= 0x80ull << (digit * 8);
+			passed = sortsLikeStableSort(digit == 0 ? "one low digit differs" : "one high digit differs", outlier) && passed;
+		}
+
+		// the fields of the key are ordered as documented
+		bool ordered = RenderQueue::makeKey(RENDER_PASS_SHADOW, true, 0x7FF, 0xFFFF, 0xFFFF, 1000.0f)
+				< RenderQueue::makeKey(RENDER_PASS_SCENE, false, 0, 0, 0, 0.0f)
+			&& RenderQueue::makeKey(RENDER_PASS_SCENE, false, 0x7FF, 0xFFFF, 0xFFFF, 1000.0f)
+				< RenderQueue::makeKey(RENDER_PASS_SCENE, true, 0, 0, 0, 0.0f)
+			&& RenderQueue::makeKey(RENDER_PASS_SCENE, false, 1, 2, 3, 1.0f)
+				< RenderQueue::makeKey(RENDER_PASS_SCENE, false, 1, 2, 3, 2.0f)
+			&& RenderQueue::makeKey(RENDER_PASS_SCENE, false, 1, 2, 3, -1.0f)
+				== RenderQueue::makeKey(RENDER_PASS_SCENE, false, 1, 2, 3, 0.0f);
+		std::printf("  key fields in order: %s\n", ordered ? "yes" : "NO");
+
+		return passed && ordered;
+	}
+
+}
@@ -0,0 +1,286 @@
+#include "Checks.hpp"
+#include "TextureCompressor.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace gps {
+
+	namespace {
+
+		// Decoders written from the format descriptions, apart from the encoders
+
+		void decodeColor565(uint16_t packed, float color[3]) {
+			color[0] = ((packed >> 11) & 31) * 255.0f / 31.0f;
+			color[1] = ((packed >> 5) & 63) * 255.0f / 63.0f;
+			color[2] = (packed & 31) * 255.0f / 31.0f;
+		}
+
+		// BC1 color block into the rgb of 16 RGBA texels - the four color mode is forced in BC3
+		void decodeColorBlock(const unsigned char* block, bool fourColors, float texels[16][4]) {
+			uint16_t color0 = (uint16_t)(block[0] | (block[1] << 8));
+			uint16_t color1 = (uint16_t)(block[2] | (block[3] << 8));
+			float palette[4][3];
+			decodeColor565(color0, palette[0]);
+			decodeColor565(color1, palette[1]);
+			for (int c = 0; c < 3; c++) {
+				if (fourColors || color0 > color1) {
+					palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+					palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+				}
+				else {
+					palette[2][c] = (palette[0][c] + palette[1][c]) / 2.0f;
+					palette[3][c] = 0.0f;
+				}
+			}
+			for (int i = 0; i < 16; i++) {
+				int index = (block[4 + i / 4] >> ((i % 4) * 2)) & 3;
+				for (int c = 0; c < 3; c++)
+					texels[i][c] = palette[index][c];
+			}
+		}
+
+		// BC4 block into one channel of 16 texels
+		void decodeChannelBlock(const unsigned char* block, int channel, float texels[16][4]) {
+			int value0 = block[0], value1 = block[1];
+			float palette[8];
+			palette[0] = (float)value0;
+			palette[1] = (float)value1;
+			if (value0 > value1) {
+				for (int i = 1; i < 7; i++)
+					palette[i + 1] = ((7 - i) * value0 + i * value1) / 7.0f;
+			}
+			else {
+				for (int i = 1; i < 5; i++)
+					palette[i + 1] = ((5 - i) * value0 + i * value1) / 5.0f;
+				palette[6] = 0.0f;
+				palette[7] = 255.0f;
+			}
+			uint64_t bits = 0;
+			for (int i = 0; i < 6; i++)
+				bits |= (uint64_t)block[2 + i] << (i * 8);
+			for (int i = 0; i < 16; i++)
+				texels[i][channel] = palette[(bits >> (i * 3)) & 7];
+		}
+
+		// Decodes a whole image back to RGBA, through the swizzle of the format
+		std::vector<float> decodeImage(const std::vector<unsigned char>& blocks, GLenum format, int width, int height) {
+			std::vector<float> image((size_t)width * height * 4);
+			int blocksX = (width + 3) / 4;
+			int blocksY = (height + 3) / 4;
+			size_t blockSize = compressedSize(format, 4, 4);
+			for (int blockY = 0; blockY < blocksY; blockY++) {
+				for (int blockX = 0; blockX < blocksX; blockX++) {
+					const unsigned char* block = blocks.data() + (blockY * blocksX + blockX) * blockSize;
+					float texels[16][4];
+					for (int i = 0; i < 16; i++)
+						texels[i][3] = 255.0f;
+					switch (format) {
+					case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+						decodeColorBlock(block, false, texels);
+						break;
+					case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+						decodeChannelBlock(block, 3, texels);
+						decodeColorBlock(block + 8, true, texels);
+						break;
+					case GL_COMPRESSED_RED_RGTC1:
+						decodeChannelBlock(block, 0, texels);
+						break;
+					case GL_COMPRESSED_RG_RGTC2:
+						decodeChannelBlock(block, 0, texels);
+						decodeChannelBlock(block + 8, 1, texels);
+						break;
+					}
+
+					GLint swizzle[4];
+					compressedFormatSwizzle(format, swizzle);
+					for (int y = 0; y < 4; y++) {
+						for (int x = 0; x < 4; x++) {
+							int imageX = blockX * 4 + x, imageY = blockY * 4 + y;
+							if (imageX >= width || imageY >= height)
+								continue;
+							const float* texel = texels[y * 4 + x];
+							float* pixel = &image[((size_t)imageY * width + imageX) * 4];
+							for (int c = 0; c < 4; c++) {
+								switch (swizzle[c]) {
+								case GL_RED: pixel[c] = texel[0]; break;
+								case GL_GREEN: pixel[c] = texel[1]; break;
+								case GL_BLUE: pixel[c] = texel[2]; break;
+								case GL_ALPHA: pixel[c] = texel[3]; break;
+								case GL_ONE: pixel[c] = 255.0f; break;
+								}
+							}
+						}
+					}
+				}
+			}
+			return image;
+		}
+
+		// Test images, RGBA8
+		enum ImageKind
+		{
+			IMAGE_COLOR_GRADIENT,
+			IMAGE_COLOR_NOISE,
+			IMAGE_GREY,
+			IMAGE_GREY_ALPHA,
+			IMAGE_CUTOUT
+		};
+
+		std::vector<unsigned char> makeImage(ImageKind kind, int width, int height, std::mt19937& random) {
+			std::vector<unsigned char> pixels((size_t)width * height * 4);
+			std::uniform_int_distribution<int> noise(-12, 12);
+			for (int y = 0; y < height; y++) {
+				for (int x = 0; x < width; x++) {
+					unsigned char* pixel = &pixels[((size_t)y * width + x) * 4];
+					// the same slopes at every size, so that the errors compare
+					float u = x / 63.0f, v = y / 63.0f;
+					int r = (int)(255.0f * std::fabs(std::fmod(u, 2.0f) - 1.0f));
+					int g = (int)(255.0f * std::fabs(std::fmod(v, 2.0f) - 1.0f));
+					int b = (int)(128.0f + 127.0f * std::sin(6.0f * u + 3.0f * v));
+					int a = 255;
+					switch (kind) {
+					case IMAGE_COLOR_GRADIENT:
+						break;
+					case IMAGE_COLOR_NOISE:
+						r += noise(random); g += noise(random); b += noise(random);
+						break;
+					case IMAGE_GREY:
+						g = b = r = (r + g) / 2;
+						break;
+					case IMAGE_GREY_ALPHA:
+						g = b = r = (r + g) / 2;
+						a = g;
+						break;
+					case IMAGE_CUTOUT:
+						// leaves with a hard edge
+						a = std::sin(9.0f * u) * std::cos(7.0f * v) > 0.2f ? 255 : 0;
+						break;
+					}
+					pixel[0] = (unsigned char)std::min(std::max(r, 0), 255);
+					pixel[1] = (unsigned char)std::min(std::max(g, 0), 255);
+					pixel[2] = (unsigned char)std::min(std::max(b, 0), 255);
+					pixel[3] = (unsigned char)a;
+				}
+			}
+			return pixels;
+		}
+
+		// Encodes and decodes an image, returns false if the root mean square error of the color or
+		// of the alpha is above its limit, or if an alpha of 0 or 255 is not kept exactly
+		bool checkEncoding(const char* name, const std::vector<unsigned char>& pixels, int width, int height, GLenum format,
+		                   float colorLimit, float alphaLimit) {
+			std::vector<unsigned char> blocks;
+			blocks.push_back(0x5A);
+			compressImage(pixels.data(), width, height, format, blocks);
+			bool sized = blocks.size() == 1 + compressedSize(format, width, height) && blocks[0] == 0x5A;
+			blocks.erase(blocks.begin());
+
+			std::vector<float> decoded = decodeImage(blocks, format, width, height);
+			double colorError = 0.0, alphaError = 0.0;
+			int hardAlphaChanged = 0;
+			size_t pixelCount = (size_t)width * height;
+			for (size_t i = 0; i < pixelCount; i++) {
+				for (int c = 0; c < 3; c++) {
+					double delta = decoded[i * 4 + c] - pixels[i * 4 + c];
+					colorError += delta * delta;
+				}
+				double delta = decoded[i * 4 + 3] - pixels[i * 4 + 3];
+				alphaError += delta * delta;
+				if ((pixels[i * 4 + 3] == 0 || pixels[i * 4 + 3] == 255) && delta != 0.0)
+					hardAlphaChanged++;
+			}
+			float colorRms = (float)std::sqrt(colorError / (pixelCount * 3));
+			float alphaRms = (float)std::sqrt(alphaError / pixelCount);
+			bool passed = sized && colorRms <= colorLimit && alphaRms <= alphaLimit && hardAlphaChanged == 0;
+			std::printf("  %-28s %3dx%-3d: color error %5.2f (limit %.1f), alpha error %5.2f (limit %.1f), %d hard alphas changed%s\n",
+				name, width, height, colorRms, colorLimit, alphaRms, alphaLimit, hardAlphaChanged,
+				passed ? "" : (sized ? " - FAILED" : " - FAILED, wrong size"));
+			return passed;
+		}
+	}
+
+	bool checkTextureCompressor()
+	{
+		std::mt19937 random(11);
+		bool passed = true;
+
+		// encoders against the decoders, on sizes with and without partial blocks. The limits are
+		// root mean square errors in 0-255 units - a 4x4 block of a two dimensional color gradient
+		// is not on a line, which BC1 needs, so the gradient keeps a few units of error.
+		const int sizes[3][2] = { { 64, 64 }, { 30, 18 }, { 1, 1 } };
+		for (int s = 0; s < 3; s++) {
+			int width = sizes[s][0], height = sizes[s][1];
+			std::vector<unsigned char> gradient = makeImage(IMAGE_COLOR_GRADIENT, width, height, random);
+			std::vector<unsigned char> noisy = makeImage(IMAGE_COLOR_NOISE, width, height, random);
+			std::vector<unsigned char> grey = makeImage(IMAGE_GREY, width, height, random);
+			std::vector<unsigned char> greyAlpha = makeImage(IMAGE_GREY_ALPHA, width, height, random);
+			std::vector<unsigned char> cutout = makeImage(IMAGE_CUTOUT, width, height, random);
+			passed = checkEncoding("BC1 gradient", gradient, width, height, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 4.5f, 0.0f) && passed;
+			passed = checkEncoding("BC1 noisy", noisy, width, height, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 8.0f, 0.0f) && passed;
+			passed = checkEncoding("BC3 cutout", cutout, width, height, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 4.5f, 0.0f) && passed;
+			passed = checkEncoding("BC3 grey alpha", greyAlpha, width, height, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 2.0f, 1.0f) && passed;
+			passed = checkEncoding("BC4 grey", grey, width, height, GL_COMPRESSED_RED_RGTC1, 1.0f, 0.0f) && passed;
+			passed = checkEncoding("BC5 grey alpha", greyAlpha, width, height, GL_COMPRESSED_RG_RGTC2, 1.0f, 1.0f) && passed;
+		}
+
+		// the format follows the channels the image uses - grey within JPEG noise
+		std::vector<unsigned char> grey = makeImage(IMAGE_GREY, 8, 8, random);
+		grey[0] = (unsigned char)std::min(grey[0] + 2, 255);
+		std::vector<unsigned char> greyAlpha = makeImage(IMAGE_GREY_ALPHA, 8, 8, random);
+		std::vector<unsigned char> color = makeImage(IMAGE_COLOR_GRADIENT, 8, 8, random);
+		std::vector<unsigned char> cutout = makeImage(IMAGE_CUTOUT, 8, 8, random);
+		std::vector<unsigned char> tinted = makeImage(IMAGE_GREY, 8, 8, random);
+		tinted[4 * 9 + 2] = (unsigned char)(tinted[4 * 9 + 1] > 127 ? tinted[4 * 9 + 1] - 3 : tinted[4 * 9 + 1] + 3);
+		bool formats = chooseCompressedFormat(grey.data(), 8, 8) == GL_COMPRESSED_RED_RGTC1
+			&& chooseCompressedFormat(greyAlpha.data(), 8, 8) == GL_COMPRESSED_RG_RGTC2
+			&& chooseCompressedFormat(color.data(), 8, 8) == GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+			&& chooseCompressedFormat(cutout.data(), 8, 8) == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+			&& chooseCompressedFormat(tinted.data(), 8, 8) == GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		std::printf("  formats chosen by the channels: %s\n", formats ? "ok" : "FAILED");
+		passed = passed && formats;
+
+		bool cutouts = isCutoutImage(cutout.data(), 8, 8) && !isCutoutImage(color.data(), 8, 8);
+		std::printf("  cutout images found: %s\n", cutouts ? "ok" : "FAILED");
+		passed = passed && cutouts;
+
+		// the SSE downsampling against a plain box filter, odd sizes included
+		const int downsampleSizes[4][2] = { { 64, 32 }, { 33, 17 }, { 7, 1 }, { 1, 5 } };
+		int downsampleDifferences = 0;
+		for (int s = 0; s < 4; s++) {
+			int width = downsampleSizes[s][0], height = downsampleSizes[s][1];
+			std::vector<unsigned char> pixels = makeImage(IMAGE_COLOR_NOISE, width, height, random);
+			for (size_t i = 3; i < pixels.size(); i += 4)
+				pixels[i] = (unsigned char)(random() & 0xFF);
+			std::vector<unsigned char> result;
+			downsampleImage(pixels.data(), width, height, result);
+			int resultWidth = std::max(width / 2, 1), resultHeight = std::max(height / 2, 1);
+			if (result.size() != (size_t)resultWidth * resultHeight * 4) {
+				downsampleDifferences++;
+				continue;
+			}
+			for (int y = 0; y < resultHeight; y++) {
+				for (int x = 0; x < resultWidth; x++) {
+					for (int c = 0; c < 4; c++) {
+						int sum = 0;
+						for (int k = 0; k < 4; k++) {
+							int sourceX = std::min(x * 2 + (k & 1), width - 1);
+							int sourceY = std::min(y * 2 + (k >> 1), height - 1);
+							sum += pixels[((size_t)sourceY * width + sourceX) * 4 + c];
+						}
+						downsampleDifferences += result[((size_t)y * resultWidth + x) * 4 + c] != (sum + 2) / 4;
+					}
+				}
+			}
+		}
+		std::printf("  downsampled channels different from a box filter: %d\n", downsampleDifferences);
+		passed = passed && downsampleDifferences == 0;
+
+		return passed;
+	}
+
+}
@@ -0,0 +1,41 @@
+#include "Checks.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+// Runs the checks whose name contains the first argument, all of them without one
+int main(int argc, const char* argv[])
+{
+    struct Check
+    {
+        const char* name;
+        bool (*run)();
+    };
+    const Check checks[] = {
+        { "bvh", gps::benchmarkBvh },
+        { "simplify", gps::checkSimplifyError },
+        { "renderqueue", gps::checkRenderQueueSort },
+        { "frustum", gps::checkFrustumCuller },
+        { "occlusion", gps::checkOcclusionCuller },
+        { "meshcache", gps::checkMeshCache },
+        { "compressor", gps::checkTextureCompressor },
+        { "ktx", gps::checkKtxFile },
+    };
+
+    std::string filter = argc > 1 ? argv[1] : "";
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++)
+    {
+        if (std::string(checks[i].name).find(filter) == std::string::npos)
+            continue;
+
+        std::cout << "== " << checks[i].name << std::endl;
+        bool passed = checks[i].run();
+        std::cout << "== " << checks[i].name << (passed ? ": passed" : ": FAILED") << std::endl;
+        if (!passed)
+            failed++;
+    }
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}